@@ -293,6 +293,13 @@ typedef struct _LIBSSH2_USERAUTH_KBDINT_RESPONSE
     unsigned int length;
 } LIBSSH2_USERAUTH_KBDINT_RESPONSE;
 
+/* One buffer of a libssh2_channel_writev_ex() call */
+typedef struct _LIBSSH2_IOVEC
+{
+    const void *iov_base;
+    size_t iov_len;
+} LIBSSH2_IOVEC;
+
 /* 'publickey' authentication callback */
 #define LIBSSH2_USERAUTH_PUBLICKEY_SIGN_FUNC(name) \
   int name(LIBSSH2_SESSION *session, unsigned char **sig, size_t *sig_len, \
@@ -346,6 +353,13 @@ typedef struct _LIBSSH2_USERAUTH_KBDINT_RESPONSE
                  const void *buffer, size_t length,                     \
                  int flags, void **abstract)
 
+/* Stage callback, called at the beginning (end == 0) and at the end
+   (end == 1) of a stage with the number of bytes it processed. Only
+   called when the library was built with LIBSSH2_STATS defined. */
+#define LIBSSH2_STAGE_FUNC(name)                                        \
+    void name(LIBSSH2_SESSION *session, int stage, int end,             \
+              size_t bytes, void **abstract)
+
 /* libssh2_session_callback_set() constants */
 #define LIBSSH2_CALLBACK_IGNORE             0
 #define LIBSSH2_CALLBACK_DEBUG              1
@@ -354,6 +368,14 @@ typedef struct _LIBSSH2_USERAUTH_KBDINT_RESPONSE
 #define LIBSSH2_CALLBACK_X11                4
 #define LIBSSH2_CALLBACK_SEND               5
 #define LIBSSH2_CALLBACK_RECV               6
+#define LIBSSH2_CALLBACK_STAGE              7
+
+/* LIBSSH2_STAGE_FUNC() stages */
+#define LIBSSH2_STAGE_READ      0
+#define LIBSSH2_STAGE_SEND      1
+#define LIBSSH2_STAGE_DECRYPT   2
+#define LIBSSH2_STAGE_INFLATE   3
+#define LIBSSH2_STAGE_DEFLATE   4
 
 /* libssh2_session_method_pref() constants */
 #define LIBSSH2_METHOD_KEX          0
@@ -617,6 +639,8 @@ LIBSSH2_API int libssh2_session_set_last_error(LIBSSH2_SESSION* session,
                                                int errcode,
                                                const char *errmsg);
 LIBSSH2_API int libssh2_session_block_directions(LIBSSH2_SESSION *session);
+LIBSSH2_API int libssh2_session_flush(LIBSSH2_SESSION *session);
+LIBSSH2_API int libssh2_session_open_pending(LIBSSH2_SESSION *session);
 
 LIBSSH2_API int libssh2_session_flag(LIBSSH2_SESSION *session, int flag,
                                      int value);
@@ -833,6 +857,24 @@ LIBSSH2_API ssize_t libssh2_channel_read_ex(LIBSSH2_CHANNEL *channel,
 #define libssh2_channel_read_stderr(channel, buf, buflen) \
   libssh2_channel_read_ex((channel), SSH_EXTENDED_DATA_STDERR, (buf), (buflen))
 
+/*
+ * libssh2_channel_read_peek() / libssh2_channel_read_consume()
+ *
+ * Zero-copy alternative to libssh2_channel_read_ex(). The peek sets *buf to
+ * point at the channel data already received into libssh2's own packet
+ * buffers and returns the number of bytes available there. Nothing is
+ * removed until libssh2_channel_read_consume() is called, so the receive
+ * window is only re-opened for data the application has actually used.
+ *
+ * The returned pointer is valid until the next consume or read call on the
+ * same channel.
+ */
+LIBSSH2_API ssize_t libssh2_channel_read_peek(LIBSSH2_CHANNEL *channel,
+                                              int stream_id,
+                                              const char **buf);
+LIBSSH2_API int libssh2_channel_read_consume(LIBSSH2_CHANNEL *channel,
+                                             int stream_id, size_t len);
+
 LIBSSH2_API int libssh2_poll_channel_read(LIBSSH2_CHANNEL *channel,
                                           int extended);
 
@@ -865,12 +907,46 @@ LIBSSH2_API ssize_t libssh2_channel_write_ex(LIBSSH2_CHANNEL *channel,
     libssh2_channel_write_ex((channel), SSH_EXTENDED_DATA_STDERR,       \
                              (buf), (buflen))
 
+/*
+ * Like libssh2_channel_write_ex() but the data is gathered from 'iovcnt'
+ * buffers, which are sent as if they were one. Data from several buffers may
+ * end up in the same packet, so a wrapped ring buffer can be written without
+ * first copying it into a linear one. The return value is the number of
+ * bytes sent, counted across the buffers.
+ */
+LIBSSH2_API ssize_t libssh2_channel_writev_ex(LIBSSH2_CHANNEL *channel,
+                                              int stream_id,
+                                              const LIBSSH2_IOVEC *iov,
+                                              int iovcnt);
+
+#define libssh2_channel_writev(channel, iov, iovcnt) \
+  libssh2_channel_writev_ex((channel), 0, (iov), (iovcnt))
+
 LIBSSH2_API unsigned long
 libssh2_channel_window_write_ex(LIBSSH2_CHANNEL *channel,
                                 unsigned long *window_size_initial);
 #define libssh2_channel_window_write(channel) \
   libssh2_channel_window_write_ex((channel), NULL)
 
+/*
+ * Outbound scheduling between channels of the same session.
+ *
+ * Channels are interactive by default. Data written to a bulk channel is
+ * split into packets of at most 8 KB so that an interactive packet written
+ * between two of them never waits long at the transport layer. With a
+ * non-zero quantum set, bulk channels together may only send that many
+ * bytes until libssh2_session_bulk_round() starts a new round, after which
+ * libssh2_channel_write_ex() on a bulk channel returns 0.
+ */
+#define LIBSSH2_CHANNEL_PRIORITY_INTERACTIVE 0
+#define LIBSSH2_CHANNEL_PRIORITY_BULK        1
+
+LIBSSH2_API void libssh2_channel_set_priority(LIBSSH2_CHANNEL *channel,
+                                              int priority);
+LIBSSH2_API void libssh2_session_set_bulk_quantum(LIBSSH2_SESSION *session,
+                                                  size_t quantum);
+LIBSSH2_API void libssh2_session_bulk_round(LIBSSH2_SESSION *session);
+
 LIBSSH2_API void libssh2_session_set_blocking(LIBSSH2_SESSION* session,
                                               int blocking);
 LIBSSH2_API int libssh2_session_get_blocking(LIBSSH2_SESSION* session);
@@ -1329,6 +1405,62 @@ LIBSSH2_API void libssh2_keepalive_config(LIBSSH2_SESSION *session,
 LIBSSH2_API int libssh2_keepalive_send(LIBSSH2_SESSION *session,
                                        int *seconds_to_next);
 
+/*
+ * libssh2_keepalive_config_ms()
+ *
+ * Same as libssh2_keepalive_config() but INTERVAL_MS is given in
+ * milliseconds, which allows sub-second probing for latency measurement.
+ */
+LIBSSH2_API void libssh2_keepalive_config_ms(LIBSSH2_SESSION *session,
+                                             int want_reply,
+                                             unsigned interval_ms);
+
+/*
+ * libssh2_keepalive_send_ms()
+ *
+ * Same as libssh2_keepalive_send() but MS_TO_NEXT is given in milliseconds.
+ */
+LIBSSH2_API int libssh2_keepalive_send_ms(LIBSSH2_SESSION *session,
+                                          long *ms_to_next);
+
+struct libssh2_keepalive_stats {
+    unsigned long samples;       /* number of replies timed so far */
+    unsigned int pending;        /* probes still waiting for a reply */
+    libssh2_uint64_t last_us;    /* most recent round-trip time */
+    libssh2_uint64_t srtt_us;    /* smoothed round-trip time */
+    libssh2_uint64_t rttvar_us;  /* round-trip time variation (jitter) */
+};
+
+/*
+ * libssh2_keepalive_rtt()
+ *
+ * Fill in STATS with the round-trip time measured from the replies to
+ * keepalive messages sent with WANT_REPLY set. Returns 0 on success, or 1
+ * if no reply has been timed yet.
+ */
+LIBSSH2_API int libssh2_keepalive_rtt(LIBSSH2_SESSION *session,
+                                      struct libssh2_keepalive_stats *stats);
+
+struct libssh2_transport_stats {
+    libssh2_uint64_t packets_in;  /* packets received */
+    libssh2_uint64_t packets_out; /* packets sent */
+    libssh2_uint64_t bytes_in;    /* bytes read from the socket */
+    libssh2_uint64_t bytes_out;   /* bytes written to the socket */
+    libssh2_uint64_t recv_calls;  /* socket reads that returned data */
+    libssh2_uint64_t send_calls;  /* socket writes that sent data */
+    libssh2_uint64_t allocs;      /* allocations made through the session */
+};
+
+/*
+ * libssh2_session_transport_stats()
+ *
+ * Fill in STATS with the transport counters of the session, which are kept
+ * from the moment it is created. Returns 0 on success.
+ */
+LIBSSH2_API int
+libssh2_session_transport_stats(LIBSSH2_SESSION *session,
+                                struct libssh2_transport_stats *stats);
+
 /* NOTE NOTE NOTE
    libssh2_trace() has no function in builds that aren't built with debug
    enabled
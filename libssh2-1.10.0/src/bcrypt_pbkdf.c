@@ -27,6 +27,10 @@
 
 #include "blf.h"
 
+#ifdef LIBSSH2_BCRYPT_PBKDF_THREADS
+#include <pthread.h>
+#endif
+
 #define MINIMUM(a,b) (((a) < (b)) ? (a) : (b))
 
 /*
@@ -97,42 +101,46 @@ bcrypt_hash(uint8_t *sha2pass, uint8_t *sha2salt, uint8_t *out)
     _libssh2_explicit_zero(&state, sizeof(state));
 }
 
-int
-bcrypt_pbkdf(const char *pass, size_t passlen, const uint8_t *salt,
-             size_t saltlen,
-             uint8_t *key, size_t keylen, unsigned int rounds)
+struct bcrypt_job {
+    const uint8_t *sha2pass;
+    const uint8_t *salt;
+    size_t saltlen;
+    unsigned int rounds;
+    uint8_t (*out)[BCRYPT_HASHSIZE];
+    size_t first;   /* first output block handled by this job */
+    size_t step;    /* distance to the next one */
+    size_t nblocks;
+    int error;
+};
+
+/*
+ * Compute the output blocks of one job. Every block only depends on the
+ * password, the salt and its own block counter, so jobs can run in parallel.
+ */
+static void
+bcrypt_pbkdf_blocks(struct bcrypt_job *job)
 {
-    uint8_t sha2pass[SHA512_DIGEST_LENGTH];
     uint8_t sha2salt[SHA512_DIGEST_LENGTH];
-    uint8_t out[BCRYPT_HASHSIZE];
     uint8_t tmpout[BCRYPT_HASHSIZE];
     uint8_t *countsalt;
-    size_t i, j, amt, stride;
+    uint8_t *out;
+    size_t saltlen = job->saltlen;
+    size_t b, i, j;
     uint32_t count;
-    size_t origkeylen = keylen;
     libssh2_sha512_ctx ctx;
 
-    /* nothing crazy */
-    if(rounds < 1)
-        return -1;
-    if(passlen == 0 || saltlen == 0 || keylen == 0 ||
-       keylen > sizeof(out) * sizeof(out) || saltlen > 1<<20)
-        return -1;
     countsalt = calloc(1, saltlen + 4);
-    if(countsalt == NULL)
-        return -1;
-    stride = (keylen + sizeof(out) - 1) / sizeof(out);
-    amt = (keylen + stride - 1) / stride;
+    if(countsalt == NULL) {
+        job->error = 1;
+        return;
+    }
 
-    memcpy(countsalt, salt, saltlen);
+    memcpy(countsalt, job->salt, saltlen);
 
-    /* collapse password */
-    libssh2_sha512_init(&ctx);
-    libssh2_sha512_update(ctx, pass, passlen);
-    libssh2_sha512_final(ctx, sha2pass);
+    for(b = job->first; b < job->nblocks; b += job->step) {
+        count = (uint32_t)(b + 1);
+        out = job->out[b];
 
-    /* generate key, sizeof(out) at a time */
-    for(count = 1; keylen > 0; count++) {
         countsalt[saltlen + 0] = (count >> 24) & 0xff;
         countsalt[saltlen + 1] = (count >> 16) & 0xff;
         countsalt[saltlen + 2] = (count >> 8) & 0xff;
@@ -143,20 +151,142 @@ bcrypt_pbkdf(const char *pass, size_t passlen, const uint8_t *salt,
         libssh2_sha512_update(ctx, countsalt, saltlen + 4);
         libssh2_sha512_final(ctx, sha2salt);
 
-        bcrypt_hash(sha2pass, sha2salt, tmpout);
-        memcpy(out, tmpout, sizeof(out));
+        bcrypt_hash((uint8_t *)job->sha2pass, sha2salt, tmpout);
+        memcpy(out, tmpout, BCRYPT_HASHSIZE);
 
-        for(i = 1; i < rounds; i++) {
+        for(i = 1; i < job->rounds; i++) {
             /* subsequent rounds, salt is previous output */
             libssh2_sha512_init(&ctx);
             libssh2_sha512_update(ctx, tmpout, sizeof(tmpout));
             libssh2_sha512_final(ctx, sha2salt);
 
-            bcrypt_hash(sha2pass, sha2salt, tmpout);
-            for(j = 0; j < sizeof(out); j++)
+            bcrypt_hash((uint8_t *)job->sha2pass, sha2salt, tmpout);
+            for(j = 0; j < BCRYPT_HASHSIZE; j++)
                 out[j] ^= tmpout[j];
         }
+    }
+
+    /* zap */
+    _libssh2_explicit_zero(sha2salt, sizeof(sha2salt));
+    _libssh2_explicit_zero(tmpout, sizeof(tmpout));
+    free(countsalt);
+}
+
+#ifdef LIBSSH2_BCRYPT_PBKDF_THREADS
+
+#ifndef LIBSSH2_BCRYPT_PBKDF_MAX_THREADS
+#define LIBSSH2_BCRYPT_PBKDF_MAX_THREADS 8
+#endif
+
+static void *
+bcrypt_pbkdf_thread(void *arg)
+{
+    bcrypt_pbkdf_blocks(arg);
+    return NULL;
+}
 
+/*
+ * Spread the blocks over up to LIBSSH2_BCRYPT_PBKDF_MAX_THREADS threads,
+ * the calling thread taking the first share. If a thread cannot be started
+ * its share is computed by the caller instead.
+ */
+static void
+bcrypt_pbkdf_run(struct bcrypt_job *proto)
+{
+    struct bcrypt_job jobs[LIBSSH2_BCRYPT_PBKDF_MAX_THREADS];
+    pthread_t threads[LIBSSH2_BCRYPT_PBKDF_MAX_THREADS];
+    int started[LIBSSH2_BCRYPT_PBKDF_MAX_THREADS];
+    size_t nthreads, t;
+    int error = 0;
+
+    nthreads = MINIMUM(proto->nblocks, LIBSSH2_BCRYPT_PBKDF_MAX_THREADS);
+
+    for(t = 0; t < nthreads; t++) {
+        jobs[t] = *proto;
+        jobs[t].first = t;
+        jobs[t].step = nthreads;
+        started[t] = (t != 0 && pthread_create(&threads[t], NULL,
+                                               bcrypt_pbkdf_thread,
+                                               &jobs[t]) == 0);
+    }
+
+    for(t = 0; t < nthreads; t++) {
+        if(started[t])
+            pthread_join(threads[t], NULL);
+        else
+            bcrypt_pbkdf_blocks(&jobs[t]);
+        error |= jobs[t].error;
+    }
+
+    proto->error = error;
+}
+
+#else
+
+static void
+bcrypt_pbkdf_run(struct bcrypt_job *job)
+{
+    job->first = 0;
+    job->step = 1;
+    bcrypt_pbkdf_blocks(job);
+}
+
+#endif /* LIBSSH2_BCRYPT_PBKDF_THREADS */
+
+int
+bcrypt_pbkdf(const char *pass, size_t passlen, const uint8_t *salt,
+             size_t saltlen,
+             uint8_t *key, size_t keylen, unsigned int rounds)
+{
+    uint8_t sha2pass[SHA512_DIGEST_LENGTH];
+    uint8_t (*out)[BCRYPT_HASHSIZE];
+    size_t i, amt, stride;
+    uint32_t count;
+    size_t origkeylen = keylen;
+    libssh2_sha512_ctx ctx;
+    struct bcrypt_job job;
+
+    /* nothing crazy */
+    if(rounds < 1)
+        return -1;
+    if(passlen == 0 || saltlen == 0 || keylen == 0 ||
+       keylen > BCRYPT_HASHSIZE * BCRYPT_HASHSIZE || saltlen > 1<<20)
+        return -1;
+    stride = (keylen + BCRYPT_HASHSIZE - 1) / BCRYPT_HASHSIZE;
+    amt = (keylen + stride - 1) / stride;
+
+    /* One output block is produced per counter value and every counter
+       value up to stride is needed to fill the key. */
+    out = calloc(stride, BCRYPT_HASHSIZE);
+    if(out == NULL)
+        return -1;
+
+    /* collapse password */
+    libssh2_sha512_init(&ctx);
+    libssh2_sha512_update(ctx, pass, passlen);
+    libssh2_sha512_final(ctx, sha2pass);
+
+    /* generate key, sizeof(out) at a time */
+    job.sha2pass = sha2pass;
+    job.salt = salt;
+    job.saltlen = saltlen;
+    job.rounds = rounds;
+    job.out = out;
+    job.first = 0;
+    job.step = 1;
+    job.nblocks = stride;
+    job.error = 0;
+
+    bcrypt_pbkdf_run(&job);
+
+    if(job.error) {
+        _libssh2_explicit_zero(out, stride * BCRYPT_HASHSIZE);
+        _libssh2_explicit_zero(sha2pass, sizeof(sha2pass));
+        free(out);
+        return -1;
+    }
+
+    for(count = 1; keylen > 0; count++) {
         /*
          * pbkdf2 deviation: output the key material non-linearly.
          */
@@ -166,14 +296,15 @@ bcrypt_pbkdf(const char *pass, size_t passlen, const uint8_t *salt,
             if(dest >= origkeylen) {
                 break;
             }
-            key[dest] = out[i];
+            key[dest] = out[count - 1][i];
         }
         keylen -= i;
     }
 
     /* zap */
-    _libssh2_explicit_zero(out, sizeof(out));
-    free(countsalt);
+    _libssh2_explicit_zero(out, stride * BCRYPT_HASHSIZE);
+    _libssh2_explicit_zero(sha2pass, sizeof(sha2pass));
+    free(out);
 
     return 0;
 }
@@ -2165,6 +2165,165 @@ libssh2_channel_read_ex(LIBSSH2_CHANNEL *channel, int stream_id, char *buf,
     return rc;
 }
 
+/*
+ * channel_packet_is_data
+ *
+ * Return non-zero if the queued packet carries data for the given stream of
+ * the channel, using the same rules as _libssh2_channel_read().
+ */
+static int
+channel_packet_is_data(LIBSSH2_CHANNEL *channel, int stream_id,
+                       LIBSSH2_PACKET *packet)
+{
+    if(packet->data_len < 5)
+        return 0;
+
+    if(channel->local.id != _libssh2_ntohu32(packet->data + 1))
+        return 0;
+
+    if(packet->data[0] == SSH_MSG_CHANNEL_DATA)
+        return !stream_id;
+
+    if(packet->data[0] != SSH_MSG_CHANNEL_EXTENDED_DATA)
+        return 0;
+
+    if(stream_id)
+        return (packet->data_len >= 9) &&
+            (stream_id == (int) _libssh2_ntohu32(packet->data + 5));
+
+    return (channel->remote.extended_data_ignore_mode ==
+            LIBSSH2_CHANNEL_EXTENDED_DATA_MERGE);
+}
+
+/*
+ * channel_read_peek
+ *
+ * Find the first unread data of the channel without copying it anywhere.
+ */
+static ssize_t
+channel_read_peek(LIBSSH2_CHANNEL *channel, int stream_id, const char **buf)
+{
+    LIBSSH2_SESSION *session = channel->session;
+    LIBSSH2_PACKET *packet;
+    int rc;
+
+    /* expand the receiving window first if it has become too narrow */
+    if((channel->read_state == libssh2_NB_state_jump1) ||
+       (channel->remote.window_size <
+        channel->remote.window_size_initial / 4 * 3)) {
+
+        uint32_t adjustment = channel->remote.window_size_initial -
+            channel->remote.window_size;
+        if(adjustment < LIBSSH2_CHANNEL_MINADJUST)
+            adjustment = LIBSSH2_CHANNEL_MINADJUST;
+
+        channel->read_state = libssh2_NB_state_jump1;
+        rc = _libssh2_channel_receive_window_adjust(channel, adjustment,
+                                                    0, NULL);
+        if(rc)
+            return rc;
+
+        channel->read_state = libssh2_NB_state_idle;
+    }
+
+    do {
+        rc = _libssh2_transport_read(session);
+    } while(rc > 0);
+
+    if((rc < 0) && (rc != LIBSSH2_ERROR_EAGAIN))
+        return _libssh2_error(session, rc, "transport read");
+
+    for(packet = _libssh2_list_first(&session->packets); packet;
+        packet = _libssh2_list_next(&packet->node)) {
+        if(channel_packet_is_data(channel, stream_id, packet) &&
+           (packet->data_head < packet->data_len)) {
+            *buf = (const char *)&packet->data[packet->data_head];
+            return packet->data_len - packet->data_head;
+        }
+    }
+
+    if(channel->remote.eof || channel->remote.close)
+        return 0;
+    else if(rc != LIBSSH2_ERROR_EAGAIN)
+        return 0;
+
+    return _libssh2_error(session, rc, "would block");
+}
+
+/*
+ * libssh2_channel_read_peek
+ *
+ * Return a pointer to and the length of the channel data that has already
+ * been received, without consuming it.
+ */
+LIBSSH2_API ssize_t
+libssh2_channel_read_peek(LIBSSH2_CHANNEL *channel, int stream_id,
+                          const char **buf)
+{
+    int rc;
+
+    if(!channel || !buf)
+        return LIBSSH2_ERROR_BAD_USE;
+
+    BLOCK_ADJUST(rc, channel->session,
+                 channel_read_peek(channel, stream_id, buf));
+    return rc;
+}
+
+/*
+ * libssh2_channel_read_consume
+ *
+ * Drop len bytes of data returned by libssh2_channel_read_peek() and free
+ * the packets that have been fully consumed.
+ */
+LIBSSH2_API int
+libssh2_channel_read_consume(LIBSSH2_CHANNEL *channel, int stream_id,
+                             size_t len)
+{
+    LIBSSH2_SESSION *session;
+    LIBSSH2_PACKET *packet;
+    LIBSSH2_PACKET *next;
+    size_t consumed = 0;
+    size_t n;
+
+    if(!channel)
+        return LIBSSH2_ERROR_BAD_USE;
+
+    session = channel->session;
+
+    packet = _libssh2_list_first(&session->packets);
+    while(packet && (consumed < len)) {
+        next = _libssh2_list_next(&packet->node);
+
+        if(channel_packet_is_data(channel, stream_id, packet)) {
+            n = packet->data_len - packet->data_head;
+            if(n > len - consumed)
+                n = len - consumed;
+
+            packet->data_head += n;
+            consumed += n;
+
+            if(packet->data_head >= packet->data_len) {
+                _libssh2_list_remove(&packet->node);
+
+                LIBSSH2_FREE(session, packet->data);
+                LIBSSH2_FREE(session, packet);
+            }
+        }
+
+        packet = next;
+    }
+
+    channel->read_avail -= consumed;
+    channel->remote.window_size -= consumed;
+
+    if(consumed < len)
+        return _libssh2_error(session, LIBSSH2_ERROR_BAD_USE,
+                              "Consumed more channel data than was queued");
+
+    return 0;
+}
+
 /*
  * _libssh2_channel_packet_data_len
  *
@@ -2239,10 +2398,34 @@ _libssh2_channel_packet_data_len(LIBSSH2_CHANNEL * channel, int stream_id)
 ssize_t
 _libssh2_channel_write(LIBSSH2_CHANNEL *channel, int stream_id,
                        const unsigned char *buf, size_t buflen)
+{
+    LIBSSH2_IOVEC iov;
+
+    iov.iov_base = buf;
+    iov.iov_len = buflen;
+
+    return _libssh2_channel_writev(channel, stream_id, &iov, 1);
+}
+
+/*
+ * _libssh2_channel_writev
+ *
+ * Send data gathered from several buffers to a channel. Nothing has been
+ * sent when this returns EAGAIN, so the caller may pass different data on
+ * the next call.
+ */
+ssize_t
+_libssh2_channel_writev(LIBSSH2_CHANNEL *channel, int stream_id,
+                        const LIBSSH2_IOVEC *iov, int iovcnt)
 {
     int rc = 0;
     LIBSSH2_SESSION *session = channel->session;
     ssize_t wrote = 0; /* counter for this specific this call */
+    size_t buflen = 0;
+    int i;
+
+    for(i = 0; i < iovcnt; i++)
+        buflen += iov[i].iov_len;
 
     /* In theory we could split larger buffers into several smaller packets
      * but it turns out to be really hard and nasty to do while still offering
@@ -2284,6 +2467,14 @@ _libssh2_channel_write(LIBSSH2_CHANNEL *channel, int stream_id,
                                   "Failure while draining incoming flow");
         }
 
+        if(channel->priority == LIBSSH2_CHANNEL_PRIORITY_BULK &&
+           session->bulk_quantum &&
+           session->bulk_sent >= session->bulk_quantum) {
+            /* this round's share is used up, leave the link to the
+               interactive channels until the next one */
+            return 0;
+        }
+
         if(channel->local.window_size <= 0) {
             /* there's no room for data so we stop */
 
@@ -2292,6 +2483,10 @@ _libssh2_channel_write(LIBSSH2_CHANNEL *channel, int stream_id,
              * herald an incoming window adjustment.
              */
             session->socket_block_directions = LIBSSH2_SESSION_BLOCK_INBOUND;
+            if(session->packet.ototal_num)
+                /* but the rest of the last packet still has to go out */
+                session->socket_block_directions |=
+                    LIBSSH2_SESSION_BLOCK_OUTBOUND;
 
             return (rc == LIBSSH2_ERROR_EAGAIN?rc:0);
         }
@@ -2322,6 +2517,10 @@ _libssh2_channel_write(LIBSSH2_CHANNEL *channel, int stream_id,
                            channel->remote.id, stream_id);
             channel->write_bufwrite = channel->local.packet_size;
         }
+        if(channel->priority == LIBSSH2_CHANNEL_PRIORITY_BULK &&
+           channel->write_bufwrite > LIBSSH2_CHANNEL_BULK_PACKET) {
+            channel->write_bufwrite = LIBSSH2_CHANNEL_BULK_PACKET;
+        }
         /* store the size here only, the buffer is passed in as-is to
            _libssh2_transport_send() */
         _libssh2_store_u32(&s, channel->write_bufwrite);
@@ -2336,14 +2535,12 @@ _libssh2_channel_write(LIBSSH2_CHANNEL *channel, int stream_id,
     }
 
     if(channel->write_state == libssh2_NB_state_created) {
-        rc = _libssh2_transport_send(session, channel->write_packet,
-                                     channel->write_packet_len,
-                                     buf, channel->write_bufwrite);
-        if(rc == LIBSSH2_ERROR_EAGAIN) {
-            return _libssh2_error(session, rc,
-                                  "Unable to send channel data");
-        }
-        else if(rc) {
+        rc = _libssh2_transport_sendv(session, channel->write_packet,
+                                      channel->write_packet_len,
+                                      iov, iovcnt, channel->write_bufwrite);
+        if(rc) {
+            /* on EAGAIN nothing was sent, so start over on the next call
+               as the window and the data may have changed by then */
             channel->write_state = libssh2_NB_state_idle;
             return _libssh2_error(session, rc,
                                   "Unable to send channel data");
@@ -2351,6 +2548,9 @@ _libssh2_channel_write(LIBSSH2_CHANNEL *channel, int stream_id,
         /* Shrink local window size */
         channel->local.window_size -= channel->write_bufwrite;
 
+        if(channel->priority == LIBSSH2_CHANNEL_PRIORITY_BULK)
+            session->bulk_sent += channel->write_bufwrite;
+
         wrote += channel->write_bufwrite;
 
         /* Since _libssh2_transport_write() succeeded, we must return
@@ -2371,6 +2571,18 @@ _libssh2_channel_write(LIBSSH2_CHANNEL *channel, int stream_id,
     return LIBSSH2_ERROR_INVAL; /* reaching this point is really bad */
 }
 
+/*
+ * libssh2_channel_set_priority
+ *
+ * Set the scheduling class of the channel's outbound data
+ */
+LIBSSH2_API void
+libssh2_channel_set_priority(LIBSSH2_CHANNEL *channel, int priority)
+{
+    if(channel)
+        channel->priority = priority;
+}
+
 /*
  * libssh2_channel_write_ex
  *
@@ -2391,6 +2603,25 @@ libssh2_channel_write_ex(LIBSSH2_CHANNEL *channel, int stream_id,
     return rc;
 }
 
+/*
+ * libssh2_channel_writev_ex
+ *
+ * Send data gathered from several buffers to a channel
+ */
+LIBSSH2_API ssize_t
+libssh2_channel_writev_ex(LIBSSH2_CHANNEL *channel, int stream_id,
+                          const LIBSSH2_IOVEC *iov, int iovcnt)
+{
+    ssize_t rc;
+
+    if(!channel || iovcnt < 0 || (iovcnt && !iov))
+        return LIBSSH2_ERROR_BAD_USE;
+
+    BLOCK_ADJUST(rc, channel->session,
+                 _libssh2_channel_writev(channel, stream_id, iov, iovcnt));
+    return rc;
+}
+
 /*
  * channel_send_eof
  *
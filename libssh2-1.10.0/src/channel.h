@@ -82,6 +82,15 @@ ssize_t
 _libssh2_channel_write(LIBSSH2_CHANNEL *channel, int stream_id,
                        const unsigned char *buf, size_t buflen);
 
+/*
+ * _libssh2_channel_writev
+ *
+ * Send data gathered from several buffers to a channel
+ */
+ssize_t
+_libssh2_channel_writev(LIBSSH2_CHANNEL *channel, int stream_id,
+                        const LIBSSH2_IOVEC *iov, int iovcnt);
+
 /*
  * _libssh2_channel_open
  *
@@ -197,7 +197,9 @@ comp_method_zlib_comp(LIBSSH2_SESSION *session,
     strm->next_out = dest;
     strm->avail_out = out_maxlen;
 
+    LIBSSH2_STAGE(session, LIBSSH2_STAGE_DEFLATE, 0, 0);
     status = deflate(strm, Z_PARTIAL_FLUSH);
+    LIBSSH2_STAGE(session, LIBSSH2_STAGE_DEFLATE, 1, src_len);
 
     if((status == Z_OK) && (strm->avail_out > 0)) {
         *dest_len = out_maxlen - strm->avail_out;
@@ -259,9 +261,13 @@ comp_method_zlib_decomp(LIBSSH2_SESSION * session,
     for(;;) {
         int status;
         size_t out_ofs;
+        size_t in_len = strm->avail_in;
         char *newout;
 
+        LIBSSH2_STAGE(session, LIBSSH2_STAGE_INFLATE, 0, 0);
         status = inflate(strm, Z_PARTIAL_FLUSH);
+        LIBSSH2_STAGE(session, LIBSSH2_STAGE_INFLATE, 1,
+                      in_len - strm->avail_in);
 
         if(status == Z_OK) {
             if(strm->avail_out > 0)
@@ -39,17 +39,38 @@
 #include "libssh2_priv.h"
 #include "transport.h" /* _libssh2_transport_write */
 
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
 /* Keep-alive stuff. */
 
+static libssh2_uint64_t
+keepalive_now(void)
+{
+    struct timeval tv;
+
+    _libssh2_gettimeofday(&tv, NULL);
+
+    return (libssh2_uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
 LIBSSH2_API void
 libssh2_keepalive_config (LIBSSH2_SESSION *session,
                           int want_reply,
                           unsigned interval)
 {
     if(interval == 1)
-        session->keepalive_interval = 2;
-    else
-        session->keepalive_interval = interval;
+        interval = 2;
+    libssh2_keepalive_config_ms(session, want_reply, interval * 1000);
+}
+
+LIBSSH2_API void
+libssh2_keepalive_config_ms (LIBSSH2_SESSION *session,
+                             int want_reply,
+                             unsigned interval_ms)
+{
+    session->keepalive_interval = interval_ms;
     session->keepalive_want_reply = want_reply ? 1 : 0;
 }
 
@@ -57,44 +78,149 @@ LIBSSH2_API int
 libssh2_keepalive_send (LIBSSH2_SESSION *session,
                         int *seconds_to_next)
 {
-    time_t now;
+    long ms_to_next;
+    int rc;
+
+    rc = libssh2_keepalive_send_ms(session, &ms_to_next);
+
+    if(seconds_to_next)
+        *seconds_to_next = (int) ((ms_to_next + 999) / 1000);
+
+    return rc;
+}
+
+LIBSSH2_API int
+libssh2_keepalive_send_ms (LIBSSH2_SESSION *session,
+                           long *ms_to_next)
+{
+    libssh2_uint64_t now;
+    libssh2_uint64_t interval;
 
     if(!session->keepalive_interval) {
-        if(seconds_to_next)
-            *seconds_to_next = 0;
+        if(ms_to_next)
+            *ms_to_next = 0;
         return 0;
     }
 
-    now = time(NULL);
+    now = keepalive_now();
+    interval = (libssh2_uint64_t)session->keepalive_interval * 1000;
+
+    /* Clock stepped backwards, restart the interval */
+    if(session->keepalive_last_sent > now)
+        session->keepalive_last_sent = now;
 
-    if(session->keepalive_last_sent + session->keepalive_interval <= now) {
+    if(session->keepalive_last_sent + interval <= now) {
         /* Format is
            "SSH_MSG_GLOBAL_REQUEST || 4-byte len || str || want-reply". */
         unsigned char keepalive_data[]
             = "\x50\x00\x00\x00\x15keepalive@libssh2.orgW";
         size_t len = sizeof(keepalive_data) - 1;
+        int want_reply = session->keepalive_want_reply;
         int rc;
 
-        keepalive_data[len - 1] =
-            (unsigned char)session->keepalive_want_reply;
+        /* Global request replies come back in order, so a timed probe must
+           not be queued behind a tcpip-forward that is still waiting for
+           its own reply. Also stop timing once too many are unanswered. */
+        if(session->fwdLstn_state != libssh2_NB_state_idle ||
+           session->keepalive_probe_count >= LIBSSH2_KEEPALIVE_PROBES)
+            want_reply = 0;
+
+        keepalive_data[len - 1] = (unsigned char)want_reply;
 
         rc = _libssh2_transport_send(session, keepalive_data, len, NULL, 0);
-        /* Silently ignore PACKET_EAGAIN here: if the write buffer is
-           already full, sending another keepalive is not useful. */
+        /* On PACKET_EAGAIN nothing was sent, as the tail of an earlier
+           packet is still waiting for the socket; try again next time. */
         if(rc && rc != LIBSSH2_ERROR_EAGAIN) {
             _libssh2_error(session, LIBSSH2_ERROR_SOCKET_SEND,
                            "Unable to send keepalive message");
             return rc;
         }
 
-        session->keepalive_last_sent = now;
-        if(seconds_to_next)
-            *seconds_to_next = session->keepalive_interval;
+        if(!rc) {
+            if(want_reply) {
+                unsigned int slot = (session->keepalive_probe_head +
+                                     session->keepalive_probe_count) %
+                                    LIBSSH2_KEEPALIVE_PROBES;
+
+                session->keepalive_probe_sent[slot] = now;
+                session->keepalive_probe_count++;
+            }
+
+            session->keepalive_last_sent = now;
+        }
     }
-    else if(seconds_to_next) {
-        *seconds_to_next = (int) (session->keepalive_last_sent - now)
-            + session->keepalive_interval;
+
+    if(ms_to_next) {
+        libssh2_uint64_t next = session->keepalive_last_sent + interval;
+
+        *ms_to_next = (next > now) ? (long) ((next - now + 999) / 1000) : 0;
     }
 
     return 0;
 }
+
+/*
+ * _libssh2_keepalive_reply
+ *
+ * Called from _libssh2_packet_add() for SSH_MSG_REQUEST_SUCCESS and
+ * SSH_MSG_REQUEST_FAILURE. Returns 1 if the reply answered one of our timed
+ * keepalives and has been consumed, 0 if it belongs to somebody else.
+ */
+int
+_libssh2_keepalive_reply(LIBSSH2_SESSION *session)
+{
+    libssh2_uint64_t now;
+    libssh2_uint64_t sent;
+    libssh2_uint64_t sample;
+    libssh2_uint64_t delta;
+
+    if(!session->keepalive_probe_count)
+        return 0;
+
+    now = keepalive_now();
+    sent = session->keepalive_probe_sent[session->keepalive_probe_head];
+    sample = (now > sent) ? now - sent : 0;
+
+    session->keepalive_probe_head = (session->keepalive_probe_head + 1) %
+                                    LIBSSH2_KEEPALIVE_PROBES;
+    session->keepalive_probe_count--;
+
+    if(!session->keepalive_rtt_samples) {
+        session->keepalive_srtt = sample;
+        session->keepalive_rttvar = sample / 2;
+    }
+    else {
+        delta = (session->keepalive_srtt > sample) ?
+                session->keepalive_srtt - sample :
+                sample - session->keepalive_srtt;
+        session->keepalive_rttvar = (3 * session->keepalive_rttvar + delta) / 4;
+        session->keepalive_srtt = (7 * session->keepalive_srtt + sample) / 8;
+    }
+
+    session->keepalive_rtt_last = sample;
+    session->keepalive_rtt_samples++;
+
+    _libssh2_debug(session, LIBSSH2_TRACE_CONN,
+                   "Keepalive reply after %lu us (srtt %lu us, rttvar %lu us)",
+                   (unsigned long) sample,
+                   (unsigned long) session->keepalive_srtt,
+                   (unsigned long) session->keepalive_rttvar);
+
+    return 1;
+}
+
+LIBSSH2_API int
+libssh2_keepalive_rtt (LIBSSH2_SESSION *session,
+                       struct libssh2_keepalive_stats *stats)
+{
+    if(!stats)
+        return LIBSSH2_ERROR_BAD_USE;
+
+    stats->samples = session->keepalive_rtt_samples;
+    stats->pending = session->keepalive_probe_count;
+    stats->last_us = session->keepalive_rtt_last;
+    stats->srtt_us = session->keepalive_srtt;
+    stats->rttvar_us = session->keepalive_rttvar;
+
+    return session->keepalive_rtt_samples ? 0 : 1;
+}
@@ -808,8 +808,15 @@ static int diffie_hellman_sha_algo(LIBSSH2_SESSION *session,
                 ret = LIBSSH2_ERROR_KEX_FAILURE;
                 goto clean_exit;
             }
-            session->local.mac->init(session, key, &free_key,
-                                     &session->local.mac_abstract);
+            if(session->local.mac->
+               init(session, key, &free_key, &session->local.mac_abstract)) {
+                if(free_key) {
+                    _libssh2_explicit_zero(key, session->local.mac->key_len);
+                    LIBSSH2_FREE(session, key);
+                }
+                ret = LIBSSH2_ERROR_KEX_FAILURE;
+                goto clean_exit;
+            }
 
             if(free_key) {
                 _libssh2_explicit_zero(key, session->local.mac->key_len);
@@ -835,8 +842,15 @@ static int diffie_hellman_sha_algo(LIBSSH2_SESSION *session,
                 ret = LIBSSH2_ERROR_KEX_FAILURE;
                 goto clean_exit;
             }
-            session->remote.mac->init(session, key, &free_key,
-                                      &session->remote.mac_abstract);
+            if(session->remote.mac->
+               init(session, key, &free_key, &session->remote.mac_abstract)) {
+                if(free_key) {
+                    _libssh2_explicit_zero(key, session->remote.mac->key_len);
+                    LIBSSH2_FREE(session, key);
+                }
+                ret = LIBSSH2_ERROR_KEX_FAILURE;
+                goto clean_exit;
+            }
 
             if(free_key) {
                 _libssh2_explicit_zero(key, session->remote.mac->key_len);
@@ -170,11 +170,12 @@ static inline int writev(int sock, struct iovec *iov, int nvecs)
 #define MAX_SHA_DIGEST_LEN SHA512_DIGEST_LENGTH
 
 #define LIBSSH2_ALLOC(session, count) \
-  session->alloc((count), &(session)->abstract)
+  ((session)->stats.allocs++, session->alloc((count), &(session)->abstract))
 #define LIBSSH2_CALLOC(session, count) _libssh2_calloc(session, count)
 #define LIBSSH2_REALLOC(session, ptr, count) \
- ((ptr) ? session->realloc((ptr), (count), &(session)->abstract) : \
- session->alloc((count), &(session)->abstract))
+ ((session)->stats.allocs++, \
+  (ptr) ? session->realloc((ptr), (count), &(session)->abstract) : \
+  session->alloc((count), &(session)->abstract))
 #define LIBSSH2_FREE(session, ptr) \
  session->free((ptr), &(session)->abstract)
 #define LIBSSH2_IGNORE(session, data, datalen) \
@@ -196,6 +197,17 @@ static inline int writev(int sock, struct iovec *iov, int nvecs)
     channel->session->x11(((channel)->session), (channel), \
                           (shost), (sport), (&(channel)->session->abstract))
 
+#ifdef LIBSSH2_STATS
+#define LIBSSH2_STAGE(session, st, end, bytes)                      \
+    do {                                                            \
+        if((session)->stage)                                        \
+            (session)->stage((session), (st), (end), (bytes),       \
+                             &(session)->abstract);                 \
+    } while(0)
+#else
+#define LIBSSH2_STAGE(session, st, end, bytes) do { (void)(bytes); } while(0)
+#endif
+
 #define LIBSSH2_CHANNEL_CLOSE(session, channel)          \
     channel->close_cb((session), &(session)->abstract, \
                       (channel), &(channel)->abstract)
@@ -440,6 +452,9 @@ struct _LIBSSH2_CHANNEL
     size_t write_packet_len;
     size_t write_bufwrite;
 
+    /* LIBSSH2_CHANNEL_PRIORITY_*, see libssh2_channel_set_priority() */
+    int priority;
+
     /* State variables used in libssh2_channel_close() */
     libssh2_nonblocking_states close_state;
     unsigned char close_packet[5];
@@ -540,10 +555,8 @@ struct transportpacket
     /* ------------- for outgoing data --------------- */
     unsigned char outbuf[MAX_SSH_PACKET_LEN]; /* area for the outgoing data */
 
-    int ototal_num;         /* size of outbuf in number of bytes */
-    const unsigned char *odata; /* original pointer to the data */
-    size_t olen;            /* original size of the data we stored in
-                               outbuf */
+    int ototal_num;         /* size of the partially sent packet in outbuf,
+                               0 when nothing is pending */
     size_t osent;           /* number of bytes already sent */
 };
 
@@ -577,6 +590,14 @@ struct _LIBSSH2_PUBLICKEY
 
 #define LIBSSH2_SCP_RESPONSE_BUFLEN     256
 
+/* Largest payload of a single packet on a bulk priority channel, which is
+   also the most an interactive packet has to wait behind at the transport
+   layer */
+#define LIBSSH2_CHANNEL_BULK_PACKET     8192
+
+/* Maximum number of unanswered want_reply keepalives that are timed */
+#define LIBSSH2_KEEPALIVE_PROBES        8
+
 struct flags {
     int sigpipe;  /* LIBSSH2_FLAG_SIGPIPE */
     int compress; /* LIBSSH2_FLAG_COMPRESS */
@@ -598,6 +619,7 @@ struct _LIBSSH2_SESSION
       LIBSSH2_X11_OPEN_FUNC((*x11));
       LIBSSH2_SEND_FUNC((*send));
       LIBSSH2_RECV_FUNC((*recv));
+      LIBSSH2_STAGE_FUNC((*stage));
 
     /* Method preferences -- NULL yields "load order" */
     char *kex_prefs;
@@ -849,10 +871,28 @@ struct _LIBSSH2_SESSION
     size_t scpSend_response_len;
     LIBSSH2_CHANNEL *scpSend_channel;
 
-    /* Keepalive variables used by keepalive.c. */
-    int keepalive_interval;
+    /* Keepalive variables used by keepalive.c. Times are in microseconds,
+       the interval in milliseconds. */
+    unsigned int keepalive_interval;
     int keepalive_want_reply;
-    time_t keepalive_last_sent;
+    libssh2_uint64_t keepalive_last_sent;
+    /* Send times of the want_reply probes still waiting for a reply */
+    libssh2_uint64_t keepalive_probe_sent[LIBSSH2_KEEPALIVE_PROBES];
+    unsigned int keepalive_probe_head;
+    unsigned int keepalive_probe_count;
+    /* Smoothed round-trip time and its mean deviation (RFC 6298) */
+    unsigned long keepalive_rtt_samples;
+    libssh2_uint64_t keepalive_rtt_last;
+    libssh2_uint64_t keepalive_srtt;
+    libssh2_uint64_t keepalive_rttvar;
+
+    /* Transport counters for libssh2_session_transport_stats() */
+    struct libssh2_transport_stats stats;
+
+    /* Bytes bulk priority channels may send per scheduling round (0 means
+       no limit) and the amount sent in the current round */
+    size_t bulk_quantum;
+    size_t bulk_sent;
 
     /* Passphrase callback */
     int (*passphrase_cb)(char *buf, int size, int rwflag, void *userdata);
@@ -1075,6 +1115,9 @@ ssize_t _libssh2_send(libssh2_socket_t socket, const void *buffer,
 #define LIBSSH2_READ_TIMEOUT 60 /* generic timeout in seconds used when
                                    waiting for more data to arrive */
 
+/* keepalive.c */
+int _libssh2_keepalive_reply(LIBSSH2_SESSION *session);
+
 
 int _libssh2_kex_exchange(LIBSSH2_SESSION * session, int reexchange,
                           key_exchange_state_t * state);
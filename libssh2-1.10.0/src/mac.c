@@ -64,6 +64,7 @@ static LIBSSH2_MAC_METHOD mac_method_none = {
 };
 #endif /* LIBSSH2_MAC_NONE */
 
+#ifndef libssh2_hmac_reset
 /* mac_method_common_init
  * Initialize simple mac methods
  */
@@ -93,29 +94,178 @@ mac_method_common_dtor(LIBSSH2_SESSION * session, void **abstract)
 
     return 0;
 }
+#endif /* libssh2_hmac_reset */
 
 
 
+/* HMAC algorithms, for mac_method_hmac_key() */
+enum {
+    MAC_HMAC_SHA1,
+    MAC_HMAC_MD5,
+    MAC_HMAC_RIPEMD160,
+    MAC_HMAC_SHA256,
+    MAC_HMAC_SHA512
+};
+
+/* mac_method_hmac_key
+ * Set up an HMAC context for the given algorithm and key
+ */
+static void
+mac_method_hmac_key(libssh2_hmac_ctx *ctx, int algo,
+                    unsigned char *key, int key_len)
+{
+    switch(algo) {
 #if LIBSSH2_HMAC_SHA512
-/* mac_method_hmac_sha512_hash
- * Calculate hash using full sha512 value
+    case MAC_HMAC_SHA512:
+        libssh2_hmac_sha512_init(ctx, key, key_len);
+        break;
+#endif
+#if LIBSSH2_HMAC_SHA256
+    case MAC_HMAC_SHA256:
+        libssh2_hmac_sha256_init(ctx, key, key_len);
+        break;
+#endif
+#if LIBSSH2_MD5
+    case MAC_HMAC_MD5:
+        libssh2_hmac_md5_init(ctx, key, key_len);
+        break;
+#endif
+#if LIBSSH2_HMAC_RIPEMD
+    case MAC_HMAC_RIPEMD160:
+        libssh2_hmac_ripemd160_init(ctx, key, key_len);
+        break;
+#endif
+    default:
+        libssh2_hmac_sha1_init(ctx, key, key_len);
+        break;
+    }
+}
+
+
+
+#ifdef libssh2_hmac_reset
+/*
+ * The key only changes at key exchange, so the HMAC context is keyed once
+ * in the init method and kept in the abstract. For each packet it is reset
+ * to the state right after the key was absorbed, which saves allocating a
+ * context and running the ipad/opad compressions every time.
+ */
+struct mac_hmac_abstract
+{
+    libssh2_hmac_ctx ctx;
+};
+
+/* mac_method_hmac_init
+ * Create the pre-keyed HMAC context
  */
 static int
-mac_method_hmac_sha2_512_hash(LIBSSH2_SESSION * session,
-                          unsigned char *buf, uint32_t seqno,
-                          const unsigned char *packet,
-                          uint32_t packet_len,
-                          const unsigned char *addtl,
-                          uint32_t addtl_len, void **abstract)
+mac_method_hmac_init(LIBSSH2_SESSION * session, unsigned char *key,
+                     int *free_key, void **abstract, int algo, int key_len)
+{
+    struct mac_hmac_abstract *mac;
+
+    /* the key is not needed after this */
+    *free_key = 1;
+
+    mac = LIBSSH2_ALLOC(session, sizeof(*mac));
+    if(!mac) {
+        *abstract = NULL;
+        return _libssh2_error(session, LIBSSH2_ERROR_ALLOC,
+                              "Unable to allocate HMAC context");
+    }
+
+    libssh2_hmac_ctx_init(mac->ctx);
+    if(libssh2_hmac_ctx_failed(mac->ctx)) {
+        LIBSSH2_FREE(session, mac);
+        *abstract = NULL;
+        return _libssh2_error(session, LIBSSH2_ERROR_ALLOC,
+                              "Unable to allocate HMAC context");
+    }
+    mac_method_hmac_key(&mac->ctx, algo, key, key_len);
+
+    *abstract = mac;
+
+    return 0;
+}
+
+
+
+/* mac_method_hmac_hash
+ * Calculate the HMAC of a packet from the pre-keyed context
+ */
+static int
+mac_method_hmac_hash(unsigned char *buf, uint32_t seqno,
+                     const unsigned char *packet, uint32_t packet_len,
+                     const unsigned char *addtl, uint32_t addtl_len,
+                     void **abstract, int algo, int key_len)
+{
+    struct mac_hmac_abstract *mac = *abstract;
+    unsigned char seqno_buf[4];
+    (void) algo;
+    (void) key_len;
+
+    if(!mac)
+        return -1;
+
+    _libssh2_htonu32(seqno_buf, seqno);
+
+    libssh2_hmac_reset(&mac->ctx);
+    libssh2_hmac_update(mac->ctx, seqno_buf, 4);
+    libssh2_hmac_update(mac->ctx, packet, packet_len);
+    if(addtl && addtl_len) {
+        libssh2_hmac_update(mac->ctx, addtl, addtl_len);
+    }
+    libssh2_hmac_final(mac->ctx, buf);
+
+    return 0;
+}
+
+
+
+/* mac_method_hmac_dtor
+ * Free the pre-keyed HMAC context
+ */
+static int
+mac_method_hmac_dtor(LIBSSH2_SESSION * session, void **abstract)
+{
+    struct mac_hmac_abstract *mac = *abstract;
+
+    if(mac) {
+        libssh2_hmac_cleanup(&mac->ctx);
+        LIBSSH2_FREE(session, mac);
+    }
+    *abstract = NULL;
+
+    return 0;
+}
+#else
+/* Crypto backends that cannot reset a keyed context keep the key and key
+   a new context for every packet */
+static int
+mac_method_hmac_init(LIBSSH2_SESSION * session, unsigned char *key,
+                     int *free_key, void **abstract, int algo, int key_len)
+{
+    (void) algo;
+    (void) key_len;
+
+    return mac_method_common_init(session, key, free_key, abstract);
+}
+
+
+
+static int
+mac_method_hmac_hash(unsigned char *buf, uint32_t seqno,
+                     const unsigned char *packet, uint32_t packet_len,
+                     const unsigned char *addtl, uint32_t addtl_len,
+                     void **abstract, int algo, int key_len)
 {
     libssh2_hmac_ctx ctx;
     unsigned char seqno_buf[4];
-    (void) session;
 
     _libssh2_htonu32(seqno_buf, seqno);
 
     libssh2_hmac_ctx_init(ctx);
-    libssh2_hmac_sha512_init(&ctx, *abstract, 64);
+    mac_method_hmac_key(&ctx, algo, *abstract, key_len);
     libssh2_hmac_update(ctx, seqno_buf, 4);
     libssh2_hmac_update(ctx, packet, packet_len);
     if(addtl && addtl_len) {
@@ -127,49 +277,87 @@ mac_method_hmac_sha2_512_hash(LIBSSH2_SESSION * session,
     return 0;
 }
 
+#define mac_method_hmac_dtor mac_method_common_dtor
+#endif /* libssh2_hmac_reset */
+
+
+
+#if LIBSSH2_HMAC_SHA512
+/* mac_method_hmac_sha512_init
+ * Initialize sha512 HMAC
+ */
+static int
+mac_method_hmac_sha2_512_init(LIBSSH2_SESSION * session, unsigned char *key,
+                              int *free_key, void **abstract)
+{
+    return mac_method_hmac_init(session, key, free_key, abstract,
+                                MAC_HMAC_SHA512, 64);
+}
+
+
+
+/* mac_method_hmac_sha512_hash
+ * Calculate hash using full sha512 value
+ */
+static int
+mac_method_hmac_sha2_512_hash(LIBSSH2_SESSION * session,
+                              unsigned char *buf, uint32_t seqno,
+                              const unsigned char *packet,
+                              uint32_t packet_len,
+                              const unsigned char *addtl,
+                              uint32_t addtl_len, void **abstract)
+{
+    (void) session;
+
+    return mac_method_hmac_hash(buf, seqno, packet, packet_len,
+                                addtl, addtl_len, abstract,
+                                MAC_HMAC_SHA512, 64);
+}
+
 
 
 static const LIBSSH2_MAC_METHOD mac_method_hmac_sha2_512 = {
     "hmac-sha2-512",
     64,
     64,
-    mac_method_common_init,
+    mac_method_hmac_sha2_512_init,
     mac_method_hmac_sha2_512_hash,
-    mac_method_common_dtor,
+    mac_method_hmac_dtor,
 };
 #endif
 
 
 
 #if LIBSSH2_HMAC_SHA256
+/* mac_method_hmac_sha256_init
+ * Initialize sha256 HMAC
+ */
+static int
+mac_method_hmac_sha2_256_init(LIBSSH2_SESSION * session, unsigned char *key,
+                              int *free_key, void **abstract)
+{
+    return mac_method_hmac_init(session, key, free_key, abstract,
+                                MAC_HMAC_SHA256, 32);
+}
+
+
+
 /* mac_method_hmac_sha256_hash
  * Calculate hash using full sha256 value
  */
 static int
 mac_method_hmac_sha2_256_hash(LIBSSH2_SESSION * session,
-                          unsigned char *buf, uint32_t seqno,
-                          const unsigned char *packet,
-                          uint32_t packet_len,
-                          const unsigned char *addtl,
-                          uint32_t addtl_len, void **abstract)
+                              unsigned char *buf, uint32_t seqno,
+                              const unsigned char *packet,
+                              uint32_t packet_len,
+                              const unsigned char *addtl,
+                              uint32_t addtl_len, void **abstract)
 {
-    libssh2_hmac_ctx ctx;
-    unsigned char seqno_buf[4];
     (void) session;
 
-    _libssh2_htonu32(seqno_buf, seqno);
-
-    libssh2_hmac_ctx_init(ctx);
-    libssh2_hmac_sha256_init(&ctx, *abstract, 32);
-    libssh2_hmac_update(ctx, seqno_buf, 4);
-    libssh2_hmac_update(ctx, packet, packet_len);
-    if(addtl && addtl_len) {
-        libssh2_hmac_update(ctx, addtl, addtl_len);
-    }
-    libssh2_hmac_final(ctx, buf);
-    libssh2_hmac_cleanup(&ctx);
-
-    return 0;
+    return mac_method_hmac_hash(buf, seqno, packet, packet_len,
+                                addtl, addtl_len, abstract,
+                                MAC_HMAC_SHA256, 32);
 }
 
 
@@ -178,14 +366,26 @@ static const LIBSSH2_MAC_METHOD mac_method_hmac_sha2_256 = {
     "hmac-sha2-256",
     32,
     32,
-    mac_method_common_init,
+    mac_method_hmac_sha2_256_init,
     mac_method_hmac_sha2_256_hash,
-    mac_method_common_dtor,
+    mac_method_hmac_dtor,
 };
 #endif
 
 
 
+/* mac_method_hmac_sha1_init
+ * Initialize sha1 HMAC
+ */
+static int
+mac_method_hmac_sha1_init(LIBSSH2_SESSION * session, unsigned char *key,
+                          int *free_key, void **abstract)
+{
+    return mac_method_hmac_init(session, key, free_key, abstract,
+                                MAC_HMAC_SHA1, 20);
+}
+
+
 
 /* mac_method_hmac_sha1_hash
  * Calculate hash using full sha1 value
@@ -198,36 +398,15 @@ mac_method_hmac_sha1_hash(LIBSSH2_SESSION * session,
                           const unsigned char *addtl,
                           uint32_t addtl_len, void **abstract)
 {
-    libssh2_hmac_ctx ctx;
-    unsigned char seqno_buf[4];
     (void) session;
 
-    _libssh2_htonu32(seqno_buf, seqno);
-
-    libssh2_hmac_ctx_init(ctx);
-    libssh2_hmac_sha1_init(&ctx, *abstract, 20);
-    libssh2_hmac_update(ctx, seqno_buf, 4);
-    libssh2_hmac_update(ctx, packet, packet_len);
-    if(addtl && addtl_len) {
-        libssh2_hmac_update(ctx, addtl, addtl_len);
-    }
-    libssh2_hmac_final(ctx, buf);
-    libssh2_hmac_cleanup(&ctx);
-
-    return 0;
+    return mac_method_hmac_hash(buf, seqno, packet, packet_len,
+                                addtl, addtl_len, abstract,
+                                MAC_HMAC_SHA1, 20);
 }
 
 
 
-static const LIBSSH2_MAC_METHOD mac_method_hmac_sha1 = {
-    "hmac-sha1",
-    20,
-    20,
-    mac_method_common_init,
-    mac_method_hmac_sha1_hash,
-    mac_method_common_dtor,
-};
-
 /* mac_method_hmac_sha1_96_hash
  * Calculate hash using first 96 bits of sha1 value
  */
@@ -250,57 +429,58 @@ mac_method_hmac_sha1_96_hash(LIBSSH2_SESSION * session,
 
 
 
+static const LIBSSH2_MAC_METHOD mac_method_hmac_sha1 = {
+    "hmac-sha1",
+    20,
+    20,
+    mac_method_hmac_sha1_init,
+    mac_method_hmac_sha1_hash,
+    mac_method_hmac_dtor,
+};
+
 static const LIBSSH2_MAC_METHOD mac_method_hmac_sha1_96 = {
     "hmac-sha1-96",
     12,
     20,
-    mac_method_common_init,
+    mac_method_hmac_sha1_init,
     mac_method_hmac_sha1_96_hash,
-    mac_method_common_dtor,
+    mac_method_hmac_dtor,
 };
 
 #if LIBSSH2_MD5
+/* mac_method_hmac_md5_init
+ * Initialize md5 HMAC
+ */
+static int
+mac_method_hmac_md5_init(LIBSSH2_SESSION * session, unsigned char *key,
+                         int *free_key, void **abstract)
+{
+    return mac_method_hmac_init(session, key, free_key, abstract,
+                                MAC_HMAC_MD5, 16);
+}
+
+
+
 /* mac_method_hmac_md5_hash
  * Calculate hash using full md5 value
  */
 static int
-mac_method_hmac_md5_hash(LIBSSH2_SESSION * session, unsigned char *buf,
-                         uint32_t seqno,
+mac_method_hmac_md5_hash(LIBSSH2_SESSION * session,
+                         unsigned char *buf, uint32_t seqno,
                          const unsigned char *packet,
                          uint32_t packet_len,
                          const unsigned char *addtl,
                          uint32_t addtl_len, void **abstract)
 {
-    libssh2_hmac_ctx ctx;
-    unsigned char seqno_buf[4];
     (void) session;
 
-    _libssh2_htonu32(seqno_buf, seqno);
-
-    libssh2_hmac_ctx_init(ctx);
-    libssh2_hmac_md5_init(&ctx, *abstract, 16);
-    libssh2_hmac_update(ctx, seqno_buf, 4);
-    libssh2_hmac_update(ctx, packet, packet_len);
-    if(addtl && addtl_len) {
-        libssh2_hmac_update(ctx, addtl, addtl_len);
-    }
-    libssh2_hmac_final(ctx, buf);
-    libssh2_hmac_cleanup(&ctx);
-
-    return 0;
+    return mac_method_hmac_hash(buf, seqno, packet, packet_len,
+                                addtl, addtl_len, abstract,
+                                MAC_HMAC_MD5, 16);
 }
 
 
 
-static const LIBSSH2_MAC_METHOD mac_method_hmac_md5 = {
-    "hmac-md5",
-    16,
-    16,
-    mac_method_common_init,
-    mac_method_hmac_md5_hash,
-    mac_method_common_dtor,
-};
-
 /* mac_method_hmac_md5_96_hash
  * Calculate hash using first 96 bits of md5 value
  */
@@ -321,19 +501,41 @@ mac_method_hmac_md5_96_hash(LIBSSH2_SESSION * session,
 
 
 
+static const LIBSSH2_MAC_METHOD mac_method_hmac_md5 = {
+    "hmac-md5",
+    16,
+    16,
+    mac_method_hmac_md5_init,
+    mac_method_hmac_md5_hash,
+    mac_method_hmac_dtor,
+};
+
 static const LIBSSH2_MAC_METHOD mac_method_hmac_md5_96 = {
     "hmac-md5-96",
     12,
     16,
-    mac_method_common_init,
+    mac_method_hmac_md5_init,
     mac_method_hmac_md5_96_hash,
-    mac_method_common_dtor,
+    mac_method_hmac_dtor,
 };
 #endif /* LIBSSH2_MD5 */
 
 #if LIBSSH2_HMAC_RIPEMD
+/* mac_method_hmac_ripemd160_init
+ * Initialize ripemd160 HMAC
+ */
+static int
+mac_method_hmac_ripemd160_init(LIBSSH2_SESSION * session, unsigned char *key,
+                               int *free_key, void **abstract)
+{
+    return mac_method_hmac_init(session, key, free_key, abstract,
+                                MAC_HMAC_RIPEMD160, 20);
+}
+
+
+
 /* mac_method_hmac_ripemd160_hash
- * Calculate hash using ripemd160 value
+ * Calculate hash using full ripemd160 value
  */
 static int
 mac_method_hmac_ripemd160_hash(LIBSSH2_SESSION * session,
@@ -341,26 +543,13 @@ mac_method_hmac_ripemd160_hash(LIBSSH2_SESSION * session,
                                const unsigned char *packet,
                                uint32_t packet_len,
                                const unsigned char *addtl,
-                               uint32_t addtl_len,
-                               void **abstract)
+                               uint32_t addtl_len, void **abstract)
 {
-    libssh2_hmac_ctx ctx;
-    unsigned char seqno_buf[4];
     (void) session;
 
-    _libssh2_htonu32(seqno_buf, seqno);
-
-    libssh2_hmac_ctx_init(ctx);
-    libssh2_hmac_ripemd160_init(&ctx, *abstract, 20);
-    libssh2_hmac_update(ctx, seqno_buf, 4);
-    libssh2_hmac_update(ctx, packet, packet_len);
-    if(addtl && addtl_len) {
-        libssh2_hmac_update(ctx, addtl, addtl_len);
-    }
-    libssh2_hmac_final(ctx, buf);
-    libssh2_hmac_cleanup(&ctx);
-
-    return 0;
+    return mac_method_hmac_hash(buf, seqno, packet, packet_len,
+                                addtl, addtl_len, abstract,
+                                MAC_HMAC_RIPEMD160, 20);
 }
 
 
@@ -369,18 +558,18 @@ static const LIBSSH2_MAC_METHOD mac_method_hmac_ripemd160 = {
     "hmac-ripemd160",
     20,
     20,
-    mac_method_common_init,
+    mac_method_hmac_ripemd160_init,
     mac_method_hmac_ripemd160_hash,
-    mac_method_common_dtor,
+    mac_method_hmac_dtor,
 };
 
 static const LIBSSH2_MAC_METHOD mac_method_hmac_ripemd160_openssh_com = {
     "hmac-ripemd160@openssh.com",
     20,
     20,
-    mac_method_common_init,
+    mac_method_hmac_ripemd160_init,
     mac_method_hmac_ripemd160_hash,
-    mac_method_common_dtor,
+    mac_method_hmac_dtor,
 };
 #endif /* LIBSSH2_HMAC_RIPEMD */
 
@@ -273,6 +273,10 @@ int _libssh2_md5_init(libssh2_md5_ctx *ctx);
 #define libssh2_hmac_update(ctx, data, datalen) \
   HMAC_Update(ctx, data, datalen)
 #define libssh2_hmac_final(ctx, data) HMAC_Final(ctx, data, NULL)
+/* restart with the key already set in the context */
+#define libssh2_hmac_reset(ctx) HMAC_Init_ex(*(ctx), NULL, 0, NULL, NULL)
+/* true if libssh2_hmac_ctx_init() could not allocate the context */
+#define libssh2_hmac_ctx_failed(ctx) ((ctx) == NULL)
 #define libssh2_hmac_cleanup(ctx) HMAC_CTX_free(*(ctx))
 #else
 #define libssh2_hmac_ctx HMAC_CTX
@@ -292,6 +296,8 @@ int _libssh2_md5_init(libssh2_md5_ctx *ctx);
 #define libssh2_hmac_update(ctx, data, datalen) \
   HMAC_Update(&(ctx), data, datalen)
 #define libssh2_hmac_final(ctx, data) HMAC_Final(&(ctx), data, NULL)
+#define libssh2_hmac_reset(ctx) HMAC_Init_ex(ctx, NULL, 0, NULL, NULL)
+#define libssh2_hmac_ctx_failed(ctx) 0
 #define libssh2_hmac_cleanup(ctx) HMAC_cleanup(ctx)
 #endif
 
@@ -650,6 +650,20 @@ _libssh2_packet_add(LIBSSH2_SESSION * session, unsigned char *data,
             session->packAdd_state = libssh2_NB_state_idle;
             return 0;
 
+            /*
+              byte      SSH_MSG_REQUEST_SUCCESS or SSH_MSG_REQUEST_FAILURE
+              ....      response specific data
+            */
+
+        case SSH_MSG_REQUEST_SUCCESS:
+        case SSH_MSG_REQUEST_FAILURE:
+            if(_libssh2_keepalive_reply(session)) {
+                LIBSSH2_FREE(session, data);
+                session->packAdd_state = libssh2_NB_state_idle;
+                return 0;
+            }
+            break;
+
             /*
               byte      SSH_MSG_CHANNEL_EXTENDED_DATA
               uint32    recipient channel
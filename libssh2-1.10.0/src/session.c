@@ -567,6 +567,11 @@ libssh2_session_callback_set(LIBSSH2_SESSION * session,
         oldcb = session->recv;
         session->recv = callback;
         return oldcb;
+
+    case LIBSSH2_CALLBACK_STAGE:
+        oldcb = session->stage;
+        session->stage = callback;
+        return oldcb;
     }
     _libssh2_debug(session, LIBSSH2_TRACE_TRANS, "Setting Callback %d",
                    cbtype);
@@ -1368,6 +1373,22 @@ libssh2_session_flag(LIBSSH2_SESSION * session, int flag, int value)
     return LIBSSH2_ERROR_NONE;
 }
 
+/* libssh2_session_transport_stats
+ *
+ * Copy the transport counters of the session to STATS
+ */
+LIBSSH2_API int
+libssh2_session_transport_stats(LIBSSH2_SESSION *session,
+                                struct libssh2_transport_stats *stats)
+{
+    if(!stats)
+        return LIBSSH2_ERROR_BAD_USE;
+
+    *stats = session->stats;
+
+    return LIBSSH2_ERROR_NONE;
+}
+
 /* _libssh2_session_set_blocking
  *
  * Set a session's blocking mode on or off, return the previous status when
@@ -1406,6 +1427,28 @@ libssh2_session_get_blocking(LIBSSH2_SESSION * session)
     return session->api_block_mode;
 }
 
+/* libssh2_session_set_bulk_quantum
+ *
+ * Set how many bytes bulk priority channels may send per scheduling round,
+ * 0 for no limit
+ */
+LIBSSH2_API void
+libssh2_session_set_bulk_quantum(LIBSSH2_SESSION * session, size_t quantum)
+{
+    session->bulk_quantum = quantum;
+    session->bulk_sent = 0;
+}
+
+/* libssh2_session_bulk_round
+ *
+ * Start a new scheduling round, giving bulk channels a full quantum again
+ */
+LIBSSH2_API void
+libssh2_session_bulk_round(LIBSSH2_SESSION * session)
+{
+    session->bulk_sent = 0;
+}
+
 
 /* libssh2_session_set_timeout
  *
@@ -1822,6 +1865,40 @@ libssh2_session_block_directions(LIBSSH2_SESSION *session)
     return session->socket_block_directions;
 }
 
+/*
+ * libssh2_session_flush
+ *
+ * Send what is left of a packet that only went out partially. Call this
+ * when the socket becomes writable while libssh2_session_block_directions()
+ * has LIBSSH2_SESSION_BLOCK_OUTBOUND set. Returns 0 once nothing is left,
+ * LIBSSH2_ERROR_EAGAIN if some of it still is.
+ */
+LIBSSH2_API int
+libssh2_session_flush(LIBSSH2_SESSION *session)
+{
+    int rc = _libssh2_transport_flush(session);
+
+    if(rc && rc != LIBSSH2_ERROR_EAGAIN)
+        return _libssh2_error(session, rc, "Unable to send packet data");
+
+    return rc;
+}
+
+/*
+ * libssh2_session_open_pending
+ *
+ * A session can only open one channel at a time. When a non-blocking
+ * channel open has returned LIBSSH2_ERROR_EAGAIN, the same call has to be
+ * repeated until it completes, and no other channel open may be started in
+ * the meantime. Returns non-zero while that is the case.
+ */
+LIBSSH2_API int
+libssh2_session_open_pending(LIBSSH2_SESSION *session)
+{
+    return session->open_state != libssh2_NB_state_idle ||
+        session->direct_state != libssh2_NB_state_idle;
+}
+
 /* libssh2_session_banner_get
  * Get the remote banner (server ID string)
  */
@@ -133,15 +133,19 @@ decrypt(LIBSSH2_SESSION * session, unsigned char *source,
 {
     struct transportpacket *p = &session->packet;
     int blocksize = session->remote.crypt->blocksize;
+    int len0 = len;
 
     /* if we get called with a len that isn't an even number of blocksizes
        we risk losing those extra bytes */
     assert((len % blocksize) == 0);
 
+    LIBSSH2_STAGE(session, LIBSSH2_STAGE_DECRYPT, 0, 0);
+
     while(len >= blocksize) {
         if(session->remote.crypt->crypt(session, source, blocksize,
                                          &session->remote.crypt_abstract)) {
             LIBSSH2_FREE(session, p->payload);
+            LIBSSH2_STAGE(session, LIBSSH2_STAGE_DECRYPT, 1, 0);
             return LIBSSH2_ERROR_DECRYPT;
         }
 
@@ -154,6 +158,7 @@ decrypt(LIBSSH2_SESSION * session, unsigned char *source,
         dest += blocksize;      /* advance write pointer */
         source += blocksize;    /* advance read pointer */
     }
+    LIBSSH2_STAGE(session, LIBSSH2_STAGE_DECRYPT, 1, len0);
     return LIBSSH2_ERROR_NONE;         /* all is fine */
 }
 
@@ -195,6 +200,7 @@ fullpacket(LIBSSH2_SESSION * session, int encrypted /* 1 or 0 */ )
         }
 
         session->remote.seqno++;
+        session->stats.packets_in++;
 
         /* ignore the padding */
         session->fullpacket_payload_len -= p->padding_length;
@@ -270,7 +276,7 @@ fullpacket(LIBSSH2_SESSION * session, int encrypted /* 1 or 0 */ )
  *
  * DOES NOT call _libssh2_error() for ANY error case.
  */
-int _libssh2_transport_read(LIBSSH2_SESSION * session)
+static int transport_read(LIBSSH2_SESSION * session)
 {
     int rc;
     struct transportpacket *p = &session->packet;
@@ -285,6 +291,12 @@ int _libssh2_transport_read(LIBSSH2_SESSION * session)
     /* default clear the bit */
     session->socket_block_directions &= ~LIBSSH2_SESSION_BLOCK_INBOUND;
 
+    /* The other side may be waiting for the rest of a packet that only
+       went out partially before it sends what the caller is waiting for */
+    rc = _libssh2_transport_flush(session);
+    if(rc && rc != LIBSSH2_ERROR_EAGAIN)
+        return rc;
+
     /*
      * All channels, systems, subsystems, etc eventually make it down here
      * when looking for more incoming data. If a key exchange is going on
@@ -389,6 +401,9 @@ int _libssh2_transport_read(LIBSSH2_SESSION * session)
 
             debugdump(session, "libssh2_transport_read() raw",
                       &p->buf[remainbuf], nread);
+            session->stats.recv_calls++;
+            session->stats.bytes_in += nread;
+
             /* advance write pointer */
             p->writeidx += nread;
 
@@ -621,31 +636,41 @@ int _libssh2_transport_read(LIBSSH2_SESSION * session)
     return LIBSSH2_ERROR_SOCKET_RECV; /* we never reach this point */
 }
 
-static int
-send_existing(LIBSSH2_SESSION *session, const unsigned char *data,
-              size_t data_len, ssize_t *ret)
+int _libssh2_transport_read(LIBSSH2_SESSION * session)
+{
+#ifdef LIBSSH2_STATS
+    uint64_t bytes_in = session->stats.bytes_in;
+    int rc;
+
+    LIBSSH2_STAGE(session, LIBSSH2_STAGE_READ, 0, 0);
+    rc = transport_read(session);
+    LIBSSH2_STAGE(session, LIBSSH2_STAGE_READ, 1,
+                  (size_t)(session->stats.bytes_in - bytes_in));
+
+    return rc;
+#else
+    return transport_read(session);
+#endif
+}
+
+/*
+ * _libssh2_transport_flush
+ *
+ * Send what is left of a packet that only went out partially. Once a packet
+ * has been encrypted into the output buffer it is part of the stream, so
+ * its tail must go out before anything else is sent.
+ */
+int _libssh2_transport_flush(LIBSSH2_SESSION *session)
 {
     ssize_t rc;
     ssize_t length;
     struct transportpacket *p = &session->packet;
 
-    if(!p->olen) {
-        *ret = 0;
+    if(!p->ototal_num) {
+        session->socket_block_directions &= ~LIBSSH2_SESSION_BLOCK_OUTBOUND;
         return LIBSSH2_ERROR_NONE;
     }
 
-    /* send as much as possible of the existing packet */
-    if((data != p->odata) || (data_len != p->olen)) {
-        /* When we are about to complete the sending of a packet, it is vital
-           that the caller doesn't try to send a new/different packet since
-           we don't add this one up until the previous one has been sent. To
-           make the caller really notice his/hers flaw, we return error for
-           this case */
-        return LIBSSH2_ERROR_BAD_USE;
-    }
-
-    *ret = 1;                   /* set to make our parent return */
-
     /* number of bytes left to send */
     length = p->ototal_num - p->osent;
 
@@ -660,31 +685,30 @@ send_existing(LIBSSH2_SESSION *session, const unsigned char *data,
                        p->osent);
         debugdump(session, "libssh2_transport_write send()",
                   &p->outbuf[p->osent], rc);
+
+        if(rc > 0) {
+            session->stats.send_calls++;
+            session->stats.bytes_out += rc;
+        }
     }
 
     if(rc == length) {
         /* the remainder of the package was sent */
         p->ototal_num = 0;
-        p->olen = 0;
-        /* we leave *ret set so that the parent returns as we MUST return back
-           a send success now, so that we don't risk sending EAGAIN later
-           which then would confuse the parent function */
+        p->osent = 0;
+        session->socket_block_directions &= ~LIBSSH2_SESSION_BLOCK_OUTBOUND;
         return LIBSSH2_ERROR_NONE;
-
     }
-    else if(rc < 0) {
-        /* nothing was sent */
-        if(rc != -EAGAIN)
-            /* send failure! */
-            return LIBSSH2_ERROR_SOCKET_SEND;
-
-        session->socket_block_directions |= LIBSSH2_SESSION_BLOCK_OUTBOUND;
-        return LIBSSH2_ERROR_EAGAIN;
+    else if(rc < 0 && rc != -EAGAIN) {
+        /* send failure! */
+        return LIBSSH2_ERROR_SOCKET_SEND;
     }
 
-    p->osent += rc;         /* we sent away this much data */
+    if(rc > 0)
+        p->osent += rc;         /* we sent away this much data */
 
-    return rc < length ? LIBSSH2_ERROR_EAGAIN : LIBSSH2_ERROR_NONE;
+    session->socket_block_directions |= LIBSSH2_SESSION_BLOCK_OUTBOUND;
+    return LIBSSH2_ERROR_EAGAIN;
 }
 
 /*
@@ -697,17 +721,32 @@ send_existing(LIBSSH2_SESSION *session, const unsigned char *data,
  * function.  The 'data' part is sent immediately before 'data2'. 'data2' may
  * be set to NULL to only use a single part.
  *
- * Returns LIBSSH2_ERROR_EAGAIN if it would block or if the whole packet was
- * not sent yet. If it does so, the caller should call this function again as
- * soon as it is likely that more data can be sent, and this function MUST
- * then be called with the same argument set (same data pointer and same
- * data_len) until ERROR_NONE or failure is returned.
+ * Returns LIBSSH2_ERROR_EAGAIN if the tail of an earlier packet could not
+ * be sent yet. Nothing of this packet has been sent then, and the caller may
+ * try again later with the same or with a different packet. Once this
+ * function has returned ERROR_NONE the packet is part of the stream, even
+ * if some of it is still waiting in the output buffer for the socket to
+ * become writable; _libssh2_transport_flush() sends that part.
  *
  * This function DOES NOT call _libssh2_error() on any errors.
  */
 int _libssh2_transport_send(LIBSSH2_SESSION *session,
                             const unsigned char *data, size_t data_len,
                             const unsigned char *data2, size_t data2_len)
+{
+    LIBSSH2_IOVEC iov;
+
+    iov.iov_base = data2;
+    iov.iov_len = data2_len;
+
+    return _libssh2_transport_sendv(session, data, data_len,
+                                    &iov, data2 ? 1 : 0, data2 ? data2_len : 0);
+}
+
+static int transport_sendv(LIBSSH2_SESSION *session,
+                           const unsigned char *data, size_t data_len,
+                           const LIBSSH2_IOVEC *iov, int iovcnt,
+                           size_t data2_len)
 {
     int blocksize =
         (session->state & LIBSSH2_STATE_NEWKEYS) ?
@@ -724,8 +763,8 @@ int _libssh2_transport_send(LIBSSH2_SESSION *session,
     int compressed;
     ssize_t ret;
     int rc;
-    const unsigned char *orgdata = data;
-    size_t orgdata_len = data_len;
+    int i;
+    size_t len, left;
 
     /*
      * If the last read operation was interrupted in the middle of a key
@@ -746,21 +785,19 @@ int _libssh2_transport_send(LIBSSH2_SESSION *session,
     }
 
     debugdump(session, "libssh2_transport_write plain", data, data_len);
-    if(data2)
-        debugdump(session, "libssh2_transport_write plain2", data2, data2_len);
+    for(i = 0, left = data2_len; i < iovcnt && left; i++) {
+        len = iov[i].iov_len < left ? iov[i].iov_len : left;
+        debugdump(session, "libssh2_transport_write plain2",
+                  iov[i].iov_base, len);
+        left -= len;
+    }
 
-    /* FIRST, check if we have a pending write to complete. send_existing
-       only sanity-check data and data_len and not data2 and data2_len!! */
-    rc = send_existing(session, data, data_len, &ret);
+    /* FIRST, finish sending the previous packet. Until that is done the
+       output buffer is in use and nothing of this one may be sent. */
+    rc = _libssh2_transport_flush(session);
     if(rc)
         return rc;
 
-    session->socket_block_directions &= ~LIBSSH2_SESSION_BLOCK_OUTBOUND;
-
-    if(ret)
-        /* set by send_existing if data was sent */
-        return rc;
-
     encrypted = (session->state & LIBSSH2_STATE_NEWKEYS) ? 1 : 0;
 
     compressed =
@@ -774,7 +811,7 @@ int _libssh2_transport_send(LIBSSH2_SESSION *session,
            larger than what fits in the assigned buffer so thus they don't
            check the input size as we don't know how much it compresses */
         size_t dest_len = MAX_SSH_PACKET_LEN-5-256;
-        size_t dest2_len = dest_len;
+        size_t dest2_len;
 
         /* compress directly to the target buffer */
         rc = session->local.comp->comp(session,
@@ -784,23 +821,28 @@ int _libssh2_transport_send(LIBSSH2_SESSION *session,
         if(rc)
             return rc;     /* compression failure */
 
-        if(data2 && data2_len) {
-            /* compress directly to the target buffer right after where the
-               previous call put data */
-            dest2_len -= dest_len;
+        /* compress each buffer directly to the target buffer right after
+           where the previous call put data */
+        for(i = 0, left = data2_len; i < iovcnt && left; i++) {
+            len = iov[i].iov_len < left ? iov[i].iov_len : left;
+            if(!len)
+                continue;
+
+            dest2_len = MAX_SSH_PACKET_LEN-5-256 - dest_len;
 
             rc = session->local.comp->comp(session,
                                            &p->outbuf[5 + dest_len],
                                            &dest2_len,
-                                           data2, data2_len,
+                                           iov[i].iov_base, len,
                                            &session->local.comp_abstract);
+            if(rc)
+                return rc;     /* compression failure */
+
+            dest_len += dest2_len;
+            left -= len;
         }
-        else
-            dest2_len = 0;
-        if(rc)
-            return rc;     /* compression failure */
 
-        data_len = dest_len + dest2_len; /* use the combined length */
+        data_len = dest_len; /* use the combined length */
     }
     else {
         if((data_len + data2_len) >= (MAX_SSH_PACKET_LEN-0x100))
@@ -810,9 +852,12 @@ int _libssh2_transport_send(LIBSSH2_SESSION *session,
 
         /* copy the payload data */
         memcpy(&p->outbuf[5], data, data_len);
-        if(data2 && data2_len)
-            memcpy(&p->outbuf[5 + data_len], data2, data2_len);
-        data_len += data2_len; /* use the combined length */
+        for(i = 0, left = data2_len; i < iovcnt && left; i++) {
+            len = iov[i].iov_len < left ? iov[i].iov_len : left;
+            memcpy(&p->outbuf[5 + data_len], iov[i].iov_base, len);
+            data_len += len;
+            left -= len;
+        }
     }
 
 
@@ -891,6 +936,7 @@ int _libssh2_transport_send(LIBSSH2_SESSION *session,
     }
 
     session->local.seqno++;
+    session->stats.packets_out++;
 
     ret = LIBSSH2_SEND(session, p->outbuf, total_length,
                         LIBSSH2_SOCKET_SEND_FLAGS(session));
@@ -901,24 +947,50 @@ int _libssh2_transport_send(LIBSSH2_SESSION *session,
         _libssh2_debug(session, LIBSSH2_TRACE_SOCKET, "Sent %d/%d bytes at %p",
                        ret, total_length, p->outbuf);
         debugdump(session, "libssh2_transport_write send()", p->outbuf, ret);
+
+        if(ret > 0) {
+            session->stats.send_calls++;
+            session->stats.bytes_out += ret;
+        }
     }
 
     if(ret != total_length) {
         if(ret >= 0 || ret == -EAGAIN) {
-            /* the whole packet could not be sent, save the rest */
+            /* the packet is encrypted and its sequence number used, so it
+               is committed: keep the rest for _libssh2_transport_flush()
+               and report the packet as sent */
             session->socket_block_directions |= LIBSSH2_SESSION_BLOCK_OUTBOUND;
-            p->odata = orgdata;
-            p->olen = orgdata_len;
             p->osent = ret <= 0 ? 0 : ret;
             p->ototal_num = total_length;
-            return LIBSSH2_ERROR_EAGAIN;
+            return LIBSSH2_ERROR_NONE;
         }
         return LIBSSH2_ERROR_SOCKET_SEND;
     }
 
-    /* the whole thing got sent away */
-    p->odata = NULL;
-    p->olen = 0;
-
     return LIBSSH2_ERROR_NONE;         /* all is good */
 }
+
+/*
+ * _libssh2_transport_sendv
+ *
+ * The second part of the payload is gathered from several buffers.
+ */
+int _libssh2_transport_sendv(LIBSSH2_SESSION *session,
+                             const unsigned char *data, size_t data_len,
+                             const LIBSSH2_IOVEC *iov, int iovcnt,
+                             size_t data2_len)
+{
+#ifdef LIBSSH2_STATS
+    uint64_t bytes_out = session->stats.bytes_out;
+    int rc;
+
+    LIBSSH2_STAGE(session, LIBSSH2_STAGE_SEND, 0, 0);
+    rc = transport_sendv(session, data, data_len, iov, iovcnt, data2_len);
+    LIBSSH2_STAGE(session, LIBSSH2_STAGE_SEND, 1,
+                  (size_t)(session->stats.bytes_out - bytes_out));
+
+    return rc;
+#else
+    return transport_sendv(session, data, data_len, iov, iovcnt, data2_len);
+#endif
+}
@@ -54,11 +54,12 @@
  * function.  The 'data' part is sent immediately before 'data2'. 'data2' can
  * be set to NULL (or data2_len to 0) to only use a single part.
  *
- * Returns LIBSSH2_ERROR_EAGAIN if it would block or if the whole packet was
- * not sent yet. If it does so, the caller should call this function again as
- * soon as it is likely that more data can be sent, and this function MUST
- * then be called with the same argument set (same data pointer and same
- * data_len) until ERROR_NONE or failure is returned.
+ * Returns LIBSSH2_ERROR_EAGAIN if the tail of an earlier packet could not
+ * be sent yet. Nothing of this packet has been sent then, and the caller may
+ * try again later with the same or with a different packet. Once this
+ * function has returned ERROR_NONE the packet is part of the stream, even
+ * if some of it is still waiting in the output buffer for the socket to
+ * become writable; _libssh2_transport_flush() sends that part.
  *
  * This function DOES NOT call _libssh2_error() on any errors.
  */
@@ -66,6 +67,30 @@ int _libssh2_transport_send(LIBSSH2_SESSION *session,
                             const unsigned char *data, size_t data_len,
                             const unsigned char *data2, size_t data2_len);
 
+/*
+ * _libssh2_transport_sendv
+ *
+ * Like _libssh2_transport_send() but the second part is made up of the
+ * first 'data2_len' bytes of the 'iovcnt' buffers in 'iov'. The same rules
+ * apply for LIBSSH2_ERROR_EAGAIN.
+ */
+int _libssh2_transport_sendv(LIBSSH2_SESSION *session,
+                             const unsigned char *data, size_t data_len,
+                             const LIBSSH2_IOVEC *iov, int iovcnt,
+                             size_t data2_len);
+
+/*
+ * _libssh2_transport_flush
+ *
+ * Send the rest of a packet that only went out partially. Returns
+ * LIBSSH2_ERROR_NONE once nothing is left, LIBSSH2_ERROR_EAGAIN (with
+ * LIBSSH2_SESSION_BLOCK_OUTBOUND set) if some of it still is, and
+ * LIBSSH2_ERROR_SOCKET_SEND on errors.
+ *
+ * This function DOES NOT call _libssh2_error() on any errors.
+ */
+int _libssh2_transport_flush(LIBSSH2_SESSION *session);
+
 /*
  * _libssh2_transport_read
  *
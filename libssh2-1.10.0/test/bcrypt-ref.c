@@ -0,0 +1,25 @@
+/* Reference bcrypt_pbkdf()
+ *
+ * ref/blowfish.c and ref/bcrypt_pbkdf.c are unmodified copies of the
+ * libssh2 1.10.0 sources that came before the block parallelisation.
+ * They are built here under ref_ names so that test-bcrypt and
+ * bench-bcrypt can compare the current code against them.
+ */
+
+#define bcrypt_pbkdf          ref_bcrypt_pbkdf
+#define Blowfish_encipher     ref_Blowfish_encipher
+#define Blowfish_decipher     ref_Blowfish_decipher
+#define Blowfish_initstate    ref_Blowfish_initstate
+#define Blowfish_expand0state ref_Blowfish_expand0state
+#define Blowfish_expandstate  ref_Blowfish_expandstate
+#define Blowfish_stream2word  ref_Blowfish_stream2word
+#define blf_key               ref_blf_key
+#define blf_enc               ref_blf_enc
+#define blf_dec               ref_blf_dec
+#define blf_ecb_encrypt       ref_blf_ecb_encrypt
+#define blf_ecb_decrypt       ref_blf_ecb_decrypt
+#define blf_cbc_encrypt       ref_blf_cbc_encrypt
+#define blf_cbc_decrypt       ref_blf_cbc_decrypt
+
+#include "ref/blowfish.c"
+#include "ref/bcrypt_pbkdf.c"
@@ -0,0 +1,20 @@
+/* Entry points for test-bcrypt and bench-bcrypt */
+#ifndef BCRYPT_TEST_H
+#define BCRYPT_TEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int bcrypt_pbkdf_func(const char *pass, size_t passlen,
+                              const uint8_t *salt, size_t saltlen,
+                              uint8_t *key, size_t keylen,
+                              unsigned int rounds);
+
+/* The current code as built into libssh2.a */
+bcrypt_pbkdf_func bcrypt_pbkdf;
+/* The same with LIBSSH2_BCRYPT_PBKDF_THREADS */
+bcrypt_pbkdf_func thr_bcrypt_pbkdf;
+/* The libssh2 1.10.0 code */
+bcrypt_pbkdf_func ref_bcrypt_pbkdf;
+
+#endif /* BCRYPT_TEST_H */
@@ -0,0 +1,7 @@
+/* bcrypt_pbkdf() as built with LIBSSH2_BCRYPT_PBKDF_THREADS, available as
+   thr_bcrypt_pbkdf() next to the default build in libssh2.a */
+
+#define LIBSSH2_BCRYPT_PBKDF_THREADS
+#define bcrypt_pbkdf thr_bcrypt_pbkdf
+
+#include "../src/bcrypt_pbkdf.c"
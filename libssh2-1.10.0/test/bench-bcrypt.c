@@ -0,0 +1,83 @@
+/* bcrypt_pbkdf() benchmark
+ *
+ * Times the libssh2 1.10.0 bcrypt_pbkdf() against the current one, with
+ * and without LIBSSH2_BCRYPT_PBKDF_THREADS, for the key and IV of the
+ * ciphers that OpenSSH key files are usually encrypted with.
+ *
+ * Usage: bench-bcrypt [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "bcrypt-test.h"
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double run(bcrypt_pbkdf_func *func, size_t keylen, unsigned int rounds,
+                  uint8_t *key)
+{
+    static const uint8_t salt[16] = "0123456789abcdef";
+    double t, best = 0;
+    int i;
+
+    /* Best of three */
+    for(i = 0; i < 3; i++) {
+        t = now();
+        if(func("passphrase", 10, salt, sizeof(salt), key, keylen, rounds)) {
+            fprintf(stderr, "bcrypt_pbkdf failed\n");
+            exit(1);
+        }
+        t = now() - t;
+        if(i == 0 || t < best)
+            best = t;
+    }
+
+    return best * 1000;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct {
+        const char *cipher;
+        size_t keylen;
+    } keys[] = {
+        { "aes128-ctr", 32 },
+        { "aes256-ctr", 48 },
+        { "aes256-gcm", 44 },
+        { "3des-cbc", 32 }
+    };
+    unsigned int rounds = argc > 1 ? (unsigned int)atoi(argv[1]) : 16;
+    uint8_t ref[64], cur[64], thr[64];
+    size_t i;
+
+    printf("%u rounds, best of 3\n\n", rounds);
+    printf("%-12s %6s %10s %10s %10s\n", "key for", "bytes", "1.10.0 ms",
+           "current ms", "threads ms");
+
+    for(i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        double t_ref = run(ref_bcrypt_pbkdf, keys[i].keylen, rounds, ref);
+        double t_cur = run(bcrypt_pbkdf, keys[i].keylen, rounds, cur);
+        double t_thr = run(thr_bcrypt_pbkdf, keys[i].keylen, rounds, thr);
+
+        if(memcmp(ref, cur, keys[i].keylen) ||
+           memcmp(ref, thr, keys[i].keylen)) {
+            fprintf(stderr, "keys differ for %s\n", keys[i].cipher);
+            return 1;
+        }
+
+        printf("%-12s %6lu %10.1f %10.1f %10.1f\n", keys[i].cipher,
+               (unsigned long)keys[i].keylen, t_ref, t_cur, t_thr);
+    }
+
+    return 0;
+}
@@ -0,0 +1,207 @@
+/* HMAC benchmark
+ *
+ * Times the MAC of one packet with the keying of libssh2 1.10.0, which
+ * allocates and keys a new HMAC context for every packet, against the
+ * current methods, which key their context once and reset it. Small
+ * packets like keystrokes and window adjusts show the per-packet cost,
+ * full packets the cost per byte.
+ *
+ * Usage: bench-hmac [ms]
+ */
+
+#include "libssh2_priv.h"
+#include "mac.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "sshd-stub.h"
+
+typedef void keyfunc(libssh2_hmac_ctx *ctx, const unsigned char *key,
+                     int key_len);
+
+static void key_sha512(libssh2_hmac_ctx *ctx, const unsigned char *key,
+                       int key_len)
+{
+    libssh2_hmac_sha512_init(ctx, key, key_len);
+}
+
+static void key_sha256(libssh2_hmac_ctx *ctx, const unsigned char *key,
+                       int key_len)
+{
+    libssh2_hmac_sha256_init(ctx, key, key_len);
+}
+
+static void key_sha1(libssh2_hmac_ctx *ctx, const unsigned char *key,
+                     int key_len)
+{
+    libssh2_hmac_sha1_init(ctx, key, key_len);
+}
+
+#if LIBSSH2_MD5
+static void key_md5(libssh2_hmac_ctx *ctx, const unsigned char *key,
+                    int key_len)
+{
+    libssh2_hmac_md5_init(ctx, key, key_len);
+}
+#endif
+
+static const struct {
+    const char *name;
+    keyfunc *key;
+} methods[] = {
+    { "hmac-sha2-512", key_sha512 },
+    { "hmac-sha2-256", key_sha256 },
+    { "hmac-sha1", key_sha1 },
+#if LIBSSH2_MD5
+    { "hmac-md5", key_md5 },
+#endif
+};
+
+static const size_t sizes[] = { 32, 32768 };
+
+static unsigned char key[64];
+static unsigned char packet[32768];
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* The hash method of libssh2 1.10.0 */
+static void old_hash(keyfunc *keyf, int key_len, unsigned char *buf,
+                     uint32_t seqno, const unsigned char *data,
+                     uint32_t len)
+{
+    libssh2_hmac_ctx ctx;
+    unsigned char seqno_buf[4];
+
+    _libssh2_htonu32(seqno_buf, seqno);
+
+    libssh2_hmac_ctx_init(ctx);
+    keyf(&ctx, key, key_len);
+    libssh2_hmac_update(ctx, seqno_buf, 4);
+    libssh2_hmac_update(ctx, data, len);
+    libssh2_hmac_final(ctx, buf);
+    libssh2_hmac_cleanup(&ctx);
+}
+
+/* Returns the best time per packet in ns out of three runs of about 'ms'
+   each, with the old keying if 'keyf' is set and the method otherwise */
+static double run(LIBSSH2_SESSION *session, const LIBSSH2_MAC_METHOD *mac,
+                  void **abstract, keyfunc *keyf, size_t len, double ms)
+{
+    unsigned char buf[64];
+    double t, best = 0;
+    uint32_t seqno = 0;
+    long count, n;
+    int i;
+
+    for(i = 0; i < 3; i++) {
+        count = 0;
+        t = now();
+        do {
+            for(n = 0; n < 256; n++, seqno++) {
+                if(keyf)
+                    old_hash(keyf, mac->key_len, buf, seqno, packet,
+                             (uint32_t)len);
+                else
+                    mac->hash(session, buf, seqno, packet, (uint32_t)len,
+                              NULL, 0, abstract);
+            }
+            count += n;
+        } while((now() - t) * 1000 < ms);
+        t = (now() - t) / count;
+        if(i == 0 || t < best)
+            best = t;
+    }
+
+    return best * 1e9;
+}
+
+static const LIBSSH2_MAC_METHOD *find_method(const char *name)
+{
+    const LIBSSH2_MAC_METHOD **m = _libssh2_mac_methods();
+
+    for(; *m; m++) {
+        if(!strcmp((*m)->name, name))
+            return *m;
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    double ms = argc > 1 ? atof(argv[1]) : 200;
+    LIBSSH2_SESSION *session;
+    size_t i, j;
+
+    for(i = 0; i < sizeof(key); i++)
+        key[i] = (unsigned char)(i * 7 + 1);
+    for(i = 0; i < sizeof(packet); i++)
+        packet[i] = (unsigned char)(i * 13 + 5);
+
+    if(libssh2_init(0)) {
+        fprintf(stderr, "libssh2_init failed\n");
+        return 1;
+    }
+
+    /* Only for the methods' allocations */
+    session = libssh2_session_init();
+    if(!session) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    printf("best of 3, ns per packet\n\n");
+    printf("%-14s %6s %10s %10s %8s\n", "MAC", "bytes", "1.10.0",
+           "reset", "speedup");
+
+    for(i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        const LIBSSH2_MAC_METHOD *mac = find_method(methods[i].name);
+        unsigned char *copy;
+        void *abstract = NULL;
+        int free_key = 0;
+
+        if(!mac) {
+            fprintf(stderr, "%s missing\n", methods[i].name);
+            return 1;
+        }
+
+        copy = malloc(mac->key_len);
+        if(!copy) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        memcpy(copy, key, mac->key_len);
+        if(mac->init(session, copy, &free_key, &abstract)) {
+            fprintf(stderr, "%s: init failed\n", mac->name);
+            return 1;
+        }
+        if(free_key)
+            free(copy);
+
+        for(j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+            double t_old = run(session, mac, &abstract, methods[i].key,
+                               sizes[j], ms);
+            double t_new = run(session, mac, &abstract, NULL, sizes[j], ms);
+
+            printf("%-14s %6lu %10.0f %10.0f %7.2fx\n", mac->name,
+                   (unsigned long)sizes[j], t_old, t_new, t_old / t_new);
+        }
+
+        mac->dtor(session, &abstract);
+    }
+
+    libssh2_session_free(session);
+    libssh2_exit();
+
+    return 0;
+}
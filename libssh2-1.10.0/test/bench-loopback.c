@@ -0,0 +1,303 @@
+/* Loopback transport benchmark
+ *
+ * Runs libssh2 against the in-process server stub over a socketpair and
+ * reports, for each cipher/MAC/compression combination, the handshake time,
+ * the channel throughput in both directions, the number of packets per
+ * socket read and write, and the allocations made per MB transferred.
+ *
+ * Both ends run on the same machine, so the throughput figures include the
+ * stub's share of the crypto work. They are meant for comparing changes to
+ * the transport against each other, not as absolute numbers.
+ *
+ * Usage: bench-loopback [-m MB] [-n handshakes] [cipher mac comp ...]
+ */
+
+#include <libssh2.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "sshd-stub.h"
+
+#define CHUNK 32768
+
+struct combo
+{
+    const char *crypt;
+    const char *mac;
+    const char *comp;
+};
+
+static const struct combo default_combos[] = {
+    { "aes128-ctr", "hmac-sha2-256", "none" },
+    { "aes128-ctr", "hmac-sha1", "none" },
+    { "aes128-ctr", "hmac-sha2-512", "none" },
+    { "aes256-ctr", "hmac-sha2-256", "none" },
+    { "aes128-cbc", "hmac-sha2-256", "none" },
+    { "aes256-cbc", "hmac-sha1", "none" },
+    { "3des-cbc", "hmac-sha1", "none" },
+    { "aes128-ctr", "hmac-sha2-256", "zlib@openssh.com" },
+    { "aes128-ctr", "hmac-sha2-256", "zlib" },
+    { NULL, NULL, NULL }
+};
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+struct conn
+{
+    LIBSSH2_SESSION *session;
+    struct sshd_stub *stub;
+    int fd;
+};
+
+static int conn_open(struct conn *c, const struct combo *combo)
+{
+    struct sshd_stub_config config;
+    int sv[2];
+
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+        perror("socketpair");
+        return -1;
+    }
+
+    memset(&config, 0, sizeof(config));
+    config.crypt = combo->crypt;
+    config.mac = combo->mac;
+    config.comp = combo->comp;
+    c->stub = sshd_stub_start(sv[1], &config);
+    c->fd = sv[0];
+    c->session = libssh2_session_init();
+    if(!c->stub || !c->session) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+
+    libssh2_session_method_pref(c->session, LIBSSH2_METHOD_KEX,
+                                "curve25519-sha256");
+    libssh2_session_method_pref(c->session, LIBSSH2_METHOD_HOSTKEY,
+                                "ssh-ed25519");
+    libssh2_session_method_pref(c->session, LIBSSH2_METHOD_CRYPT_CS,
+                                combo->crypt);
+    libssh2_session_method_pref(c->session, LIBSSH2_METHOD_CRYPT_SC,
+                                combo->crypt);
+    libssh2_session_method_pref(c->session, LIBSSH2_METHOD_MAC_CS,
+                                combo->mac);
+    libssh2_session_method_pref(c->session, LIBSSH2_METHOD_MAC_SC,
+                                combo->mac);
+    if(strcmp(combo->comp, "none")) {
+        libssh2_session_flag(c->session, LIBSSH2_FLAG_COMPRESS, 1);
+        libssh2_session_method_pref(c->session, LIBSSH2_METHOD_COMP_CS,
+                                    combo->comp);
+        libssh2_session_method_pref(c->session, LIBSSH2_METHOD_COMP_SC,
+                                    combo->comp);
+    }
+
+    if(libssh2_session_handshake(c->session, c->fd)) {
+        fprintf(stderr, "handshake failed\n");
+        return -1;
+    }
+
+    /* The stub accepts the "none" method that this tries first */
+    libssh2_userauth_list(c->session, "bench", 5);
+    if(!libssh2_userauth_authenticated(c->session)) {
+        fprintf(stderr, "authentication failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int conn_close(struct conn *c, struct sshd_stub_result *result)
+{
+    libssh2_session_disconnect(c->session, "done");
+    libssh2_session_free(c->session);
+    shutdown(c->fd, SHUT_RDWR);
+    close(c->fd);
+
+    return sshd_stub_join(c->stub, result);
+}
+
+static LIBSSH2_CHANNEL *exec(struct conn *c, const char *cmd)
+{
+    LIBSSH2_CHANNEL *channel = libssh2_channel_open_session(c->session);
+
+    if(!channel || libssh2_channel_exec(channel, cmd)) {
+        fprintf(stderr, "exec %s failed\n", cmd);
+        return NULL;
+    }
+
+    return channel;
+}
+
+static void channel_end(LIBSSH2_CHANNEL *channel)
+{
+    libssh2_channel_close(channel);
+    libssh2_channel_wait_closed(channel);
+    libssh2_channel_free(channel);
+}
+
+static int run(const struct combo *combo, size_t total, int handshakes)
+{
+    static unsigned char data[CHUNK + 65536];
+    struct libssh2_transport_stats before, after;
+    struct sshd_stub_result result;
+    LIBSSH2_CHANNEL *channel;
+    struct conn c;
+    double t, hs = 0, up, down;
+    double pkts_read, pkts_write, allocs;
+    uint64_t hash = STUB_HASH_INIT;
+    char cmd[64];
+    size_t done;
+    ssize_t n;
+    int i;
+
+    /* Handshake: connect, exchange keys, authenticate, open a channel */
+    for(i = 0; i < handshakes; i++) {
+        t = now();
+        if(conn_open(&c, combo))
+            return -1;
+        channel = libssh2_channel_open_session(c.session);
+        hs += now() - t;
+        if(!channel)
+            return -1;
+        channel_end(channel);
+        if(conn_close(&c, NULL))
+            return -1;
+    }
+
+    if(conn_open(&c, combo))
+        return -1;
+
+    stub_fill(data, sizeof(data), 0);
+
+    /* Upload into a sink */
+    channel = exec(&c, "sink");
+    if(!channel)
+        return -1;
+    libssh2_session_transport_stats(c.session, &before);
+    t = now();
+    for(done = 0; done < total; done += n) {
+        size_t len = total - done < CHUNK ? total - done : CHUNK;
+
+        n = libssh2_channel_write(channel,
+                                  (const char *)data + done % 65536, len);
+        if(n < 0) {
+            fprintf(stderr, "write failed: %d\n", (int)n);
+            return -1;
+        }
+        hash = stub_hash(hash, data + done % 65536, n);
+    }
+    libssh2_channel_send_eof(channel);
+    libssh2_channel_wait_eof(channel);
+    up = now() - t;
+    libssh2_session_transport_stats(c.session, &after);
+    channel_end(channel);
+
+    pkts_write = (double)(after.packets_out - before.packets_out) /
+        (after.send_calls - before.send_calls);
+    allocs = (double)(after.allocs - before.allocs);
+
+    /* Download from a source */
+    snprintf(cmd, sizeof(cmd), "source %lu", (unsigned long)total);
+    channel = exec(&c, cmd);
+    if(!channel)
+        return -1;
+    libssh2_session_transport_stats(c.session, &before);
+    t = now();
+    done = 0;
+    while((n = libssh2_channel_read(channel, (char *)data, CHUNK)) > 0)
+        done += n;
+    down = now() - t;
+    libssh2_session_transport_stats(c.session, &after);
+    channel_end(channel);
+
+    if(n < 0 || done != total) {
+        fprintf(stderr, "read %lu of %lu bytes (%d)\n", (unsigned long)done,
+                (unsigned long)total, (int)n);
+        return -1;
+    }
+
+    pkts_read = (double)(after.packets_in - before.packets_in) /
+        (after.recv_calls - before.recv_calls);
+    allocs += (double)(after.allocs - before.allocs);
+
+    if(conn_close(&c, &result))
+        return -1;
+    if(result.hash_in != hash || result.bytes_in != total) {
+        fprintf(stderr, "the stub received different data\n");
+        return -1;
+    }
+
+    printf("%-12s %-14s %-17s %7.2f %8.1f %8.1f %8.2f %8.2f %8.1f\n",
+           combo->crypt, combo->mac, combo->comp,
+           handshakes ? hs * 1000 / handshakes : 0.0,
+           total / up / 1048576, total / down / 1048576,
+           pkts_read, pkts_write, allocs / (2.0 * total / 1048576));
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    size_t total = 16 * 1048576;
+    int handshakes = 5;
+    int i, rc = 0;
+
+    for(i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if(!strcmp(argv[i], "-m") && i + 1 < argc)
+            total = (size_t)atoi(argv[++i]) * 1048576;
+        else if(!strcmp(argv[i], "-n") && i + 1 < argc)
+            handshakes = atoi(argv[++i]);
+        else {
+            fprintf(stderr, "Usage: %s [-m MB] [-n handshakes] "
+                    "[cipher mac comp ...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if(libssh2_init(0)) {
+        fprintf(stderr, "libssh2_init failed\n");
+        return 1;
+    }
+
+    printf("%lu MB each way, handshake averaged over %d connections\n\n",
+           (unsigned long)(total / 1048576), handshakes);
+    printf("%-12s %-14s %-17s %7s %8s %8s %8s %8s %8s\n", "cipher", "mac",
+           "comp", "hs ms", "up MB/s", "dn MB/s", "pkt/rd", "pkt/wr",
+           "alloc/MB");
+
+    if(i < argc) {
+        for(; i + 2 < argc; i += 3) {
+            struct combo combo;
+
+            combo.crypt = argv[i];
+            combo.mac = argv[i + 1];
+            combo.comp = argv[i + 2];
+            if(run(&combo, total, handshakes))
+                rc = 1;
+        }
+    }
+    else {
+        const struct combo *combo;
+
+        for(combo = default_combos; combo->crypt; combo++) {
+            if(run(combo, total, handshakes))
+                rc = 1;
+        }
+    }
+
+    libssh2_exit();
+
+    return rc;
+}
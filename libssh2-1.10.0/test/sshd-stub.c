@@ -0,0 +1,1313 @@
+/* Minimal in-process SSH server for the host tests and benchmarks
+ *
+ * See sshd-stub.h. This is test code: it trusts the client, does no key
+ * re-exchange and keeps everything in memory.
+ */
+
+#include "libssh2_priv.h"
+#include "mac.h"
+#include "comp.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include "sshd-stub.h"
+
+#define STUB_BANNER "SSH-2.0-sshd_stub"
+
+#define STUB_WINDOW (2 * 1024 * 1024)
+#define STUB_PACKET 32768
+#define STUB_MAX_PACKET (256 * 1024)
+#define STUB_MAX_CHANNELS 64
+/* Stop generating channel data while this much output is queued */
+#define STUB_OUTQ_HIGH (256 * 1024)
+
+const LIBSSH2_CRYPT_METHOD **libssh2_crypt_methods(void);
+
+enum {
+    MODE_NONE,
+    MODE_SINK,
+    MODE_ECHO,
+    MODE_SOURCE
+};
+
+struct stub_channel
+{
+    int used;
+    int opening;                /* forwarded-tcpip open not confirmed yet */
+    uint32_t remote_id;
+    uint32_t remote_window;
+    uint32_t remote_packet;
+    uint32_t local_window;
+    int mode;
+    int eof_in;
+    int eof_out;
+    int close_out;
+    /* echo backlog, or the amount still to send for MODE_SOURCE */
+    unsigned char *echo;
+    size_t echo_len;
+    size_t echo_size;
+    uint64_t source_left;
+    uint64_t source_pos;
+};
+
+struct stub_dir
+{
+    const LIBSSH2_CRYPT_METHOD *crypt;
+    void *crypt_abstract;
+    const LIBSSH2_MAC_METHOD *mac;
+    void *mac_abstract;
+    const LIBSSH2_COMP_METHOD *comp;
+    void *comp_abstract;
+    int comp_on;
+    uint32_t seqno;
+};
+
+struct buf
+{
+    unsigned char *data;
+    size_t len;
+    size_t size;
+};
+
+struct sshd_stub
+{
+    pthread_t thread;
+    int fd;
+    struct sshd_stub_config config;
+    struct sshd_stub_result result;
+    LIBSSH2_SESSION *session;   /* only for the method calls */
+
+    struct stub_dir in, out;
+    /* keys that take effect at the next NEWKEYS */
+    struct stub_dir next_in, next_out;
+    int delayed_comp;
+
+    /* raw input and the packet being decrypted */
+    unsigned char *rbuf;
+    size_t rlen;
+    size_t rpos;
+    unsigned char *pkt;
+    size_t pkt_first;           /* bytes of pkt already decrypted */
+    size_t pkt_need;            /* bytes the packet takes on the wire */
+
+    struct buf outq;
+    size_t outq_pos;
+
+    unsigned char session_id[SHA256_DIGEST_LENGTH];
+    struct stub_channel channels[STUB_MAX_CHANNELS];
+    /* the accepted tcpip-forward request and the channels still to open */
+    char *forward_addr;
+    uint32_t forward_port;
+    int forward_left;
+    int done;
+};
+
+/* Buffer helpers */
+
+static int buf_grow(struct buf *b, size_t len)
+{
+    unsigned char *data;
+    size_t size;
+
+    if(b->len + len <= b->size)
+        return 0;
+
+    size = b->size ? b->size : 256;
+    while(size < b->len + len)
+        size *= 2;
+
+    data = realloc(b->data, size);
+    if(!data)
+        return -1;
+
+    b->data = data;
+    b->size = size;
+
+    return 0;
+}
+
+static void buf_put(struct buf *b, const void *data, size_t len)
+{
+    if(buf_grow(b, len))
+        abort();
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+static void buf_u8(struct buf *b, unsigned char v)
+{
+    buf_put(b, &v, 1);
+}
+
+static void buf_u32(struct buf *b, uint32_t v)
+{
+    unsigned char tmp[4];
+
+    _libssh2_htonu32(tmp, v);
+    buf_put(b, tmp, 4);
+}
+
+static void buf_string(struct buf *b, const void *data, size_t len)
+{
+    buf_u32(b, (uint32_t)len);
+    buf_put(b, data, len);
+}
+
+static void buf_cstring(struct buf *b, const char *str)
+{
+    buf_string(b, str, strlen(str));
+}
+
+/* Store a big-endian unsigned number as an mpint */
+static void buf_mpint(struct buf *b, const unsigned char *num, size_t len)
+{
+    while(len && !*num) {
+        num++;
+        len--;
+    }
+
+    if(len && (*num & 0x80)) {
+        buf_u32(b, (uint32_t)len + 1);
+        buf_u8(b, 0);
+        buf_put(b, num, len);
+    }
+    else
+        buf_string(b, num, len);
+}
+
+struct reader
+{
+    const unsigned char *data;
+    size_t len;
+    size_t pos;
+    int error;
+};
+
+static unsigned char get_u8(struct reader *r)
+{
+    if(r->pos + 1 > r->len) {
+        r->error = 1;
+        return 0;
+    }
+    return r->data[r->pos++];
+}
+
+static uint32_t get_u32(struct reader *r)
+{
+    uint32_t v;
+
+    if(r->pos + 4 > r->len) {
+        r->error = 1;
+        return 0;
+    }
+    v = _libssh2_ntohu32(r->data + r->pos);
+    r->pos += 4;
+
+    return v;
+}
+
+static const unsigned char *get_string(struct reader *r, size_t *len)
+{
+    const unsigned char *s;
+    uint32_t l = get_u32(r);
+
+    if(r->error || l > r->len - r->pos) {
+        r->error = 1;
+        *len = 0;
+        return (const unsigned char *)"";
+    }
+    s = r->data + r->pos;
+    r->pos += l;
+    *len = l;
+
+    return s;
+}
+
+static int string_is(const unsigned char *s, size_t len, const char *str)
+{
+    return len == strlen(str) && !memcmp(s, str, len);
+}
+
+/* Test data */
+
+void stub_fill(unsigned char *buf, size_t len, uint64_t offset)
+{
+    static unsigned char text[65536];
+    static int ready;
+    size_t i;
+
+    if(!ready) {
+        static const char *const words[] = {
+            "connection", "from", "user", "session", "opened", "closed",
+            "for", "port", "accepted", "key", "INFO", "WARN", "debug",
+            "request", "/usr/lib", "ok", "0x7f3a", "retry", "in", "ms"
+        };
+        uint32_t seed = 12345;
+        size_t pos = 0;
+        unsigned long line = 0;
+
+        /* Lines of a made-up log, generated once with a fixed seed */
+        while(pos < sizeof(text)) {
+            char tmp[128];
+            int n = snprintf(tmp, sizeof(tmp), "%08lu ", line++);
+            int w;
+
+            for(w = 0; w < 8; w++) {
+                seed = seed * 1103515245 + 12345;
+                n += snprintf(tmp + n, sizeof(tmp) - n, "%s ",
+                              words[(seed >> 16) % 20]);
+            }
+            tmp[n - 1] = '\n';
+            for(w = 0; w < n && pos < sizeof(text); w++)
+                text[pos++] = (unsigned char)tmp[w];
+        }
+        ready = 1;
+    }
+
+    for(i = 0; i < len; i++)
+        buf[i] = text[(offset + i) % sizeof(text)];
+}
+
+uint64_t stub_hash(uint64_t hash, const unsigned char *buf, size_t len)
+{
+    size_t i;
+
+    for(i = 0; i < len; i++) {
+        hash ^= buf[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+/* Socket I/O */
+
+static int stub_fail(struct sshd_stub *stub, const char *msg)
+{
+    if(!stub->result.error)
+        fprintf(stderr, "sshd-stub: %s\n", msg);
+    stub->result.error = 1;
+    stub->done = 1;
+
+    return -1;
+}
+
+/* Send as much of the queued output as the socket takes */
+static int stub_flush(struct sshd_stub *stub)
+{
+    while(stub->outq_pos < stub->outq.len) {
+        ssize_t n = send(stub->fd, stub->outq.data + stub->outq_pos,
+                         stub->outq.len - stub->outq_pos, MSG_NOSIGNAL);
+        if(n < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if(errno == EINTR)
+                continue;
+            /* the client went away */
+            stub->done = 1;
+            return -1;
+        }
+        stub->outq_pos += n;
+    }
+
+    if(stub->outq_pos == stub->outq.len) {
+        stub->outq.len = 0;
+        stub->outq_pos = 0;
+    }
+
+    return 0;
+}
+
+/* Read what is available into rbuf. Returns 0 at EOF. */
+static int stub_fill_input(struct sshd_stub *stub)
+{
+    ssize_t n;
+
+    /* Everything before rpos has been parsed and what is left is less
+       than a packet, so there is always room after moving it down */
+    if(stub->rpos) {
+        memmove(stub->rbuf, stub->rbuf + stub->rpos, stub->rlen - stub->rpos);
+        stub->rlen -= stub->rpos;
+        stub->rpos = 0;
+    }
+
+    n = recv(stub->fd, stub->rbuf + stub->rlen,
+             2 * STUB_MAX_PACKET - stub->rlen, 0);
+    if(n < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return 1;
+        return 0;
+    }
+    stub->rlen += n;
+
+    return n != 0;
+}
+
+/* Wait until the socket can be read or, with queued output, written */
+static int stub_wait(struct sshd_stub *stub, int timeout)
+{
+    struct pollfd pfd;
+
+    pfd.fd = stub->fd;
+    pfd.events = POLLIN;
+    if(stub->outq.len)
+        pfd.events |= POLLOUT;
+    pfd.revents = 0;
+
+    if(poll(&pfd, 1, timeout) < 0 && errno != EINTR)
+        return stub_fail(stub, "poll failed");
+
+    if(pfd.revents & POLLOUT)
+        stub_flush(stub);
+    if(pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+        if(!stub_fill_input(stub))
+            stub->done = 1;
+    }
+
+    return 0;
+}
+
+/* Packets */
+
+static void stub_send(struct sshd_stub *stub, const unsigned char *payload,
+                      size_t len)
+{
+    struct stub_dir *d = &stub->out;
+    unsigned char *zbuf = NULL;
+    size_t blocksize = d->crypt ? (size_t)d->crypt->blocksize : 8;
+    size_t maclen = d->mac ? (size_t)d->mac->mac_len : 0;
+    size_t packet_len, padding, i, start;
+    unsigned char *p;
+
+    if(blocksize < 8)
+        blocksize = 8;
+
+    if(d->comp_on) {
+        size_t zlen = len + 1024;
+
+        zbuf = malloc(zlen);
+        if(!zbuf || d->comp->comp(stub->session, zbuf, &zlen, payload, len,
+                                  &d->comp_abstract))
+            abort();
+        payload = zbuf;
+        len = zlen;
+    }
+
+    padding = blocksize - ((len + 5) % blocksize);
+    if(padding < 4)
+        padding += blocksize;
+    packet_len = len + 1 + padding;
+
+    start = stub->outq.len;
+    if(buf_grow(&stub->outq, 4 + packet_len + maclen))
+        abort();
+    p = stub->outq.data + start;
+
+    _libssh2_htonu32(p, (uint32_t)packet_len);
+    p[4] = (unsigned char)padding;
+    memcpy(p + 5, payload, len);
+    RAND_bytes(p + 5 + len, (int)padding);
+
+    if(d->mac)
+        d->mac->hash(stub->session, p + 4 + packet_len, d->seqno, p,
+                     (uint32_t)(4 + packet_len), NULL, 0, &d->mac_abstract);
+    if(d->crypt) {
+        for(i = 0; i < 4 + packet_len; i += d->crypt->blocksize)
+            d->crypt->crypt(stub->session, p + i, d->crypt->blocksize,
+                            &d->crypt_abstract);
+    }
+
+    stub->outq.len += 4 + packet_len + maclen;
+    d->seqno++;
+
+    free(zbuf);
+}
+
+static void stub_send_buf(struct sshd_stub *stub, struct buf *b)
+{
+    stub_send(stub, b->data, b->len);
+    b->len = 0;
+}
+
+/*
+ * Take the next packet out of the input buffer. Returns 1 and the payload
+ * (which the caller frees) if one is complete, 0 if more input is needed
+ * and -1 on errors.
+ */
+static int stub_parse(struct sshd_stub *stub, unsigned char **payload,
+                      size_t *len)
+{
+    struct stub_dir *d = &stub->in;
+    size_t blocksize = d->crypt ? (size_t)d->crypt->blocksize : 8;
+    size_t maclen = d->mac ? (size_t)d->mac->mac_len : 0;
+    size_t avail = stub->rlen - stub->rpos;
+    unsigned char *raw = stub->rbuf + stub->rpos;
+    uint32_t packet_len;
+    size_t padding, i, paylen;
+    unsigned char mac[64];
+
+    if(blocksize < 8)
+        blocksize = 8;
+
+    if(!stub->pkt_first) {
+        if(avail < blocksize)
+            return 0;
+        memcpy(stub->pkt, raw, blocksize);
+        if(d->crypt)
+            d->crypt->crypt(stub->session, stub->pkt, blocksize,
+                            &d->crypt_abstract);
+        packet_len = _libssh2_ntohu32(stub->pkt);
+        if(packet_len < 5 || packet_len + 4 > STUB_MAX_PACKET ||
+           (packet_len + 4) % blocksize)
+            return stub_fail(stub, "bad packet length");
+        stub->pkt_first = blocksize;
+        stub->pkt_need = 4 + packet_len + maclen;
+    }
+
+    if(avail < stub->pkt_need)
+        return 0;
+
+    packet_len = _libssh2_ntohu32(stub->pkt);
+    memcpy(stub->pkt + blocksize, raw + blocksize, 4 + packet_len - blocksize);
+    if(d->crypt) {
+        for(i = blocksize; i < 4 + packet_len; i += blocksize)
+            d->crypt->crypt(stub->session, stub->pkt + i, blocksize,
+                            &d->crypt_abstract);
+    }
+
+    if(d->mac) {
+        d->mac->hash(stub->session, mac, d->seqno, stub->pkt, 4 + packet_len,
+                     NULL, 0, &d->mac_abstract);
+        if(memcmp(mac, raw + 4 + packet_len, maclen))
+            return stub_fail(stub, "MAC mismatch");
+    }
+
+    padding = stub->pkt[4];
+    if(padding + 1 > packet_len)
+        return stub_fail(stub, "bad padding");
+    paylen = packet_len - padding - 1;
+
+    if(d->comp_on) {
+        unsigned char *out = NULL;
+        size_t outlen = 0;
+
+        if(d->comp->decomp(stub->session, &out, &outlen, STUB_MAX_PACKET,
+                           stub->pkt + 5, paylen, &d->comp_abstract))
+            return stub_fail(stub, "decompression failed");
+        *payload = malloc(outlen + 1);
+        memcpy(*payload, out, outlen);
+        LIBSSH2_FREE(stub->session, out);
+        *len = outlen;
+    }
+    else {
+        *payload = malloc(paylen + 1);
+        memcpy(*payload, stub->pkt + 5, paylen);
+        *len = paylen;
+    }
+
+    stub->rpos += stub->pkt_need;
+    stub->pkt_first = 0;
+    d->seqno++;
+
+    return 1;
+}
+
+/* Wait for the next packet during the handshake */
+static int stub_read(struct sshd_stub *stub, unsigned char **payload,
+                     size_t *len)
+{
+    int rc;
+
+    for(;;) {
+        rc = stub_parse(stub, payload, len);
+        if(rc)
+            return rc;
+        if(stub->done)
+            return -1;
+        stub_wait(stub, -1);
+    }
+}
+
+/* Key exchange */
+
+/* All method structures start with the name */
+struct common_method
+{
+    const char *name;
+};
+
+static const void *find_method(const void **list, const char *name)
+{
+    const struct common_method **m = (const struct common_method **)list;
+
+    for(; *m; m++) {
+        if(!strcmp((*m)->name, name))
+            return *m;
+    }
+
+    return NULL;
+}
+
+/* K_n = HASH(K || H || letter || session_id), extended as in RFC 4253 */
+static unsigned char *derive(const unsigned char *k, size_t klen,
+                             const unsigned char *h, const unsigned char *sid,
+                             char letter, size_t need)
+{
+    unsigned char *out = malloc(need + SHA256_DIGEST_LENGTH);
+    size_t len = 0;
+
+    while(len < need) {
+        EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+
+        EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
+        EVP_DigestUpdate(ctx, k, klen);
+        EVP_DigestUpdate(ctx, h, SHA256_DIGEST_LENGTH);
+        if(len)
+            EVP_DigestUpdate(ctx, out, len);
+        else {
+            EVP_DigestUpdate(ctx, &letter, 1);
+            EVP_DigestUpdate(ctx, sid, SHA256_DIGEST_LENGTH);
+        }
+        EVP_DigestFinal_ex(ctx, out + len, NULL);
+        EVP_MD_CTX_free(ctx);
+        len += SHA256_DIGEST_LENGTH;
+    }
+
+    return out;
+}
+
+static int setup_dir(struct sshd_stub *stub, struct stub_dir *d, int encrypt,
+                     const unsigned char *k, size_t klen,
+                     const unsigned char *h, char iv_letter, char key_letter,
+                     char mac_letter)
+{
+    const LIBSSH2_CRYPT_METHOD *crypt =
+        find_method((const void **)libssh2_crypt_methods(),
+                    stub->config.crypt);
+    const LIBSSH2_MAC_METHOD *mac =
+        find_method((const void **)_libssh2_mac_methods(), stub->config.mac);
+    const LIBSSH2_COMP_METHOD *comp =
+        find_method((const void **)_libssh2_comp_methods(stub->session),
+                    stub->config.comp);
+    unsigned char *iv, *secret, *mackey;
+    int free_iv = 0, free_secret = 0, free_key = 0;
+
+    if(!crypt || !mac || !comp)
+        return stub_fail(stub, "unknown method");
+
+    memset(d, 0, sizeof(*d));
+
+    iv = derive(k, klen, h, stub->session_id, iv_letter, crypt->iv_len);
+    secret = derive(k, klen, h, stub->session_id, key_letter,
+                    crypt->secret_len);
+    if(crypt->init(stub->session, crypt, iv, &free_iv, secret, &free_secret,
+                   encrypt, &d->crypt_abstract))
+        return stub_fail(stub, "cipher init failed");
+    free(iv);
+    free(secret);
+    d->crypt = crypt;
+
+    mackey = derive(k, klen, h, stub->session_id, mac_letter, mac->key_len);
+    mac->init(stub->session, mackey, &free_key, &d->mac_abstract);
+    if(!free_key)
+        return stub_fail(stub, "MAC kept its key");
+    free(mackey);
+    d->mac = mac;
+
+    if(comp->compress) {
+        if(comp->init(stub->session, encrypt, &d->comp_abstract))
+            return stub_fail(stub, "compression init failed");
+        d->comp = comp;
+        d->comp_on = comp->use_in_auth;
+        stub->delayed_comp = !comp->use_in_auth;
+    }
+
+    return 0;
+}
+
+static void free_dir(struct sshd_stub *stub, struct stub_dir *d, int encrypt)
+{
+    if(d->crypt && d->crypt->dtor)
+        d->crypt->dtor(stub->session, &d->crypt_abstract);
+    if(d->mac && d->mac->dtor)
+        d->mac->dtor(stub->session, &d->mac_abstract);
+    if(d->comp && d->comp->dtor)
+        d->comp->dtor(stub->session, encrypt, &d->comp_abstract);
+    memset(d, 0, sizeof(*d));
+}
+
+static void kexinit(struct sshd_stub *stub, struct buf *b)
+{
+    unsigned char cookie[16];
+
+    RAND_bytes(cookie, sizeof(cookie));
+
+    buf_u8(b, SSH_MSG_KEXINIT);
+    buf_put(b, cookie, sizeof(cookie));
+    buf_cstring(b, "curve25519-sha256,curve25519-sha256@libssh.org");
+    buf_cstring(b, "ssh-ed25519");
+    buf_cstring(b, stub->config.crypt);
+    buf_cstring(b, stub->config.crypt);
+    buf_cstring(b, stub->config.mac);
+    buf_cstring(b, stub->config.mac);
+    buf_cstring(b, stub->config.comp);
+    buf_cstring(b, stub->config.comp);
+    buf_cstring(b, "");
+    buf_cstring(b, "");
+    buf_u8(b, 0);
+    buf_u32(b, 0);
+}
+
+static int stub_handshake(struct sshd_stub *stub)
+{
+    char vc[256];
+    size_t vclen = 0;
+    struct buf is = { NULL, 0, 0 }, b = { NULL, 0, 0 }, hb = { NULL, 0, 0 };
+    struct buf ks = { NULL, 0, 0 }, sig = { NULL, 0, 0 };
+    unsigned char *ic = NULL, *msg = NULL;
+    size_t iclen = 0, len;
+    const unsigned char *qc;
+    size_t qclen;
+    EVP_PKEY_CTX *pctx;
+    EVP_PKEY *hostkey = NULL, *eph = NULL, *peer = NULL;
+    unsigned char hostpub[32], qs[32], secret[32], h[SHA256_DIGEST_LENGTH];
+    unsigned char sigraw[64];
+    size_t publen = 32, secretlen = 32, siglen = 64;
+    EVP_MD_CTX *mctx;
+    struct reader r;
+    int rc = -1;
+
+    /* Version exchange; the client's line is read a byte at a time so
+       that nothing after it is consumed */
+    buf_put(&stub->outq, STUB_BANNER "\r\n", sizeof(STUB_BANNER) + 1);
+    stub_flush(stub);
+    for(;;) {
+        char c;
+        ssize_t n = recv(stub->fd, &c, 1, 0);
+
+        if(n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            struct pollfd pfd = { stub->fd, POLLIN, 0 };
+            poll(&pfd, 1, -1);
+            continue;
+        }
+        if(n <= 0)
+            return stub_fail(stub, "no client banner");
+        if(c == '\n')
+            break;
+        if(c != '\r' && vclen < sizeof(vc) - 1)
+            vc[vclen++] = c;
+    }
+
+    kexinit(stub, &is);
+    stub_send(stub, is.data, is.len);
+
+    if(stub_read(stub, &ic, &iclen) < 0 || ic[0] != SSH_MSG_KEXINIT) {
+        stub_fail(stub, "expected KEXINIT");
+        goto out;
+    }
+
+    if(stub_read(stub, &msg, &len) < 0 ||
+       msg[0] != SSH2_MSG_KEX_ECDH_INIT) {
+        stub_fail(stub, "expected KEX_ECDH_INIT");
+        goto out;
+    }
+    r.data = msg;
+    r.len = len;
+    r.pos = 1;
+    r.error = 0;
+    qc = get_string(&r, &qclen);
+    if(r.error || qclen != 32) {
+        stub_fail(stub, "bad client key");
+        goto out;
+    }
+
+    /* A new host key for every connection; the client does not check it
+       against anything */
+    pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_ED25519, NULL);
+    EVP_PKEY_keygen_init(pctx);
+    EVP_PKEY_keygen(pctx, &hostkey);
+    EVP_PKEY_CTX_free(pctx);
+    EVP_PKEY_get_raw_public_key(hostkey, hostpub, &publen);
+
+    pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, NULL);
+    EVP_PKEY_keygen_init(pctx);
+    EVP_PKEY_keygen(pctx, &eph);
+    EVP_PKEY_CTX_free(pctx);
+    publen = 32;
+    EVP_PKEY_get_raw_public_key(eph, qs, &publen);
+
+    peer = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, NULL, qc, 32);
+    pctx = EVP_PKEY_CTX_new(eph, NULL);
+    if(!peer || EVP_PKEY_derive_init(pctx) <= 0 ||
+       EVP_PKEY_derive_set_peer(pctx, peer) <= 0 ||
+       EVP_PKEY_derive(pctx, secret, &secretlen) <= 0) {
+        EVP_PKEY_CTX_free(pctx);
+        stub_fail(stub, "key agreement failed");
+        goto out;
+    }
+    EVP_PKEY_CTX_free(pctx);
+
+    buf_cstring(&ks, "ssh-ed25519");
+    buf_string(&ks, hostpub, 32);
+
+    /* The shared secret is used as an mpint from here on */
+    buf_mpint(&b, secret, 32);
+
+    buf_string(&hb, vc, vclen);
+    buf_cstring(&hb, STUB_BANNER);
+    buf_string(&hb, ic, iclen);
+    buf_string(&hb, is.data, is.len);
+    buf_string(&hb, ks.data, ks.len);
+    buf_string(&hb, qc, 32);
+    buf_string(&hb, qs, 32);
+    buf_put(&hb, b.data, b.len);
+    EVP_Digest(hb.data, hb.len, h, NULL, EVP_sha256(), NULL);
+    memcpy(stub->session_id, h, sizeof(h));
+
+    mctx = EVP_MD_CTX_new();
+    EVP_DigestSignInit(mctx, NULL, NULL, NULL, hostkey);
+    EVP_DigestSign(mctx, sigraw, &siglen, h, sizeof(h));
+    EVP_MD_CTX_free(mctx);
+    buf_cstring(&sig, "ssh-ed25519");
+    buf_string(&sig, sigraw, siglen);
+
+    hb.len = 0;
+    buf_u8(&hb, SSH2_MSG_KEX_ECDH_REPLY);
+    buf_string(&hb, ks.data, ks.len);
+    buf_string(&hb, qs, 32);
+    buf_string(&hb, sig.data, sig.len);
+    stub_send_buf(stub, &hb);
+
+    /* Server to client uses IV "B", key "D" and MAC key "F" */
+    if(setup_dir(stub, &stub->next_out, 1, b.data, b.len, h, 'B', 'D', 'F') ||
+       setup_dir(stub, &stub->next_in, 0, b.data, b.len, h, 'A', 'C', 'E'))
+        goto out;
+
+    buf_u8(&hb, SSH_MSG_NEWKEYS);
+    stub_send_buf(stub, &hb);
+    stub->next_out.seqno = stub->out.seqno;
+    stub->out = stub->next_out;
+
+    free(msg);
+    if(stub_read(stub, &msg, &len) < 0 || msg[0] != SSH_MSG_NEWKEYS) {
+        stub_fail(stub, "expected NEWKEYS");
+        goto out;
+    }
+    stub->next_in.seqno = stub->in.seqno;
+    stub->in = stub->next_in;
+
+    free(msg);
+    if(stub_read(stub, &msg, &len) < 0 ||
+       msg[0] != SSH_MSG_SERVICE_REQUEST) {
+        stub_fail(stub, "expected SERVICE_REQUEST");
+        goto out;
+    }
+    buf_u8(&hb, SSH_MSG_SERVICE_ACCEPT);
+    buf_cstring(&hb, "ssh-userauth");
+    stub_send_buf(stub, &hb);
+
+    /* Whatever the client tries first is accepted */
+    free(msg);
+    if(stub_read(stub, &msg, &len) < 0 ||
+       msg[0] != SSH_MSG_USERAUTH_REQUEST) {
+        stub_fail(stub, "expected USERAUTH_REQUEST");
+        goto out;
+    }
+    buf_u8(&hb, SSH_MSG_USERAUTH_SUCCESS);
+    stub_send_buf(stub, &hb);
+
+    if(stub->delayed_comp) {
+        /* zlib@openssh.com starts right after the authentication */
+        stub->out.comp_on = 1;
+        stub->in.comp_on = 1;
+    }
+
+    rc = 0;
+
+out:
+    free(msg);
+    free(ic);
+    free(is.data);
+    free(b.data);
+    free(hb.data);
+    free(ks.data);
+    free(sig.data);
+    EVP_PKEY_free(hostkey);
+    EVP_PKEY_free(eph);
+    EVP_PKEY_free(peer);
+
+    return rc;
+}
+
+/* Connection protocol */
+
+static struct stub_channel *get_channel(struct sshd_stub *stub, uint32_t id)
+{
+    if(id >= STUB_MAX_CHANNELS || !stub->channels[id].used)
+        return NULL;
+
+    return &stub->channels[id];
+}
+
+static void set_mode(struct stub_channel *ch, const unsigned char *cmd,
+                     size_t len)
+{
+    if(string_is(cmd, len, "sink"))
+        ch->mode = MODE_SINK;
+    else if(string_is(cmd, len, "echo") || string_is(cmd, len, "shell"))
+        ch->mode = MODE_ECHO;
+    else if(len > 7 && !memcmp(cmd, "source ", 7)) {
+        char num[32];
+
+        len -= 7;
+        if(len >= sizeof(num))
+            len = sizeof(num) - 1;
+        memcpy(num, cmd + 7, len);
+        num[len] = '\0';
+        ch->mode = MODE_SOURCE;
+        ch->source_left = strtoull(num, NULL, 10);
+    }
+}
+
+static void channel_send_close(struct sshd_stub *stub,
+                               struct stub_channel *ch)
+{
+    struct buf b = { NULL, 0, 0 };
+
+    if(!ch->eof_out) {
+        buf_u8(&b, SSH_MSG_CHANNEL_EOF);
+        buf_u32(&b, ch->remote_id);
+        stub_send_buf(stub, &b);
+        ch->eof_out = 1;
+    }
+    if(!ch->close_out) {
+        buf_u8(&b, SSH_MSG_CHANNEL_CLOSE);
+        buf_u32(&b, ch->remote_id);
+        stub_send_buf(stub, &b);
+        ch->close_out = 1;
+    }
+    free(b.data);
+}
+
+static void handle_packet(struct sshd_stub *stub, const unsigned char *msg,
+                          size_t len)
+{
+    struct reader r = { msg, len, 1, 0 };
+    struct buf b = { NULL, 0, 0 };
+    struct stub_channel *ch;
+    const unsigned char *s;
+    size_t slen;
+    uint32_t id;
+    int want_reply;
+
+    switch(msg[0]) {
+    case SSH_MSG_DISCONNECT:
+        stub->done = 1;
+        break;
+
+    case SSH_MSG_IGNORE:
+    case SSH_MSG_DEBUG:
+    case SSH_MSG_UNIMPLEMENTED:
+        break;
+
+    case SSH_MSG_GLOBAL_REQUEST:
+        s = get_string(&r, &slen);
+        want_reply = get_u8(&r);
+        if(string_is(s, slen, "tcpip-forward") && stub->config.forward &&
+           !stub->forward_addr) {
+            s = get_string(&r, &slen);
+            id = get_u32(&r);
+            stub->forward_addr = calloc(1, slen + 1);
+            if(r.error || !stub->forward_addr) {
+                stub_fail(stub, "bad tcpip-forward");
+                break;
+            }
+            memcpy(stub->forward_addr, s, slen);
+            stub->forward_port = id ? id : 10022;
+            stub->forward_left = stub->config.forward_channels;
+            if(want_reply) {
+                buf_u8(&b, SSH_MSG_REQUEST_SUCCESS);
+                if(!id)
+                    buf_u32(&b, stub->forward_port);
+                stub_send_buf(stub, &b);
+            }
+        }
+        else if(string_is(s, slen, "cancel-tcpip-forward") &&
+                stub->forward_addr) {
+            stub->forward_left = 0;
+            if(want_reply) {
+                buf_u8(&b, SSH_MSG_REQUEST_SUCCESS);
+                stub_send_buf(stub, &b);
+            }
+        }
+        else if(want_reply) {
+            /* Keepalives and anything else: like OpenSSH, answer with a
+               failure */
+            buf_u8(&b, SSH_MSG_REQUEST_FAILURE);
+            stub_send_buf(stub, &b);
+        }
+        break;
+
+    case SSH_MSG_CHANNEL_OPEN:
+        s = get_string(&r, &slen);
+        for(id = 0; id < STUB_MAX_CHANNELS; id++) {
+            if(!stub->channels[id].used)
+                break;
+        }
+        if(id == STUB_MAX_CHANNELS) {
+            stub_fail(stub, "too many channels");
+            break;
+        }
+        ch = &stub->channels[id];
+        memset(ch, 0, sizeof(*ch));
+        ch->used = 1;
+        ch->remote_id = get_u32(&r);
+        ch->remote_window = get_u32(&r);
+        ch->remote_packet = get_u32(&r);
+        ch->local_window = STUB_WINDOW;
+        if(string_is(s, slen, "direct-tcpip")) {
+            /* the target host picks what to do */
+            s = get_string(&r, &slen);
+            set_mode(ch, s, slen);
+        }
+        if(r.error) {
+            stub_fail(stub, "bad CHANNEL_OPEN");
+            break;
+        }
+        stub->result.channels++;
+        buf_u8(&b, SSH_MSG_CHANNEL_OPEN_CONFIRMATION);
+        buf_u32(&b, ch->remote_id);
+        buf_u32(&b, id);
+        buf_u32(&b, STUB_WINDOW);
+        buf_u32(&b, STUB_PACKET);
+        stub_send_buf(stub, &b);
+        break;
+
+    case SSH_MSG_CHANNEL_OPEN_CONFIRMATION:
+        ch = get_channel(stub, get_u32(&r));
+        if(!ch || !ch->opening) {
+            stub_fail(stub, "bad CHANNEL_OPEN_CONFIRMATION");
+            break;
+        }
+        ch->remote_id = get_u32(&r);
+        ch->remote_window = get_u32(&r);
+        ch->remote_packet = get_u32(&r);
+        ch->opening = 0;
+        break;
+
+    case SSH_MSG_CHANNEL_OPEN_FAILURE:
+        ch = get_channel(stub, get_u32(&r));
+        if(!ch || !ch->opening) {
+            stub_fail(stub, "bad CHANNEL_OPEN_FAILURE");
+            break;
+        }
+        stub->result.open_failures++;
+        memset(ch, 0, sizeof(*ch));
+        break;
+
+    case SSH_MSG_CHANNEL_REQUEST:
+        ch = get_channel(stub, get_u32(&r));
+        s = get_string(&r, &slen);
+        want_reply = get_u8(&r);
+        if(!ch || r.error) {
+            stub_fail(stub, "bad CHANNEL_REQUEST");
+            break;
+        }
+        if(string_is(s, slen, "exec")) {
+            s = get_string(&r, &slen);
+            set_mode(ch, s, slen);
+        }
+        else if(string_is(s, slen, "shell"))
+            ch->mode = MODE_ECHO;
+        if(want_reply) {
+            buf_u8(&b, SSH_MSG_CHANNEL_SUCCESS);
+            buf_u32(&b, ch->remote_id);
+            stub_send_buf(stub, &b);
+        }
+        break;
+
+    case SSH_MSG_CHANNEL_DATA:
+    case SSH_MSG_CHANNEL_EXTENDED_DATA:
+        ch = get_channel(stub, get_u32(&r));
+        if(msg[0] == SSH_MSG_CHANNEL_EXTENDED_DATA)
+            get_u32(&r);
+        s = get_string(&r, &slen);
+        if(!ch || r.error || slen > ch->local_window) {
+            stub_fail(stub, "bad CHANNEL_DATA");
+            break;
+        }
+        ch->local_window -= (uint32_t)slen;
+        stub->result.bytes_in += slen;
+        if(ch->mode == MODE_ECHO) {
+            struct buf e = { ch->echo, ch->echo_len, ch->echo_size };
+
+            buf_put(&e, s, slen);
+            ch->echo = e.data;
+            ch->echo_len = e.len;
+            ch->echo_size = e.size;
+        }
+        else
+            stub->result.hash_in = stub_hash(stub->result.hash_in, s, slen);
+
+        if(ch->local_window < STUB_WINDOW / 2) {
+            buf_u8(&b, SSH_MSG_CHANNEL_WINDOW_ADJUST);
+            buf_u32(&b, ch->remote_id);
+            buf_u32(&b, STUB_WINDOW - ch->local_window);
+            stub_send_buf(stub, &b);
+            ch->local_window = STUB_WINDOW;
+        }
+        break;
+
+    case SSH_MSG_CHANNEL_WINDOW_ADJUST:
+        ch = get_channel(stub, get_u32(&r));
+        id = get_u32(&r);
+        if(ch && !r.error)
+            ch->remote_window += id;
+        break;
+
+    case SSH_MSG_CHANNEL_EOF:
+        ch = get_channel(stub, get_u32(&r));
+        if(ch)
+            ch->eof_in = 1;
+        break;
+
+    case SSH_MSG_CHANNEL_CLOSE:
+        ch = get_channel(stub, get_u32(&r));
+        if(ch) {
+            if(!ch->close_out) {
+                buf_u8(&b, SSH_MSG_CHANNEL_CLOSE);
+                buf_u32(&b, ch->remote_id);
+                stub_send_buf(stub, &b);
+            }
+            free(ch->echo);
+            memset(ch, 0, sizeof(*ch));
+        }
+        break;
+
+    default:
+        buf_u8(&b, SSH_MSG_UNIMPLEMENTED);
+        buf_u32(&b, stub->in.seqno - 1);
+        stub_send_buf(stub, &b);
+        break;
+    }
+
+    free(b.data);
+}
+
+/* Open a forwarded-tcpip channel for the accepted tcpip-forward request */
+static void forward_open(struct sshd_stub *stub)
+{
+    struct buf b = { NULL, 0, 0 };
+    struct stub_channel *ch;
+    uint32_t id;
+
+    for(id = 0; id < STUB_MAX_CHANNELS; id++) {
+        if(!stub->channels[id].used)
+            break;
+    }
+    if(id == STUB_MAX_CHANNELS)
+        return;
+
+    ch = &stub->channels[id];
+    memset(ch, 0, sizeof(*ch));
+    ch->used = 1;
+    ch->opening = 1;
+    ch->local_window = STUB_WINDOW;
+    set_mode(ch, (const unsigned char *)stub->config.forward,
+             strlen(stub->config.forward));
+    stub->forward_left--;
+    stub->result.channels++;
+
+    buf_u8(&b, SSH_MSG_CHANNEL_OPEN);
+    buf_cstring(&b, "forwarded-tcpip");
+    buf_u32(&b, id);
+    buf_u32(&b, STUB_WINDOW);
+    buf_u32(&b, STUB_PACKET);
+    buf_cstring(&b, stub->forward_addr);
+    buf_u32(&b, stub->forward_port);
+    buf_cstring(&b, "127.0.0.1");
+    buf_u32(&b, 40000 + id);
+    stub_send_buf(stub, &b);
+    free(b.data);
+}
+
+/* Queue channel data as far as the client's window allows. Returns the
+   number of bytes queued. */
+static size_t channel_output(struct sshd_stub *stub, struct stub_channel *ch)
+{
+    unsigned char data[STUB_PACKET];
+    struct buf b = { NULL, 0, 0 };
+    size_t queued = 0;
+
+    if(ch->opening)
+        return 0;
+
+    while(stub->outq.len < STUB_OUTQ_HIGH && ch->remote_window &&
+          !ch->close_out) {
+        size_t n = ch->remote_packet < STUB_PACKET ?
+            ch->remote_packet : STUB_PACKET;
+        const unsigned char *p;
+
+        if(n > ch->remote_window)
+            n = ch->remote_window;
+
+        if(ch->mode == MODE_ECHO && ch->echo_len) {
+            if(n > ch->echo_len)
+                n = ch->echo_len;
+            p = ch->echo;
+        }
+        else if(ch->mode == MODE_SOURCE && ch->source_left) {
+            if(n > ch->source_left)
+                n = (size_t)ch->source_left;
+            stub_fill(data, n, ch->source_pos);
+            p = data;
+        }
+        else
+            break;
+
+        buf_u8(&b, SSH_MSG_CHANNEL_DATA);
+        buf_u32(&b, ch->remote_id);
+        buf_string(&b, p, n);
+        stub_send_buf(stub, &b);
+
+        ch->remote_window -= (uint32_t)n;
+        stub->result.bytes_out += n;
+        queued += n;
+        if(ch->mode == MODE_ECHO) {
+            memmove(ch->echo, ch->echo + n, ch->echo_len - n);
+            ch->echo_len -= n;
+        }
+        else {
+            ch->source_left -= n;
+            ch->source_pos += n;
+        }
+    }
+    free(b.data);
+
+    /* Sinks and echoes end when the client's data does, sources when all
+       of it has been sent */
+    if((ch->mode == MODE_SOURCE && !ch->source_left) ||
+       (ch->mode != MODE_SOURCE && ch->eof_in && !ch->echo_len))
+        channel_send_close(stub, ch);
+
+    return queued;
+}
+
+static void *stub_thread(void *arg)
+{
+    struct sshd_stub *stub = arg;
+    unsigned char *msg;
+    size_t len, queued;
+    int i, rc;
+
+    if(stub_handshake(stub))
+        goto out;
+
+    while(!stub->done) {
+        while((rc = stub_parse(stub, &msg, &len)) > 0) {
+            handle_packet(stub, msg, len);
+            free(msg);
+        }
+        if(rc < 0)
+            break;
+
+        while(stub->forward_left > 0)
+            forward_open(stub);
+
+        /* Keep queueing while the socket takes everything, as nothing
+           would wake the wait below for the rest */
+        do {
+            queued = 0;
+            for(i = 0; i < STUB_MAX_CHANNELS; i++) {
+                if(stub->channels[i].used)
+                    queued += channel_output(stub, &stub->channels[i]);
+            }
+            stub_flush(stub);
+        } while(queued && !stub->outq.len);
+
+        stub_wait(stub, -1);
+    }
+
+out:
+    free_dir(stub, &stub->in, 0);
+    free_dir(stub, &stub->out, 1);
+    for(i = 0; i < STUB_MAX_CHANNELS; i++)
+        free(stub->channels[i].echo);
+    free(stub->forward_addr);
+    close(stub->fd);
+
+    return NULL;
+}
+
+struct sshd_stub *sshd_stub_start(int fd,
+                                  const struct sshd_stub_config *config)
+{
+    struct sshd_stub *stub = calloc(1, sizeof(*stub));
+
+    if(!stub)
+        return NULL;
+
+    stub->fd = fd;
+    stub->config.crypt = config && config->crypt ?
+        config->crypt : "aes128-ctr";
+    stub->config.mac = config && config->mac ?
+        config->mac : "hmac-sha2-256";
+    stub->config.comp = config && config->comp ? config->comp : "none";
+    if(config && config->forward) {
+        stub->config.forward = config->forward;
+        stub->config.forward_channels = config->forward_channels;
+    }
+    stub->result.hash_in = STUB_HASH_INIT;
+    stub->session = libssh2_session_init();
+    stub->rbuf = malloc(2 * STUB_MAX_PACKET);
+    stub->pkt = malloc(STUB_MAX_PACKET);
+    if(!stub->session || !stub->rbuf || !stub->pkt)
+        goto fail;
+
+    /* Otherwise _libssh2_comp_methods() offers only "none" */
+    libssh2_session_flag(stub->session, LIBSSH2_FLAG_COMPRESS, 1);
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    if(pthread_create(&stub->thread, NULL, stub_thread, stub))
+        goto fail;
+
+    return stub;
+
+fail:
+    if(stub->session)
+        libssh2_session_free(stub->session);
+    free(stub->rbuf);
+    free(stub->pkt);
+    free(stub);
+
+    return NULL;
+}
+
+int sshd_stub_join(struct sshd_stub *stub, struct sshd_stub_result *result)
+{
+    int error;
+
+    pthread_join(stub->thread, NULL);
+
+    if(result)
+        *result = stub->result;
+    error = stub->result.error;
+
+    libssh2_session_free(stub->session);
+    free(stub->outq.data);
+    free(stub->rbuf);
+    free(stub->pkt);
+    free(stub);
+
+    return error ? -1 : 0;
+}
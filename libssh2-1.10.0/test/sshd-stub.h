@@ -0,0 +1,68 @@
+/* Minimal in-process SSH server for the host tests and benchmarks
+ *
+ * The stub speaks just enough of the server side of SSH-2 to let an
+ * unmodified libssh2 client connect over a socket: curve25519-sha256 key
+ * exchange with an ed25519 host key, "none" authentication that always
+ * succeeds, and session and direct-tcpip channels. Packets are encrypted,
+ * authenticated and compressed with libssh2's own crypt, MAC and
+ * compression methods, so the client side sees the same code on both ends.
+ *
+ * The stub can also accept one tcpip-forward request, after which it opens
+ * a set number of forwarded-tcpip channels to the client.
+ *
+ * What a channel does with its data is chosen by the exec command of a
+ * session channel, by the host name of a direct-tcpip channel or by the
+ * configuration for forwarded-tcpip channels:
+ *
+ *   "sink"      read and count everything, send EOF when the client does
+ *   "echo"      send everything back (also used for "shell")
+ *   "source N"  send N bytes of stub_fill() data, then EOF and close
+ */
+#ifndef SSHD_STUB_H
+#define SSHD_STUB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct sshd_stub_config
+{
+    const char *crypt;      /* cipher, NULL for aes128-ctr */
+    const char *mac;        /* MAC, NULL for hmac-sha2-256 */
+    const char *comp;       /* compression, NULL for "none" */
+    const char *forward;    /* what the forwarded-tcpip channels do, NULL
+                               to refuse tcpip-forward requests */
+    int forward_channels;   /* how many of them to open */
+};
+
+struct sshd_stub_result
+{
+    int error;              /* non-zero if the stub hit a protocol error */
+    int channels;           /* channels opened by either side */
+    int open_failures;      /* forwarded-tcpip channels the client refused */
+    uint64_t bytes_in;      /* channel data received */
+    uint64_t bytes_out;     /* channel data sent */
+    uint64_t hash_in;       /* FNV-1a hash of the sink channel data */
+};
+
+struct sshd_stub;
+
+/*
+ * Serve one connection on 'fd' in a new thread. The stub owns the socket
+ * and closes it when the client disconnects.
+ */
+struct sshd_stub *sshd_stub_start(int fd,
+                                  const struct sshd_stub_config *config);
+
+/* Wait for the connection to end, fill in 'result' and free the stub */
+int sshd_stub_join(struct sshd_stub *stub, struct sshd_stub_result *result);
+
+/* Fill 'buf' with the test data stream starting at 'offset'. The data is
+   made up of log-like text lines, so it compresses about like real terminal
+   output does. */
+void stub_fill(unsigned char *buf, size_t len, uint64_t offset);
+
+/* Continue the FNV-1a hash 'hash' (start with STUB_HASH_INIT) over 'buf' */
+#define STUB_HASH_INIT 0xcbf29ce484222325ULL
+uint64_t stub_hash(uint64_t hash, const unsigned char *buf, size_t len);
+
+#endif /* SSHD_STUB_H */
@@ -0,0 +1,93 @@
+/* bcrypt_pbkdf() output test
+ *
+ * Checks that the current bcrypt_pbkdf(), both the default build and the
+ * one with LIBSSH2_BCRYPT_PBKDF_THREADS, derives exactly the same keys as
+ * the libssh2 1.10.0 code for a range of password, salt and key lengths
+ * and round counts, and that both reject the same bad arguments.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bcrypt-test.h"
+
+static const size_t keylens[] = {
+    1, 2, 16, 31, 32, 33, 48, 63, 64, 65, 100, 255, 256, 257
+};
+
+static int check(const char *pass, size_t passlen, const uint8_t *salt,
+                 size_t saltlen, size_t keylen, unsigned int rounds)
+{
+    static uint8_t ref[1025], cur[1025], thr[1025];
+    int rc_ref, rc_cur, rc_thr;
+
+    memset(ref, 0xaa, sizeof(ref));
+    memset(cur, 0xaa, sizeof(cur));
+    memset(thr, 0xaa, sizeof(thr));
+
+    rc_ref = ref_bcrypt_pbkdf(pass, passlen, salt, saltlen, ref, keylen,
+                              rounds);
+    rc_cur = bcrypt_pbkdf(pass, passlen, salt, saltlen, cur, keylen, rounds);
+    rc_thr = thr_bcrypt_pbkdf(pass, passlen, salt, saltlen, thr, keylen,
+                              rounds);
+
+    if(rc_ref != rc_cur || rc_ref != rc_thr ||
+       memcmp(ref, cur, sizeof(ref)) || memcmp(ref, thr, sizeof(ref))) {
+        fprintf(stderr, "FAIL: passlen %lu saltlen %lu keylen %lu rounds %u"
+                " (rc %d/%d/%d)\n", (unsigned long)passlen,
+                (unsigned long)saltlen, (unsigned long)keylen, rounds,
+                rc_ref, rc_cur, rc_thr);
+        return 1;
+    }
+
+    return 0;
+}
+
+int main(void)
+{
+    static const char pass[] = "correct horse battery staple, "
+        "with some more words to make it longer than a hash block";
+    uint8_t salt[64];
+    unsigned int rounds;
+    size_t i, n = 0;
+    int failed = 0;
+
+    for(i = 0; i < sizeof(salt); i++)
+        salt[i] = (uint8_t)(i * 37 + 11);
+
+    for(rounds = 1; rounds <= 4; rounds++) {
+        for(i = 0; i < sizeof(keylens) / sizeof(keylens[0]); i++) {
+            /* keep the run time down for the long keys */
+            if(keylens[i] > 65 && rounds != 1 && rounds != 4)
+                continue;
+            failed |= check(pass, 8, salt, 16, keylens[i], rounds);
+            n++;
+        }
+    }
+
+    /* The largest keys take long, so only with one round */
+    failed |= check(pass, 8, salt, 16, 1000, 1);
+    failed |= check(pass, 8, salt, 16, 1024, 1);
+    n += 2;
+
+    /* Password and salt lengths, with the key of an aes256-ctr key file */
+    for(i = 1; i < sizeof(pass) - 1; i += 7) {
+        failed |= check(pass, i, salt, 1 + i % sizeof(salt), 48, 2);
+        n++;
+    }
+
+    /* Arguments that must be rejected */
+    failed |= check(pass, 8, salt, 16, 32, 0);
+    failed |= check(pass, 0, salt, 16, 32, 1);
+    failed |= check(pass, 8, salt, 0, 32, 1);
+    failed |= check(pass, 8, salt, 16, 0, 1);
+    failed |= check(pass, 8, salt, 16, 1025, 1);
+    n += 5;
+
+    if(failed)
+        return 1;
+
+    printf("OK (%lu cases)\n", (unsigned long)n);
+
+    return 0;
+}
@@ -0,0 +1,44 @@
+/* Helpers shared by the host tests
+ *
+ * The random numbers that make every run the same and failure reports.
+ */
+#ifndef TEST_COMMON_H
+#define TEST_COMMON_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* LCG on a seed of the caller's, for runs that pick their own seed */
+static inline uint32_t rnd_r(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+
+    return *seed >> 8;
+}
+
+static inline uint32_t rnd(void)
+{
+    static uint32_t seed = 1;
+
+    return rnd_r(&seed);
+}
+
+/* Prints "FAIL: " and the message and returns 1, for "return fail(...)" */
+static inline int fail(const char *format, ...)
+    __attribute__((format(printf, 1, 2)));
+
+static inline int fail(const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    fprintf(stderr, "FAIL: ");
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+
+    return 1;
+}
+
+#endif /* TEST_COMMON_H */
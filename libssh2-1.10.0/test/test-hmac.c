@@ -0,0 +1,218 @@
+/* HMAC test
+ *
+ * The HMAC methods key their context once in init and reset it for every
+ * packet. This keys each method once and then hashes a series of packets
+ * with it, the way a session does between two key exchanges, checking
+ * every MAC against a one-shot HMAC from OpenSSL that is keyed afresh.
+ *
+ * The known answers are the "Jefe" vectors of RFC 2202, RFC 2286 and
+ * RFC 4231. Their message is split into the sequence number ("what") and
+ * the packet, and the short key is zero padded to the method's key
+ * length, which leaves the HMAC unchanged. They are hashed again between
+ * the other packets, so a reset that leaves state behind shows up even
+ * where it happens to agree with OpenSSL.
+ *
+ * Usage: test-hmac
+ */
+
+#include "libssh2_priv.h"
+#include "mac.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include "sshd-stub.h"
+#include "test-common.h"
+
+#define PACKETS 200
+
+struct vector
+{
+    const char *name;
+    const EVP_MD *(*md)(void);
+    const char *answer;     /* HMAC of "what do ya want for nothing?" */
+};
+
+static const struct vector vectors[] = {
+    { "hmac-sha2-512", EVP_sha512,
+      "164b7a7bfcf819e2e395fbe73b56e0a387bd64222e831fd610270cd7ea250554"
+      "9758bf75c05a994a6d034f65f8f0e6fdcaeab1a34d4a6b4b636e070a38bce737" },
+    { "hmac-sha2-256", EVP_sha256,
+      "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843" },
+    { "hmac-sha1", EVP_sha1,
+      "effcdf6ae5eb2fa2d27416d5f184df9c259a7c79" },
+    { "hmac-sha1-96", EVP_sha1,
+      "effcdf6ae5eb2fa2d27416d5" },
+#if LIBSSH2_MD5
+    { "hmac-md5", EVP_md5,
+      "750c783e6ab0b503eaa86e310a5db738" },
+    { "hmac-md5-96", EVP_md5,
+      "750c783e6ab0b503eaa86e31" },
+#endif
+#if LIBSSH2_HMAC_RIPEMD
+    { "hmac-ripemd160", EVP_ripemd160,
+      "dda6c0213a485a9e24f4742064a7f033b43c4069" },
+    { "hmac-ripemd160@openssh.com", EVP_ripemd160,
+      "dda6c0213a485a9e24f4742064a7f033b43c4069" },
+#endif
+    { NULL, NULL, NULL }
+};
+
+static const LIBSSH2_MAC_METHOD *find_method(const char *name)
+{
+    const LIBSSH2_MAC_METHOD **methods = _libssh2_mac_methods();
+
+    for(; *methods; methods++) {
+        if(!strcmp((*methods)->name, name))
+            return *methods;
+    }
+
+    return NULL;
+}
+
+/* Key 'mac' with 'key', zero padded to the method's key length */
+static int mac_init(LIBSSH2_SESSION *session, const LIBSSH2_MAC_METHOD *mac,
+                    const unsigned char *key, size_t key_len, void **abstract)
+{
+    unsigned char *copy = calloc(1, mac->key_len);
+    int free_key = 0;
+    int rc;
+
+    if(!copy)
+        return -1;
+    memcpy(copy, key, key_len);
+
+    rc = mac->init(session, copy, &free_key, abstract);
+
+    /* Without a reset the method keeps the key and frees it in dtor */
+    if(rc || free_key)
+        free(copy);
+
+    return rc;
+}
+
+static int check_answer(LIBSSH2_SESSION *session,
+                        const LIBSSH2_MAC_METHOD *mac, void **abstract,
+                        const struct vector *v, int packet)
+{
+    static const char message[] = " do ya want for nothing?";
+    unsigned char buf[EVP_MAX_MD_SIZE];
+    char hex[2 * EVP_MAX_MD_SIZE + 1];
+    int i;
+
+    /* "what" as the sequence number */
+    mac->hash(session, buf, 0x77686174, (const unsigned char *)message,
+              sizeof(message) - 1, NULL, 0, abstract);
+
+    for(i = 0; i < mac->mac_len; i++)
+        sprintf(hex + 2 * i, "%02x", buf[i]);
+
+    return strcmp(hex, v->answer) ?
+           fail("%s: wrong answer (packet %d)", v->name, packet) : 0;
+}
+
+static int run(LIBSSH2_SESSION *session, const struct vector *v)
+{
+    static unsigned char packet[35000 + 4];
+    unsigned char key[64];
+    unsigned char buf[EVP_MAX_MD_SIZE], ref[EVP_MAX_MD_SIZE];
+    unsigned int ref_len;
+    const LIBSSH2_MAC_METHOD *mac = find_method(v->name);
+    void *abstract = NULL;
+    uint32_t seqno = rnd();
+    int i;
+
+    if(!mac)
+        return fail("%s: method missing", v->name);
+    if(mac->key_len > (int)sizeof(key) || mac->mac_len > EVP_MAX_MD_SIZE)
+        return fail("%s: unexpected sizes", v->name);
+
+    if(mac_init(session, mac, (const unsigned char *)"Jefe", 4, &abstract))
+        return fail("%s: init", v->name);
+    if(check_answer(session, mac, &abstract, v, 0))
+        return 1;
+    mac->dtor(session, &abstract);
+
+    for(i = 0; i < mac->key_len; i++)
+        key[i] = (unsigned char)rnd();
+    if(mac_init(session, mac, key, mac->key_len, &abstract))
+        return fail("%s: init", v->name);
+
+    for(i = 1; i <= PACKETS; i++) {
+        size_t len = rnd() % 4 ? 16 + rnd() % 1024 : rnd() % 35000;
+        size_t split = len ? rnd() % len : 0;
+        size_t j;
+
+        for(j = 0; j < len; j++)
+            packet[4 + j] = (unsigned char)rnd();
+
+        /* The transport passes decrypted packets in two parts */
+        if(rnd() % 2)
+            mac->hash(session, buf, seqno, packet + 4, split,
+                      packet + 4 + split, (uint32_t)(len - split), &abstract);
+        else
+            mac->hash(session, buf, seqno, packet + 4, len, NULL, 0,
+                      &abstract);
+
+        _libssh2_htonu32(packet, seqno);
+        HMAC(v->md(), key, mac->key_len, packet, len + 4, ref, &ref_len);
+
+        if(memcmp(buf, ref, mac->mac_len))
+            return fail("%s: differs from a freshly keyed HMAC (packet %d)",
+                        v->name, i);
+
+        seqno++;
+
+        /* The known answer needs the "Jefe" key, so use a second context
+           that has been reset as often as the first */
+        if(i % 50 == 0) {
+            void *jefe = NULL;
+            int k;
+
+            if(mac_init(session, mac, (const unsigned char *)"Jefe", 4,
+                        &jefe))
+                return fail("%s: init (packet %d)", v->name, i);
+            for(k = 0; k < i; k++)
+                mac->hash(session, buf, seqno + k, packet + 4, len % 512,
+                          NULL, 0, &jefe);
+            if(check_answer(session, mac, &jefe, v, i))
+                return 1;
+            mac->dtor(session, &jefe);
+        }
+    }
+
+    mac->dtor(session, &abstract);
+
+    printf("%-27s %d packets OK\n", v->name, PACKETS);
+
+    return 0;
+}
+
+int main(void)
+{
+    LIBSSH2_SESSION *session;
+    const struct vector *v;
+
+    if(libssh2_init(0))
+        return fail("libssh2_init failed");
+
+    /* Only for the methods' allocations */
+    session = libssh2_session_init();
+    if(!session)
+        return fail("session: out of memory");
+
+    for(v = vectors; v->name; v++) {
+        if(run(session, v))
+            return 1;
+    }
+
+    libssh2_session_free(session);
+    libssh2_exit();
+
+    printf("OK\n");
+
+    return 0;
+}
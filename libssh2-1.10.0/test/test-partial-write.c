@@ -0,0 +1,268 @@
+/* Partial write test
+ *
+ * Runs a non-blocking session through a send callback that cuts writes
+ * short and fails them with EAGAIN at random, so that packets often go out
+ * only partially. While the tail of such a packet is pending, other senders
+ * get their turn the way they do in SSHTerm's main loop: keepalives, the
+ * window adjusts sent by channel reads, pty size changes and writes on a
+ * second channel. Everything echoed back must match what was written and
+ * the stub must see an intact stream.
+ *
+ * Usage: test-partial-write [MB]
+ */
+
+#include <libssh2.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "sshd-stub.h"
+#include "test-common.h"
+
+struct injector
+{
+    uint32_t seed;
+    unsigned long calls;
+    unsigned long shortened;
+    unsigned long refused;
+};
+
+static struct injector inj;
+
+static LIBSSH2_SEND_FUNC(short_send)
+{
+    ssize_t rc;
+
+    (void)abstract;
+
+    inj.calls++;
+    if(rnd_r(&inj.seed) % 4 == 0) {
+        inj.refused++;
+        return -EAGAIN;
+    }
+    if(length > 1 && rnd_r(&inj.seed) % 2) {
+        length = 1 + rnd_r(&inj.seed) % (length - 1);
+        inj.shortened++;
+    }
+
+    rc = send(socket, buffer, length, flags | MSG_NOSIGNAL);
+    if(rc < 0)
+        return -errno;
+
+    return rc;
+}
+
+static int run(uint32_t seed, size_t total)
+{
+    static unsigned char data[65536 + 32768];
+    static unsigned char expect[32768];
+    static unsigned char buf[32768];
+    struct sshd_stub_result result;
+    struct sshd_stub *stub;
+    LIBSSH2_SESSION *session;
+    LIBSSH2_CHANNEL *echo, *sink;
+    uint64_t sink_hash = STUB_HASH_INIT;
+    size_t echo_sent = 0, echo_recv = 0, sink_sent = 0;
+    int echo_eof = 0, sink_eof = 0, sink_closed = 0;
+    int resize_pending = 0, columns = 80, rows = 24;
+    unsigned long loops = 0, resizes = 0, pending = 0;
+    ssize_t n;
+    int sv[2];
+    int rc;
+
+    inj.seed = seed;
+    inj.calls = inj.shortened = inj.refused = 0;
+
+    stub_fill(data, sizeof(data), 0);
+
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+        return fail("socketpair: %ld", (long)errno);
+
+    stub = sshd_stub_start(sv[1], NULL);
+    session = libssh2_session_init();
+    if(!stub || !session)
+        return fail("init");
+
+    libssh2_session_callback_set(session, LIBSSH2_CALLBACK_SEND,
+                                 (void *)short_send);
+    libssh2_session_method_pref(session, LIBSSH2_METHOD_KEX,
+                                "curve25519-sha256");
+    libssh2_session_method_pref(session, LIBSSH2_METHOD_HOSTKEY,
+                                "ssh-ed25519");
+
+    if((rc = libssh2_session_handshake(session, sv[0])))
+        return fail("handshake: %ld", (long)rc);
+    libssh2_userauth_list(session, "test", 4);
+    if(!libssh2_userauth_authenticated(session))
+        return fail("authentication");
+
+    echo = libssh2_channel_open_session(session);
+    if(!echo || (rc = libssh2_channel_exec(echo, "echo")))
+        return fail("open echo channel: %ld", (long)rc);
+    sink = libssh2_channel_open_session(session);
+    if(!sink || (rc = libssh2_channel_exec(sink, "sink")))
+        return fail("open sink channel: %ld", (long)rc);
+
+    /* A keepalive every millisecond ends up between most packets */
+    libssh2_keepalive_config_ms(session, 1, 1);
+    libssh2_session_set_blocking(session, 0);
+
+    while(echo_recv < total || !sink_closed) {
+        struct pollfd pfd;
+        int dir;
+
+        loops++;
+
+        rc = libssh2_keepalive_send_ms(session, NULL);
+        if(rc < 0)
+            return fail("keepalive: %ld", (long)rc);
+
+        if(loops % 64 == 0 && !resize_pending) {
+            columns = 80 + (int)(rnd_r(&inj.seed) % 80);
+            rows = 24 + (int)(rnd_r(&inj.seed) % 40);
+            resize_pending = 1;
+        }
+        if(resize_pending) {
+            rc = libssh2_channel_request_pty_size(echo, columns, rows);
+            if(rc == 0) {
+                resize_pending = 0;
+                resizes++;
+            }
+            else if(rc != LIBSSH2_ERROR_EAGAIN)
+                return fail("pty size: %ld", (long)rc);
+        }
+
+        if(echo_sent < total) {
+            size_t len = 1 + rnd_r(&inj.seed) % 32768;
+
+            if(len > total - echo_sent)
+                len = total - echo_sent;
+            n = libssh2_channel_write(echo, (const char *)data +
+                                      echo_sent % 65536, len);
+            if(n > 0)
+                echo_sent += n;
+            else if(n < 0 && n != LIBSSH2_ERROR_EAGAIN)
+                return fail("echo write: %ld", (long)n);
+        }
+        else if(!echo_eof) {
+            rc = libssh2_channel_send_eof(echo);
+            if(rc == 0)
+                echo_eof = 1;
+            else if(rc != LIBSSH2_ERROR_EAGAIN)
+                return fail("echo eof: %ld", (long)rc);
+        }
+
+        if(sink_sent < total / 2) {
+            size_t len = 1 + rnd_r(&inj.seed) % 4096;
+
+            if(len > total / 2 - sink_sent)
+                len = total / 2 - sink_sent;
+            n = libssh2_channel_write(sink, (const char *)data +
+                                      sink_sent % 65536, len);
+            if(n > 0) {
+                sink_hash = stub_hash(sink_hash, data + sink_sent % 65536, n);
+                sink_sent += n;
+            }
+            else if(n < 0 && n != LIBSSH2_ERROR_EAGAIN)
+                return fail("sink write: %ld", (long)n);
+        }
+        else if(!sink_eof) {
+            rc = libssh2_channel_send_eof(sink);
+            if(rc == 0)
+                sink_eof = 1;
+            else if(rc != LIBSSH2_ERROR_EAGAIN)
+                return fail("sink eof: %ld", (long)rc);
+        }
+        else if(!sink_closed) {
+            rc = libssh2_channel_close(sink);
+            if(rc == 0)
+                sink_closed = 1;
+            else if(rc != LIBSSH2_ERROR_EAGAIN)
+                return fail("sink close: %ld", (long)rc);
+        }
+
+        /* Reading sends window adjusts once enough has come in */
+        for(;;) {
+            n = libssh2_channel_read(echo, (char *)buf, sizeof(buf));
+            if(n <= 0)
+                break;
+            if(echo_recv + n > total)
+                return fail("echoed too much: %ld", (long)(echo_recv + n));
+            stub_fill(expect, n, echo_recv);
+            if(memcmp(buf, expect, n))
+                return fail("echoed data differs at %ld", (long)echo_recv);
+            echo_recv += n;
+        }
+        if(n < 0 && n != LIBSSH2_ERROR_EAGAIN)
+            return fail("echo read: %ld", (long)n);
+        if(n == 0 && echo_recv < total && libssh2_channel_eof(echo))
+            return fail("early EOF at %ld", (long)echo_recv);
+
+        dir = libssh2_session_block_directions(session);
+        if(dir & LIBSSH2_SESSION_BLOCK_OUTBOUND)
+            pending++;
+
+        pfd.fd = sv[0];
+        pfd.events = POLLIN;
+        if(dir & LIBSSH2_SESSION_BLOCK_OUTBOUND)
+            pfd.events |= POLLOUT;
+        pfd.revents = 0;
+        poll(&pfd, 1, 1);
+
+        if(pfd.revents & POLLOUT) {
+            rc = libssh2_session_flush(session);
+            if(rc < 0 && rc != LIBSSH2_ERROR_EAGAIN)
+                return fail("flush: %ld", (long)rc);
+        }
+    }
+
+    libssh2_session_set_blocking(session, 1);
+    libssh2_channel_free(sink);
+    libssh2_channel_close(echo);
+    libssh2_channel_free(echo);
+    libssh2_session_disconnect(session, "done");
+    libssh2_session_free(session);
+    close(sv[0]);
+
+    sshd_stub_join(stub, &result);
+    if(result.error)
+        return fail("stub error: %ld", (long)result.error);
+    if(result.hash_in != sink_hash)
+        return fail("sink data differs");
+    if(result.bytes_in != echo_sent + sink_sent)
+        return fail("stub received: %ld", (long)result.bytes_in);
+
+    printf("seed %u: %lu sends, %lu short, %lu refused, %lu loops with a "
+           "pending tail, %lu resizes\n", seed, inj.calls, inj.shortened,
+           inj.refused, pending, resizes);
+
+    if(!inj.shortened || !pending)
+        return fail("no partial packets were produced");
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    size_t total = (argc > 1 ? (size_t)atoi(argv[1]) : 4) * 1048576;
+    uint32_t seed;
+
+    if(libssh2_init(0))
+        return fail("libssh2_init");
+
+    for(seed = 1; seed <= 4; seed++) {
+        if(run(seed, total))
+            return 1;
+    }
+
+    libssh2_exit();
+
+    printf("OK\n");
+
+    return 0;
+}
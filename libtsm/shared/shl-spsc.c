@@ -0,0 +1,190 @@
+/*
+ * SHL - Single-producer/single-consumer ring buffer
+ *
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * Single-producer/single-consumer ring buffer
+ *
+ * @head and @tail count the bytes pushed and pulled since the buffer was
+ * created and are only masked when indexing @buf, so head - tail is always
+ * the number of used bytes, even after they wrap around. Each index has a
+ * single writer: the side that owns it reads it without ordering and
+ * publishes it with a release store, the other side reads it with an
+ * acquire load. This makes the data written before a commit visible to the
+ * consumer before the new head, and keeps the producer from overwriting
+ * data before the consumer is done with it.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "shl-macro.h"
+#include "shl-spsc.h"
+
+#define SPSC_MASK(_r, _v) ((_v) & ((_r)->size - 1))
+
+#define SPSC_LOAD(_p) __atomic_load_n((_p), __ATOMIC_RELAXED)
+#define SPSC_ACQUIRE(_p) __atomic_load_n((_p), __ATOMIC_ACQUIRE)
+#define SPSC_RELEASE(_p, _v) __atomic_store_n((_p), (_v), __ATOMIC_RELEASE)
+
+/*
+ * Allocate the buffer. @size is rounded up to a power of 2. This must be
+ * done before the buffer is shared. -ENOMEM is returned on OOM, 0 on
+ * success.
+ */
+int shl_spsc_init(struct shl_spsc *r, size_t size)
+{
+	memset(r, 0, sizeof(*r));
+
+	if (size < 4096)
+		size = 4096;
+
+	size = SHL_ALIGN_POWER2(size);
+	if (size == 0)
+		return -ENOMEM;
+
+	r->buf = malloc(size);
+	if (!r->buf)
+		return -ENOMEM;
+
+	r->size = size;
+
+	return 0;
+}
+
+void shl_spsc_clear(struct shl_spsc *r)
+{
+	free(r->buf);
+	memset(r, 0, sizeof(*r));
+}
+
+size_t shl_spsc_get_size(struct shl_spsc *r)
+{
+	return SPSC_ACQUIRE(&r->head) - SPSC_LOAD(&r->tail);
+}
+
+size_t shl_spsc_get_free(struct shl_spsc *r)
+{
+	return r->size - (SPSC_LOAD(&r->head) - SPSC_ACQUIRE(&r->tail));
+}
+
+/*
+ * Fill @vec (an array of 2 iovec objects) with the free space of the
+ * buffer. The producer may write into it and then make what was written
+ * visible with shl_spsc_commit(). 0, 1 or 2 is returned according to the
+ * number of iovec objects that were filled (0 meaning buffer is full).
+ */
+size_t shl_spsc_reserve(struct shl_spsc *r, struct iovec *vec)
+{
+	size_t head, pos, len, l;
+
+	head = SPSC_LOAD(&r->head);
+	len = r->size - (head - SPSC_ACQUIRE(&r->tail));
+	if (len == 0)
+		return 0;
+
+	pos = SPSC_MASK(r, head);
+	l = r->size - pos;
+	if (len <= l) {
+		vec[0].iov_base = &r->buf[pos];
+		vec[0].iov_len = len;
+		return 1;
+	} else {
+		vec[0].iov_base = &r->buf[pos];
+		vec[0].iov_len = l;
+		vec[1].iov_base = r->buf;
+		vec[1].iov_len = len - l;
+		return 2;
+	}
+}
+
+/*
+ * Hand @size bytes of the reserved space over to the consumer. Committing
+ * more than shl_spsc_reserve() returned is not allowed.
+ */
+void shl_spsc_commit(struct shl_spsc *r, size_t size)
+{
+	SPSC_RELEASE(&r->head, SPSC_LOAD(&r->head) + size);
+}
+
+/*
+ * Push as much of the @size bytes from @u8 as fits into the buffer. Returns
+ * the number of bytes pushed, which is less than @size if the buffer is
+ * full.
+ */
+size_t shl_spsc_push(struct shl_spsc *r, const void *u8, size_t size)
+{
+	struct iovec vec[2];
+	size_t n, l;
+
+	n = shl_spsc_reserve(r, vec);
+	if (n == 0)
+		return 0;
+
+	l = vec[0].iov_len;
+	if (n == 2)
+		l += vec[1].iov_len;
+	if (size > l)
+		size = l;
+
+	l = vec[0].iov_len;
+	if (size <= l) {
+		memcpy(vec[0].iov_base, u8, size);
+	} else {
+		memcpy(vec[0].iov_base, u8, l);
+		memcpy(vec[1].iov_base, (const uint8_t*)u8 + l, size - l);
+	}
+
+	shl_spsc_commit(r, size);
+
+	return size;
+}
+
+/*
+ * Get data pointers for the data available to the consumer. @vec must be an
+ * array of 2 iovec objects. The data stays valid until it is released with
+ * shl_spsc_pull(). 0, 1 or 2 is returned according to the number of iovec
+ * objects that were filled (0 meaning buffer is empty).
+ */
+size_t shl_spsc_peek(struct shl_spsc *r, struct iovec *vec)
+{
+	size_t tail, pos, len, l;
+
+	tail = SPSC_LOAD(&r->tail);
+	len = SPSC_ACQUIRE(&r->head) - tail;
+	if (len == 0)
+		return 0;
+
+	pos = SPSC_MASK(r, tail);
+	l = r->size - pos;
+	if (len <= l) {
+		vec[0].iov_base = &r->buf[pos];
+		vec[0].iov_len = len;
+		return 1;
+	} else {
+		vec[0].iov_base = &r->buf[pos];
+		vec[0].iov_len = l;
+		vec[1].iov_base = r->buf;
+		vec[1].iov_len = len - l;
+		return 2;
+	}
+}
+
+/*
+ * Release @size bytes from the start of the buffer to the producer. Pulling
+ * more bytes than available is safe.
+ */
+void shl_spsc_pull(struct shl_spsc *r, size_t size)
+{
+	size_t tail, used;
+
+	tail = SPSC_LOAD(&r->tail);
+	used = SPSC_ACQUIRE(&r->head) - tail;
+	if (size > used)
+		size = used;
+
+	SPSC_RELEASE(&r->tail, tail + size);
+}
@@ -0,0 +1,57 @@
+/*
+ * SHL - Single-producer/single-consumer ring buffer
+ *
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * Lock-free ring buffer for passing a byte stream from one thread to
+ * another. Exactly one thread may call the producer functions and exactly
+ * one other thread the consumer functions, no locking is needed between
+ * the two. The buffer has a fixed power-of-2 size and is never resized.
+ */
+
+#ifndef SHL_SPSC_H
+#define SHL_SPSC_H
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+struct shl_spsc {
+	uint8_t *buf;		/* buffer or NULL */
+	size_t size;		/* size of @buf, a power of 2 */
+	size_t head;		/* bytes pushed so far, written by the producer */
+	size_t tail;		/* bytes pulled so far, written by the consumer */
+};
+
+/* allocate a buffer of at least @size bytes */
+int shl_spsc_init(struct shl_spsc *r, size_t size);
+
+/* free allocated data and reset to initial state */
+void shl_spsc_clear(struct shl_spsc *r);
+
+/* return number of bytes that can be pulled (consumer) */
+size_t shl_spsc_get_size(struct shl_spsc *r);
+
+/* return number of bytes that can be pushed (producer) */
+size_t shl_spsc_get_free(struct shl_spsc *r);
+
+/* get pointers to the free space of the buffer (producer) */
+size_t shl_spsc_reserve(struct shl_spsc *r, struct iovec *vec);
+
+/* make @size bytes written to the reserved space visible (producer) */
+void shl_spsc_commit(struct shl_spsc *r, size_t size);
+
+/* push up to @size bytes from @u8, returns the number pushed (producer) */
+size_t shl_spsc_push(struct shl_spsc *r, const void *u8, size_t size);
+
+/* get pointers to buffer data and their length (consumer) */
+size_t shl_spsc_peek(struct shl_spsc *r, struct iovec *vec);
+
+/* pull data from the front of the buffer (consumer) */
+void shl_spsc_pull(struct shl_spsc *r, size_t size);
+
+#endif  /* SHL_SPSC_H */
@@ -0,0 +1,506 @@
+/*
+ * libtsm - Replay Corpus Generator
+ *
+ * Copyright (c) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Replay Corpus Generator
+ * Writes recordings of typical terminal sessions on an 80x24 terminal in
+ * the format of SSHTerm's RECORD option: each block of output is preceded
+ * by its time of arrival (seconds, microseconds) and its length, as three
+ * little-endian 32-bit words. The output follows what the programs send to
+ * an xterm-256color terminal, with a fixed random seed so that the golden
+ * screen hashes stay valid:
+ *
+ *   cat-log  cat of a large log file with coloured log levels
+ *   vim      editing and scrolling in vim with syntax highlighting
+ *   htop     htop refreshing its meters and process list
+ *   tmux     two tmux panes side by side and a full-width window
+ *   cjk      Chinese, Japanese, Korean, Cyrillic and emoji text
+ *
+ * Blocks are cut at random sizes, like reads from the network, so escape
+ * sequences and UTF-8 characters are split across blocks.
+ *
+ * Usage: gen-corpus DIR
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_MAX 4096
+
+struct gen {
+	FILE *f;
+	uint64_t time;		/* in microseconds */
+	char buf[65536];	/* output not yet written in blocks */
+	size_t len;
+	size_t total;
+};
+
+static uint32_t seed;
+
+static uint32_t rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+
+	return seed >> 8;
+}
+
+static uint32_t rnd_range(uint32_t min, uint32_t max)
+{
+	return min + rnd() % (max - min + 1);
+}
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void write_block(struct gen *g, const char *data, size_t len)
+{
+	unsigned char header[12];
+
+	put_le32(&header[0], 1650000000 + g->time / 1000000);
+	put_le32(&header[4], g->time % 1000000);
+	put_le32(&header[8], len);
+
+	fwrite(header, sizeof(header), 1, g->f);
+	fwrite(data, len, 1, g->f);
+
+	g->total += len;
+}
+
+/* Write what has been output so far in randomly sized blocks, which arrive
+ * 'usec' microseconds apart */
+static void tick(struct gen *g, uint32_t usec)
+{
+	size_t done = 0, len;
+
+	while (done < g->len) {
+		len = rnd_range(1, BLOCK_MAX);
+		if (len > g->len - done)
+			len = g->len - done;
+
+		write_block(g, g->buf + done, len);
+		done += len;
+	}
+
+	g->len = 0;
+	g->time += usec;
+}
+
+static void out(struct gen *g, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	if (g->len > sizeof(g->buf) - 1024)
+		tick(g, 100);
+
+	va_start(ap, fmt);
+	len = vsnprintf(g->buf + g->len, sizeof(g->buf) - g->len, fmt, ap);
+	va_end(ap);
+
+	g->len += len;
+}
+
+static const char *const words[] = {
+	"connection", "from", "request", "handler", "timeout", "session",
+	"accepted", "closed", "user", "queue", "worker", "retry", "cache",
+	"miss", "backend", "upstream", "took", "ms", "bytes", "status", "ok",
+	"failed", "to", "read", "write", "socket", "GET", "POST", "/api/v1/items",
+	"/static/app.js", "client", "reset", "by", "peer", "done", "in",
+};
+
+#define NUM_WORDS (sizeof(words) / sizeof(words[0]))
+
+static void out_words(struct gen *g, unsigned int num)
+{
+	unsigned int i;
+
+	for (i = 0; i < num; i++)
+		out(g, i ? " %s" : "%s", words[rnd() % NUM_WORDS]);
+}
+
+static void gen_cat_log(struct gen *g)
+{
+	static const char *const levels[] = {
+		"\e[31mERROR\e[0m", "\e[33mWARN\e[0m ", "\e[32mINFO\e[0m ",
+		"\e[32mINFO\e[0m ", "\e[32mINFO\e[0m ", "\e[36mDEBUG\e[0m",
+	};
+	unsigned int line = 0;
+
+	while (g->total + g->len < 8 * 1024 * 1024) {
+		out(g, "2022-%02u-", rnd_range(1, 12));
+		out(g, "%02u ", rnd_range(1, 28));
+		out(g, "%02u:", rnd_range(0, 23));
+		out(g, "%02u:", rnd_range(0, 59));
+		out(g, "%02u.", rnd_range(0, 59));
+		out(g, "%03u ", rnd_range(0, 999));
+		out(g, "%s ", levels[rnd() % 6]);
+		out(g, "[worker-%u] ", rnd_range(1, 16));
+
+		/* about one line in five is long enough to wrap */
+		out_words(g, rnd() % 5 ? rnd_range(3, 10) : rnd_range(15, 60));
+
+		if (rnd() % 8 == 0)
+			out(g, "\tid=%08x", rnd());
+
+		out(g, "\r\n");
+
+		if (++line % 64 == 0)
+			tick(g, 500);
+	}
+}
+
+static const char *const keywords[] = {
+	"static", "int", "return", "if", "else", "for", "while", "struct",
+	"unsigned", "const", "void", "size_t",
+};
+
+#define NUM_KEYWORDS (sizeof(keywords) / sizeof(keywords[0]))
+
+/* A line of C as vim draws it, with the line number in front */
+static void vim_line(struct gen *g, unsigned int row, unsigned int num)
+{
+	unsigned int i, n, col = 5 + rnd_range(0, 4) * 4;
+
+	out(g, "\e[%u;1H\e[33m%4u \e[m%*s", row, num, (int)col - 5, "");
+
+	n = rnd() % 6;
+	for (i = 0; i < n && col < 70; i++) {
+		switch (rnd() % 4) {
+		case 0:
+			out(g, "\e[38;5;130m%s\e[m ", keywords[rnd() % NUM_KEYWORDS]);
+			break;
+		case 1:
+			out(g, "\e[38;5;28m\"%s\"\e[m", words[rnd() % NUM_WORDS]);
+			break;
+		case 2:
+			out(g, "\e[38;5;244m/* %s */\e[m", words[rnd() % NUM_WORDS]);
+			break;
+		default:
+			out(g, "%s(", words[rnd() % NUM_WORDS]);
+			out(g, "%s);", words[rnd() % NUM_WORDS]);
+			break;
+		}
+		col += 10;
+	}
+
+	out(g, "\e[K");
+}
+
+static void vim_status(struct gen *g, unsigned int top, unsigned int y,
+		       unsigned int x)
+{
+	out(g, "\e[24;1H\e[1m-- INSERT --\e[m\e[24;63H%u,%u\e[K\e[24;76H%u%%",
+	    top + y, x, top * 100 / 2000);
+	out(g, "\e[%u;%uH", y, x + 5);
+}
+
+static void gen_vim(struct gen *g)
+{
+	unsigned int top = 1, row, step, i, n, y = 1, x = 1;
+
+	out(g, "\e[?1049h\e[22;0;0t\e[?1h\e=\e[H\e[2J\e[?2004h");
+
+	for (step = 0; step < 1500; step++) {
+		out(g, "\e[?25l");
+
+		switch (step ? rnd() % 6 : 2) {
+		case 0:
+			/* scroll down a line, delete at the top of the region */
+			top++;
+			out(g, "\e[1;23r\e[1;1H\e[M\e[r");
+			vim_line(g, 23, top + 22);
+			break;
+		case 1:
+			/* scroll up a line, insert at the top of the region */
+			if (top > 1) {
+				top--;
+				out(g, "\e[1;23r\e[1;1H\e[L\e[r");
+				vim_line(g, 1, top);
+			}
+			break;
+		case 2:
+			/* page down, everything is redrawn */
+			top += step ? 21 : 0;
+			out(g, "\e[H\e[2J");
+			for (row = 1; row <= 23; row++)
+				vim_line(g, row, top + row - 1);
+			break;
+		case 3:
+			/* typing in insert mode, a key at a time */
+			y = rnd_range(1, 23);
+			x = rnd_range(1, 40);
+			out(g, "\e[%u;%uH\e[?25h", y, x + 5);
+			tick(g, 1000);
+			n = rnd_range(3, 30);
+			for (i = 0; i < n; i++) {
+				out(g, "\e[@%c", 'a' + rnd() % 26);
+				x++;
+				tick(g, rnd_range(60000, 200000));
+			}
+			break;
+		default:
+			/* cursor movement */
+			y = rnd_range(1, 23);
+			x = rnd_range(1, 70);
+			break;
+		}
+
+		vim_status(g, top, y, x);
+		out(g, "\e[?25h");
+		tick(g, rnd_range(5000, 300000));
+	}
+
+	out(g, "\e[?2004l\e[?1l\e>\e[?1049l\e[23;0;0t");
+	tick(g, 0);
+}
+
+static void htop_meter(struct gen *g, unsigned int row, unsigned int col,
+		       const char *name, unsigned int percent)
+{
+	unsigned int i, bars = percent * 30 / 100;
+
+	out(g, "\e[%u;%uH\e[36m%3s\e[1;30m[", row, col, name);
+	for (i = 0; i < 30; i++) {
+		if (i < bars * 2 / 3)
+			out(g, "\e[32m|");
+		else if (i < bars)
+			out(g, "\e[31m|");
+		else
+			out(g, " ");
+	}
+	out(g, "\e[1;30m%5u.%u%%\e[1;30m]\e[m", percent, rnd() % 10);
+}
+
+static void gen_htop(struct gen *g)
+{
+	static const char *const cmds[] = {
+		"/usr/sbin/sshd -D", "postgres: writer", "nginx: worker process",
+		"/usr/bin/python3 app.py", "htop", "-bash", "systemd --user",
+		"/usr/lib/jvm/bin/java -Xmx2g -jar server.jar",
+	};
+	unsigned int frame, row, cpu, sel = 0;
+
+	out(g, "\e[?1049h\e[22;0;0t\e[1;24r\e(B\e[m\e[4l\e[?7h\e[?1h\e=\e[?25l\e[H\e[2J");
+
+	for (frame = 0; frame < 300; frame++) {
+		for (cpu = 0; cpu < 4; cpu++)
+			htop_meter(g, cpu + 1, 1, (const char []){ '1' + cpu, 0 },
+				   rnd() % 100);
+		htop_meter(g, 5, 1, "Mem", 60 + rnd() % 5);
+		htop_meter(g, 6, 1, "Swp", 3);
+
+		out(g, "\e[1;42H\e[36mTasks: \e[1m%u\e[m", rnd_range(100, 140));
+		out(g, "\e[36m, \e[1;32m%u\e[m", rnd_range(300, 400));
+		out(g, "\e[36m thr; \e[1;32m%u\e[m\e[36m running\e[K", rnd_range(1, 5));
+		out(g, "\e[2;42H\e[36mLoad average: \e[1m%u.", rnd() % 4);
+		out(g, "%02u \e[m\e[36m", rnd() % 100);
+		for (cpu = 0; cpu < 2; cpu++) {
+			out(g, "%u.", rnd() % 4);
+			out(g, "%02u ", rnd() % 100);
+		}
+		out(g, "\e[K");
+		out(g, "\e[3;42H\e[36mUptime: \e[1m%u days, %02u:%02u:%02u\e[m\e[K",
+		    12, frame / 3600, frame / 60 % 60, frame % 60);
+
+		out(g, "\e[8;1H\e[30;42m    PID USER      PRI  NI  VIRT   RES   SHR S CPU%%▽"
+		    "MEM%%   TIME+  Command\e[K\e[m");
+
+		if (rnd() % 4 == 0)
+			sel = rnd() % 15;
+
+		for (row = 0; row < 15; row++) {
+			out(g, "\e[%u;1H%s", row + 9, row == sel ? "\e[30;46m" : "");
+			out(g, "%7u ", rnd_range(1, 65535));
+			out(g, "%-9s  20   0 ", rnd() % 3 ? "root" : "www-data");
+			out(g, "%5uM ", rnd_range(10, 4000));
+			out(g, "%5uM ", rnd_range(1, 900));
+			out(g, "%5uM ", rnd_range(1, 100));
+			out(g, "%c ", rnd() % 10 ? 'S' : 'R');
+			out(g, "%4u.", rnd() % 100);
+			out(g, "%u ", rnd() % 10);
+			out(g, "%4u.", rnd() % 20);
+			out(g, "%u ", rnd() % 10);
+			out(g, "%3u:", rnd() % 60);
+			out(g, "%02u.", rnd() % 60);
+			out(g, "%02u ", rnd() % 100);
+			out(g, "%s%s\e[K\e[m", row == sel ? "" : "\e[1;32m", cmds[rnd() % 8]);
+		}
+
+		out(g, "\e[24;1HF1\e[30;46mHelp  \e[mF2\e[30;46mSetup \e[mF3\e[30;46mSearch"
+		    "\e[mF4\e[30;46mFilter\e[mF5\e[30;46mTree  \e[mF6\e[30;46mSortBy"
+		    "\e[mF7\e[30;46mNice -\e[mF8\e[30;46mNice +\e[mF9\e[30;46mKill  "
+		    "\e[mF10\e[30;46mQuit\e[K\e[m");
+
+		tick(g, 1500000);
+	}
+
+	out(g, "\e[?1l\e>\e[?25h\e[?1049l\e[23;0;0t");
+	tick(g, 0);
+}
+
+static void tmux_status(struct gen *g, unsigned int win, unsigned int sec)
+{
+	out(g, "\e7\e[?25l\e[24;1H\e[30;42m[main] %s0:bash%s 1:vim%s\e[K"
+	    "\e[24;59H\"host.example.org\" %02u:%02u\e[m\e8\e[?25h",
+	    win == 0 ? "" : " ", win == 0 ? "*" : "-", win == 1 ? "*" : "",
+	    sec / 3600 % 24, sec / 60 % 60);
+}
+
+static void gen_tmux(struct gen *g)
+{
+	unsigned int step, row, pane, win = 0, sec = 0;
+	unsigned int lines[2] = { 0, 0 };
+
+	out(g, "\e[?1049h\e[22;0;0t\e[H\e[2J\e[?25l\e[?1000l\e[?1002l\e[?1006l");
+	tmux_status(g, win, sec);
+
+	for (step = 0; step < 3000; step++) {
+		if (step % 500 == 0) {
+			/* switch between the split window and a full one */
+			win = !win;
+			out(g, "\e[1;23r\e[H\e[2J");
+			if (win == 0) {
+				for (row = 1; row <= 23; row++)
+					out(g, "\e[%u;40H│", row);
+			}
+			tmux_status(g, win, sec);
+		}
+
+		if (win == 0) {
+			/* without left and right margins tmux redraws a pane
+			 * line by line when it scrolls */
+			pane = rnd() % 2;
+			lines[pane]++;
+			out(g, "\e[?25l");
+			for (row = 1; row <= 23; row++) {
+				out(g, "\e[%u;%uH\e[39X", row, pane ? 41 : 1);
+				if (row == 23)
+					out(g, "\e[1;34m$\e[m ");
+				out_words(g, rnd_range(0, 2));
+			}
+			out(g, "\e[?25h");
+		} else {
+			out(g, "\e[23;1H\r\n");
+			out_words(g, rnd_range(1, 12));
+			out(g, "\e[K");
+		}
+
+		if (step % 20 == 0) {
+			sec += 7;
+			tmux_status(g, win, sec);
+		}
+
+		tick(g, rnd_range(1000, 40000));
+	}
+
+	out(g, "\e[r\e[?1049l\e[23;0;0t");
+	tick(g, 0);
+}
+
+static void gen_cjk(struct gen *g)
+{
+	static const char *const phrases[] = {
+		"汉字表示和文本渲染",
+		"日本語のテキストとカタカナ",
+		"한국어 텍스트 출력",
+		"Русский текст",
+		"\U0001f600\U0001f680❤️",
+		"全角ＡＢＣ１２３",
+		"ASCII text",
+		"éèà café naïve",
+	};
+	unsigned int line = 0, i, n;
+
+	while (g->total + g->len < 2 * 1024 * 1024) {
+		if (rnd() % 6 == 0)
+			out(g, "\e[3%um", rnd_range(1, 6));
+
+		n = rnd_range(1, 12);
+		for (i = 0; i < n; i++)
+			out(g, "%s ", phrases[rnd() % 8]);
+
+		out(g, "\e[m\r\n");
+
+		if (++line % 32 == 0)
+			tick(g, 1000);
+	}
+
+	tick(g, 0);
+}
+
+static int generate(const char *dir, const char *name, void (*fn)(struct gen *))
+{
+	static struct gen g;
+	char path[1024];
+
+	snprintf(path, sizeof(path), "%s/%s.rec", dir, name);
+
+	memset(&g, 0, sizeof(g));
+	g.f = fopen(path, "wb");
+	if (!g.f) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	/* every recording starts from the same seed */
+	seed = 1;
+
+	fn(&g);
+	tick(&g, 0);
+
+	if (fclose(g.f)) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	printf("%-24s %8zu bytes\n", path, g.total);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s DIR\n", argv[0]);
+		return 1;
+	}
+
+	if (generate(argv[1], "cat-log", gen_cat_log) ||
+	    generate(argv[1], "vim", gen_vim) ||
+	    generate(argv[1], "htop", gen_htop) ||
+	    generate(argv[1], "tmux", gen_tmux) ||
+	    generate(argv[1], "cjk", gen_cjk))
+		return 1;
+
+	return 0;
+}
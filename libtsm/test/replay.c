@@ -0,0 +1,406 @@
+/*
+ * libtsm - Recording Replay
+ *
+ * Copyright (c) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Recording Replay
+ * Feeds recordings made with SSHTerm's RECORD option (or by gen-corpus)
+ * through tsm_vte_input() on an 80x24 screen with 2000 lines of
+ * scrollback, as SSHTerm does by default. A frame is drawn whenever the
+ * recorded time has moved on by a frame interval, unless a synchronized
+ * update is in progress, with a draw callback that only counts the cells
+ * it is given and those a renderer would have to paint because their age
+ * is newer than the last frame.
+ *
+ * For every recording it reports the MB/s that tsm_vte_input() parses, the
+ * frames and cells drawn, and the peak heap use of libtsm, which is taken
+ * from wrappers around the allocator (see the makefile).
+ *
+ * With -g or -p the cells of every frame and of the final screen are also
+ * hashed from their position, characters, width and attributes, so the
+ * hash covers the screens the application left behind as well.
+ *
+ * Usage: replay [-f FPS] [-g GOLDEN | -p] FILE...
+ *   -g  compare the screen hashes with the "name hash" lines in GOLDEN
+ *   -p  print the screen hashes in the format of GOLDEN
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "libtsm.h"
+#include "test-common.h"
+
+struct counts {
+	tsm_age_t age;		/* of the last frame */
+	uint64_t frames;
+	uint64_t cells;		/* passed to the draw callback */
+	uint64_t drawn;		/* newer than the last frame */
+	uint64_t *hash;		/* of all frames, or NULL */
+};
+
+/* allocator wrappers, see the makefile */
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t num, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static size_t heap_used;
+static size_t heap_peak;
+
+static void heap_add(void *ptr)
+{
+	if (ptr) {
+		heap_used += malloc_usable_size(ptr);
+		if (heap_used > heap_peak)
+			heap_peak = heap_used;
+	}
+}
+
+static void heap_sub(void *ptr)
+{
+	if (ptr)
+		heap_used -= malloc_usable_size(ptr);
+}
+
+void *__wrap_malloc(size_t size)
+{
+	void *ptr = __real_malloc(size);
+
+	heap_add(ptr);
+	return ptr;
+}
+
+void *__wrap_calloc(size_t num, size_t size)
+{
+	void *ptr = __real_calloc(num, size);
+
+	heap_add(ptr);
+	return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	size_t old = ptr ? malloc_usable_size(ptr) : 0;
+	void *new = __real_realloc(ptr, size);
+
+	if (new || !size) {
+		heap_used -= old;
+		heap_add(new);
+	}
+	return new;
+}
+
+void __wrap_free(void *ptr)
+{
+	heap_sub(ptr);
+	__real_free(ptr);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t fnv1a(uint64_t hash, uint32_t v)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		hash ^= (v >> (i * 8)) & 0xff;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+static int hash_cb(struct tsm_screen *con, const uint32_t *ch, size_t len,
+		   unsigned int width, unsigned int posx, unsigned int posy,
+		   const struct tsm_screen_attr *attr, tsm_age_t age,
+		   void *data)
+{
+	uint64_t *hash = data;
+	size_t i;
+
+	*hash = fnv1a(*hash, posx | posy << 16);
+	*hash = fnv1a(*hash, width | len << 8);
+	for (i = 0; i < len; i++)
+		*hash = fnv1a(*hash, ch[i]);
+
+	*hash = fnv1a(*hash, (uint8_t)attr->fccode | (uint8_t)attr->bccode << 8);
+	*hash = fnv1a(*hash, attr->fr | attr->fg << 8 | attr->fb << 16);
+	*hash = fnv1a(*hash, attr->br | attr->bg << 8 | attr->bb << 16);
+	*hash = fnv1a(*hash, attr->bold | attr->italic << 1 |
+			     attr->underline << 2 | attr->inverse << 3 |
+			     attr->protect << 4 | attr->blink << 5);
+
+	return 0;
+}
+
+static int count_cb(struct tsm_screen *con, const uint32_t *ch, size_t len,
+		    unsigned int width, unsigned int posx, unsigned int posy,
+		    const struct tsm_screen_attr *attr, tsm_age_t age,
+		    void *data)
+{
+	struct counts *c = data;
+
+	c->cells++;
+	if (age == 0 || age > c->age)
+		c->drawn++;
+
+	if (c->hash)
+		hash_cb(con, ch, len, width, posx, posy, attr, age, c->hash);
+
+	return 0;
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+struct result {
+	size_t bytes;
+	double parse_time;
+	double draw_time;
+	struct counts counts;
+	size_t heap_peak;
+	uint64_t hash;
+};
+
+static int replay(const char *path, unsigned int fps, bool hash,
+		  struct result *res)
+{
+	struct tsm_screen *con;
+	struct tsm_vte *vte;
+	unsigned char header[12];
+	char *buf = NULL;
+	size_t size = 0, len;
+	uint64_t time, frame_time = 0;
+	uint64_t frame_us = fps ? 1000000 / fps : 0;
+	double t;
+	FILE *f;
+	int ret = 1;
+
+	memset(res, 0, sizeof(*res));
+
+	f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	heap_used = 0;
+	heap_peak = 0;
+
+	res->hash = 0xcbf29ce484222325ULL;
+	if (hash)
+		res->counts.hash = &res->hash;
+
+	if (tsm_screen_new(&con, test_log_cb, NULL) < 0)
+		goto out_file;
+
+	if (tsm_vte_new(&vte, con, test_write_cb, NULL, test_log_cb, NULL) < 0)
+		goto out_screen;
+
+	tsm_screen_set_max_sb(con, 2000);
+
+	while (fread(header, sizeof(header), 1, f) == 1) {
+		time = get_le32(&header[0]) * 1000000ULL + get_le32(&header[4]);
+		len = get_le32(&header[8]);
+
+		if (len > size) {
+			/* not counted as libtsm memory */
+			__real_free(buf);
+			size = len;
+			buf = __real_malloc(size);
+			if (!buf)
+				goto out_vte;
+		}
+
+		if (fread(buf, len, 1, f) != 1) {
+			fprintf(stderr, "%s: truncated recording\n", path);
+			goto out_vte;
+		}
+
+		t = now();
+		tsm_vte_input(vte, buf, len);
+		res->parse_time += now() - t;
+		res->bytes += len;
+
+		if (time - frame_time >= frame_us &&
+		    !tsm_vte_synchronized_update(vte)) {
+			frame_time = time;
+
+			t = now();
+			res->counts.age = tsm_screen_draw(con, count_cb, &res->counts);
+			res->draw_time += now() - t;
+			res->counts.frames++;
+		}
+	}
+
+	if (ferror(f)) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		goto out_vte;
+	}
+
+	res->heap_peak = heap_peak;
+
+	if (hash)
+		tsm_screen_draw(con, hash_cb, &res->hash);
+
+	ret = 0;
+
+out_vte:
+	tsm_vte_unref(vte);
+out_screen:
+	tsm_screen_unref(con);
+out_file:
+	__real_free(buf);
+	fclose(f);
+	return ret;
+}
+
+/* recording name without directory and extension */
+static void get_name(const char *path, char *name, size_t size)
+{
+	const char *p = strrchr(path, '/');
+	size_t len;
+
+	p = p ? p + 1 : path;
+	len = strcspn(p, ".");
+	if (len >= size)
+		len = size - 1;
+
+	memcpy(name, p, len);
+	name[len] = 0;
+}
+
+static int find_golden(const char *golden, const char *name, uint64_t *hash)
+{
+	char line[256], gname[128];
+	unsigned long long ghash;
+	FILE *f;
+	int ret = 1;
+
+	f = fopen(golden, "r");
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", golden, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%127s %llx", gname, &ghash) == 2 &&
+		    !strcmp(gname, name)) {
+			*hash = ghash;
+			ret = 0;
+			break;
+		}
+	}
+
+	fclose(f);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	const char *golden = NULL;
+	bool print = false;
+	unsigned int fps = 50;
+	struct result res;
+	char name[128];
+	uint64_t hash;
+	int opt, i, ret = 0;
+
+	while ((opt = getopt(argc, argv, "f:g:p")) != -1) {
+		switch (opt) {
+		case 'f':
+			fps = atoi(optarg);
+			break;
+		case 'g':
+			golden = optarg;
+			break;
+		case 'p':
+			print = true;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (optind == argc)
+		goto usage;
+
+	if (!golden && !print)
+		printf("%-10s %8s %8s %7s %10s %10s %8s %9s\n", "recording",
+		       "MB", "MB/s", "frames", "cells", "drawn", "draw ms",
+		       "heap KB");
+
+	for (i = optind; i < argc; i++) {
+		get_name(argv[i], name, sizeof(name));
+
+		if (replay(argv[i], fps, golden || print, &res))
+			return 1;
+
+		if (print) {
+			printf("%s %016" PRIx64 "\n", name, res.hash);
+		} else if (golden) {
+			if (find_golden(golden, name, &hash)) {
+				fprintf(stderr, "FAIL: %s: no golden hash\n", name);
+				ret = 1;
+			} else if (hash != res.hash) {
+				fprintf(stderr, "FAIL: %s: screen hash %016" PRIx64
+					", expected %016" PRIx64 "\n", name,
+					res.hash, hash);
+				ret = 1;
+			} else {
+				printf("%-10s %016" PRIx64 " OK\n", name, res.hash);
+			}
+		} else {
+			printf("%-10s %8.2f %8.1f %7" PRIu64 " %10" PRIu64 " %10"
+			       PRIu64 " %8.1f %9zu\n", name,
+			       res.bytes / 1e6, res.bytes / 1e6 / res.parse_time,
+			       res.counts.frames, res.counts.cells,
+			       res.counts.drawn, res.draw_time * 1000,
+			       res.heap_peak / 1024);
+		}
+	}
+
+	return ret;
+
+usage:
+	fprintf(stderr, "Usage: %s [-f FPS] [-g GOLDEN | -p] FILE...\n",
+		argv[0]);
+	return 1;
+}
@@ -0,0 +1,95 @@
+/*
+ * libtsm - Test Helpers
+ *
+ * Copyright (c) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Test Helpers
+ * Shared by the tests and benchmarks in this directory: the random numbers
+ * that make every run the same, failure reports, and libtsm callbacks for
+ * whatever a test does not look at.
+ */
+
+#ifndef TEST_COMMON_H
+#define TEST_COMMON_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "libtsm.h"
+
+/* LCG on a seed of the caller's, for threads that need their own sequence */
+static inline uint32_t rnd_r(uint32_t *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+
+	return *seed >> 8;
+}
+
+static inline uint32_t rnd(void)
+{
+	static uint32_t seed = 1;
+
+	return rnd_r(&seed);
+}
+
+/* Prints "FAIL: " and the message and returns 1, for "return fail(...)" */
+static inline int fail(const char *format, ...)
+	__attribute__((format(printf, 1, 2)));
+
+static inline int fail(const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	fprintf(stderr, "FAIL: ");
+	vfprintf(stderr, format, args);
+	fprintf(stderr, "\n");
+	va_end(args);
+
+	return 1;
+}
+
+static inline void test_log_cb(void *data, const char *file, int line,
+			       const char *func, const char *subs,
+			       unsigned int sev, const char *format,
+			       va_list args)
+{
+}
+
+/* Answers to queries are dropped */
+static inline void test_write_cb(struct tsm_vte *vte, const char *u8,
+				 size_t len, void *data)
+{
+}
+
+static inline int test_draw_cb(struct tsm_screen *con, const uint32_t *ch,
+			       size_t len, unsigned int width,
+			       unsigned int posx, unsigned int posy,
+			       const struct tsm_screen_attr *attr,
+			       tsm_age_t age, void *data)
+{
+	return 0;
+}
+
+#endif /* TEST_COMMON_H */
@@ -0,0 +1,595 @@
+/*
+ * libtsm - Predictive Local Echo Test
+ *
+ * Copyright (c) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Predictive Local Echo Test
+ * Replays traces of key presses and application output with their times
+ * through a vte and a prediction object, as SSHTerm's terminal task does,
+ * and checks which predictions are drawn, which are still pending and the
+ * measured echo delay along the way. tsm-predict.c is included to see
+ * when predictions are dropped as wrong.
+ *
+ * The fixed traces cover a slow echo, a password prompt that does not
+ * echo, a wrong echo, the alternate screen, cursor keys and backspace, the
+ * last line scrolling, a repeated character and a link that gets fast
+ * again. Then a simulated line editor echoes random typing after delays
+ * from 5 to 700 ms with jitter, with its echoes sometimes arriving
+ * together. Predictions may be wrong where the screen scrolled under them
+ * but hardly ever otherwise, all must be settled at the end, and the
+ * measured delay must be close to the simulated one.
+ *
+ * Usage: test-predict
+ */
+
+#include <stdio.h>
+#include "../tsm/tsm-predict.c"
+#include "test-common.h"
+
+#define COLS 80
+#define ROWS 24
+
+#define SESSIONS     24
+#define SESSION_KEYS 400
+#define MAX_LINE     60
+#define TICK_MS      20
+/* time to let the last predictions settle or time out */
+#define SETTLE_MS    5000
+/* wrong predictions per 100 keys that are not caused by a newline */
+#define STRAY_MAX    1
+
+struct term {
+	struct tsm_screen *con;
+	struct tsm_vte *vte;
+	struct tsm_predict *pr;
+	unsigned int wrong;	/* predictions dropped as wrong */
+	char shown[PREDICT_MAX + 1];	/* predicted cells last drawn */
+};
+
+static int draw_cb(struct tsm_screen *con, const uint32_t *ch, size_t len,
+		   unsigned int width, unsigned int posx, unsigned int posy,
+		   const struct tsm_screen_attr *attr, tsm_age_t age,
+		   void *data)
+{
+	char *shown = data;
+	size_t n = strlen(shown);
+
+	if (n < PREDICT_MAX && len == 1 && attr->underline)
+		shown[n] = ch[0] < 0x80 ? ch[0] : '?';
+
+	return 0;
+}
+
+static int term_new(struct term *t)
+{
+	memset(t, 0, sizeof(*t));
+
+	if (tsm_screen_new(&t->con, test_log_cb, NULL) < 0)
+		return -1;
+	if (tsm_screen_resize(t->con, COLS, ROWS) < 0 ||
+	    tsm_vte_new(&t->vte, t->con, test_write_cb, NULL, test_log_cb,
+			NULL) < 0)
+		goto err_screen;
+	if (tsm_predict_new(&t->pr, t->con, test_log_cb, NULL) < 0)
+		goto err_vte;
+
+	return 0;
+
+err_vte:
+	tsm_vte_unref(t->vte);
+err_screen:
+	tsm_screen_unref(t->con);
+	return -1;
+}
+
+static void term_free(struct term *t)
+{
+	tsm_predict_unref(t->pr);
+	tsm_vte_unref(t->vte);
+	tsm_screen_unref(t->con);
+}
+
+static void term_update(struct term *t, uint64_t now)
+{
+	unsigned int epoch = t->pr->epoch;
+
+	tsm_predict_update(t->pr, now);
+
+	/* only a wrong prediction starts a new epoch here */
+	if (t->pr->epoch != epoch)
+		t->wrong++;
+
+	memset(t->shown, 0, sizeof(t->shown));
+	tsm_predict_draw(t->pr, draw_cb, t->shown);
+}
+
+static void term_output(struct term *t, const char *u8, uint64_t now)
+{
+	tsm_vte_input(t->vte, u8, strlen(u8));
+	term_update(t, now);
+}
+
+/* fixed traces */
+
+enum {
+	S_END,
+	S_KEY,		/* tsm_predict_key(key, ucs4) */
+	S_OUT,		/* application output followed by an update */
+	S_TICK,		/* update without output, as the blink timer does */
+	S_SHOWN,	/* the predicted cells drawn, in order */
+	S_PENDING,	/* number of predictions */
+	S_SRTT,		/* measured echo delay between min and max */
+	S_WRONG,	/* number of wrong predictions so far */
+};
+
+struct step {
+	unsigned int time;
+	int type;
+	unsigned int key;
+	uint32_t ucs4;
+	const char *str;
+	unsigned int min;
+	unsigned int max;
+};
+
+#define KEY(t, k, c) { (t), S_KEY, (k), (c), NULL, 0, 0 }
+#define CHAR(t, c)   KEY(t, TSM_PREDICT_CHAR, c)
+#define OUT(t, s)    { (t), S_OUT, 0, 0, (s), 0, 0 }
+#define TICK(t)      { (t), S_TICK, 0, 0, NULL, 0, 0 }
+#define SHOWN(s)     { 0, S_SHOWN, 0, 0, (s), 0, 0 }
+#define PENDING(n)   { 0, S_PENDING, 0, 0, NULL, (n), 0 }
+#define SRTT(lo, hi) { 0, S_SRTT, 0, 0, NULL, (lo), (hi) }
+#define WRONG(n)     { 0, S_WRONG, 0, 0, NULL, (n), 0 }
+#define END          { 0, S_END, 0, 0, NULL, 0, 0 }
+
+/* Typing "ls" with a 300 ms echo. The first key is not shown as nothing
+ * has been confirmed yet, the second one is. */
+static const struct step trace_slow[] = {
+	OUT(0, "$ "),
+	CHAR(1000, 'l'),
+	SHOWN(""), PENDING(1),
+	OUT(1300, "l"),
+	PENDING(0), SRTT(300, 300),
+	CHAR(1400, 's'),
+	SHOWN("s"), PENDING(1),
+	TICK(1500),
+	SHOWN("s"),
+	OUT(1700, "s"),
+	SHOWN(""), PENDING(0), SRTT(300, 300), WRONG(0),
+	END
+};
+
+/* Nothing typed at a password prompt is shown, and the predictions time
+ * out without being counted as an echo delay. */
+static const struct step trace_password[] = {
+	OUT(0, "$ "),
+	CHAR(100, 'a'),
+	OUT(400, "a"),
+	SRTT(300, 300),
+	KEY(500, TSM_PREDICT_OTHER, 0),
+	OUT(800, "\r\nPassword: "),
+	CHAR(1000, 's'), CHAR(1100, 'e'), CHAR(1200, 'c'),
+	TICK(1600),
+	SHOWN(""), PENDING(3),
+	TICK(3000),
+	SHOWN(""), PENDING(0), SRTT(300, 300), WRONG(1),
+	END
+};
+
+/* An echo that differs from the prediction drops it and the ones after
+ * it. Keys are not predicted again until the typing has paused, and not
+ * shown until one of them has been confirmed. */
+static const struct step trace_wrong[] = {
+	OUT(0, "$ "),
+	CHAR(100, 'a'),
+	OUT(400, "a"),
+	CHAR(500, 'b'), CHAR(550, 'c'),
+	SHOWN("bc"),
+	OUT(800, "*"),
+	SHOWN(""), PENDING(0), WRONG(1),
+	CHAR(900, 'd'),
+	PENDING(0),
+	OUT(1200, "d"),
+	CHAR(2600, 'e'),
+	SHOWN(""), PENDING(1),
+	OUT(2900, "e"),
+	PENDING(0), WRONG(1),
+	CHAR(3000, 'f'),
+	SHOWN("f"),
+	END
+};
+
+/* Full screen applications get no predictions, and the keys typed in them
+ * start a new epoch that has to be confirmed again afterwards */
+static const struct step trace_alternate[] = {
+	OUT(0, "$ "),
+	CHAR(100, 'v'),
+	OUT(400, "v"),
+	OUT(500, "\033[?1049h\033[H\033[2J"),
+	CHAR(600, 'i'), CHAR(650, 'j'),
+	PENDING(0), SHOWN(""),
+	OUT(900, "\033[?1049l"),
+	CHAR(1000, 'x'),
+	SHOWN(""), PENDING(1),
+	OUT(1300, "x"),
+	CHAR(1400, 'y'),
+	SHOWN("y"), PENDING(1), WRONG(0),
+	END
+};
+
+/* Backspace shows a blank cell and the cursor keys only move the cursor */
+static const struct step trace_edit[] = {
+	OUT(0, "$ "),
+	CHAR(100, 'a'),
+	OUT(300, "a"),
+	CHAR(400, 'b'), CHAR(450, 'c'),
+	KEY(500, TSM_PREDICT_BACKSPACE, 0),
+	SHOWN("bc "), PENDING(3),
+	OUT(600, "bc"),
+	SHOWN(" "), PENDING(1),
+	OUT(650, "\b \b"),
+	PENDING(0),
+	KEY(700, TSM_PREDICT_LEFT, 0), CHAR(720, 'x'),
+	SHOWN("x"), PENDING(2),
+	OUT(900, "\bxb\b"),
+	PENDING(0), WRONG(0),
+	KEY(1000, TSM_PREDICT_RIGHT, 0),
+	OUT(1200, "\033[C"),
+	PENDING(0), WRONG(0),
+	END
+};
+
+/* Once the echo gets fast the predictions are no longer shown */
+/* On the last line the echo of return scrolls the screen, which moves the
+ * predictions typed before it up with their line. */
+static const struct step trace_bottom[] = {
+	OUT(0, "\033[24H$ "),
+	CHAR(100, 'a'),
+	OUT(400, "a"),
+	CHAR(500, 'l'), CHAR(550, 's'),
+	SHOWN("ls"), PENDING(2),
+	KEY(600, TSM_PREDICT_OTHER, 0),
+	OUT(850, "ls\r\n$ "),
+	SHOWN(""), PENDING(0), WRONG(0),
+	END
+};
+
+/* A character typed in front of the same character is only confirmed once
+ * it has been echoed, not by the cell already holding it. */
+static const struct step trace_repeat[] = {
+	OUT(0, "$ "),
+	CHAR(100, 'a'),
+	OUT(400, "a"),
+	KEY(500, TSM_PREDICT_LEFT, 0), CHAR(600, 'a'),
+	TICK(620),
+	PENDING(2),
+	OUT(800, "\b"),
+	PENDING(1),
+	TICK(850),
+	PENDING(1),
+	OUT(900, "aa\b"),
+	PENDING(0), WRONG(0),
+	END
+};
+
+static const struct step trace_fast[] = {
+	OUT(0, "$ "),
+	CHAR(100, 'a'), OUT(200, "a"),
+	CHAR(300, 'b'), SHOWN("b"), OUT(400, "b"),
+	CHAR(500, 'c'), OUT(505, "c"),
+	CHAR(600, 'd'), OUT(605, "d"),
+	CHAR(700, 'e'), OUT(705, "e"),
+	CHAR(800, 'f'), OUT(805, "f"),
+	CHAR(900, 'g'), OUT(905, "g"),
+	CHAR(1000, 'h'), OUT(1005, "h"),
+	CHAR(1100, 'i'), OUT(1105, "i"),
+	CHAR(1200, 'j'), OUT(1205, "j"),
+	CHAR(1300, 'k'), OUT(1305, "k"),
+	SRTT(21, 40),
+	CHAR(1400, 'l'), SHOWN("l"), OUT(1405, "l"),
+	CHAR(1500, 'm'), OUT(1505, "m"),
+	CHAR(1600, 'n'), OUT(1605, "n"),
+	CHAR(1700, 'o'), OUT(1705, "o"),
+	CHAR(1800, 'p'), OUT(1805, "p"),
+	CHAR(1900, 'q'), OUT(1905, "q"),
+	SRTT(1, 19),
+	CHAR(2000, 'r'),
+	SHOWN(""), PENDING(1),
+	END
+};
+
+static const struct {
+	const char *name;
+	const struct step *steps;
+} traces[] = {
+	{ "slow echo", trace_slow },
+	{ "password", trace_password },
+	{ "wrong echo", trace_wrong },
+	{ "alternate screen", trace_alternate },
+	{ "editing", trace_edit },
+	{ "last line", trace_bottom },
+	{ "repeated character", trace_repeat },
+	{ "fast echo", trace_fast },
+};
+
+static int run_trace(const char *name, const struct step *s)
+{
+	struct term t;
+	unsigned int i, srtt;
+	int ret = 0;
+
+	if (term_new(&t))
+		return 1;
+
+	for (i = 0; s[i].type != S_END && !ret; i++) {
+		switch (s[i].type) {
+		case S_KEY:
+			tsm_predict_key(t.pr, s[i].key, s[i].ucs4, s[i].time);
+			memset(t.shown, 0, sizeof(t.shown));
+			tsm_predict_draw(t.pr, draw_cb, t.shown);
+			break;
+		case S_OUT:
+			term_output(&t, s[i].str, s[i].time);
+			break;
+		case S_TICK:
+			term_update(&t, s[i].time);
+			break;
+		case S_SHOWN:
+			if (strcmp(t.shown, s[i].str)) {
+				fprintf(stderr, "FAIL: %s: step %u: \"%s\" shown, "
+					"expected \"%s\"\n", name, i, t.shown,
+					s[i].str);
+				ret = 1;
+			}
+			break;
+		case S_PENDING:
+			if (t.pr->count != s[i].min) {
+				fprintf(stderr, "FAIL: %s: step %u: %u pending, "
+					"expected %u\n", name, i, t.pr->count,
+					s[i].min);
+				ret = 1;
+			}
+			break;
+		case S_SRTT:
+			srtt = tsm_predict_get_srtt(t.pr);
+			if (srtt < s[i].min || srtt > s[i].max) {
+				fprintf(stderr, "FAIL: %s: step %u: echo delay "
+					"%u ms, expected %u-%u\n", name, i,
+					srtt, s[i].min, s[i].max);
+				ret = 1;
+			}
+			break;
+		case S_WRONG:
+			if (t.wrong != s[i].min) {
+				fprintf(stderr, "FAIL: %s: step %u: %u wrong, "
+					"expected %u\n", name, i, t.wrong,
+					s[i].min);
+				ret = 1;
+			}
+			break;
+		}
+	}
+
+	if (!ret)
+		printf("%s OK\n", name);
+
+	term_free(&t);
+	return ret;
+}
+
+/* simulated line editor */
+
+struct echo {
+	uint64_t time;		/* when it arrives */
+	char out[2 * MAX_LINE + 8];
+	bool newline;
+};
+
+struct editor {
+	char line[MAX_LINE + 1];
+	unsigned int len;
+	unsigned int pos;
+};
+
+/* Picks a key the way a user editing the line might, applies it to the
+ * line and writes the echo of a readline-like editor into \e */
+static unsigned int editor_key(struct editor *ed, uint32_t *ucs4,
+			       struct echo *e)
+{
+	unsigned int r = rnd() % 100, i;
+	char *o = e->out;
+
+	e->newline = false;
+
+	if (ed->len >= MAX_LINE || r < 8) {
+		ed->len = ed->pos = 0;
+		strcpy(o, "\r\n$ ");
+		e->newline = true;
+		return TSM_PREDICT_OTHER;
+	}
+
+	if (r < 18 && ed->pos == ed->len && ed->len > 0) {
+		ed->len--;
+		ed->pos--;
+		strcpy(o, "\b \b");
+		return TSM_PREDICT_BACKSPACE;
+	}
+
+	if (r < 25 && ed->pos > 0) {
+		ed->pos--;
+		strcpy(o, "\b");
+		return TSM_PREDICT_LEFT;
+	}
+
+	if (r < 30 && ed->pos < ed->len) {
+		ed->pos++;
+		strcpy(o, "\033[C");
+		return TSM_PREDICT_RIGHT;
+	}
+
+	/* insert a character and redraw the rest of the line */
+	*ucs4 = 0x21 + rnd() % 0x5e;
+	memmove(&ed->line[ed->pos + 1], &ed->line[ed->pos], ed->len - ed->pos);
+	ed->line[ed->pos] = *ucs4;
+	ed->len++;
+
+	memcpy(o, &ed->line[ed->pos], ed->len - ed->pos);
+	o += ed->len - ed->pos;
+	for (i = ed->pos + 1; i < ed->len; i++)
+		*o++ = '\b';
+	*o = 0;
+
+	ed->pos++;
+	return TSM_PREDICT_CHAR;
+}
+
+static int run_session(unsigned int delay, unsigned int *shown)
+{
+	static struct echo echoes[SESSION_KEYS];
+	struct editor ed;
+	struct term t;
+	uint64_t now, due, next_key = 0, last = 0;
+	unsigned int keys = 0, head = 0, key, srtt, wrong, stray = 0;
+	uint32_t ucs4 = 0;
+	bool newline;
+	int ret = 0;
+
+	if (term_new(&t))
+		return 1;
+
+	memset(&ed, 0, sizeof(ed));
+	term_output(&t, "$ ", 0);
+	*shown = 0;
+
+	for (now = 1; keys < SESSION_KEYS || head < keys ||
+		      now < last + SETTLE_MS; now++) {
+		if (keys < SESSION_KEYS && now >= next_key) {
+			key = editor_key(&ed, &ucs4, &echoes[keys]);
+			tsm_predict_key(t.pr, key, ucs4, now);
+
+			/* echoes stay in order; some are held back a little
+			 * so that they arrive together with the next one */
+			due = now + delay + rnd() % (delay / 4 + 1);
+			if (due < last)
+				due = last;
+			if (rnd() % 4 == 0)
+				due += rnd() % (delay / 2 + 1);
+			echoes[keys++].time = last = due;
+
+			/* with a pause to think now and then */
+			next_key = now + 30 + rnd() % 220;
+			if (rnd() % 12 == 0)
+				next_key += 1000 + rnd() % 5000;
+		}
+
+		newline = false;
+		if (head < keys && echoes[head].time <= now) {
+			while (head < keys && echoes[head].time <= now) {
+				tsm_vte_input(t.vte, echoes[head].out,
+					      strlen(echoes[head].out));
+				newline = newline || echoes[head].newline;
+				head++;
+			}
+
+			wrong = t.wrong;
+			term_update(&t, now);
+
+			/* Where a newline scrolled the screen under them
+			 * predictions are expected to be wrong. Otherwise
+			 * only an echo that happens to look like that of a
+			 * later key, such as a character typed twice in the
+			 * middle of the line, may lead to one. */
+			if (t.wrong != wrong && !newline)
+				stray++;
+		} else if (now % TICK_MS == 0) {
+			wrong = t.wrong;
+			term_update(&t, now);
+			if (t.wrong != wrong)
+				stray++;
+		}
+
+		if (t.shown[0] && tsm_predict_get_srtt(t.pr) < PREDICT_DISENGAGE_MS) {
+			fprintf(stderr, "FAIL: %u ms echo: shown at %u ms "
+				"measured delay\n", delay,
+				tsm_predict_get_srtt(t.pr));
+			ret = 1;
+			break;
+		}
+		*shown += strlen(t.shown) > 0;
+	}
+
+	srtt = tsm_predict_get_srtt(t.pr);
+	if (!ret && stray * 100 > STRAY_MAX * SESSION_KEYS) {
+		fprintf(stderr, "FAIL: %u ms echo: %u wrong predictions "
+			"without a newline\n", delay, stray);
+		ret = 1;
+	} else if (!ret && tsm_predict_pending(t.pr)) {
+		fprintf(stderr, "FAIL: %u ms echo: %u predictions left\n",
+			delay, t.pr->count);
+		ret = 1;
+	} else if (!ret && (srtt < delay * 3 / 4 || srtt > delay * 3 / 2 + 30)) {
+		fprintf(stderr, "FAIL: %u ms echo: measured %u ms\n", delay,
+			srtt);
+		ret = 1;
+	}
+
+	if (!ret)
+		printf("%3u ms echo: measured %3u ms, %u wrong, %u without a "
+		       "newline, shown for %u ms OK\n", delay, srtt, t.wrong,
+		       stray, *shown);
+
+	term_free(&t);
+	return ret;
+}
+
+int main(void)
+{
+	static const unsigned int delays[] = { 5, 15, 40, 120, 300, 700 };
+	unsigned int i, shown;
+
+	for (i = 0; i < sizeof(traces) / sizeof(traces[0]); i++) {
+		if (run_trace(traces[i].name, traces[i].steps))
+			return 1;
+	}
+
+	for (i = 0; i < SESSIONS; i++) {
+		if (run_session(delays[i % 6], &shown))
+			return 1;
+
+		if (delays[i % 6] < PREDICT_DISENGAGE_MS && shown) {
+			fprintf(stderr, "FAIL: shown at %u ms echo\n",
+				delays[i % 6]);
+			return 1;
+		}
+		if (delays[i % 6] > 2 * PREDICT_ENGAGE_MS && !shown) {
+			fprintf(stderr, "FAIL: never shown at %u ms echo\n",
+				delays[i % 6]);
+			return 1;
+		}
+	}
+
+	printf("OK\n");
+
+	return 0;
+}
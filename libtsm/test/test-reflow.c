@@ -0,0 +1,363 @@
+/*
+ * libtsm - Reflow Test
+ *
+ * Copyright (c) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Reflow Test
+ * Writes random text with wide characters and newlines through the VTE,
+ * resizes the screen at random, scrolls back and draws, which reflows the
+ * scrollback lines that come into view, and copies selections. Along the
+ * way it checks that:
+ *  - the scrollback list, its IDs and line widths and the cursor are
+ *    consistent,
+ *  - copying everything gives back the text that was written, or the end of
+ *    it once the scrollback is full, however often it was reflowed,
+ *  - a selection copies the same text before and after the lines under it
+ *    have been reflowed by a draw,
+ *  - a resize to a new width, which reflows the main screen, drops the
+ *    selection.
+ *
+ * The makefile also builds it with AddressSanitizer.
+ *
+ * Usage: test-reflow [ROUNDS]
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libtsm.h"
+#include "libtsm-int.h"
+#include "test-common.h"
+
+#ifndef ROUNDS
+#define ROUNDS 40
+#endif
+#define STEPS  1500
+
+struct text {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+static void text_add(struct text *t, const char *s, size_t len)
+{
+	if (t->len + len + 1 > t->size) {
+		t->size = (t->len + len + 1) * 2;
+		t->buf = realloc(t->buf, t->size);
+		if (!t->buf) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+
+	memcpy(t->buf + t->len, s, len);
+	t->len += len;
+	t->buf[t->len] = 0;
+}
+
+/* length without the newlines at the end */
+static size_t trimmed_len(const char *s, size_t len)
+{
+	while (len && s[len - 1] == '\n')
+		--len;
+
+	return len;
+}
+
+/*
+ * Random text, with wide CJK characters and now and then a newline. The
+ * VTE gets \r\n for a newline, the expected text only \n as that is what
+ * a copy gives.
+ */
+static void gen_text(char *out, size_t *out_len, struct text *expect)
+{
+	unsigned int i, num = 1 + rnd() % (rnd() % 4 ? 40 : 300);
+	uint32_t ch, r;
+	size_t len = 0;
+	char u8[4];
+	size_t n;
+
+	for (i = 0; i < num; i++) {
+		r = rnd() % 100;
+		if (r < 3) {
+			memcpy(out + len, "\r\n", 2);
+			len += 2;
+			text_add(expect, "\n", 1);
+			continue;
+		}
+
+		if (r < 13)
+			ch = ' ';
+		else if (r < 23)
+			ch = 0x4e00 + rnd() % 0x400;
+		else
+			ch = 0x21 + rnd() % 0x5e;
+
+		n = tsm_ucs4_to_utf8(ch, u8);
+		memcpy(out + len, u8, n);
+		len += n;
+		text_add(expect, u8, n);
+	}
+
+	*out_len = len;
+}
+
+/* the scrollback list and the cursor */
+static const char *check_screen(struct tsm_screen *con)
+{
+	struct line *iter, *prev = NULL;
+	unsigned int count = 0, i;
+	bool pos_found = !con->sb_pos;
+
+	for (iter = con->sb_first; iter; iter = iter->next) {
+		if (iter->prev != prev)
+			return "broken sb links";
+		if (prev && iter->sb_id <= prev->sb_id)
+			return "sb IDs not increasing";
+		if (!iter->width || iter->width > iter->size)
+			return "bad sb line width";
+		if (iter == con->sb_pos)
+			pos_found = true;
+		prev = iter;
+		++count;
+	}
+
+	if (prev != con->sb_last)
+		return "sb_last is not the last line";
+	if (count != con->sb_count)
+		return "wrong sb_count";
+	if (!pos_found)
+		return "sb_pos not in the sb";
+
+	for (i = 0; i < con->size_y; i++) {
+		if (con->lines[i]->size < con->size_x)
+			return "screen line too short";
+	}
+
+	if (con->cursor_x > con->size_x || con->cursor_y >= con->size_y)
+		return "cursor off the screen";
+
+	return NULL;
+}
+
+/* Everything that was written must still be there, apart from what may
+ * have fallen out of the top of a small sb. */
+static const char *check_text(struct tsm_screen *con, const struct text *expect,
+			      bool small_sb)
+{
+	char *str;
+	int ret;
+	size_t len, exp_len;
+	const char *err = NULL;
+
+	ret = tsm_screen_copy_all(con, &str);
+	if (ret < 0)
+		return "tsm_screen_copy_all";
+
+	len = trimmed_len(str, ret);
+	exp_len = trimmed_len(expect->buf, expect->len);
+
+	if (len > exp_len || (!small_sb && len != exp_len) ||
+	    memcmp(str, expect->buf + exp_len - len, len))
+		err = "copied text differs from the text written";
+
+	free(str);
+	return err;
+}
+
+/* A column within the text of row @y, which for an sb line that has not
+ * been drawn yet is still laid out for its old width. A selection can only
+ * be made on what was drawn, and a position past the old width has no
+ * place in the reflowed text. */
+static unsigned int pick_x(struct tsm_screen *con, unsigned int y)
+{
+	struct line *iter = con->sb_pos;
+	unsigned int width = con->size_x;
+
+	while (y && iter) {
+		--y;
+		iter = iter->next;
+	}
+	if (iter && iter->width < width)
+		width = iter->width;
+
+	return rnd() % width;
+}
+
+/* A selection on lines that have not been reflowed yet must still copy the
+ * same text once drawing has reflowed them. */
+static const char *check_selection(struct tsm_screen *con)
+{
+	char *before, *after;
+	const char *err = NULL;
+	unsigned int y;
+	int ret;
+
+	tsm_screen_sb_reset(con);
+	tsm_screen_sb_up(con, rnd() % (con->sb_count + 1));
+
+	y = rnd() % con->size_y;
+	tsm_screen_selection_start(con, pick_x(con, y), y);
+	y = rnd() % con->size_y;
+	tsm_screen_selection_target(con, pick_x(con, y), y);
+
+	ret = tsm_screen_selection_copy(con, &before);
+	if (ret < 0)
+		return "tsm_screen_selection_copy";
+
+	tsm_screen_draw(con, test_draw_cb, NULL);
+
+	ret = tsm_screen_selection_copy(con, &after);
+	if (ret < 0) {
+		free(before);
+		return "selection lost by a draw";
+	}
+
+	if (strcmp(before, after))
+		err = "selection copies differently after a draw";
+
+	free(before);
+	free(after);
+	return err;
+}
+
+static int run_round(unsigned int round)
+{
+	struct tsm_screen *con;
+	struct tsm_vte *vte;
+	struct text expect = { NULL, 0, 0 };
+	static char buf[1300];
+	unsigned int step, x, y, r;
+	bool small_sb;
+	size_t len, split;
+	const char *err = NULL;
+	char *str;
+	int ret = 0;
+
+	if (tsm_screen_new(&con, test_log_cb, NULL) < 0)
+		return fail("round %u: tsm_screen_new", round);
+	if (tsm_vte_new(&vte, con, test_write_cb, NULL, test_log_cb,
+			NULL) < 0) {
+		tsm_screen_unref(con);
+		return fail("round %u: tsm_vte_new", round);
+	}
+
+	/* a small sb that fills up, or one that holds everything */
+	small_sb = rnd() % 2;
+	tsm_screen_set_max_sb(con, small_sb ? 50 + rnd() % 200 : 100000);
+	tsm_screen_resize(con, 10 + rnd() % 90, 2 + rnd() % 40);
+	text_add(&expect, "", 0);
+
+	for (step = 0; step < STEPS && !err; step++) {
+		r = rnd() % 100;
+		if (r < 60) {
+			gen_text(buf, &len, &expect);
+			split = rnd() % (len + 1);
+			tsm_vte_input(vte, buf, split);
+			tsm_vte_input(vte, buf + split, len - split);
+		} else if (r < 75) {
+			do {
+				x = 1 + rnd() % (rnd() % 8 ? 100 : 4);
+				y = 1 + rnd() % 40;
+			} while (x == con->size_x && y == con->size_y);
+
+			if (x != con->size_x && rnd() % 4 == 0) {
+				/* reflowing drops the selection */
+				tsm_screen_selection_start(con, 0, 0);
+				tsm_screen_selection_target(con, 1, 0);
+				if (tsm_screen_resize(con, x, y))
+					err = "tsm_screen_resize";
+				else if (tsm_screen_selection_copy(con, &str) >= 0) {
+					free(str);
+					err = "selection kept over a resize";
+				}
+			} else if (tsm_screen_resize(con, x, y)) {
+				err = "tsm_screen_resize";
+			}
+		} else if (r < 90) {
+			switch (rnd() % 5) {
+			case 0:
+				tsm_screen_sb_up(con, rnd() % 50);
+				break;
+			case 1:
+				tsm_screen_sb_down(con, rnd() % 50);
+				break;
+			case 2:
+				tsm_screen_sb_page_up(con, rnd() % 3);
+				break;
+			case 3:
+				tsm_screen_sb_page_down(con, rnd() % 3);
+				break;
+			default:
+				tsm_screen_sb_reset(con);
+				break;
+			}
+			tsm_screen_draw(con, test_draw_cb, NULL);
+		} else if (r < 97) {
+			err = check_selection(con);
+			tsm_screen_selection_reset(con);
+			tsm_screen_sb_reset(con);
+		} else {
+			err = check_text(con, &expect, small_sb);
+		}
+
+		if (!err)
+			err = check_screen(con);
+	}
+
+	if (!err)
+		err = check_text(con, &expect, small_sb);
+
+	if (err)
+		ret = fail("round %u step %u: %s", round, step, err);
+	else if (round % 10 == 0)
+		printf("round %u: %zu bytes, %u sb lines OK\n", round,
+		       expect.len, con->sb_count);
+
+	free(expect.buf);
+	tsm_vte_unref(vte);
+	tsm_screen_unref(con);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int rounds = ROUNDS, i;
+
+	if (argc > 1)
+		rounds = strtoul(argv[1], NULL, 0);
+
+	for (i = 0; i < rounds; i++) {
+		if (run_round(i))
+			return 1;
+	}
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,280 @@
+/*
+ * libtsm - SPSC Ring Buffer Test
+ *
+ * Copyright (c) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * SPSC Ring Buffer Test
+ * First the sizes and counters of shl-spsc are checked from a single
+ * thread. Then a producer thread passes a numbered byte stream to a
+ * consumer thread, the same way the terminal task and the main task of
+ * SSHTerm do. The producer alternates between shl_spsc_push() and writing
+ * part of what shl_spsc_reserve() returned, the consumer pulls random
+ * amounts of what shl_spsc_peek() returned and checks every byte. The
+ * counters start just below SIZE_MAX so that they wrap around during the
+ * run.
+ *
+ * The makefile also builds it with ThreadSanitizer, which checks that the
+ * data is ordered by the atomic head and tail.
+ *
+ * Usage: test-spsc [MB]
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "shl-spsc.h"
+#include "test-common.h"
+
+#define RING_SIZE 4096
+#ifndef STREAM_MB
+#define STREAM_MB 64
+#endif
+
+struct stream {
+	struct shl_spsc ring;
+	size_t total;
+	size_t failed_at;	/* position of the first bad byte or SIZE_MAX */
+};
+
+static bool failed(struct stream *s)
+{
+	return __atomic_load_n(&s->failed_at, __ATOMIC_RELAXED) != SIZE_MAX;
+}
+
+/* byte number \pos of the stream */
+static uint8_t stream_byte(size_t pos)
+{
+	return (pos ^ (pos >> 8) ^ (pos >> 17)) * 0x9d;
+}
+
+static int test_single(void)
+{
+	struct shl_spsc r;
+	struct iovec vec[2];
+	uint8_t buf[RING_SIZE];
+	size_t n;
+
+	if (shl_spsc_init(&r, 1) || r.size != RING_SIZE)
+		return fail("small size not raised to 4096");
+	shl_spsc_clear(&r);
+
+	if (shl_spsc_init(&r, 5000) || r.size != 8192)
+		return fail("size not rounded up to a power of 2");
+	shl_spsc_clear(&r);
+
+	if (shl_spsc_init(&r, RING_SIZE))
+		return fail("shl_spsc_init");
+
+	/* start just before the counters wrap */
+	r.head = r.tail = SIZE_MAX - 100;
+
+	if (shl_spsc_get_size(&r) != 0 || shl_spsc_get_free(&r) != RING_SIZE ||
+	    shl_spsc_peek(&r, vec) != 0)
+		return fail("new ring not empty");
+
+	memset(buf, 0x5a, sizeof(buf));
+	if (shl_spsc_push(&r, buf, 1000) != 1000 ||
+	    shl_spsc_get_size(&r) != 1000 ||
+	    shl_spsc_get_free(&r) != RING_SIZE - 1000)
+		return fail("counts after a push");
+
+	if (shl_spsc_push(&r, buf, RING_SIZE) != RING_SIZE - 1000 ||
+	    shl_spsc_get_free(&r) != 0 || shl_spsc_reserve(&r, vec) != 0 ||
+	    shl_spsc_push(&r, buf, 1) != 0)
+		return fail("full ring accepted data");
+
+	/* the stored data wraps around the end of the buffer */
+	n = shl_spsc_peek(&r, vec);
+	if (n != 2 || vec[0].iov_len + vec[1].iov_len != RING_SIZE)
+		return fail("peek of a wrapped full ring");
+
+	shl_spsc_pull(&r, RING_SIZE - 10);
+	if (shl_spsc_get_size(&r) != 10)
+		return fail("counts after a pull");
+
+	/* pulling more than there is only empties the ring */
+	shl_spsc_pull(&r, 100);
+	if (shl_spsc_get_size(&r) != 0 || shl_spsc_get_free(&r) != RING_SIZE)
+		return fail("pulling more than available");
+
+	if (r.head != (size_t)(SIZE_MAX - 100 + RING_SIZE) || r.head != r.tail)
+		return fail("counters did not wrap");
+
+	shl_spsc_clear(&r);
+	if (r.buf || r.size || r.head || r.tail)
+		return fail("shl_spsc_clear");
+
+	printf("single thread OK\n");
+
+	return 0;
+}
+
+static void *producer(void *data)
+{
+	struct stream *s = data;
+	struct iovec vec[2];
+	uint8_t buf[RING_SIZE];
+	uint32_t seed = 1;
+	size_t pos = 0, len, n, i, j, k;
+	uint8_t *p;
+
+	/* stops early if the consumer found a bad byte, as nothing pulls
+	 * from the ring any more */
+	while (pos < s->total && !failed(s)) {
+		len = 1 + rnd_r(&seed) % (rnd_r(&seed) % 4 ? 64 : RING_SIZE);
+		if (len > s->total - pos)
+			len = s->total - pos;
+
+		if (rnd_r(&seed) % 2) {
+			for (i = 0; i < len; i++)
+				buf[i] = stream_byte(pos + i);
+
+			n = shl_spsc_push(&s->ring, buf, len);
+		} else {
+			n = shl_spsc_reserve(&s->ring, vec);
+			if (n == 0) {
+				sched_yield();
+				continue;
+			}
+
+			/* part of the reserved space only */
+			for (i = j = 0; i < n && j < len; i++) {
+				p = vec[i].iov_base;
+				for (k = 0; k < vec[i].iov_len && j < len; k++, j++)
+					p[k] = stream_byte(pos + j);
+			}
+
+			shl_spsc_commit(&s->ring, j);
+			n = j;
+		}
+
+		if (n == 0)
+			sched_yield();
+		pos += n;
+	}
+
+	return NULL;
+}
+
+static void *consumer(void *data)
+{
+	struct stream *s = data;
+	struct iovec vec[2];
+	uint32_t seed = 2;
+	size_t pos = 0, len, n, i, j, k;
+	const uint8_t *p;
+
+	while (pos < s->total) {
+		n = shl_spsc_peek(&s->ring, vec);
+		if (n == 0) {
+			sched_yield();
+			continue;
+		}
+
+		len = vec[0].iov_len + (n == 2 ? vec[1].iov_len : 0);
+		if (rnd_r(&seed) % 2)
+			len = 1 + rnd_r(&seed) % len;
+
+		for (i = j = 0; i < n && j < len; i++) {
+			p = vec[i].iov_base;
+			for (k = 0; k < vec[i].iov_len && j < len; k++, j++) {
+				if (p[k] != stream_byte(pos + j)) {
+					__atomic_store_n(&s->failed_at, pos + j,
+							 __ATOMIC_RELAXED);
+					return NULL;
+				}
+			}
+		}
+
+		shl_spsc_pull(&s->ring, len);
+		pos += len;
+	}
+
+	return NULL;
+}
+
+static int test_threads(size_t mb)
+{
+	struct stream s;
+	pthread_t prod, cons;
+	struct timespec t0, t1;
+	double t;
+
+	memset(&s, 0, sizeof(s));
+	s.total = mb << 20;
+	s.failed_at = SIZE_MAX;
+
+	if (shl_spsc_init(&s.ring, RING_SIZE))
+		return fail("shl_spsc_init");
+
+	/* wraps after the first MB */
+	s.ring.head = s.ring.tail = SIZE_MAX - (1 << 20);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	if (pthread_create(&cons, NULL, consumer, &s))
+		return fail("pthread_create");
+	if (pthread_create(&prod, NULL, producer, &s))
+		return fail("pthread_create");
+
+	pthread_join(prod, NULL);
+	pthread_join(cons, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	t = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	if (s.failed_at != SIZE_MAX) {
+		fprintf(stderr, "FAIL: wrong byte at %zu\n", s.failed_at);
+		return 1;
+	}
+
+	if (shl_spsc_get_size(&s.ring) != 0)
+		return fail("data left over");
+
+	shl_spsc_clear(&s.ring);
+
+	printf("%zu MB through two threads OK (%.1f MB/s)\n", mb, mb / t);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	size_t mb = STREAM_MB;
+
+	if (argc > 1)
+		mb = strtoul(argv[1], NULL, 0);
+
+	if (test_single() || test_threads(mb))
+		return 1;
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,422 @@
+/*
+ * libtsm - UTF-8 Decoder Test
+ *
+ * Copyright (c) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * UTF-8 Decoder Test
+ * tsm_utf8_mach_decode() must give the same characters and leave the machine
+ * in the same state as feeding the bytes one by one to tsm_utf8_mach_feed().
+ * This is checked for every buffer of up to three bytes (two when starting
+ * in the middle of a character) from each state of the machine, and for random buffers of ASCII runs, valid and
+ * invalid sequences that are decoded in randomly split calls. The decoder
+ * must also not write past the characters it returns.
+ *
+ * The makefile builds it a second time with the portable ASCII test and
+ * unsigned chars, as in the AmigaOS build.
+ *
+ * With -b it reports the MB/s of both ways of decoding on mostly ASCII and
+ * on CJK/Cyrillic/emoji text, decoded in 256 byte blocks as tsm_vte_input()
+ * does.
+ *
+ * Usage: test-utf8 [-b]
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "libtsm.h"
+#include "libtsm-int.h"
+#include "test-common.h"
+
+#define BUFFERS    100000
+#define MAX_LEN    1024
+#define GUARD      32
+#define GUARD_VAL  0xdeadbeef
+
+#define BENCH_SIZE  (8 * 1024 * 1024)
+#define BENCH_BLOCK 256
+#define BENCH_RUNS  3
+
+/* feeds \in one byte at a time, as tsm_vte_input() used to */
+static size_t feed(struct tsm_utf8_mach *mach, const char *in, size_t len,
+		   uint32_t *out)
+{
+	size_t i, n = 0;
+	int state;
+
+	for (i = 0; i < len; i++) {
+		state = tsm_utf8_mach_feed(mach, in[i]);
+		if (state == TSM_UTF8_ACCEPT || state == TSM_UTF8_REJECT)
+			out[n++] = tsm_utf8_mach_get(mach);
+	}
+
+	return n;
+}
+
+static void dump(const char *in, size_t len)
+{
+	size_t i;
+
+	fprintf(stderr, "input:");
+	for (i = 0; i < len && i < 64; i++)
+		fprintf(stderr, " %02x", (unsigned char)in[i]);
+	fprintf(stderr, "%s\n", i < len ? " ..." : "");
+}
+
+/*
+ * Decodes \in with both the reference and tsm_utf8_mach_decode(), the
+ * latter in calls of the sizes in \splits (ending with 0, or NULL for one
+ * call), starting with the machine in \start. Returns 0 if both agree.
+ */
+static int check(const struct tsm_utf8_mach *start, const char *in,
+		 size_t len, const size_t *splits)
+{
+	static uint32_t ref[MAX_LEN], out[MAX_LEN + GUARD];
+	struct tsm_utf8_mach rmach = *start, mach = *start;
+	size_t rnum, num = 0, pos = 0, n, part, i;
+
+	rnum = feed(&rmach, in, len, ref);
+
+	while (pos < len) {
+		part = splits && *splits ? *splits++ : len - pos;
+		if (part > len - pos)
+			part = len - pos;
+
+		for (i = num + part; i < num + part + GUARD; i++)
+			out[i] = GUARD_VAL;
+
+		n = tsm_utf8_mach_decode(&mach, &in[pos], part, &out[num]);
+		if (n > part) {
+			fprintf(stderr, "FAIL: %zu characters from %zu bytes\n",
+				n, part);
+			goto fail;
+		}
+
+		for (i = num + part; i < num + part + GUARD; i++) {
+			if (out[i] != GUARD_VAL) {
+				fprintf(stderr, "FAIL: written past the end\n");
+				goto fail;
+			}
+		}
+
+		num += n;
+		pos += part;
+	}
+
+	if (num != rnum || memcmp(out, ref, num * sizeof(*out))) {
+		fprintf(stderr, "FAIL: %zu characters, expected %zu\n", num,
+			rnum);
+		for (i = 0; i < num && i < rnum; i++) {
+			if (out[i] != ref[i]) {
+				fprintf(stderr, "character %zu is U+%04x, "
+					"expected U+%04x\n", i, out[i], ref[i]);
+				break;
+			}
+		}
+		goto fail;
+	}
+
+	if (mach.state != rmach.state ||
+	    (mach.state >= TSM_UTF8_EXPECT1 && mach.ch != rmach.ch)) {
+		fprintf(stderr, "FAIL: machine in state %d, expected %d\n",
+			mach.state, rmach.state);
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	fprintf(stderr, "start state %d, ", start->state);
+	dump(in, len);
+	return 1;
+}
+
+/* every buffer of up to three bytes from the start state and of up to two
+ * from the others */
+static int test_all(void)
+{
+	static const struct tsm_utf8_mach starts[] = {
+		{ TSM_UTF8_START, 0 },
+		{ TSM_UTF8_ACCEPT, 'a' },
+		{ TSM_UTF8_REJECT, 0 },
+		{ TSM_UTF8_EXPECT1, 0x3 << 6 },
+		{ TSM_UTF8_EXPECT2, 0xa << 12 },
+		{ TSM_UTF8_EXPECT3, 0x1 << 18 },
+	};
+	char in[3];
+	unsigned int s, v;
+	size_t len;
+
+	for (s = 0; s < sizeof(starts) / sizeof(starts[0]); s++) {
+		for (len = 1; len <= (s == 0 ? 3 : 2); len++) {
+			for (v = 0; v < 1U << (len * 8); v++) {
+				in[0] = v;
+				in[1] = v >> 8;
+				in[2] = v >> 16;
+
+				if (check(&starts[s], in, len, NULL))
+					return 1;
+			}
+		}
+	}
+
+	printf("all short buffers from %zu states OK\n",
+	       sizeof(starts) / sizeof(starts[0]));
+
+	return 0;
+}
+
+static size_t put_utf8(char *p, uint32_t c)
+{
+	return tsm_ucs4_to_utf8(c, p);
+}
+
+/* Appends one random piece of input of at most 64 bytes */
+static size_t put_piece(char *p)
+{
+	static const unsigned char bad[] = {
+		0x80, 0xbf, 0xc0, 0xc1, 0xf5, 0xf8, 0xfc, 0xfe, 0xff
+	};
+	size_t len = 0, i, num;
+	char seq[8];
+
+	switch (rnd() % 8) {
+	case 0:
+	case 1:
+		/* ASCII runs of all lengths, for the vector test */
+		num = rnd() % 64;
+		for (i = 0; i < num; i++)
+			p[len++] = rnd() % 0x80;
+		break;
+	case 2:
+		len = put_utf8(p, 0x80 + rnd() % 0x780);
+		break;
+	case 3:
+		len = put_utf8(p, 0x800 + rnd() % 0xf800);
+		break;
+	case 4:
+		len = put_utf8(p, 0x10000 + rnd() % 0x100000);
+		break;
+	case 5:
+		/* a sequence cut short */
+		num = put_utf8(seq, 0x80 + rnd() % 0x10ff80);
+		if (!num)
+			break;
+		num = 1 + rnd() % num;
+		memcpy(p, seq, num);
+		len = num - (num > 1 ? rnd() % 2 : 0);
+		break;
+	case 6:
+		/* bytes that are never valid, lone continuations and
+		 * overlong forms */
+		switch (rnd() % 3) {
+		case 0:
+			p[len++] = bad[rnd() % sizeof(bad)];
+			break;
+		case 1:
+			p[len++] = 0xc0 | rnd() % 2;
+			p[len++] = 0x80 | rnd() % 0x40;
+			break;
+		default:
+			p[len++] = 0xe0;
+			p[len++] = 0x80 | rnd() % 0x20;
+			p[len++] = 0x80 | rnd() % 0x40;
+			break;
+		}
+		break;
+	default:
+		num = 1 + rnd() % 8;
+		for (i = 0; i < num; i++)
+			p[len++] = rnd() % 0x100;
+		break;
+	}
+
+	return len;
+}
+
+static int test_random(void)
+{
+	static char in[MAX_LEN + 64];
+	struct tsm_utf8_mach start;
+	size_t splits[MAX_LEN + 1];
+	size_t len, max, total, n;
+	unsigned int i;
+
+	for (i = 0; i < BUFFERS; i++) {
+		max = 1 + rnd() % MAX_LEN;
+		for (len = 0; len < max; )
+			len += put_piece(&in[len]);
+		if (len > MAX_LEN)
+			len = MAX_LEN;
+
+		n = 0;
+		for (total = 0; total < len; total += splits[n++])
+			splits[n] = 1 + rnd() % (rnd() % 2 ? 8 : len);
+		splits[n] = 0;
+
+		/* sometimes start in the middle of a sequence */
+		tsm_utf8_mach_init(&start);
+		if (rnd() % 4 == 0)
+			tsm_utf8_mach_feed(&start, 0xe2);
+
+		if (check(&start, in, len, splits))
+			return 1;
+	}
+
+	printf("%u random buffers OK\n", BUFFERS);
+
+	return 0;
+}
+
+/* benchmark */
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void gen_ascii(char *buf, size_t size)
+{
+	size_t len = 0;
+
+	while (len < size - 4) {
+		if (rnd() % 100 == 0)
+			len += put_utf8(&buf[len], 0xa0 + rnd() % 0x2000);
+		else if (rnd() % 60 == 0)
+			buf[len++] = '\n';
+		else
+			buf[len++] = 0x20 + rnd() % 0x5f;
+	}
+	while (len < size)
+		buf[len++] = ' ';
+}
+
+static void gen_text(char *buf, size_t size)
+{
+	size_t len = 0;
+
+	while (len < size - 4) {
+		switch (rnd() % 6) {
+		case 0:
+			buf[len++] = 0x20 + rnd() % 0x5f;
+			break;
+		case 1:
+		case 2:
+			len += put_utf8(&buf[len], 0x410 + rnd() % 0x40);
+			break;
+		case 3:
+		case 4:
+			len += put_utf8(&buf[len], 0x4e00 + rnd() % 0x5200);
+			break;
+		default:
+			len += put_utf8(&buf[len], 0x1f300 + rnd() % 0x300);
+			break;
+		}
+	}
+	while (len < size)
+		buf[len++] = ' ';
+}
+
+static double bench_run(const char *buf, size_t size, uint32_t *out,
+			bool block)
+{
+	struct tsm_utf8_mach mach;
+	size_t pos, part;
+	double t;
+
+	tsm_utf8_mach_init(&mach);
+
+	t = now();
+	for (pos = 0; pos < size; pos += part) {
+		part = size - pos < BENCH_BLOCK ? size - pos : BENCH_BLOCK;
+		if (block)
+			tsm_utf8_mach_decode(&mach, &buf[pos], part, out);
+		else
+			feed(&mach, &buf[pos], part, out);
+	}
+	t = now() - t;
+
+	return size / 1e6 / t;
+}
+
+static int bench(void)
+{
+	static uint32_t out[BENCH_BLOCK];
+	char *buf;
+	double f, d;
+	int i, j;
+
+	buf = malloc(BENCH_SIZE);
+	if (!buf)
+		return 1;
+
+	printf("%-10s %9s %9s\n", "input", "feed MB/s", "block MB/s");
+
+	for (i = 0; i < 2; i++) {
+		if (i == 0)
+			gen_ascii(buf, BENCH_SIZE);
+		else
+			gen_text(buf, BENCH_SIZE);
+
+		f = d = 0;
+		for (j = 0; j < BENCH_RUNS; j++) {
+			f = fmax(f, bench_run(buf, BENCH_SIZE, out, false));
+			d = fmax(d, bench_run(buf, BENCH_SIZE, out, true));
+		}
+
+		printf("%-10s %9.1f %9.1f\n", i == 0 ? "ascii" : "text", f, d);
+	}
+
+	free(buf);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b")) != -1) {
+		switch (opt) {
+		case 'b':
+			return bench();
+		default:
+			fprintf(stderr, "Usage: %s [-b]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (test_all() || test_random())
+		return 1;
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,1059 @@
+/*
+ * libtsm - VT Parser Comparison
+ *
+ * Copyright (c) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * VT Parser Comparison
+ * The table driven parser in tsm-vte.c replaced a parse_data() that
+ * switched on the input, first for the characters that are handled the
+ * same in every state and then per state. That parser is kept here as the
+ * reference, together with the byte at a time UTF-8 input loop of the time,
+ * and tsm-vte.c is included to get at its statics.
+ *
+ * The test has three parts:
+ * - The transition (next state and action) of both parsers is compared for
+ *   every state and every input from 0 to 0x10ffff and some beyond.
+ * - Random escape sequence streams, split at random, are fed to two vtes,
+ *   one of them driven by the reference. Replies, OSC strings, bells, the
+ *   parser state and the screen contents must stay the same.
+ * - The same is done for the recordings given on the command line.
+ *
+ * With -b the recordings are only fed through both input paths and the
+ * throughput of each is reported, the best of a few runs.
+ *
+ * Usage: vte-parser [-b] [FILE...]
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "../tsm/tsm-vte.c"
+#include "shl-macro.h"
+#include "test-common.h"
+
+#define STREAMS    2000
+#define STREAM_LEN 4096
+#define BENCH_RUNS 3
+
+typedef void (*trans_fn)(struct tsm_vte *vte, uint32_t data, int state,
+			 int act);
+
+/*
+ * Reference parser
+ * The body is unchanged from the switch-based parse_data(). It is given the
+ * function that performs the transition so that the transitions can also
+ * be recorded instead of performed.
+ */
+static inline __attribute__((always_inline))
+void old_parse(struct tsm_vte *vte, uint32_t raw, trans_fn do_trans)
+{
+	/* events that may occur in any state */
+	switch (raw) {
+		case 0x18:
+		case 0x1a:
+		case 0x80 ... 0x8f:
+		case 0x91 ... 0x97:
+		case 0x99:
+		case 0x9a:
+		case 0x9c:
+			do_trans(vte, raw, STATE_GROUND, ACTION_EXECUTE);
+			return;
+		case 0x1b:
+			do_trans(vte, raw, STATE_ESC, ACTION_NONE);
+			return;
+		case 0x98:
+		case 0x9e:
+		case 0x9f:
+			do_trans(vte, raw, STATE_ST_IGNORE, ACTION_NONE);
+			return;
+		case 0x90:
+			do_trans(vte, raw, STATE_DCS_ENTRY, ACTION_NONE);
+			return;
+		case 0x9d:
+			do_trans(vte, raw, STATE_OSC_STRING, ACTION_NONE);
+			return;
+		case 0x9b:
+			do_trans(vte, raw, STATE_CSI_ENTRY, ACTION_NONE);
+			return;
+	}
+
+	/* events that depend on the current state */
+	switch (vte->state) {
+	case STATE_GROUND:
+		switch (raw) {
+		case 0x00 ... 0x17:
+		case 0x19:
+		case 0x1c ... 0x1f:
+		case 0x80 ... 0x8f:
+		case 0x91 ... 0x9a:
+		case 0x9c:
+			do_trans(vte, raw, STATE_NONE, ACTION_EXECUTE);
+			return;
+		case 0x20 ... 0x7f:
+			do_trans(vte, raw, STATE_NONE, ACTION_PRINT);
+			return;
+		}
+		do_trans(vte, raw, STATE_NONE, ACTION_PRINT);
+		return;
+	case STATE_ESC:
+		switch (raw) {
+		case 0x00 ... 0x17:
+		case 0x19:
+		case 0x1c ... 0x1f:
+			do_trans(vte, raw, STATE_NONE, ACTION_EXECUTE);
+			return;
+		case 0x7f:
+			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
+			return;
+		case 0x20 ... 0x2f:
+			do_trans(vte, raw, STATE_ESC_INT, ACTION_COLLECT);
+			return;
+		case 0x30 ... 0x4f:
+		case 0x51 ... 0x57:
+		case 0x59:
+		case 0x5a:
+		case 0x5c:
+		case 0x60 ... 0x7e:
+			do_trans(vte, raw, STATE_GROUND, ACTION_ESC_DISPATCH);
+			return;
+		case 0x5b:
+			do_trans(vte, raw, STATE_CSI_ENTRY, ACTION_NONE);
+			return;
+		case 0x5d:
+			do_trans(vte, raw, STATE_OSC_STRING, ACTION_NONE);
+			return;
+		case 0x50:
+			do_trans(vte, raw, STATE_DCS_ENTRY, ACTION_NONE);
+			return;
+		case 0x58:
+		case 0x5e:
+		case 0x5f:
+			do_trans(vte, raw, STATE_ST_IGNORE, ACTION_NONE);
+			return;
+		}
+		do_trans(vte, raw, STATE_ESC_INT, ACTION_COLLECT);
+		return;
+	case STATE_ESC_INT:
+		switch (raw) {
+		case 0x00 ... 0x17:
+		case 0x19:
+		case 0x1c ... 0x1f:
+			do_trans(vte, raw, STATE_NONE, ACTION_EXECUTE);
+			return;
+		case 0x20 ... 0x2f:
+			do_trans(vte, raw, STATE_NONE, ACTION_COLLECT);
+			return;
+		case 0x7f:
+			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
+			return;
+		case 0x30 ... 0x7e:
+			do_trans(vte, raw, STATE_GROUND, ACTION_ESC_DISPATCH);
+			return;
+		}
+		do_trans(vte, raw, STATE_NONE, ACTION_COLLECT);
+		return;
+	case STATE_CSI_ENTRY:
+		switch (raw) {
+		case 0x00 ... 0x17:
+		case 0x19:
+		case 0x1c ... 0x1f:
+			do_trans(vte, raw, STATE_NONE, ACTION_EXECUTE);
+			return;
+		case 0x7f:
+			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
+			return;
+		case 0x20 ... 0x2f:
+			do_trans(vte, raw, STATE_CSI_INT, ACTION_COLLECT);
+			return;
+		case 0x3a:
+			do_trans(vte, raw, STATE_CSI_IGNORE, ACTION_NONE);
+			return;
+		case 0x30 ... 0x39:
+		case 0x3b:
+			do_trans(vte, raw, STATE_CSI_PARAM, ACTION_PARAM);
+			return;
+		case 0x3c ... 0x3f:
+			do_trans(vte, raw, STATE_CSI_PARAM, ACTION_COLLECT);
+			return;
+		case 0x40 ... 0x7e:
+			do_trans(vte, raw, STATE_GROUND, ACTION_CSI_DISPATCH);
+			return;
+		}
+		do_trans(vte, raw, STATE_CSI_IGNORE, ACTION_NONE);
+		return;
+	case STATE_CSI_PARAM:
+		switch (raw) {
+		case 0x00 ... 0x17:
+		case 0x19:
+		case 0x1c ... 0x1f:
+			do_trans(vte, raw, STATE_NONE, ACTION_EXECUTE);
+			return;
+		case 0x30 ... 0x39:
+		case 0x3b:
+			do_trans(vte, raw, STATE_NONE, ACTION_PARAM);
+			return;
+		case 0x7f:
+			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
+			return;
+		case 0x3a:
+		case 0x3c ... 0x3f:
+			do_trans(vte, raw, STATE_CSI_IGNORE, ACTION_NONE);
+			return;
+		case 0x20 ... 0x2f:
+			do_trans(vte, raw, STATE_CSI_INT, ACTION_COLLECT);
+			return;
+		case 0x40 ... 0x7e:
+			do_trans(vte, raw, STATE_GROUND, ACTION_CSI_DISPATCH);
+			return;
+		}
+		do_trans(vte, raw, STATE_CSI_IGNORE, ACTION_NONE);
+		return;
+	case STATE_CSI_INT:
+		switch (raw) {
+		case 0x00 ... 0x17:
+		case 0x19:
+		case 0x1c ... 0x1f:
+			do_trans(vte, raw, STATE_NONE, ACTION_EXECUTE);
+			return;
+		case 0x20 ... 0x2f:
+			do_trans(vte, raw, STATE_NONE, ACTION_COLLECT);
+			return;
+		case 0x7f:
+			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
+			return;
+		case 0x30 ... 0x3f:
+			do_trans(vte, raw, STATE_CSI_IGNORE, ACTION_NONE);
+			return;
+		case 0x40 ... 0x7e:
+			do_trans(vte, raw, STATE_GROUND, ACTION_CSI_DISPATCH);
+			return;
+		}
+		do_trans(vte, raw, STATE_CSI_IGNORE, ACTION_NONE);
+		return;
+	case STATE_CSI_IGNORE:
+		switch (raw) {
+		case 0x00 ... 0x17:
+		case 0x19:
+		case 0x1c ... 0x1f:
+			do_trans(vte, raw, STATE_NONE, ACTION_EXECUTE);
+			return;
+		case 0x20 ... 0x3f:
+		case 0x7f:
+			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
+			return;
+		case 0x40 ... 0x7e:
+			do_trans(vte, raw, STATE_GROUND, ACTION_NONE);
+			return;
+		}
+		do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
+		return;
+	case STATE_DCS_ENTRY:
+		switch (raw) {
+		case 0x00 ... 0x17:
+		case 0x19:
+		case 0x1c ... 0x1f:
+		case 0x7f:
+			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
+			return;
+		case 0x3a:
+			do_trans(vte, raw, STATE_DCS_IGNORE, ACTION_NONE);
+			return;
+		case 0x20 ... 0x2f:
+			do_trans(vte, raw, STATE_DCS_INT, ACTION_COLLECT);
+			return;
+		case 0x30 ... 0x39:
+		case 0x3b:
+			do_trans(vte, raw, STATE_DCS_PARAM, ACTION_PARAM);
+			return;
+		case 0x3c ... 0x3f:
+			do_trans(vte, raw, STATE_DCS_PARAM, ACTION_COLLECT);
+			return;
+		case 0x40 ... 0x7e:
+			do_trans(vte, raw, STATE_DCS_PASS, ACTION_NONE);
+			return;
+		}
+		do_trans(vte, raw, STATE_DCS_PASS, ACTION_NONE);
+		return;
+	case STATE_DCS_PARAM:
+		switch (raw) {
+		case 0x00 ... 0x17:
+		case 0x19:
+		case 0x1c ... 0x1f:
+		case 0x7f:
+			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
+			return;
+		case 0x30 ... 0x39:
+		case 0x3b:
+			do_trans(vte, raw, STATE_NONE, ACTION_PARAM);
+			return;
+		case 0x3a:
+		case 0x3c ... 0x3f:
+			do_trans(vte, raw, STATE_DCS_IGNORE, ACTION_NONE);
+			return;
+		case 0x20 ... 0x2f:
+			do_trans(vte, raw, STATE_DCS_INT, ACTION_COLLECT);
+			return;
+		case 0x40 ... 0x7e:
+			do_trans(vte, raw, STATE_DCS_PASS, ACTION_NONE);
+			return;
+		}
+		do_trans(vte, raw, STATE_DCS_PASS, ACTION_NONE);
+		return;
+	case STATE_DCS_INT:
+		switch (raw) {
+		case 0x00 ... 0x17:
+		case 0x19:
+		case 0x1c ... 0x1f:
+		case 0x7f:
+			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
+			return;
+		case 0x20 ... 0x2f:
+			do_trans(vte, raw, STATE_NONE, ACTION_COLLECT);
+			return;
+		case 0x30 ... 0x3f:
+			do_trans(vte, raw, STATE_DCS_IGNORE, ACTION_NONE);
+			return;
+		case 0x40 ... 0x7e:
+			do_trans(vte, raw, STATE_DCS_PASS, ACTION_NONE);
+			return;
+		}
+		do_trans(vte, raw, STATE_DCS_PASS, ACTION_NONE);
+		return;
+	case STATE_DCS_PASS:
+		switch (raw) {
+		case 0x00 ... 0x17:
+		case 0x19:
+		case 0x1c ... 0x1f:
+		case 0x20 ... 0x7e:
+			do_trans(vte, raw, STATE_NONE, ACTION_DCS_COLLECT);
+			return;
+		case 0x7f:
+			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
+			return;
+		case 0x9c:
+			do_trans(vte, raw, STATE_GROUND, ACTION_NONE);
+			return;
+		}
+		do_trans(vte, raw, STATE_NONE, ACTION_DCS_COLLECT);
+		return;
+	case STATE_DCS_IGNORE:
+		switch (raw) {
+		case 0x00 ... 0x17:
+		case 0x19:
+		case 0x1c ... 0x1f:
+		case 0x20 ... 0x7f:
+			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
+			return;
+		case 0x9c:
+			do_trans(vte, raw, STATE_GROUND, ACTION_NONE);
+			return;
+		}
+		do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
+		return;
+	case STATE_OSC_STRING:
+		switch (raw) {
+		case 0x00 ... 0x06:
+		case 0x08 ... 0x17:
+		case 0x19:
+		case 0x1c ... 0x1f:
+			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
+			return;
+		case 0x20 ... 0x7f:
+			do_trans(vte, raw, STATE_NONE, ACTION_OSC_COLLECT);
+			return;
+		case 0x07:
+		case 0x9c:
+			do_trans(vte, raw, STATE_GROUND, ACTION_NONE);
+			return;
+		}
+		do_trans(vte, raw, STATE_NONE, ACTION_OSC_COLLECT);
+		return;
+	case STATE_ST_IGNORE:
+		switch (raw) {
+		case 0x00 ... 0x17:
+		case 0x19:
+		case 0x1c ... 0x1f:
+		case 0x20 ... 0x7f:
+			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
+			return;
+		case 0x9c:
+			do_trans(vte, raw, STATE_GROUND, ACTION_NONE);
+			return;
+		}
+		do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
+		return;
+	}
+
+	llog_warning(vte, "unhandled input %u in state %d", raw, vte->state);
+}
+
+static void old_parse_data(struct tsm_vte *vte, uint32_t raw)
+{
+	old_parse(vte, raw, do_trans);
+}
+
+/* tsm_vte_input() as it was with the reference parser */
+static void old_vte_input(struct tsm_vte *vte, const char *u8, size_t len)
+{
+	int state;
+	uint32_t ucs4;
+	size_t i;
+
+	++vte->parse_cnt;
+	for (i = 0; i < len; ++i) {
+		if (vte->flags & TSM_VTE_FLAG_7BIT_MODE) {
+			old_parse_data(vte, u8[i] & 0x7f);
+		} else if (vte->flags & TSM_VTE_FLAG_8BIT_MODE) {
+			old_parse_data(vte, u8[i]);
+		} else {
+			state = tsm_utf8_mach_feed(&vte->mach, u8[i]);
+			if (state == TSM_UTF8_ACCEPT ||
+			    state == TSM_UTF8_REJECT) {
+				ucs4 = tsm_utf8_mach_get(&vte->mach);
+				old_parse_data(vte, ucs4);
+			}
+		}
+	}
+	--vte->parse_cnt;
+}
+
+/* transition tables */
+
+static int rec_trans;
+
+static void record_trans(struct tsm_vte *vte, uint32_t data, int state,
+			 int act)
+{
+	rec_trans = TRANS(state, act);
+}
+
+static int old_trans(unsigned int state, uint32_t raw)
+{
+	struct tsm_vte vte;
+
+	memset(&vte, 0, sizeof(vte));
+	vte.state = state;
+
+	rec_trans = -1;
+	old_parse(&vte, raw, record_trans);
+
+	return rec_trans;
+}
+
+/* what parse_data() does for \raw, the ground fast path included */
+static int new_trans(unsigned int state, uint32_t raw)
+{
+	if (state == STATE_GROUND &&
+	    ((raw >= 0x20 && raw <= 0x7f) || raw >= HIGH_CLASS))
+		return TRANS(STATE_NONE, ACTION_PRINT);
+
+	return vte_trans[state][raw < HIGH_CLASS ? raw : HIGH_CLASS];
+}
+
+static int test_table(void)
+{
+	static const uint32_t beyond[] = {
+		0x110000, 0x7fffffff, 0x80000000, 0xffffffff
+	};
+	uint32_t num = 0x110000 + SHL_ARRAY_LENGTH(beyond);
+	unsigned int state;
+	uint32_t raw, c;
+	int o, n, ret = 0;
+
+	for (state = STATE_GROUND; state < STATE_NUM; state++) {
+		for (raw = 0; raw < num; raw++) {
+			c = raw < 0x110000 ? raw : beyond[raw - 0x110000];
+			o = old_trans(state, c);
+			n = new_trans(state, c);
+
+			if (o != n) {
+				fprintf(stderr, "FAIL: state %u input 0x%x: "
+					"state %d action %d, expected state %d "
+					"action %d\n", state, c, TRANS_STATE(n),
+					TRANS_ACTION(n), TRANS_STATE(o),
+					TRANS_ACTION(o));
+				if (++ret == 10)
+					return ret;
+			}
+		}
+	}
+
+	if (!ret)
+		printf("transitions for %d states x %u inputs OK\n",
+		       STATE_NUM - 1, num);
+
+	return ret;
+}
+
+/* terminal pairs */
+
+struct side {
+	struct tsm_screen *con;
+	struct tsm_vte *vte;
+	uint64_t out;		/* hash of replies, OSC strings and bells */
+};
+
+static uint64_t fnv1a(uint64_t hash, uint32_t v)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		hash ^= (v >> (i * 8)) & 0xff;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+static uint64_t fnv1a_buf(uint64_t hash, const char *u8, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		hash = fnv1a(hash, (unsigned char)u8[i]);
+
+	return hash;
+}
+
+static void write_cb(struct tsm_vte *vte, const char *u8, size_t len,
+		     void *data)
+{
+	struct side *s = data;
+
+	s->out = fnv1a_buf(fnv1a(s->out, 'W'), u8, len);
+}
+
+static void osc_cb(struct tsm_vte *vte, const char *u8, size_t len,
+		   void *data)
+{
+	struct side *s = data;
+
+	s->out = fnv1a_buf(fnv1a(s->out, 'O'), u8, len);
+}
+
+static void bell_cb(struct tsm_vte *vte, void *data)
+{
+	struct side *s = data;
+
+	s->out = fnv1a(s->out, 'B');
+}
+
+static int hash_cb(struct tsm_screen *con, const uint32_t *ch, size_t len,
+		   unsigned int width, unsigned int posx, unsigned int posy,
+		   const struct tsm_screen_attr *attr, tsm_age_t age,
+		   void *data)
+{
+	uint64_t *hash = data;
+	size_t i;
+
+	*hash = fnv1a(*hash, posx | posy << 16);
+	*hash = fnv1a(*hash, width | len << 8);
+	for (i = 0; i < len; i++)
+		*hash = fnv1a(*hash, ch[i]);
+
+	*hash = fnv1a(*hash, (uint8_t)attr->fccode | (uint8_t)attr->bccode << 8);
+	*hash = fnv1a(*hash, attr->fr | attr->fg << 8 | attr->fb << 16);
+	*hash = fnv1a(*hash, attr->br | attr->bg << 8 | attr->bb << 16);
+	*hash = fnv1a(*hash, attr->bold | attr->italic << 1 |
+			     attr->underline << 2 | attr->inverse << 3 |
+			     attr->protect << 4 | attr->blink << 5);
+
+	return 0;
+}
+
+static int side_new(struct side *s)
+{
+	memset(s, 0, sizeof(*s));
+	s->out = 0xcbf29ce484222325ULL;
+
+	if (tsm_screen_new(&s->con, test_log_cb, NULL) < 0)
+		return -1;
+
+	if (tsm_vte_new(&s->vte, s->con, write_cb, s, test_log_cb, NULL) < 0) {
+		tsm_screen_unref(s->con);
+		return -1;
+	}
+
+	tsm_vte_set_osc_cb(s->vte, osc_cb, s);
+	tsm_vte_set_bell_cb(s->vte, bell_cb, s);
+	tsm_screen_set_max_sb(s->con, 200);
+
+	return 0;
+}
+
+static void side_free(struct side *s)
+{
+	tsm_vte_unref(s->vte);
+	tsm_screen_unref(s->con);
+}
+
+static uint64_t side_hash(struct side *s)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	tsm_screen_draw(s->con, hash_cb, &hash);
+	hash = fnv1a(hash, tsm_screen_get_cursor_x(s->con));
+	hash = fnv1a(hash, tsm_screen_get_cursor_y(s->con));
+	hash = fnv1a(hash, tsm_screen_get_flags(s->con));
+	hash = fnv1a(hash, s->vte->flags);
+
+	return hash;
+}
+
+/* Returns 0 if the two sides agree, with the screens compared only if
+ * \screen is set as drawing them is slow */
+static int compare(struct side *o, struct side *n, bool screen)
+{
+	if (o->vte->state != n->vte->state)
+		return -1;
+	if (o->out != n->out)
+		return -1;
+	if (screen && side_hash(o) != side_hash(n))
+		return -1;
+
+	return 0;
+}
+
+/* random streams */
+
+static size_t put_utf8(char *p, uint32_t c)
+{
+	return tsm_ucs4_to_utf8(c, p);
+}
+
+/* An introducer for CSI, OSC, DCS or ST, as a 7-bit ESC sequence or an
+ * 8-bit C1 code in UTF-8 */
+static size_t put_c1(char *p, uint32_t c1)
+{
+	if (rnd() % 4) {
+		p[0] = 0x1b;
+		p[1] = c1 - 0x40;
+		return 2;
+	}
+
+	return put_utf8(p, c1);
+}
+
+static size_t put_params(char *p)
+{
+	static const char chars[] = "0123456789;;;:";
+	size_t len = 0;
+	unsigned int i, num = rnd() % 12;
+
+	for (i = 0; i < num; i++)
+		p[len++] = chars[rnd() % (sizeof(chars) - 1)];
+
+	return len;
+}
+
+static size_t put_string(char *p)
+{
+	size_t len = 0;
+	unsigned int i, num = rnd() % 40;
+	uint32_t c;
+
+	for (i = 0; i < num; i++) {
+		c = rnd() % 16 ? 0x20 + rnd() % 0x5f : rnd() % 0x100;
+		len += put_utf8(&p[len], c);
+	}
+
+	return len;
+}
+
+/* Appends one random piece of terminal output and returns its length,
+ * which is at most 128 bytes */
+static size_t put_piece(char *p)
+{
+	static const char csi_finals[] = "@ABCDEFGHIJKLMPSTXZ`abcdefghilmnpqrstuxz";
+	static const char esc_finals[] = "78=>DEHMNOZc\\|}~";
+	static const char controls[] = "\a\b\t\n\v\f\r\016\017\030\032\033\177";
+	size_t len = 0;
+	unsigned int i, num;
+
+	switch (rnd() % 12) {
+	case 0:
+	case 1:
+		/* text */
+		num = 1 + rnd() % 30;
+		for (i = 0; i < num; i++)
+			p[len++] = 0x20 + rnd() % 0x5f;
+		break;
+	case 2:
+		/* text outside ASCII: Latin-1, C1 codes, CJK, emoji */
+		num = 1 + rnd() % 8;
+		for (i = 0; i < num; i++) {
+			switch (rnd() % 4) {
+			case 0:
+				len += put_utf8(&p[len], 0x80 + rnd() % 0x80);
+				break;
+			case 1:
+				len += put_utf8(&p[len], 0x4e00 + rnd() % 0x1000);
+				break;
+			case 2:
+				len += put_utf8(&p[len], 0x1f300 + rnd() % 0x300);
+				break;
+			default:
+				len += put_utf8(&p[len], 0x100 + rnd() % 0x2000);
+				break;
+			}
+		}
+		break;
+	case 3:
+		p[len++] = controls[rnd() % (sizeof(controls) - 1)];
+		break;
+	case 4:
+	case 5:
+	case 6:
+		/* CSI with an optional private marker and intermediate */
+		len += put_c1(&p[len], 0x9b);
+		if (rnd() % 3 == 0)
+			p[len++] = 0x3c + rnd() % 4;
+		len += put_params(&p[len]);
+		if (rnd() % 6 == 0)
+			p[len++] = 0x20 + rnd() % 0x10;
+		if (rnd() % 8 == 0)
+			p[len++] = rnd() % 0x80;
+		p[len++] = rnd() % 8 ? csi_finals[rnd() % (sizeof(csi_finals) - 1)] :
+				       0x40 + rnd() % 0x3f;
+		break;
+	case 7:
+		/* ESC with optional intermediates, which includes charset
+		 * designations and DECSCL 7bit/8bit switches */
+		p[len++] = 0x1b;
+		num = rnd() % 3;
+		for (i = 0; i < num; i++)
+			p[len++] = 0x20 + rnd() % 0x10;
+		p[len++] = rnd() % 2 ? esc_finals[rnd() % (sizeof(esc_finals) - 1)] :
+				       0x30 + rnd() % 0x4f;
+		break;
+	case 8:
+		/* OSC ended by BEL or ST, or not at all */
+		len += put_c1(&p[len], 0x9d);
+		len += put_params(&p[len]);
+		len += put_string(&p[len]);
+		switch (rnd() % 3) {
+		case 0:
+			p[len++] = '\a';
+			break;
+		case 1:
+			len += put_c1(&p[len], 0x9c);
+			break;
+		}
+		break;
+	case 9:
+		/* DCS, SOS, PM or APC ended by ST */
+		len += put_c1(&p[len], (uint32_t[]){ 0x90, 0x98, 0x9e, 0x9f }[rnd() % 4]);
+		len += put_params(&p[len]);
+		len += put_string(&p[len]);
+		if (rnd() % 4)
+			len += put_c1(&p[len], 0x9c);
+		break;
+	case 10:
+		/* raw bytes, mostly invalid UTF-8 */
+		num = 1 + rnd() % 4;
+		for (i = 0; i < num; i++)
+			p[len++] = rnd() % 0x100;
+		break;
+	default:
+		/* a query, so that replies are compared as well */
+		len += put_c1(&p[len], 0x9b);
+		len += snprintf(&p[len], 16, "%s", (const char *[]){
+			"c", ">c", "5n", "6n", "?6n", "x", "1x", "?1$p"
+		}[rnd() % 8]);
+		break;
+	}
+
+	return len;
+}
+
+static int test_streams(void)
+{
+	static char buf[STREAM_LEN + 128];
+	struct side o, n;
+	unsigned int i;
+	size_t len, pos, chunk;
+	int ret = 0;
+
+	for (i = 0; i < STREAMS && !ret; i++) {
+		if (side_new(&o))
+			return 1;
+		if (side_new(&n)) {
+			side_free(&o);
+			return 1;
+		}
+
+		for (len = 0; len < STREAM_LEN; )
+			len += put_piece(&buf[len]);
+
+		for (pos = 0; pos < len; pos += chunk) {
+			chunk = 1 + rnd() % (rnd() % 4 ? 16 : 1024);
+			if (chunk > len - pos)
+				chunk = len - pos;
+
+			old_vte_input(o.vte, &buf[pos], chunk);
+			tsm_vte_input(n.vte, &buf[pos], chunk);
+
+			if (compare(&o, &n, rnd() % 8 == 0)) {
+				fprintf(stderr, "FAIL: stream %u differs after "
+					"%zu bytes\n", i, pos + chunk);
+				ret = 1;
+				break;
+			}
+		}
+
+		if (!ret && compare(&o, &n, true)) {
+			fprintf(stderr, "FAIL: stream %u differs at the end\n", i);
+			ret = 1;
+		}
+
+		side_free(&n);
+		side_free(&o);
+	}
+
+	if (!ret)
+		printf("%u random streams OK\n", STREAMS);
+
+	return ret;
+}
+
+/* recordings */
+
+static uint32_t get_le32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+struct block {
+	char *data;
+	size_t len;
+};
+
+/* Reads the blocks of a recording, the data of which is kept in one
+ * buffer */
+static int read_recording(const char *path, struct block **blocks,
+			  size_t *num, char **data)
+{
+	unsigned char header[12];
+	size_t size = 0, len, n = 0, max = 0, i;
+	char *buf = NULL;
+	struct block *b = NULL;
+	FILE *f;
+	void *p;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while (fread(header, sizeof(header), 1, f) == 1) {
+		len = get_le32(&header[8]);
+
+		if (n == max) {
+			max = max ? max * 2 : 1024;
+			p = realloc(b, max * sizeof(*b));
+			if (!p)
+				goto err;
+			b = p;
+		}
+
+		p = realloc(buf, size + len);
+		if (!p)
+			goto err;
+		buf = p;
+
+		if (fread(&buf[size], len, 1, f) != 1) {
+			fprintf(stderr, "%s: truncated recording\n", path);
+			goto err;
+		}
+
+		/* offsets for now, as the buffer may still move */
+		b[n].data = (char *)size;
+		b[n].len = len;
+		n++;
+		size += len;
+	}
+
+	if (ferror(f)) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		goto err;
+	}
+
+	fclose(f);
+
+	for (i = 0; i < n; i++)
+		b[i].data = buf + (size_t)b[i].data;
+
+	*blocks = b;
+	*num = n;
+	*data = buf;
+	return 0;
+
+err:
+	free(b);
+	free(buf);
+	fclose(f);
+	return -1;
+}
+
+static int test_recording(const char *path)
+{
+	struct block *blocks;
+	char *data;
+	struct side o, n;
+	size_t num, i;
+	int ret = 0;
+
+	if (read_recording(path, &blocks, &num, &data))
+		return 1;
+
+	if (side_new(&o))
+		goto out;
+	if (side_new(&n)) {
+		side_free(&o);
+		goto out;
+	}
+
+	for (i = 0; i < num; i++) {
+		old_vte_input(o.vte, blocks[i].data, blocks[i].len);
+		tsm_vte_input(n.vte, blocks[i].data, blocks[i].len);
+
+		if (compare(&o, &n, i % 64 == 0 || i == num - 1)) {
+			fprintf(stderr, "FAIL: %s: differs after block %zu\n",
+				path, i);
+			ret = 1;
+			break;
+		}
+	}
+
+	if (!ret)
+		printf("%s OK\n", path);
+
+	side_free(&n);
+	side_free(&o);
+	free(blocks);
+	free(data);
+	return ret;
+
+out:
+	free(blocks);
+	free(data);
+	return 1;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Returns the MB/s of feeding \blocks to a new vte with \input */
+static double bench_input(struct block *blocks, size_t num,
+			  void (*input)(struct tsm_vte *vte, const char *u8,
+					size_t len))
+{
+	struct side s;
+	size_t bytes = 0, i;
+	double t;
+
+	if (side_new(&s))
+		return 0;
+
+	t = now();
+	for (i = 0; i < num; i++) {
+		input(s.vte, blocks[i].data, blocks[i].len);
+		bytes += blocks[i].len;
+	}
+	t = now() - t;
+
+	side_free(&s);
+	return bytes / 1e6 / t;
+}
+
+static int bench_recording(const char *path)
+{
+	struct block *blocks;
+	char *data;
+	size_t num;
+	double o = 0, n = 0;
+	int i;
+
+	if (read_recording(path, &blocks, &num, &data))
+		return 1;
+
+	/* the best of a few runs, taken in turns, as timings on a busy host
+	 * vary a lot */
+	for (i = 0; i < BENCH_RUNS; i++) {
+		o = fmax(o, bench_input(blocks, num, old_vte_input));
+		n = fmax(n, bench_input(blocks, num, tsm_vte_input));
+	}
+
+	printf("%-24s %8.1f %8.1f %+7.1f%%\n", path, o, n, (n / o - 1) * 100);
+
+	free(blocks);
+	free(data);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	bool bench = false;
+	int opt, i, ret = 0;
+
+	while ((opt = getopt(argc, argv, "b")) != -1) {
+		switch (opt) {
+		case 'b':
+			bench = true;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-b] [FILE...]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (bench) {
+		printf("%-24s %8s %8s %8s\n", "recording", "old MB/s",
+		       "new MB/s", "change");
+		for (i = optind; i < argc; i++) {
+			if (bench_recording(argv[i]))
+				return 1;
+		}
+		return 0;
+	}
+
+	if (test_table() || test_streams())
+		return 1;
+
+	for (i = optind; i < argc; i++)
+		ret |= test_recording(argv[i]);
+
+	if (!ret)
+		printf("OK\n");
+
+	return ret;
+}
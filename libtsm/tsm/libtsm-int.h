@@ -77,6 +77,8 @@ void tsm_utf8_mach_init(struct tsm_utf8_mach *mach);
 int tsm_utf8_mach_feed(struct tsm_utf8_mach *mach, char c);
 uint32_t tsm_utf8_mach_get(struct tsm_utf8_mach *mach);
 void tsm_utf8_mach_reset(struct tsm_utf8_mach *mach);
+size_t tsm_utf8_mach_decode(struct tsm_utf8_mach *mach, const char *in,
+			    size_t len, uint32_t *out);
 
 /* TSM screen */
 
@@ -95,6 +97,9 @@ struct line {
 	struct cell *cells; /* actuall cells */
 	uint64_t sb_id;     /* sb ID */
 	tsm_age_t age;      /* age of the whole line */
+	bool blink;         /* may contain blinking cells */
+	bool wrapped;       /* text continues on the next line (auto-wrap) */
+	unsigned int width; /* screen width when moved into sb */
 };
 
 #define SELECTION_TOP -1
@@ -153,6 +158,7 @@ struct tsm_screen {
 };
 
 void screen_cell_init(struct tsm_screen *con, struct cell *cell);
+void screen_sb_reflow_view(struct tsm_screen *con);
 
 void tsm_screen_set_opts(struct tsm_screen *scr, unsigned int opts);
 void tsm_screen_reset_opts(struct tsm_screen *scr, unsigned int opts);
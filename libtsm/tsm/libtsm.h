@@ -255,6 +255,7 @@ unsigned int tsm_screen_get_sb_top(struct tsm_screen *con);
 unsigned int tsm_screen_get_sb_visible(struct tsm_screen *con);
 unsigned int tsm_screen_get_sb_total(struct tsm_screen *con);
 bool tsm_screen_blink(struct tsm_screen *con);
+bool tsm_screen_has_blink(struct tsm_screen *con);
 
 void tsm_screen_selection_reset(struct tsm_screen *con);
 void tsm_screen_selection_start(struct tsm_screen *con,
@@ -314,6 +315,8 @@ struct tsm_vte;
 #define TSM_VTE_FLAG_BACKGROUND_COLOR_ERASE_MODE 0x00008000 /* Set background color on erase (bce) */
 #define TSM_VTE_FLAG_PREPEND_ESCAPE              0x00010000 /* Prepend escape character to next output */
 #define TSM_VTE_FLAG_TITE_INHIBIT_MODE           0x00020000 /* Prevent switching to alternate screen buffer */
+#define TSM_VTE_FLAG_SYNCHRONIZED_OUTPUT_MODE    0x00040000 /* Application is drawing a frame (mode 2026) */
+#define TSM_VTE_FLAG_BRACKETED_PASTE_MODE        0x00080000 /* Enclose pasted text in CSI 200~/201~ (mode 2004) */
 
 /* keep in sync with shl_xkb_mods */
 enum tsm_vte_modifier {
@@ -444,6 +447,19 @@ const uint8_t (*tsm_vte_get_palette_rgb(struct tsm_vte *vte))[3];
 void tsm_vte_get_def_attr(struct tsm_vte *vte, struct tsm_screen_attr *out);
 unsigned int tsm_vte_get_flags(struct tsm_vte *vte);
 
+/**
+ * @brief Check if the screen should be left undrawn for now.
+ *
+ * Applications that support synchronized output (DEC private mode 2026)
+ * set the mode before updating the screen and reset it when done, so that
+ * the terminal can skip drawing the half finished frame. The mode is
+ * dropped if it has been set for too long.
+ *
+ * @param vte The vte object to check
+ * @return \c true while an update is in progress
+ */
+bool tsm_vte_synchronized_update(struct tsm_vte *vte);
+
 void tsm_vte_reset(struct tsm_vte *vte);
 void tsm_vte_hard_reset(struct tsm_vte *vte);
 void tsm_vte_input(struct tsm_vte *vte, const char *u8, size_t len);
@@ -460,6 +476,25 @@ void tsm_vte_input(struct tsm_vte *vte, const char *u8, size_t len);
  * @param enable Send ASCII delete if \c true, send ASCII backspace if \c false.
  */
 void tsm_vte_set_backspace_sends_delete(struct tsm_vte *vte, bool enable);
+
+/**
+ * @brief Send pasted text to the application.
+ *
+ * The whole buffer is converted in one go and handed to the write callback
+ * as a single chunk. Line breaks (LF, CR or CR LF) are sent the way the
+ * return key would send them and characters that cannot be represented in
+ * 7bit or 8bit mode are replaced by '?'. If the application has enabled
+ * bracketed paste mode (DEC private mode 2004) the text is enclosed in
+ * CSI 200~ and CSI 201~, and any ESC characters are removed from it so
+ * that it cannot end the paste early.
+ *
+ * @param vte The vte object to send the text through
+ * @param u8 UTF-8 encoded text
+ * @param len Length of \p u8 in bytes
+ * @return \c false if vte is NULL or memory could not be allocated
+ */
+bool tsm_vte_paste(struct tsm_vte *vte, const char *u8, size_t len);
+
 #ifdef __amigaos4__
 bool tsm_vte_handle_keyboard_amiga(struct tsm_vte *vte, uint16_t code,
                                    uint16_t qualifier, uint32_t unicode);
@@ -471,6 +506,53 @@ bool tsm_vte_handle_keyboard(struct tsm_vte *vte, uint32_t keysym,
 
 /** @} */
 
+/**
+ * @defgroup predict Predictive Local Echo
+ * Speculative echo of keystrokes on slow connections
+ *
+ * A prediction object guesses how the screen will look once the application
+ * has echoed the keys the user typed, so that they can be shown right away
+ * instead of after a full round trip. Predictions are checked against the
+ * screen whenever the application output has been processed and are removed
+ * when they come true. A wrong prediction or one that is not confirmed in
+ * time removes all of them.
+ *
+ * Predictions are made in epochs. Every key that cannot be predicted (such
+ * as return) starts a new epoch, and the predictions of an epoch are only
+ * shown once one of them has come true. This keeps them off the screen at
+ * password prompts and in applications that do not echo what is typed.
+ * They are also only shown while the measured echo delay is long enough to
+ * be noticed.
+ *
+ * All times are in milliseconds from an arbitrary starting point.
+ *
+ * @{
+ */
+
+struct tsm_predict;
+
+/* keys for tsm_predict_key() */
+#define TSM_PREDICT_CHAR      0 /* printable character */
+#define TSM_PREDICT_BACKSPACE 1 /* erase the character left of the cursor */
+#define TSM_PREDICT_LEFT      2 /* cursor left */
+#define TSM_PREDICT_RIGHT     3 /* cursor right */
+#define TSM_PREDICT_OTHER     4 /* anything else */
+
+int tsm_predict_new(struct tsm_predict **out, struct tsm_screen *con,
+                    tsm_log_t log, void *log_data);
+void tsm_predict_ref(struct tsm_predict *pr);
+void tsm_predict_unref(struct tsm_predict *pr);
+
+void tsm_predict_key(struct tsm_predict *pr, unsigned int key,
+                     uint32_t ucs4, uint64_t now);
+bool tsm_predict_update(struct tsm_predict *pr, uint64_t now);
+bool tsm_predict_pending(struct tsm_predict *pr);
+unsigned int tsm_predict_get_srtt(struct tsm_predict *pr);
+void tsm_predict_draw(struct tsm_predict *pr, tsm_screen_draw_cb draw_cb,
+                      void *data);
+
+/** @} */
+
 #ifdef __cplusplus
 }
 #endif
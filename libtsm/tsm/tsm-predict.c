@@ -0,0 +1,572 @@
+/*
+ * libtsm - Predictive Local Echo
+ *
+ * Copyright (c) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Predictive Local Echo
+ * Each key that is predicted adds an entry with the cell it is expected to
+ * change and where the cursor should end up, starting from the cursor
+ * position of the previous entry (or the real cursor if there is none).
+ * After the application output has been processed the entries are checked
+ * from the newest: an entry whose cell has been written to with the
+ * expected contents once the cursor has moved past it is confirmed and
+ * removed together with the entries before it. The time from key press to
+ * confirmation is the echo delay that is used to decide whether predictions
+ * are worth showing and how long to wait for them. The oldest entry was
+ * wrong if it is still not confirmed when the cursor has moved past it or
+ * on to another line, or when it times out. After that no predictions are
+ * made until the keys typed before have had time to be echoed.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libtsm.h"
+#include "libtsm-int.h"
+#include "shl-llog.h"
+
+#define LLOG_SUBSYSTEM "tsm-predict"
+
+#define PREDICT_MAX 64
+
+/* show predictions while the smoothed echo delay is above ENGAGE and stop
+ * again once it falls below DISENGAGE */
+#define PREDICT_ENGAGE_MS    30
+#define PREDICT_DISENGAGE_MS 20
+
+/* time to wait for confirmation before any delay has been measured */
+#define PREDICT_TIMEOUT_MS   2000
+/* added to the expected delay to allow for a busy application */
+#define PREDICT_SLACK_MS     250
+
+struct prediction {
+	unsigned int x;         /* cell changed by the key */
+	unsigned int y;
+	struct line *line;      /* to follow the line when it scrolls */
+	tsm_symbol_t ch;        /* expected contents of the cell */
+	bool cell;              /* false for pure cursor movements */
+	unsigned int start_x;   /* cursor column before the key */
+	unsigned int cur_x;     /* expected cursor column afterwards */
+	unsigned int epoch;
+	uint64_t time;          /* time of the key press */
+	tsm_age_t age;          /* screen age at the key press */
+};
+
+struct tsm_predict {
+	unsigned long ref;
+	tsm_log_t llog;
+	void *llog_data;
+	struct tsm_screen *con;
+
+	struct prediction entries[PREDICT_MAX];
+	unsigned int count;
+
+	unsigned int epoch;             /* epoch of new predictions */
+	unsigned int confirmed_epoch;   /* latest epoch with a confirmation */
+	uint64_t last_key;              /* time of the latest key */
+	uint64_t hold;                  /* no predictions before this time */
+
+	unsigned int srtt;              /* smoothed echo delay, 0 if unknown */
+	unsigned int rttvar;
+	bool engaged;
+};
+
+enum {
+	PREDICT_PENDING,
+	PREDICT_CONFIRMED,
+	PREDICT_WRONG
+};
+
+SHL_EXPORT
+int tsm_predict_new(struct tsm_predict **out, struct tsm_screen *con,
+                    tsm_log_t log, void *log_data)
+{
+	struct tsm_predict *pr;
+
+	if (!out || !con)
+		return -EINVAL;
+
+	pr = malloc(sizeof(*pr));
+	if (!pr)
+		return -ENOMEM;
+
+	memset(pr, 0, sizeof(*pr));
+	pr->ref = 1;
+	pr->llog = log;
+	pr->llog_data = log_data;
+	pr->con = con;
+	pr->epoch = 1;
+
+	tsm_screen_ref(pr->con);
+
+	llog_debug(pr, "new prediction object");
+	*out = pr;
+
+	return 0;
+}
+
+SHL_EXPORT
+void tsm_predict_ref(struct tsm_predict *pr)
+{
+	if (!pr || !pr->ref)
+		return;
+
+	++pr->ref;
+}
+
+SHL_EXPORT
+void tsm_predict_unref(struct tsm_predict *pr)
+{
+	if (!pr || !pr->ref || --pr->ref)
+		return;
+
+	llog_debug(pr, "destroying prediction object");
+	tsm_screen_unref(pr->con);
+	free(pr);
+}
+
+static struct cell *get_cell(struct tsm_predict *pr, unsigned int x,
+                             unsigned int y)
+{
+	struct tsm_screen *con = pr->con;
+
+	if (y >= con->size_y || x >= con->size_x || x >= con->lines[y]->size)
+		return NULL;
+
+	return &con->lines[y]->cells[x];
+}
+
+static bool shown(struct tsm_predict *pr, const struct prediction *p)
+{
+	return pr->engaged && p->cell && p->epoch <= pr->confirmed_epoch;
+}
+
+/* make the screen draw the real contents of a cell again */
+static void redraw_cell(struct tsm_predict *pr, const struct prediction *p)
+{
+	struct cell *cell;
+
+	if (!p->cell)
+		return;
+
+	cell = get_cell(pr, p->x, p->y);
+	if (!cell)
+		return;
+
+	screen_inc_age(pr->con);
+	cell->age = pr->con->age_cnt;
+}
+
+static void remove_entries(struct tsm_predict *pr, unsigned int num)
+{
+	unsigned int i;
+
+	for (i = 0; i < num; ++i)
+		redraw_cell(pr, &pr->entries[i]);
+
+	pr->count -= num;
+	memmove(pr->entries, &pr->entries[num],
+	        pr->count * sizeof(*pr->entries));
+}
+
+/* Drop all predictions and only show new ones after a confirmation */
+static void predict_reset(struct tsm_predict *pr)
+{
+	remove_entries(pr, pr->count);
+	++pr->epoch;
+}
+
+static void add_sample(struct tsm_predict *pr, unsigned int delay)
+{
+	unsigned int diff;
+
+	if (pr->srtt == 0) {
+		pr->srtt = delay ? delay : 1;
+		pr->rttvar = delay / 2;
+	} else {
+		diff = delay > pr->srtt ? delay - pr->srtt : pr->srtt - delay;
+		pr->rttvar = (3 * pr->rttvar + diff) / 4;
+		pr->srtt = (7 * pr->srtt + delay) / 8;
+		if (pr->srtt == 0)
+			pr->srtt = 1;
+	}
+
+	if (!pr->engaged && pr->srtt > PREDICT_ENGAGE_MS) {
+		llog_debug(pr, "engaging at %u ms echo delay", pr->srtt);
+		pr->engaged = true;
+	} else if (pr->engaged && pr->srtt < PREDICT_DISENGAGE_MS) {
+		llog_debug(pr, "disengaging at %u ms echo delay", pr->srtt);
+		pr->engaged = false;
+	}
+}
+
+static unsigned int get_timeout(struct tsm_predict *pr)
+{
+	if (pr->srtt == 0)
+		return PREDICT_TIMEOUT_MS;
+
+	return 2 * pr->srtt + 4 * pr->rttvar + PREDICT_SLACK_MS;
+}
+
+/*
+ * Only the oldest entry can be found wrong from the cursor position: until
+ * the keys before it have been echoed the cursor tells nothing about it.
+ * A key that moves the cursor back, such as backspace over a character that
+ * is still pending, cannot be confirmed either while the cursor started out
+ * where it ends up for one of the keys up to it, since the screen looks the
+ * same before they have been echoed as after.
+ */
+static bool ambiguous(struct tsm_predict *pr, unsigned int num)
+{
+	const struct prediction *p = &pr->entries[num - 1];
+	unsigned int i;
+
+	for (i = 0; i < num; ++i) {
+		if (pr->entries[i].y == p->y &&
+		    pr->entries[i].start_x == p->cur_x)
+			return true;
+	}
+
+	return false;
+}
+
+/* row that the line of an entry has scrolled to, or -1 if it is gone */
+static int find_row(struct tsm_predict *pr, const struct prediction *p)
+{
+	unsigned int y = p->y < pr->con->size_y ? p->y + 1 : pr->con->size_y;
+
+	while (y-- > 0) {
+		if (pr->con->lines[y] == p->line)
+			return y;
+	}
+
+	return -1;
+}
+
+static int check_entry(struct tsm_predict *pr, unsigned int num)
+{
+	struct tsm_screen *con = pr->con;
+	const struct prediction *p = &pr->entries[num - 1];
+	bool oldest = num == 1;
+	struct cell *cell = NULL;
+	tsm_symbol_t ch;
+	bool match, touched;
+	int row;
+
+	row = find_row(pr, p);
+	if (row >= 0)
+		cell = get_cell(pr, p->x, row);
+
+	/* Written to after the key, or the cursor moved there. Without this
+	 * typing a character that the cell already holds would look like an
+	 * echo. */
+	touched = cell && cell->age > p->age;
+
+	match = !p->cell;
+	if (p->cell && cell) {
+		ch = cell->ch ? cell->ch : ' ';
+		match = ch == p->ch;
+	}
+
+	if (row < 0 || con->cursor_y != (unsigned int)row) {
+		/* The application has moved on to another line or scrolled
+		 * the line away, so the key has been handled by now. This
+		 * also catches predictions made on the old line after a key
+		 * such as return. */
+		if (match && touched && p->cur_x > p->x)
+			return PREDICT_CONFIRMED;
+		if (oldest)
+			return PREDICT_WRONG;
+	} else if (p->cur_x > p->x) {
+		/* a printed character, the cursor moves on from the cell */
+		if (con->cursor_x > p->x && touched) {
+			if (match)
+				return PREDICT_CONFIRMED;
+			if (oldest)
+				return PREDICT_WRONG;
+		}
+	} else if (con->cursor_x == p->cur_x && match && touched &&
+	           !ambiguous(pr, num)) {
+		return PREDICT_CONFIRMED;
+	} else if (oldest && con->cursor_x != p->start_x &&
+	           con->cursor_x != p->cur_x) {
+		/* no earlier key left to move the cursor elsewhere */
+		return PREDICT_WRONG;
+	}
+
+	return PREDICT_PENDING;
+}
+
+static bool confirm_entries(struct tsm_predict *pr, unsigned int num,
+                            uint64_t now)
+{
+	struct prediction *p = &pr->entries[num - 1];
+	bool changed = false;
+
+	add_sample(pr, (unsigned int)(now - p->time));
+	if (p->epoch > pr->confirmed_epoch) {
+		pr->confirmed_epoch = p->epoch;
+		changed = true;
+	}
+	changed = changed || shown(pr, p);
+	remove_entries(pr, num);
+
+	return changed;
+}
+
+/*
+ * Number of entries up to the newest cursor movement or backspace that has
+ * left the cursor where it is now, or 0 if there is none.
+ */
+static unsigned int find_echoed(struct tsm_predict *pr)
+{
+	struct tsm_screen *con = pr->con;
+	const struct prediction *p;
+	unsigned int i;
+
+	for (i = pr->count; i > 1; --i) {
+		p = &pr->entries[i - 1];
+		if (p->cur_x <= p->x && con->cursor_y == p->y &&
+		    find_row(pr, p) == (int)p->y && con->cursor_x == p->cur_x)
+			return i;
+	}
+
+	return 0;
+}
+
+/*
+ * Check the predictions against the screen. This should be called after the
+ * application output has been passed to the VTE, and from time to time while
+ * predictions are pending so that they can time out. Returns true if the
+ * predictions shown on the screen have changed.
+ */
+SHL_EXPORT
+bool tsm_predict_update(struct tsm_predict *pr, uint64_t now)
+{
+	unsigned int i, num;
+	bool changed = false;
+
+	if (!pr)
+		return false;
+
+	/* the newest confirmation also settles the entries before it */
+	i = pr->count;
+	while (i > 0) {
+		switch (check_entry(pr, i)) {
+		case PREDICT_CONFIRMED:
+			changed = confirm_entries(pr, i, now) || changed;
+			i = pr->count;
+			break;
+		case PREDICT_WRONG:
+			goto wrong;
+		default:
+			--i;
+			break;
+		}
+	}
+
+	if (pr->count == 0 ||
+	    now - pr->entries[0].time <= get_timeout(pr))
+		return changed;
+
+	/* A character followed by a backspace over it cannot be confirmed
+	 * when both are echoed together, so take the cursor being where the
+	 * backspace left it as their echo once the character times out. */
+	num = find_echoed(pr);
+	if (num) {
+		for (i = 0; i < num; ++i)
+			changed = changed || shown(pr, &pr->entries[i]);
+		remove_entries(pr, num);
+		return changed;
+	}
+
+wrong:
+	llog_debug(pr, "wrong prediction at %ux%u",
+	           pr->entries[0].x, pr->entries[0].y);
+	for (i = 0; i < pr->count; ++i)
+		changed = changed || shown(pr, &pr->entries[i]);
+	predict_reset(pr);
+
+	/* The keys typed so far may still be echoed and move the cursor, so
+	 * new predictions would start from the wrong place. Wait until the
+	 * typing has paused for as long as an echo can take. */
+	pr->hold = pr->last_key + get_timeout(pr);
+	return changed;
+}
+
+/*
+ * Predict the effect of a key that has been sent to the application. Keys
+ * that cannot be predicted start a new epoch. Nothing is predicted on the
+ * alternate screen since full-screen applications rarely echo keys where
+ * the cursor is.
+ */
+SHL_EXPORT
+void tsm_predict_key(struct tsm_predict *pr, unsigned int key,
+                     uint32_t ucs4, uint64_t now)
+{
+	struct tsm_screen *con;
+	struct prediction *p;
+	unsigned int x, y;
+
+	if (!pr)
+		return;
+
+	con = pr->con;
+
+	pr->last_key = now;
+	if (now < pr->hold) {
+		pr->hold = now + get_timeout(pr);
+		goto unpredictable;
+	}
+
+	if (key == TSM_PREDICT_OTHER ||
+	    (con->flags & (TSM_SCREEN_ALTERNATE | TSM_SCREEN_HIDE_CURSOR)) ||
+	    pr->count == PREDICT_MAX)
+		goto unpredictable;
+
+	if (pr->count == 0) {
+		x = con->cursor_x;
+		y = con->cursor_y;
+	} else {
+		x = pr->entries[pr->count - 1].cur_x;
+		y = pr->entries[pr->count - 1].y;
+	}
+
+	if (x >= con->size_x || y >= con->size_y)
+		goto unpredictable;
+
+	p = &pr->entries[pr->count];
+	p->y = y;
+	p->line = con->lines[y];
+	p->start_x = x;
+	p->age = con->age_cnt;
+	p->epoch = pr->epoch;
+	p->time = now;
+
+	switch (key) {
+	case TSM_PREDICT_CHAR:
+		/* stay clear of the last column where the line wraps */
+		if (ucs4 < 0x20 || (ucs4 >= 0x7f && ucs4 < 0xa0) ||
+		    ucs4 > TSM_UCS4_MAX || tsm_ucs4_get_width(ucs4) != 1 ||
+		    x + 1 >= con->size_x)
+			goto unpredictable;
+		p->x = x;
+		p->ch = ucs4;
+		p->cell = true;
+		p->cur_x = x + 1;
+		break;
+	case TSM_PREDICT_BACKSPACE:
+		if (x == 0)
+			goto unpredictable;
+		p->x = x - 1;
+		p->ch = ' ';
+		p->cell = true;
+		p->cur_x = x - 1;
+		break;
+	case TSM_PREDICT_LEFT:
+		if (x == 0)
+			goto unpredictable;
+		p->x = x - 1;
+		p->cell = false;
+		p->cur_x = x - 1;
+		break;
+	case TSM_PREDICT_RIGHT:
+		if (x + 1 >= con->size_x)
+			goto unpredictable;
+		p->x = x + 1;
+		p->cell = false;
+		p->cur_x = x + 1;
+		break;
+	default:
+		goto unpredictable;
+	}
+
+	++pr->count;
+	return;
+
+unpredictable:
+	++pr->epoch;
+}
+
+SHL_EXPORT
+bool tsm_predict_pending(struct tsm_predict *pr)
+{
+	return pr && pr->count > 0;
+}
+
+SHL_EXPORT
+unsigned int tsm_predict_get_srtt(struct tsm_predict *pr)
+{
+	return pr ? pr->srtt : 0;
+}
+
+/*
+ * Draw the predicted cells that are shown, underlined, on top of what
+ * tsm_screen_draw() has drawn. The age passed to @draw_cb is always 0 so
+ * they are drawn every time. Nothing is drawn while the screen is scrolled
+ * back.
+ */
+SHL_EXPORT
+void tsm_predict_draw(struct tsm_predict *pr, tsm_screen_draw_cb draw_cb,
+                      void *data)
+{
+	struct tsm_screen *con;
+	struct prediction *p;
+	struct cell *cell;
+	struct tsm_screen_attr attr;
+	const uint32_t *ch;
+	size_t len;
+	unsigned int i;
+
+	if (!pr || !draw_cb)
+		return;
+
+	con = pr->con;
+	if (con->sb_pos)
+		return;
+
+	for (i = 0; i < pr->count; ++i) {
+		p = &pr->entries[i];
+		if (!shown(pr, p))
+			continue;
+
+		cell = get_cell(pr, p->x, p->y);
+		if (!cell)
+			continue;
+
+		memcpy(&attr, &cell->attr, sizeof(attr));
+		attr.underline = 1;
+
+		if (p->x == con->cursor_x && p->y == con->cursor_y &&
+		    !(con->flags & TSM_SCREEN_HIDE_CURSOR))
+			attr.inverse = !attr.inverse;
+		if (con->flags & TSM_SCREEN_INVERSE)
+			attr.inverse = !attr.inverse;
+
+		ch = tsm_symbol_get(con->sym_table, &p->ch, &len);
+		draw_cb(con, ch, len, 1, p->x, p->y, &attr, 0, data);
+	}
+}
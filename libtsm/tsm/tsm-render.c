@@ -60,6 +60,10 @@ tsm_age_t tsm_screen_draw(struct tsm_screen *con, tsm_screen_draw_cb draw_cb,
 	if (!con || !draw_cb)
 		return 0;
 
+	/* scrollback lines are only reflowed once they are displayed */
+	if (con->sb_pos)
+		screen_sb_reflow_view(con);
+
 	screen_cell_init(con, &empty);
 
 	cur_x = con->cursor_x;
@@ -67,6 +67,10 @@
 
 #define LLOG_SUBSYSTEM "tsm-screen"
 
+/* Distance between the IDs of consecutive sb-lines. The gaps leave room for
+ * the extra lines created when a line in the sb is reflowed. */
+#define SB_ID_STEP 65536
+
 static struct cell *get_cursor_cell(struct tsm_screen *con)
 {
 	unsigned int cur_x, cur_y;
@@ -118,11 +122,39 @@ void screen_cell_init(struct tsm_screen *con, struct cell *cell)
 	memcpy(&cell->attr, &con->def_attr, sizeof(cell->attr));
 }
 
+/* Initialize \num cells of \line starting at \x. The first one is set up as a
+ * template which is then copied to the rest in doubling chunks, so this takes
+ * a handful of memcpy() calls instead of one screen_cell_init() per cell. */
+static void screen_cells_init(struct tsm_screen *con, struct line *line,
+			      unsigned int x, unsigned int num)
+{
+	struct cell *cells = &line->cells[x];
+	unsigned int done, chunk;
+
+	if (!num)
+		return;
+
+	if (con->def_attr.blink)
+		line->blink = true;
+
+	/* a line no longer wraps once its last column is cleared */
+	if (x < con->size_x && x + num >= con->size_x)
+		line->wrapped = false;
+
+	screen_cell_init(con, &cells[0]);
+
+	for (done = 1; done < num; done += chunk) {
+		chunk = done;
+		if (chunk > num - done)
+			chunk = num - done;
+		memcpy(&cells[done], cells, chunk * sizeof(*cells));
+	}
+}
+
 static int line_new(struct tsm_screen *con, struct line **out,
                     unsigned int width)
 {
 	struct line *line;
-	unsigned int i;
 
 	if (!width)
 		return -EINVAL;
@@ -133,7 +165,11 @@ static int line_new(struct tsm_screen *con, struct line **out,
 	line->next = NULL;
 	line->prev = NULL;
 	line->size = width;
+	line->sb_id = 0;
 	line->age = con->age_cnt;
+	line->blink = false;
+	line->wrapped = false;
+	line->width = 0;
 
 	line->cells = malloc(sizeof(struct cell) * width);
 	if (!line->cells) {
@@ -141,8 +177,7 @@ static int line_new(struct tsm_screen *con, struct line **out,
 		return -ENOMEM;
 	}
 
-	for (i = 0; i < width; ++i)
-		screen_cell_init(con, &line->cells[i]);
+	screen_cells_init(con, line, 0, width);
 
 	*out = line;
 	return 0;
@@ -169,10 +204,8 @@ static int line_resize(struct tsm_screen *con, struct line *line,
 
 		line->cells = tmp;
 
-		while (line->size < width) {
-			screen_cell_init(con, &line->cells[line->size]);
-			++line->size;
-		}
+		screen_cells_init(con, line, line->size, width - line->size);
+		line->size = width;
 	}
 
 	return 0;
@@ -206,7 +239,7 @@ static void link_to_scrollback(struct tsm_screen *con, struct line *line)
 	 * line is linked in after we remove the top-most line here.
 	 * sb_max == 0 is tested earlier so we can assume sb_max > 0 here. In
 	 * other words, buf->sb_first is a valid line if sb_count >= sb_max. */
-	if (con->sb_count >= con->sb_max) {
+	while (con->sb_count >= con->sb_max) {
 		tmp = con->sb_first;
 		con->sb_first = tmp->next;
 		if (tmp->next)
@@ -244,7 +277,8 @@ static void link_to_scrollback(struct tsm_screen *con, struct line *line)
 		line_free(tmp);
 	}
 
-	line->sb_id = ++con->sb_last_id;
+	con->sb_last_id += SB_ID_STEP;
+	line->sb_id = con->sb_last_id;
 	line->next = NULL;
 	line->prev = con->sb_last;
 	if (con->sb_last)
@@ -257,7 +291,7 @@ static void link_to_scrollback(struct tsm_screen *con, struct line *line)
 
 static void screen_scroll_up(struct tsm_screen *con, unsigned int num)
 {
-	unsigned int i, j, max, pos;
+	unsigned int i, max, pos;
 	int ret;
 
 	if (!num)
@@ -289,11 +323,11 @@ static void screen_scroll_up(struct tsm_screen *con, unsigned int num)
 			ret = -EAGAIN;
 
 		if (!ret) {
+			con->lines[pos]->width = con->size_x;
 			link_to_scrollback(con, con->lines[pos]);
 		} else {
 			cache[i] = con->lines[pos];
-			for (j = 0; j < con->size_x; ++j)
-				screen_cell_init(con, &cache[i]->cells[j]);
+			screen_cells_init(con, cache[i], 0, con->size_x);
 		}
 	}
 
@@ -330,7 +364,7 @@ static void screen_scroll_up(struct tsm_screen *con, unsigned int num)
 
 static void screen_scroll_down(struct tsm_screen *con, unsigned int num)
 {
-	unsigned int i, j, max;
+	unsigned int i, max;
 
 	if (!num)
 		return;
@@ -351,8 +385,7 @@ static void screen_scroll_down(struct tsm_screen *con, unsigned int num)
 
 	for (i = 0; i < num; ++i) {
 		cache[i] = con->lines[con->margin_bottom - i];
-		for (j = 0; j < con->size_x; ++j)
-			screen_cell_init(con, &cache[i]->cells[j]);
+		screen_cells_init(con, cache[i], 0, con->size_x);
 	}
 
 	if (num < max) {
@@ -400,6 +433,8 @@ static void screen_write(struct tsm_screen *con, unsigned int x,
 	line->cells[x].ch = ch;
 	line->cells[x].width = len;
 	memcpy(&line->cells[x].attr, attr, sizeof(*attr));
+	if (attr->blink)
+		line->blink = true;
 
 	for (i = 1; i < len && i + x < con->size_x; ++i) {
 		line->cells[x + i].age = con->age_cnt;
@@ -414,7 +449,7 @@ static void screen_erase_region(struct tsm_screen *con,
 				 unsigned int y_to,
 				 bool protect)
 {
-	unsigned int to;
+	unsigned int to, start;
 	struct line *line;
 
 	if (y_to >= con->size_y)
@@ -433,11 +468,28 @@ static void screen_erase_region(struct tsm_screen *con,
 			to = x_to;
 		else
 			to = con->size_x - 1;
-		for ( ; x_from <= to; ++x_from) {
-			if (protect && line->cells[x_from].attr.protect)
+
+		if (!protect) {
+			if (x_from <= to)
+				screen_cells_init(con, line, x_from,
+						  to - x_from + 1);
+			x_from = 0;
+			continue;
+		}
+
+		/* erase the runs of unprotected cells */
+		while (x_from <= to) {
+			if (line->cells[x_from].attr.protect) {
+				++x_from;
 				continue;
+			}
+
+			start = x_from;
+			while (x_from <= to && !line->cells[x_from].attr.protect)
+				++x_from;
 
-			screen_cell_init(con, &line->cells[x_from]);
+			screen_cells_init(con, line, start,
+					  x_from - start);
 		}
 		x_from = 0;
 	}
@@ -583,7 +635,7 @@ static bool line_is_empty(const struct tsm_screen *con, const struct line *line)
 {
 	unsigned int i;
 
-	for (i = 0; i < line->size && i < con->size_x; i++) {
+	for (i = 0; i < line->size; i++) {
 		if (line->cells[i].ch)
 			return false;
 	}
@@ -591,14 +643,447 @@ static bool line_is_empty(const struct tsm_screen *con, const struct line *line)
 	return true;
 }
 
+/*
+ * Reflow
+ * Lines that were wrapped by TSM_SCREEN_AUTO_WRAP are marked as such, so the
+ * text can be laid out again when the screen width changes. The screen is
+ * reflowed right away on resize, but the scrollback buffer can be very large
+ * so its lines keep the width they had when they were moved there and are
+ * only reflowed when they are displayed, one logical line (a run of wrapped
+ * lines and the line that ends it) at a time.
+ */
+
+/* A position that is moved along when lines are reflowed */
+struct reflow_mark {
+	unsigned int line;      /* index of the source line */
+	unsigned int x;
+	unsigned int new_line;  /* index of the new line, set by reflow() */
+	unsigned int new_x;
+};
+
+static void set_marks(struct reflow_mark *marks, unsigned int num_marks,
+		      unsigned int line, unsigned int x,
+		      unsigned int new_line, unsigned int new_x)
+{
+	unsigned int k;
+
+	for (k = 0; k < num_marks; ++k) {
+		if (marks[k].line == line && marks[k].x == x) {
+			marks[k].new_line = new_line;
+			marks[k].new_x = new_x;
+		}
+	}
+}
+
+/* width the text of @line was laid out for */
+static unsigned int line_width(struct tsm_screen *con, const struct line *line)
+{
+	unsigned int width;
+
+	width = line->sb_id ? line->width : con->size_x;
+	if (width > line->size)
+		width = line->size;
+
+	return width;
+}
+
+/* Lay out the text of the @num lines in @src for a screen @x cells wide.
+ * Each source line that is not wrapped ends a logical line. Returns the
+ * number of lines needed and, if @dst is not NULL, copies the cells into
+ * the lines in @dst which must be cleared and at least @x cells wide. The
+ * positions in @marks are translated to the new lines. */
+static unsigned int reflow(struct tsm_screen *con, struct line **src,
+			   unsigned int num, unsigned int x,
+			   struct reflow_mark *marks, unsigned int num_marks,
+			   struct line **dst)
+{
+	unsigned int i, j, k, n, width, row = 0, col = 0;
+	const struct cell *cell;
+	struct cell *out;
+
+	if (!num)
+		return 0;
+
+	for (i = 0; i < num; ++i) {
+		width = line_width(con, src[i]);
+
+		/* the end of a logical line is trimmed, but must still
+		 * reach the cells that marks are on (the cursor) */
+		n = width;
+		if (!src[i]->wrapped) {
+			while (n && !src[i]->cells[n - 1].ch &&
+			       src[i]->cells[n - 1].width)
+				--n;
+		}
+		for (k = 0; k < num_marks; ++k) {
+			if (marks[k].line == i && marks[k].x >= n)
+				n = marks[k].x < width ? marks[k].x + 1 : width;
+		}
+
+		for (j = 0; j < n; ++j) {
+			cell = &src[i]->cells[j];
+
+			/* second half of a wide character that did not fit */
+			if (!cell->width && col >= x) {
+				set_marks(marks, num_marks, i, j, row, col);
+				continue;
+			}
+
+			/* move wide characters to the next line as a whole */
+			if (col >= x || (cell->width > 1 && col == x - 1 && x > 1)) {
+				if (dst)
+					dst[row]->wrapped = true;
+				++row;
+				col = 0;
+			}
+
+			set_marks(marks, num_marks, i, j, row, col);
+
+			if (dst) {
+				out = &dst[row]->cells[col];
+				memcpy(out, cell, sizeof(*out));
+				out->age = con->age_cnt;
+				if (out->attr.blink)
+					dst[row]->blink = true;
+			}
+
+			++col;
+		}
+
+		/* marks past the text go right after it, the cursor may end
+		 * up with a pending wrap here */
+		for (k = 0; k < num_marks; ++k) {
+			if (marks[k].line == i && marks[k].x >= n) {
+				marks[k].new_line = row;
+				marks[k].new_x = col;
+			}
+		}
+
+		if (!src[i]->wrapped && i + 1 < num) {
+			++row;
+			col = 0;
+		}
+	}
+
+	if (dst && src[num - 1]->wrapped)
+		dst[row]->wrapped = true;
+
+	return row + 1;
+}
+
+static void sb_renumber(struct tsm_screen *con)
+{
+	struct line *iter;
+
+	con->sb_last_id = 0;
+	for (iter = con->sb_first; iter; iter = iter->next) {
+		con->sb_last_id += SB_ID_STEP;
+		iter->sb_id = con->sb_last_id;
+	}
+}
+
+/* Reflow the logical line in the scrollback buffer that @line is part of
+ * to @x cells. Returns the line that now holds the first cell of @line,
+ * which is @line itself if nothing had to be done or we are out of
+ * memory. */
+static struct line *sb_reflow(struct tsm_screen *con, struct line *line,
+			      unsigned int x)
+{
+	struct line *first, *last, *iter, **src, **dst;
+	struct reflow_mark marks[4];
+	struct selection_pos *sel[2];
+	int sel_mark[2] = { -1, -1 }, pos_mark = -1;
+	unsigned int num, n, i, k, num_marks;
+	uint64_t lo, step;
+	bool changed = false;
+
+	first = line;
+	while (first->prev && first->prev->wrapped)
+		first = first->prev;
+	last = line;
+	while (last->wrapped && last->next)
+		last = last->next;
+
+	num = 0;
+	for (iter = first; ; iter = iter->next) {
+		if (iter->width != x)
+			changed = true;
+		++num;
+		if (iter == last)
+			break;
+	}
+
+	if (!changed)
+		return line;
+
+	src = malloc(sizeof(*src) * num);
+	if (!src)
+		return line;
+
+	sel[0] = &con->sel_start;
+	sel[1] = &con->sel_end;
+
+	marks[0].x = 0;
+	num_marks = 1;
+	for (i = 0, iter = first; i < num; ++i, iter = iter->next) {
+		src[i] = iter;
+
+		if (iter == line)
+			marks[0].line = i;
+
+		if (iter == con->sb_pos) {
+			pos_mark = num_marks++;
+			marks[pos_mark].line = i;
+			marks[pos_mark].x = 0;
+		}
+
+		for (k = 0; k < 2; ++k) {
+			if (con->sel_active && sel[k]->line == iter) {
+				sel_mark[k] = num_marks++;
+				marks[sel_mark[k]].line = i;
+				marks[sel_mark[k]].x = sel[k]->x;
+			}
+		}
+	}
+
+	n = reflow(con, src, num, x, marks, num_marks, NULL);
+
+	dst = malloc(sizeof(*dst) * n);
+	if (!dst) {
+		free(src);
+		return line;
+	}
+
+	for (i = 0; i < n; ++i) {
+		if (line_new(con, &dst[i], x)) {
+			while (i--)
+				line_free(dst[i]);
+			free(dst);
+			free(src);
+			return line;
+		}
+		dst[i]->width = x;
+	}
+
+	reflow(con, src, num, x, marks, num_marks, dst);
+
+	/* replace the old lines */
+	for (i = 0; i < n; ++i) {
+		dst[i]->prev = i ? dst[i - 1] : first->prev;
+		dst[i]->next = i + 1 < n ? dst[i + 1] : last->next;
+	}
+	if (first->prev)
+		first->prev->next = dst[0];
+	else
+		con->sb_first = dst[0];
+	if (last->next)
+		last->next->prev = dst[n - 1];
+	else
+		con->sb_last = dst[n - 1];
+	con->sb_count = con->sb_count - num + n;
+
+	/* the new lines get IDs from the gap between their neighbours */
+	lo = first->prev ? first->prev->sb_id : 0;
+	if (!last->next) {
+		for (i = 0; i < n; ++i)
+			dst[i]->sb_id = lo + (i + 1) * (uint64_t)SB_ID_STEP;
+		con->sb_last_id = dst[n - 1]->sb_id;
+	} else {
+		step = (last->next->sb_id - lo) / (n + 1);
+		if (step) {
+			for (i = 0; i < n; ++i)
+				dst[i]->sb_id = lo + (i + 1) * step;
+		} else {
+			sb_renumber(con);
+		}
+	}
+
+	if (pos_mark >= 0)
+		con->sb_pos = dst[marks[pos_mark].new_line];
+
+	for (k = 0; k < 2; ++k) {
+		if (sel_mark[k] < 0)
+			continue;
+		sel[k]->line = dst[marks[sel_mark[k]].new_line];
+		sel[k]->x = marks[sel_mark[k]].new_x;
+		if (sel[k]->x >= x)
+			sel[k]->x = x - 1;
+	}
+
+	for (i = 0; i < num; ++i)
+		line_free(src[i]);
+
+	line = dst[marks[0].new_line];
+
+	free(dst);
+	free(src);
+
+	screen_inc_age(con);
+	/* TODO: more sophisticated ageing */
+	con->age = con->age_cnt;
+
+	return line;
+}
+
+/* Reflow the sb-lines that are displayed from the current sb position */
+void screen_sb_reflow_view(struct tsm_screen *con)
+{
+	struct line *iter;
+	unsigned int i;
+
+	iter = con->sb_pos;
+	for (i = 0; iter && i < con->size_y; ++i) {
+		if (iter->width != con->size_x)
+			iter = sb_reflow(con, iter, con->size_x);
+		iter = iter->next;
+	}
+}
+
+/* Reflow the last @num sb-lines so they can be moved back to the screen */
+static void sb_reflow_tail(struct tsm_screen *con, unsigned int x,
+			   unsigned int num)
+{
+	struct line *iter;
+	unsigned int i;
+
+	iter = con->sb_last;
+	for (i = 0; iter && i < num; ++i) {
+		if (iter->width != x)
+			iter = sb_reflow(con, iter, x);
+		iter = iter->prev;
+	}
+}
+
+/* Reflow the main screen to @x cells and place the text in the first @y
+ * lines of the line buffer, which must have at least that many lines. The
+ * lines that are pushed out at the top are moved into the sb and a line
+ * that started in the sb and wraps onto the screen is pulled back. Empty
+ * lines below the cursor are dropped and the lines at the bottom are left
+ * empty if the text now takes up fewer lines. */
+static int screen_reflow(struct tsm_screen *con, unsigned int x,
+			 unsigned int y)
+{
+	struct line *iter, **src, **dst;
+	struct reflow_mark mark;
+	unsigned int num_sb = 0, used, num, n, total, top, width, i;
+
+	if (!con->size_x || !con->size_y)
+		return -EINVAL;
+
+	iter = con->sb_last;
+	if (iter && iter->wrapped) {
+		num_sb = 1;
+		while (iter->prev && iter->prev->wrapped) {
+			iter = iter->prev;
+			++num_sb;
+		}
+	}
+
+	used = con->size_y;
+	while (used > con->cursor_y + 1 &&
+	       line_is_empty(con, con->lines[used - 1]))
+		--used;
+
+	num = num_sb + used;
+	src = malloc(sizeof(*src) * num);
+	if (!src)
+		return -ENOMEM;
+
+	for (i = 0; i < num_sb; ++i, iter = iter->next)
+		src[i] = iter;
+	for (i = 0; i < used; ++i)
+		src[num_sb + i] = con->lines[i];
+
+	mark.line = num_sb + con->cursor_y;
+	mark.x = con->cursor_x;
+
+	n = reflow(con, src, num, x, &mark, 1, NULL);
+
+	/* keep the cursor on the screen */
+	top = 0;
+	if (n > y)
+		top = n - y;
+	if (top > mark.new_line)
+		top = mark.new_line;
+
+	total = n;
+	if (total < top + y)
+		total = top + y;
+
+	dst = malloc(sizeof(*dst) * total);
+	if (!dst) {
+		free(src);
+		return -ENOMEM;
+	}
+
+	/* lines on the screen must be wide enough for the old and new size */
+	width = x > con->size_x ? x : con->size_x;
+	for (i = 0; i < total; ++i) {
+		if (line_new(con, &dst[i], width)) {
+			while (i--)
+				line_free(dst[i]);
+			free(dst);
+			free(src);
+			return -ENOMEM;
+		}
+	}
+
+	reflow(con, src, num, x, &mark, 1, dst);
+
+	if (num_sb) {
+		iter = src[0]->prev;
+		con->sb_last = iter;
+		if (iter)
+			iter->next = NULL;
+		else
+			con->sb_first = NULL;
+		con->sb_count -= num_sb;
+
+		for (i = 0; i < num_sb; ++i) {
+			if (con->sb_pos == src[i])
+				con->sb_pos = NULL;
+		}
+	}
+
+	/* the selection may point into any of the replaced lines */
+	con->sel_active = false;
+
+	for (i = 0; i < num_sb; ++i)
+		line_free(src[i]);
+	for (i = 0; i < y; ++i)
+		line_free(con->lines[i]);
+
+	for (i = 0; i < top; ++i) {
+		dst[i]->width = x;
+		link_to_scrollback(con, dst[i]);
+	}
+	for (i = 0; i < y; ++i)
+		con->lines[i] = dst[top + i];
+	for (i = top + y; i < total; ++i)
+		line_free(dst[i]);
+
+	con->cursor_x = mark.new_x;
+	con->cursor_y = mark.new_line - top;
+
+	free(dst);
+	free(src);
+
+	screen_inc_age(con);
+	/* TODO: more sophisticated ageing */
+	con->age = con->age_cnt;
+
+	return 0;
+}
+
 SHL_EXPORT
 int tsm_screen_resize(struct tsm_screen *con, unsigned int x,
                       unsigned int y)
 {
 	struct line **cache;
-	unsigned int i, j, width, diff, start;
+	unsigned int i, j, width, diff, start, height;
 	int ret;
 	bool *tab_ruler;
+	unsigned int reflowed = 0;
 
 	if (!con || !x || !y)
 		return -EINVAL;
@@ -675,6 +1160,14 @@ int tsm_screen_resize(struct tsm_screen *con, unsigned int x,
 		}
 	}
 
+	/* Lay out the main screen for the new width. If this fails the lines
+	 * are cut off or padded instead. */
+	if (!(con->flags & TSM_SCREEN_ALTERNATE) && x != con->size_x) {
+		height = y > con->size_y ? y : con->size_y;
+		if (!screen_reflow(con, x, height))
+			reflowed = height;
+	}
+
 	screen_inc_age(con);
 
 	/* clear expansion/padding area */
@@ -682,21 +1175,26 @@ int tsm_screen_resize(struct tsm_screen *con, unsigned int x,
 	if (x > con->size_x)
 		start = con->size_x;
 	for (j = 0; j < con->line_num; ++j) {
-		/* main-lines may go into SB, so clear all cells */
+		/* main-lines may go into SB, so clear all cells, except
+		 * for the ones that were just reflowed */
 		i = 0;
-		if (j < con->size_y)
+		if (j < reflowed)
+			i = con->main_lines[j]->size;
+		else if (j < con->size_y)
 			i = start;
 
-		for ( ; i < con->main_lines[j]->size; ++i)
-			screen_cell_init(con, &con->main_lines[j]->cells[i]);
+		if (i < con->main_lines[j]->size)
+			screen_cells_init(con, con->main_lines[j], i,
+					  con->main_lines[j]->size - i);
 
 		/* alt-lines never go into SB, only clear visible cells */
 		i = 0;
 		if (j < con->size_y)
 			i = con->size_x;
 
-		for ( ; i < x; ++i)
-			screen_cell_init(con, &con->alt_lines[j]->cells[i]);
+		if (i < x)
+			screen_cells_init(con, con->alt_lines[j], i,
+					  x - i);
 	}
 
 	if (!(con->flags & TSM_SCREEN_ALTERNATE)) {
@@ -706,7 +1204,14 @@ int tsm_screen_resize(struct tsm_screen *con, unsigned int x,
 		if (y > last_y)
 			last_y = y;
 
-		while (last_y && line_is_empty(con, con->main_lines[last_y - 1])) {
+		/* lines that are moved back from the sb must have the new
+		 * width */
+		sb_reflow_tail(con, x, last_y);
+
+		/* empty lines below the cursor make room for sb lines, the
+		 * cursor line must stay where the cursor is */
+		while (last_y > con->cursor_y + 1 &&
+		       line_is_empty(con, con->main_lines[last_y - 1])) {
 			last_y--;
 
 			if (y < con->size_y && (con->cursor_y + 1) < con->size_y)
@@ -768,9 +1273,12 @@ int tsm_screen_resize(struct tsm_screen *con, unsigned int x,
 	 * We need to carefully look for the functions that we call here as they
 	 * have stronger invariants as when called normally. */
 
+	/* The cursor may be right after a full line, where the next character
+	 * wraps. That is kept if the line was laid out for the new width. */
+	if (con->cursor_x > x ||
+	    (con->cursor_x == x && x != con->size_x && !reflowed))
+		move_cursor(con, x - 1, con->cursor_y);
 	con->size_x = x;
-	if (con->cursor_x >= con->size_x)
-		move_cursor(con, con->size_x - 1, con->cursor_y);
 
 	/* scroll buffer if screen height shrinks */
 	if (y < con->size_y) {
@@ -1126,7 +1634,7 @@ SHL_EXPORT
 void tsm_screen_write(struct tsm_screen *con, tsm_symbol_t ch,
                       const struct tsm_screen_attr *attr)
 {
-	unsigned int last, len;
+	unsigned int last, len, x;
 
 	if (!con)
 		return;
@@ -1143,11 +1651,18 @@ void tsm_screen_write(struct tsm_screen *con, tsm_symbol_t ch,
 	else
 		last = con->size_y - 1;
 
-	if (con->cursor_x >= con->size_x) {
-		if (con->flags & TSM_SCREEN_AUTO_WRAP)
+	/* like in xterm a wide character that does not fit at the end of the
+	 * line is moved to the next one as a whole */
+	if (con->cursor_x >= con->size_x ||
+	    (con->cursor_x + len > con->size_x && len <= con->size_x &&
+	     (con->flags & TSM_SCREEN_AUTO_WRAP))) {
+		if (con->flags & TSM_SCREEN_AUTO_WRAP) {
+			/* remembered so the line can be reflowed on resize */
+			con->lines[con->cursor_y]->wrapped = true;
 			move_cursor(con, 0, con->cursor_y + 1);
-		else
+		} else {
 			move_cursor(con, con->size_x - 1, con->cursor_y);
+		}
 	}
 
 	if (con->cursor_y > last) {
@@ -1156,7 +1671,13 @@ void tsm_screen_write(struct tsm_screen *con, tsm_symbol_t ch,
 	}
 
 	screen_write(con, con->cursor_x, con->cursor_y, ch, len, attr);
-	move_cursor(con, con->cursor_x + len, con->cursor_y);
+
+	/* a wide character cut off at the edge still leaves the cursor
+	 * waiting to wrap */
+	x = con->cursor_x + len;
+	if (x > con->size_x)
+		x = con->size_x;
+	move_cursor(con, x, con->cursor_y);
 }
 
 SHL_EXPORT
@@ -1396,7 +1917,7 @@ void tsm_screen_tab_left(struct tsm_screen *con, unsigned int num)
 SHL_EXPORT
 void tsm_screen_insert_lines(struct tsm_screen *con, unsigned int num)
 {
-	unsigned int i, j, max;
+	unsigned int i, max;
 
 	if (!con || !num)
 		return;
@@ -1417,8 +1938,7 @@ void tsm_screen_insert_lines(struct tsm_screen *con, unsigned int num)
 
 	for (i = 0; i < num; ++i) {
 		cache[i] = con->lines[con->margin_bottom - i];
-		for (j = 0; j < con->size_x; ++j)
-			screen_cell_init(con, &cache[i]->cells[j]);
+		screen_cells_init(con, cache[i], 0, con->size_x);
 	}
 
 	if (num < max) {
@@ -1436,7 +1956,7 @@ void tsm_screen_insert_lines(struct tsm_screen *con, unsigned int num)
 SHL_EXPORT
 void tsm_screen_delete_lines(struct tsm_screen *con, unsigned int num)
 {
-	unsigned int i, j, max;
+	unsigned int i, max;
 
 	if (!con || !num)
 		return;
@@ -1457,8 +1977,7 @@ void tsm_screen_delete_lines(struct tsm_screen *con, unsigned int num)
 
 	for (i = 0; i < num; ++i) {
 		cache[i] = con->lines[con->cursor_y + i];
-		for (j = 0; j < con->size_x; ++j)
-			screen_cell_init(con, &cache[i]->cells[j]);
+		screen_cells_init(con, cache[i], 0, con->size_x);
 	}
 
 	if (num < max) {
@@ -1476,8 +1995,9 @@ void tsm_screen_delete_lines(struct tsm_screen *con, unsigned int num)
 SHL_EXPORT
 void tsm_screen_insert_chars(struct tsm_screen *con, unsigned int num)
 {
+	struct line *line;
 	struct cell *cells;
-	unsigned int max, mv, i;
+	unsigned int max, mv;
 
 	if (!con || !num || !con->size_y || !con->size_x)
 		return;
@@ -1496,19 +2016,20 @@ void tsm_screen_insert_chars(struct tsm_screen *con, unsigned int num)
 		num = max;
 	mv = max - num;
 
-	cells = con->lines[con->cursor_y]->cells;
+	line = con->lines[con->cursor_y];
+	cells = line->cells;
 	if (mv)
 		memmove(&cells[con->cursor_x + num],
 			&cells[con->cursor_x],
 			mv * sizeof(*cells));
 
-	for (i = 0; i < num; ++i)
-		screen_cell_init(con, &cells[con->cursor_x + i]);
+	screen_cells_init(con, line, con->cursor_x, num);
 }
 
 SHL_EXPORT
 void tsm_screen_delete_chars(struct tsm_screen *con, unsigned int num)
 {
+	struct line *line;
 	struct cell *cells;
 	unsigned int max, mv, i;
 
@@ -1527,7 +2048,8 @@ void tsm_screen_delete_chars(struct tsm_screen *con, unsigned int num)
 		num = max;
 	mv = max - num;
 
-	cells = con->lines[con->cursor_y]->cells;
+	line = con->lines[con->cursor_y];
+	cells = line->cells;
 	if (mv) {
 		memmove(&cells[con->cursor_x],
 			&cells[con->cursor_x + num],
@@ -1537,8 +2059,7 @@ void tsm_screen_delete_chars(struct tsm_screen *con, unsigned int num)
 			cells[con->cursor_x + i].age = con->age_cnt;
 	}
 
-	for (i = 0; i < num; ++i)
-		screen_cell_init(con, &cells[con->cursor_x + mv + i]);
+	screen_cells_init(con, line, con->cursor_x + mv, num);
 }
 
 SHL_EXPORT
@@ -1710,6 +2231,9 @@ unsigned int tsm_screen_get_sb_total(struct tsm_screen *con)
 	return con->size_y + con->sb_count;
 }
 
+/* Only lines flagged as possibly containing blinking text are scanned. The
+ * flag is set when such cells are written and cleared here once a scan finds
+ * none, so a screen without blinking text costs one test per visible line. */
 SHL_EXPORT
 bool tsm_screen_blink(struct tsm_screen *con)
 {
@@ -1717,7 +2241,7 @@ bool tsm_screen_blink(struct tsm_screen *con)
 	struct line *iter, *line = NULL;
 	struct cell *cell;
 	size_t len;
-	bool res = false;
+	bool res = false, found;
 
 	iter = con->sb_pos;
 	k = 0;
@@ -1731,6 +2255,11 @@ bool tsm_screen_blink(struct tsm_screen *con)
 			k++;
 		}
 
+		if (!line->blink)
+			continue;
+
+		found = false;
+
 		for (j = 0; j < con->size_x && j < line->size; ++j) {
 			cell = &line->cells[j];
 
@@ -1746,11 +2275,40 @@ bool tsm_screen_blink(struct tsm_screen *con)
 						res = true;
 					}
 					cell->age = con->age_cnt;
+					found = true;
 				}
 			}
 		}
+
+		if (!found)
+			line->blink = false;
 	}
 
 	return res;
 }
 
+SHL_EXPORT
+bool tsm_screen_has_blink(struct tsm_screen *con)
+{
+	unsigned int i, k;
+	struct line *iter, *line = NULL;
+
+	iter = con->sb_pos;
+	k = 0;
+
+	for (i = 0; i < con->size_y; ++i) {
+		if (iter) {
+			line = iter;
+			iter = iter->next;
+		} else {
+			line = con->lines[k];
+			k++;
+		}
+
+		if (line->blink)
+			return true;
+	}
+
+	return false;
+}
+
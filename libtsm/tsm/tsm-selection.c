@@ -466,7 +466,9 @@ int tsm_screen_selection_copy(struct tsm_screen *con, char **out)
 			pos += copy_line(iter, pos, 0, iter->size);
 		}
 
-		*pos++ = '\n';
+		/* soft-wrapped lines are copied as one */
+		if (!iter->wrapped)
+			*pos++ = '\n';
 		iter = iter->next;
 	}
 
@@ -501,7 +503,8 @@ int tsm_screen_selection_copy(struct tsm_screen *con, char **out)
 				pos += copy_line(iter, pos, 0, con->size_x);
 			}
 
-			*pos++ = '\n';
+			if (!iter->wrapped)
+				*pos++ = '\n';
 		}
 	}
 
@@ -552,7 +555,9 @@ int tsm_screen_copy_all(struct tsm_screen *con, char **out)
 	while (iter) {
 		pos += copy_line(iter, pos, 0, iter->size);
 
-		*pos++ = '\n';
+		/* soft-wrapped lines are copied as one */
+		if (!iter->wrapped)
+			*pos++ = '\n';
 		iter = iter->next;
 	}
 
@@ -561,7 +566,8 @@ int tsm_screen_copy_all(struct tsm_screen *con, char **out)
 
 		pos += copy_line(iter, pos, 0, con->size_x);
 
-		*pos++ = '\n';
+		if (!iter->wrapped)
+			*pos++ = '\n';
 	}
 
 	/* return buffer */
@@ -64,6 +64,12 @@
 #include "shl-array.h"
 #include "shl-htable.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 /*
  * Unicode Symbol Handling
  * The main goal of the tsm_symbol_* functions is to provide a datatype which
@@ -577,3 +583,148 @@ void tsm_utf8_mach_reset(struct tsm_utf8_mach *mach)
 
 	mach->state = TSM_UTF8_START;
 }
+
+/*
+ * Block decoding
+ * tsm_utf8_mach_decode() turns a whole buffer into UCS4 values. The result is
+ * exactly what feeding the bytes one by one to tsm_utf8_mach_feed() and
+ * collecting a character for every TSM_UTF8_ACCEPT or TSM_UTF8_REJECT would
+ * give, but runs of ASCII are checked and widened a vector at a time and
+ * complete multi-byte sequences are decoded without going through the state
+ * machine. Everything else (invalid input and sequences that are cut off at
+ * the end of the buffer) is still handed to the state machine, so a sequence
+ * that is split across two calls is completed by the next one.
+ */
+
+#define UTF8_CONT(c) (((c) & 0xC0) == 0x80)
+
+/* Widen the leading ASCII bytes of \in into \out and return their number */
+static size_t utf8_ascii_run(const uint8_t *in, size_t len, uint32_t *out)
+{
+	size_t n = 0;
+
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	__m128i v, lo, hi;
+
+	while (len - n >= 16) {
+		v = _mm_loadu_si128((const __m128i *)&in[n]);
+		if (_mm_movemask_epi8(v))
+			break;
+
+		lo = _mm_unpacklo_epi8(v, zero);
+		hi = _mm_unpackhi_epi8(v, zero);
+		_mm_storeu_si128((__m128i *)&out[n], _mm_unpacklo_epi16(lo, zero));
+		_mm_storeu_si128((__m128i *)&out[n + 4], _mm_unpackhi_epi16(lo, zero));
+		_mm_storeu_si128((__m128i *)&out[n + 8], _mm_unpacklo_epi16(hi, zero));
+		_mm_storeu_si128((__m128i *)&out[n + 12], _mm_unpackhi_epi16(hi, zero));
+		n += 16;
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	uint8x16_t v;
+	uint16x8_t lo, hi;
+
+	while (len - n >= 16) {
+		v = vld1q_u8(&in[n]);
+		if (vmaxvq_u8(v) & 0x80)
+			break;
+
+		lo = vmovl_u8(vget_low_u8(v));
+		hi = vmovl_u8(vget_high_u8(v));
+		vst1q_u32(&out[n], vmovl_u16(vget_low_u16(lo)));
+		vst1q_u32(&out[n + 4], vmovl_u16(vget_high_u16(lo)));
+		vst1q_u32(&out[n + 8], vmovl_u16(vget_low_u16(hi)));
+		vst1q_u32(&out[n + 12], vmovl_u16(vget_high_u16(hi)));
+		n += 16;
+	}
+#else
+	uint32_t w1, w2;
+	size_t i;
+
+	while (len - n >= 8) {
+		memcpy(&w1, &in[n], 4);
+		memcpy(&w2, &in[n + 4], 4);
+		if ((w1 | w2) & 0x80808080)
+			break;
+
+		for (i = 0; i < 8; ++i)
+			out[n + i] = in[n + i];
+		n += 8;
+	}
+#endif
+
+	while (n < len && in[n] < 0x80) {
+		out[n] = in[n];
+		++n;
+	}
+
+	return n;
+}
+
+size_t tsm_utf8_mach_decode(struct tsm_utf8_mach *mach, const char *in,
+			    size_t len, uint32_t *out)
+{
+	const uint8_t *p = (const uint8_t *)in, *end = p + len;
+	uint32_t *o = out;
+	uint32_t c;
+	size_t n;
+	int state;
+	bool direct = false;
+
+	while (p < end) {
+		if (mach->state < TSM_UTF8_EXPECT1) {
+			n = utf8_ascii_run(p, end - p, o);
+			p += n;
+			o += n;
+			if (n)
+				direct = true;
+			if (p == end)
+				break;
+
+			c = *p;
+			if (c >= 0xC2 && c <= 0xDF) {
+				if (end - p >= 2 && UTF8_CONT(p[1])) {
+					*o++ = ((c & 0x1F) << 6) |
+					       (p[1] & 0x3F);
+					p += 2;
+					direct = true;
+					continue;
+				}
+			} else if ((c & 0xF0) == 0xE0) {
+				if (end - p >= 3 && UTF8_CONT(p[1]) &&
+				    UTF8_CONT(p[2])) {
+					*o++ = ((c & 0x0F) << 12) |
+					       ((p[1] & 0x3F) << 6) |
+					       (p[2] & 0x3F);
+					p += 3;
+					direct = true;
+					continue;
+				}
+			} else if ((c & 0xF8) == 0xF0) {
+				if (end - p >= 4 && UTF8_CONT(p[1]) &&
+				    UTF8_CONT(p[2]) && UTF8_CONT(p[3])) {
+					*o++ = ((c & 0x07) << 18) |
+					       ((p[1] & 0x3F) << 12) |
+					       ((p[2] & 0x3F) << 6) |
+					       (p[3] & 0x3F);
+					p += 4;
+					direct = true;
+					continue;
+				}
+			}
+		}
+
+		state = tsm_utf8_mach_feed(mach, *p++);
+		if (state == TSM_UTF8_ACCEPT || state == TSM_UTF8_REJECT)
+			*o++ = tsm_utf8_mach_get(mach);
+		direct = false;
+	}
+
+	/* leave the machine as if it had decoded the last character */
+	if (direct) {
+		mach->state = TSM_UTF8_ACCEPT;
+		mach->ch = o[-1];
+	}
+
+	return o - out;
+}
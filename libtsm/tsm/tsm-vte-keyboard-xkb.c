@@ -291,7 +291,7 @@ bool tsm_vte_handle_keyboard(struct tsm_vte *vte, uint32_t keysym,
 			return true;
 		case XKB_KEY_Down:
 		case XKB_KEY_KP_Down:
-			if (mods & TSM_CONTROL_MASK) {
+			if (mods & TSM_CONTROL_MASK)
 				vte_write(vte, "\e[1;5B", 6);
 			else if (vte->flags & TSM_VTE_FLAG_CURSOR_KEY_MODE)
 				vte_write(vte, "\eOB", 3);
@@ -300,7 +300,7 @@ bool tsm_vte_handle_keyboard(struct tsm_vte *vte, uint32_t keysym,
 			return true;
 		case XKB_KEY_Right:
 		case XKB_KEY_KP_Right:
-			if (mods & TSM_CONTROL_MASK) {
+			if (mods & TSM_CONTROL_MASK)
 				vte_write(vte, "\e[1;5C", 6);
 			else if (vte->flags & TSM_VTE_FLAG_CURSOR_KEY_MODE)
 				vte_write(vte, "\eOC", 3);
@@ -309,7 +309,7 @@ bool tsm_vte_handle_keyboard(struct tsm_vte *vte, uint32_t keysym,
 			return true;
 		case XKB_KEY_Left:
 		case XKB_KEY_KP_Left:
-			if (mods & TSM_CONTROL_MASK) {
+			if (mods & TSM_CONTROL_MASK)
 				vte_write(vte, "\e[1;5D", 6);
 			else if (vte->flags & TSM_VTE_FLAG_CURSOR_KEY_MODE)
 				vte_write(vte, "\eOD", 3);
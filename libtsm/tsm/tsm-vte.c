@@ -51,6 +51,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
 #include "libtsm.h"
 #include "libtsm-int.h"
 #include "shl-llog.h"
@@ -116,6 +117,12 @@ enum parser_action {
 /* max length of an OSC code */
 #define OSC_MAX_LEN 128
 
+/* max time in ms a synchronized update may hold back screen updates */
+#define SYNC_TIMEOUT 500
+
+/* bytes of UTF-8 input that are decoded at a time */
+#define VTE_DECODE_BLOCK 256
+
 struct vte_saved_state {
 	unsigned int cursor_x;
 	unsigned int cursor_y;
@@ -154,6 +161,7 @@ struct tsm_vte {
 	uint8_t palette[TSM_COLOR_NUM][3];
 	struct tsm_screen_attr def_attr;
 	struct tsm_screen_attr cattr;
+	bool cattr_dirty; /* cattr colors must be resolved with to_rgb() */
 	unsigned int flags;
 
 	tsm_vte_charset **gl;
@@ -168,6 +176,8 @@ struct tsm_vte {
 	struct vte_saved_state saved_state;
 	unsigned int alt_cursor_x;
 	unsigned int alt_cursor_y;
+
+	unsigned long sync_start;
 };
 
 static const uint8_t color_palette[TSM_COLOR_NUM][3] = {
@@ -381,6 +391,16 @@ static void to_rgb(struct tsm_vte *vte, struct tsm_screen_attr *attr)
 	}
 }
 
+/* Attributes change far less often than characters are printed, so the
+ * colors of cattr are only resolved again when they may have changed. */
+static inline void resolve_cattr(struct tsm_vte *vte)
+{
+	if (vte->cattr_dirty) {
+		to_rgb(vte, &vte->cattr);
+		vte->cattr_dirty = false;
+	}
+}
+
 static void copy_fcolor(struct tsm_screen_attr *dest,
                         const struct tsm_screen_attr *src)
 {
@@ -493,6 +513,7 @@ static int vte_update_palette(struct tsm_vte *vte)
 
 	to_rgb(vte, &vte->def_attr);
 	memcpy(&vte->cattr, &vte->def_attr, sizeof(vte->cattr));
+	vte->cattr_dirty = true;
 
 	tsm_screen_set_def_attr(con, &vte->def_attr);
 
@@ -583,6 +604,32 @@ unsigned int tsm_vte_get_flags(struct tsm_vte *vte)
 	return vte->flags;
 }
 
+static unsigned long vte_time_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec * 1000UL + tv.tv_usec / 1000;
+}
+
+SHL_EXPORT
+bool tsm_vte_synchronized_update(struct tsm_vte *vte)
+{
+	if (!vte || !(vte->flags & TSM_VTE_FLAG_SYNCHRONIZED_OUTPUT_MODE))
+		return false;
+
+	/* Don't let an application that never ends its update (or died in
+	 * the middle of it) freeze the screen. */
+	if (vte_time_ms() - vte->sync_start >= SYNC_TIMEOUT) {
+		llog_debug(vte, "synchronized update timed out");
+		vte->flags &= ~TSM_VTE_FLAG_SYNCHRONIZED_OUTPUT_MODE;
+		return false;
+	}
+
+	return true;
+}
+
 /*
  * Write raw byte-stream to pty.
  * When writing data to the client we must make sure that we send the correct
@@ -654,7 +701,7 @@ static void vte_write_debug(struct tsm_vte *vte, const char *u8, size_t len,
 /* write to console */
 static void write_console(struct tsm_vte *vte, tsm_symbol_t sym)
 {
-	to_rgb(vte, &vte->cattr);
+	resolve_cattr(vte);
 	tsm_screen_write(vte->con, sym, &vte->cattr);
 }
 
@@ -693,9 +740,11 @@ static void restore_state(struct tsm_vte *vte)
 	tsm_screen_move_to(vte->con, vte->saved_state.cursor_x,
 			       vte->saved_state.cursor_y);
 	vte->cattr = vte->saved_state.cattr;
-	to_rgb(vte, &vte->cattr);
-	if (vte->flags & TSM_VTE_FLAG_BACKGROUND_COLOR_ERASE_MODE)
+	vte->cattr_dirty = true;
+	if (vte->flags & TSM_VTE_FLAG_BACKGROUND_COLOR_ERASE_MODE) {
+		resolve_cattr(vte);
 		tsm_screen_set_def_attr(vte->con, &vte->cattr);
+	}
 	vte->gl = vte->saved_state.gl;
 	vte->gr = vte->saved_state.gr;
 
@@ -749,7 +798,7 @@ void tsm_vte_reset(struct tsm_vte *vte)
 	vte->g3 = &tsm_vte_unicode_upper;
 
 	memcpy(&vte->cattr, &vte->def_attr, sizeof(vte->cattr));
-	to_rgb(vte, &vte->cattr);
+	vte->cattr_dirty = true;
 	tsm_screen_set_def_attr(vte->con, &vte->def_attr);
 
 	reset_state(vte);
@@ -1371,9 +1420,11 @@ static void csi_attribute(struct tsm_vte *vte)
 		}
 	}
 
-	to_rgb(vte, &vte->cattr);
-	if (vte->flags & TSM_VTE_FLAG_BACKGROUND_COLOR_ERASE_MODE)
+	vte->cattr_dirty = true;
+	if (vte->flags & TSM_VTE_FLAG_BACKGROUND_COLOR_ERASE_MODE) {
+		resolve_cattr(vte);
 		tsm_screen_set_def_attr(vte->con, &vte->cattr);
+	}
 }
 
 static void csi_soft_reset(struct tsm_vte *vte)
@@ -1616,6 +1667,19 @@ static void csi_mode(struct tsm_vte *vte, bool set)
 						   vte->alt_cursor_y);
 			}
 			continue;
+		case 2004: /* Bracketed paste */
+			set_reset_flag(vte, set,
+				       TSM_VTE_FLAG_BRACKETED_PASTE_MODE);
+			continue;
+		case 2026: /* Synchronized output */
+			/* the timeout runs from the start of the update, a
+			 * repeated set does not extend it */
+			if (set && !(vte->flags &
+				     TSM_VTE_FLAG_SYNCHRONIZED_OUTPUT_MODE))
+				vte->sync_start = vte_time_ms();
+			set_reset_flag(vte, set,
+				       TSM_VTE_FLAG_SYNCHRONIZED_OUTPUT_MODE);
+			continue;
 		default:
 			llog_debug(vte, "unknown DEC %set-Mode %d",
 				   set?"S":"Res", vte->csi_argv[i]);
@@ -1624,6 +1688,23 @@ static void csi_mode(struct tsm_vte *vte, bool set)
 	}
 }
 
+/* DECRPM reply for the DEC private modes that can be queried */
+static void csi_mode_report(struct tsm_vte *vte)
+{
+	char buf[32];
+	unsigned int flag;
+	int len;
+
+	if (vte->csi_argv[0] == 2004)
+		flag = TSM_VTE_FLAG_BRACKETED_PASTE_MODE;
+	else
+		flag = TSM_VTE_FLAG_SYNCHRONIZED_OUTPUT_MODE;
+
+	len = snprintf(buf, sizeof(buf), "\e[?%d;%d$y", vte->csi_argv[0],
+		       (vte->flags & flag) ? 1 : 2);
+	vte_write(vte, buf, len);
+}
+
 static void csi_dev_attr(struct tsm_vte *vte)
 {
 	if (vte->csi_argc <= 1 && vte->csi_argv[0] <= 0) {
@@ -1786,6 +1867,14 @@ static void do_csi(struct tsm_vte *vte, uint32_t data)
 			/* DECRQM: Request DEC Private Mode */
 			/* If CSI_WHAT is set, then enable,
 			 * otherwise disable */
+			if ((vte->csi_flags & CSI_WHAT) &&
+			    (vte->csi_argv[0] == 2004 ||
+			     vte->csi_argv[0] == 2026)) {
+				/* Applications use this to find out if
+				 * these modes are supported */
+				csi_mode_report(vte);
+				break;
+			}
 			csi_soft_reset(vte);
 		} else {
 			/* DECSCL: Compatibility Level */
@@ -2023,6 +2112,165 @@ static void do_trans(struct tsm_vte *vte, uint32_t data, int state, int act)
 	}
 }
 
+/*
+ * Parser transition table
+ * For every state this gives the state to switch to (STATE_NONE to stay in
+ * the current one) and the action to perform for each input character.
+ * Characters from 0xa0 upwards are all handled the same so they share the
+ * last column. Each row starts out with the default transition for the
+ * state and then overrides it for the characters that are handled
+ * differently, with the transitions that are the same in every state
+ * applied last.
+ */
+#define HIGH_CLASS 0xa0
+
+#define TRANS(state, action) (((action) << 4) | (state))
+#define TRANS_STATE(t) ((t) & 0xf)
+#define TRANS_ACTION(t) ((t) >> 4)
+
+_Static_assert(STATE_NUM <= 16 && ACTION_NUM <= 16,
+	       "states and actions must fit in 4 bits each of vte_trans");
+
+#define ALL(t) [0x00 ... HIGH_CLASS] = (t)
+#define C0(t) [0x00 ... 0x17] = (t), [0x19] = (t), [0x1c ... 0x1f] = (t)
+#define ANYWHERE \
+	[0x18] = TRANS(STATE_GROUND, ACTION_EXECUTE), \
+	[0x1a] = TRANS(STATE_GROUND, ACTION_EXECUTE), \
+	[0x80 ... 0x8f] = TRANS(STATE_GROUND, ACTION_EXECUTE), \
+	[0x91 ... 0x97] = TRANS(STATE_GROUND, ACTION_EXECUTE), \
+	[0x99 ... 0x9a] = TRANS(STATE_GROUND, ACTION_EXECUTE), \
+	[0x9c] = TRANS(STATE_GROUND, ACTION_EXECUTE), \
+	[0x1b] = TRANS(STATE_ESC, ACTION_NONE), \
+	[0x98] = TRANS(STATE_ST_IGNORE, ACTION_NONE), \
+	[0x9e ... 0x9f] = TRANS(STATE_ST_IGNORE, ACTION_NONE), \
+	[0x90] = TRANS(STATE_DCS_ENTRY, ACTION_NONE), \
+	[0x9d] = TRANS(STATE_OSC_STRING, ACTION_NONE), \
+	[0x9b] = TRANS(STATE_CSI_ENTRY, ACTION_NONE)
+
+static const uint8_t vte_trans[STATE_NUM][HIGH_CLASS + 1] = {
+	[STATE_GROUND] = {
+		ALL(TRANS(STATE_NONE, ACTION_PRINT)),
+		C0(TRANS(STATE_NONE, ACTION_EXECUTE)),
+		[0x80 ... 0x8f] = TRANS(STATE_NONE, ACTION_EXECUTE),
+		[0x91 ... 0x9a] = TRANS(STATE_NONE, ACTION_EXECUTE),
+		[0x9c] = TRANS(STATE_NONE, ACTION_EXECUTE),
+		ANYWHERE
+	},
+	[STATE_ESC] = {
+		ALL(TRANS(STATE_ESC_INT, ACTION_COLLECT)),
+		C0(TRANS(STATE_NONE, ACTION_EXECUTE)),
+		[0x7f] = TRANS(STATE_NONE, ACTION_IGNORE),
+		[0x20 ... 0x2f] = TRANS(STATE_ESC_INT, ACTION_COLLECT),
+		[0x30 ... 0x4f] = TRANS(STATE_GROUND, ACTION_ESC_DISPATCH),
+		[0x51 ... 0x57] = TRANS(STATE_GROUND, ACTION_ESC_DISPATCH),
+		[0x59 ... 0x5a] = TRANS(STATE_GROUND, ACTION_ESC_DISPATCH),
+		[0x5c] = TRANS(STATE_GROUND, ACTION_ESC_DISPATCH),
+		[0x60 ... 0x7e] = TRANS(STATE_GROUND, ACTION_ESC_DISPATCH),
+		[0x5b] = TRANS(STATE_CSI_ENTRY, ACTION_NONE),
+		[0x5d] = TRANS(STATE_OSC_STRING, ACTION_NONE),
+		[0x50] = TRANS(STATE_DCS_ENTRY, ACTION_NONE),
+		[0x58] = TRANS(STATE_ST_IGNORE, ACTION_NONE),
+		[0x5e ... 0x5f] = TRANS(STATE_ST_IGNORE, ACTION_NONE),
+		ANYWHERE
+	},
+	[STATE_ESC_INT] = {
+		ALL(TRANS(STATE_NONE, ACTION_COLLECT)),
+		C0(TRANS(STATE_NONE, ACTION_EXECUTE)),
+		[0x20 ... 0x2f] = TRANS(STATE_NONE, ACTION_COLLECT),
+		[0x7f] = TRANS(STATE_NONE, ACTION_IGNORE),
+		[0x30 ... 0x7e] = TRANS(STATE_GROUND, ACTION_ESC_DISPATCH),
+		ANYWHERE
+	},
+	[STATE_CSI_ENTRY] = {
+		ALL(TRANS(STATE_CSI_IGNORE, ACTION_NONE)),
+		C0(TRANS(STATE_NONE, ACTION_EXECUTE)),
+		[0x7f] = TRANS(STATE_NONE, ACTION_IGNORE),
+		[0x20 ... 0x2f] = TRANS(STATE_CSI_INT, ACTION_COLLECT),
+		[0x3a] = TRANS(STATE_CSI_IGNORE, ACTION_NONE),
+		[0x30 ... 0x39] = TRANS(STATE_CSI_PARAM, ACTION_PARAM),
+		[0x3b] = TRANS(STATE_CSI_PARAM, ACTION_PARAM),
+		[0x3c ... 0x3f] = TRANS(STATE_CSI_PARAM, ACTION_COLLECT),
+		[0x40 ... 0x7e] = TRANS(STATE_GROUND, ACTION_CSI_DISPATCH),
+		ANYWHERE
+	},
+	[STATE_CSI_PARAM] = {
+		ALL(TRANS(STATE_CSI_IGNORE, ACTION_NONE)),
+		C0(TRANS(STATE_NONE, ACTION_EXECUTE)),
+		[0x30 ... 0x39] = TRANS(STATE_NONE, ACTION_PARAM),
+		[0x3b] = TRANS(STATE_NONE, ACTION_PARAM),
+		[0x7f] = TRANS(STATE_NONE, ACTION_IGNORE),
+		[0x3a] = TRANS(STATE_CSI_IGNORE, ACTION_NONE),
+		[0x3c ... 0x3f] = TRANS(STATE_CSI_IGNORE, ACTION_NONE),
+		[0x20 ... 0x2f] = TRANS(STATE_CSI_INT, ACTION_COLLECT),
+		[0x40 ... 0x7e] = TRANS(STATE_GROUND, ACTION_CSI_DISPATCH),
+		ANYWHERE
+	},
+	[STATE_CSI_INT] = {
+		ALL(TRANS(STATE_CSI_IGNORE, ACTION_NONE)),
+		C0(TRANS(STATE_NONE, ACTION_EXECUTE)),
+		[0x20 ... 0x2f] = TRANS(STATE_NONE, ACTION_COLLECT),
+		[0x7f] = TRANS(STATE_NONE, ACTION_IGNORE),
+		[0x30 ... 0x3f] = TRANS(STATE_CSI_IGNORE, ACTION_NONE),
+		[0x40 ... 0x7e] = TRANS(STATE_GROUND, ACTION_CSI_DISPATCH),
+		ANYWHERE
+	},
+	[STATE_CSI_IGNORE] = {
+		ALL(TRANS(STATE_NONE, ACTION_IGNORE)),
+		C0(TRANS(STATE_NONE, ACTION_EXECUTE)),
+		[0x40 ... 0x7e] = TRANS(STATE_GROUND, ACTION_NONE),
+		ANYWHERE
+	},
+	[STATE_DCS_ENTRY] = {
+		ALL(TRANS(STATE_DCS_PASS, ACTION_NONE)),
+		C0(TRANS(STATE_NONE, ACTION_IGNORE)),
+		[0x7f] = TRANS(STATE_NONE, ACTION_IGNORE),
+		[0x3a] = TRANS(STATE_DCS_IGNORE, ACTION_NONE),
+		[0x20 ... 0x2f] = TRANS(STATE_DCS_INT, ACTION_COLLECT),
+		[0x30 ... 0x39] = TRANS(STATE_DCS_PARAM, ACTION_PARAM),
+		[0x3b] = TRANS(STATE_DCS_PARAM, ACTION_PARAM),
+		[0x3c ... 0x3f] = TRANS(STATE_DCS_PARAM, ACTION_COLLECT),
+		ANYWHERE
+	},
+	[STATE_DCS_PARAM] = {
+		ALL(TRANS(STATE_DCS_PASS, ACTION_NONE)),
+		C0(TRANS(STATE_NONE, ACTION_IGNORE)),
+		[0x7f] = TRANS(STATE_NONE, ACTION_IGNORE),
+		[0x30 ... 0x39] = TRANS(STATE_NONE, ACTION_PARAM),
+		[0x3b] = TRANS(STATE_NONE, ACTION_PARAM),
+		[0x3a] = TRANS(STATE_DCS_IGNORE, ACTION_NONE),
+		[0x3c ... 0x3f] = TRANS(STATE_DCS_IGNORE, ACTION_NONE),
+		[0x20 ... 0x2f] = TRANS(STATE_DCS_INT, ACTION_COLLECT),
+		ANYWHERE
+	},
+	[STATE_DCS_INT] = {
+		ALL(TRANS(STATE_DCS_PASS, ACTION_NONE)),
+		C0(TRANS(STATE_NONE, ACTION_IGNORE)),
+		[0x7f] = TRANS(STATE_NONE, ACTION_IGNORE),
+		[0x20 ... 0x2f] = TRANS(STATE_NONE, ACTION_COLLECT),
+		[0x30 ... 0x3f] = TRANS(STATE_DCS_IGNORE, ACTION_NONE),
+		ANYWHERE
+	},
+	[STATE_DCS_PASS] = {
+		ALL(TRANS(STATE_NONE, ACTION_DCS_COLLECT)),
+		[0x7f] = TRANS(STATE_NONE, ACTION_IGNORE),
+		ANYWHERE
+	},
+	[STATE_DCS_IGNORE] = {
+		ALL(TRANS(STATE_NONE, ACTION_IGNORE)),
+		ANYWHERE
+	},
+	[STATE_OSC_STRING] = {
+		ALL(TRANS(STATE_NONE, ACTION_OSC_COLLECT)),
+		C0(TRANS(STATE_NONE, ACTION_IGNORE)),
+		[0x07] = TRANS(STATE_GROUND, ACTION_NONE),
+		ANYWHERE
+	},
+	[STATE_ST_IGNORE] = {
+		ALL(TRANS(STATE_NONE, ACTION_IGNORE)),
+		ANYWHERE
+	},
+};
+
 /*
  * Escape sequence parser
  * This parses the new input character \data. It performs state transition and
@@ -2030,372 +2278,85 @@ static void do_trans(struct tsm_vte *vte, uint32_t data, int state, int act)
  */
 static void parse_data(struct tsm_vte *vte, uint32_t raw)
 {
-	/* events that may occur in any state */
-	switch (raw) {
-		case 0x18:
-		case 0x1a:
-		case 0x80 ... 0x8f:
-		case 0x91 ... 0x97:
-		case 0x99:
-		case 0x9a:
-		case 0x9c:
-			do_trans(vte, raw, STATE_GROUND, ACTION_EXECUTE);
-			return;
-		case 0x1b:
-			do_trans(vte, raw, STATE_ESC, ACTION_NONE);
-			return;
-		case 0x98:
-		case 0x9e:
-		case 0x9f:
-			do_trans(vte, raw, STATE_ST_IGNORE, ACTION_NONE);
-			return;
-		case 0x90:
-			do_trans(vte, raw, STATE_DCS_ENTRY, ACTION_NONE);
-			return;
-		case 0x9d:
-			do_trans(vte, raw, STATE_OSC_STRING, ACTION_NONE);
-			return;
-		case 0x9b:
-			do_trans(vte, raw, STATE_CSI_ENTRY, ACTION_NONE);
-			return;
-	}
+	uint8_t trans;
 
-	/* events that depend on the current state */
-	switch (vte->state) {
-	case STATE_GROUND:
-		switch (raw) {
-		case 0x00 ... 0x17:
-		case 0x19:
-		case 0x1c ... 0x1f:
-		case 0x80 ... 0x8f:
-		case 0x91 ... 0x9a:
-		case 0x9c:
-			do_trans(vte, raw, STATE_NONE, ACTION_EXECUTE);
-			return;
-		case 0x20 ... 0x7f:
-			do_trans(vte, raw, STATE_NONE, ACTION_PRINT);
-			return;
-		}
-		do_trans(vte, raw, STATE_NONE, ACTION_PRINT);
-		return;
-	case STATE_ESC:
-		switch (raw) {
-		case 0x00 ... 0x17:
-		case 0x19:
-		case 0x1c ... 0x1f:
-			do_trans(vte, raw, STATE_NONE, ACTION_EXECUTE);
-			return;
-		case 0x7f:
-			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
-			return;
-		case 0x20 ... 0x2f:
-			do_trans(vte, raw, STATE_ESC_INT, ACTION_COLLECT);
-			return;
-		case 0x30 ... 0x4f:
-		case 0x51 ... 0x57:
-		case 0x59:
-		case 0x5a:
-		case 0x5c:
-		case 0x60 ... 0x7e:
-			do_trans(vte, raw, STATE_GROUND, ACTION_ESC_DISPATCH);
-			return;
-		case 0x5b:
-			do_trans(vte, raw, STATE_CSI_ENTRY, ACTION_NONE);
-			return;
-		case 0x5d:
-			do_trans(vte, raw, STATE_OSC_STRING, ACTION_NONE);
-			return;
-		case 0x50:
-			do_trans(vte, raw, STATE_DCS_ENTRY, ACTION_NONE);
-			return;
-		case 0x58:
-		case 0x5e:
-		case 0x5f:
-			do_trans(vte, raw, STATE_ST_IGNORE, ACTION_NONE);
-			return;
-		}
-		do_trans(vte, raw, STATE_ESC_INT, ACTION_COLLECT);
-		return;
-	case STATE_ESC_INT:
-		switch (raw) {
-		case 0x00 ... 0x17:
-		case 0x19:
-		case 0x1c ... 0x1f:
-			do_trans(vte, raw, STATE_NONE, ACTION_EXECUTE);
-			return;
-		case 0x20 ... 0x2f:
-			do_trans(vte, raw, STATE_NONE, ACTION_COLLECT);
-			return;
-		case 0x7f:
-			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
-			return;
-		case 0x30 ... 0x7e:
-			do_trans(vte, raw, STATE_GROUND, ACTION_ESC_DISPATCH);
-			return;
-		}
-		do_trans(vte, raw, STATE_NONE, ACTION_COLLECT);
-		return;
-	case STATE_CSI_ENTRY:
-		switch (raw) {
-		case 0x00 ... 0x17:
-		case 0x19:
-		case 0x1c ... 0x1f:
-			do_trans(vte, raw, STATE_NONE, ACTION_EXECUTE);
-			return;
-		case 0x7f:
-			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
-			return;
-		case 0x20 ... 0x2f:
-			do_trans(vte, raw, STATE_CSI_INT, ACTION_COLLECT);
-			return;
-		case 0x3a:
-			do_trans(vte, raw, STATE_CSI_IGNORE, ACTION_NONE);
-			return;
-		case 0x30 ... 0x39:
-		case 0x3b:
-			do_trans(vte, raw, STATE_CSI_PARAM, ACTION_PARAM);
-			return;
-		case 0x3c ... 0x3f:
-			do_trans(vte, raw, STATE_CSI_PARAM, ACTION_COLLECT);
-			return;
-		case 0x40 ... 0x7e:
-			do_trans(vte, raw, STATE_GROUND, ACTION_CSI_DISPATCH);
-			return;
-		}
-		do_trans(vte, raw, STATE_CSI_IGNORE, ACTION_NONE);
-		return;
-	case STATE_CSI_PARAM:
-		switch (raw) {
-		case 0x00 ... 0x17:
-		case 0x19:
-		case 0x1c ... 0x1f:
-			do_trans(vte, raw, STATE_NONE, ACTION_EXECUTE);
-			return;
-		case 0x30 ... 0x39:
-		case 0x3b:
-			do_trans(vte, raw, STATE_NONE, ACTION_PARAM);
-			return;
-		case 0x7f:
-			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
-			return;
-		case 0x3a:
-		case 0x3c ... 0x3f:
-			do_trans(vte, raw, STATE_CSI_IGNORE, ACTION_NONE);
-			return;
-		case 0x20 ... 0x2f:
-			do_trans(vte, raw, STATE_CSI_INT, ACTION_COLLECT);
-			return;
-		case 0x40 ... 0x7e:
-			do_trans(vte, raw, STATE_GROUND, ACTION_CSI_DISPATCH);
-			return;
-		}
-		do_trans(vte, raw, STATE_CSI_IGNORE, ACTION_NONE);
-		return;
-	case STATE_CSI_INT:
-		switch (raw) {
-		case 0x00 ... 0x17:
-		case 0x19:
-		case 0x1c ... 0x1f:
-			do_trans(vte, raw, STATE_NONE, ACTION_EXECUTE);
-			return;
-		case 0x20 ... 0x2f:
-			do_trans(vte, raw, STATE_NONE, ACTION_COLLECT);
-			return;
-		case 0x7f:
-			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
-			return;
-		case 0x30 ... 0x3f:
-			do_trans(vte, raw, STATE_CSI_IGNORE, ACTION_NONE);
-			return;
-		case 0x40 ... 0x7e:
-			do_trans(vte, raw, STATE_GROUND, ACTION_CSI_DISPATCH);
-			return;
-		}
-		do_trans(vte, raw, STATE_CSI_IGNORE, ACTION_NONE);
-		return;
-	case STATE_CSI_IGNORE:
-		switch (raw) {
-		case 0x00 ... 0x17:
-		case 0x19:
-		case 0x1c ... 0x1f:
-			do_trans(vte, raw, STATE_NONE, ACTION_EXECUTE);
-			return;
-		case 0x20 ... 0x3f:
-		case 0x7f:
-			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
-			return;
-		case 0x40 ... 0x7e:
-			do_trans(vte, raw, STATE_GROUND, ACTION_NONE);
-			return;
-		}
-		do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
-		return;
-	case STATE_DCS_ENTRY:
-		switch (raw) {
-		case 0x00 ... 0x17:
-		case 0x19:
-		case 0x1c ... 0x1f:
-		case 0x7f:
-			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
-			return;
-		case 0x3a:
-			do_trans(vte, raw, STATE_DCS_IGNORE, ACTION_NONE);
-			return;
-		case 0x20 ... 0x2f:
-			do_trans(vte, raw, STATE_DCS_INT, ACTION_COLLECT);
-			return;
-		case 0x30 ... 0x39:
-		case 0x3b:
-			do_trans(vte, raw, STATE_DCS_PARAM, ACTION_PARAM);
-			return;
-		case 0x3c ... 0x3f:
-			do_trans(vte, raw, STATE_DCS_PARAM, ACTION_COLLECT);
-			return;
-		case 0x40 ... 0x7e:
-			do_trans(vte, raw, STATE_DCS_PASS, ACTION_NONE);
-			return;
-		}
-		do_trans(vte, raw, STATE_DCS_PASS, ACTION_NONE);
-		return;
-	case STATE_DCS_PARAM:
-		switch (raw) {
-		case 0x00 ... 0x17:
-		case 0x19:
-		case 0x1c ... 0x1f:
-		case 0x7f:
-			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
-			return;
-		case 0x30 ... 0x39:
-		case 0x3b:
-			do_trans(vte, raw, STATE_NONE, ACTION_PARAM);
-			return;
-		case 0x3a:
-		case 0x3c ... 0x3f:
-			do_trans(vte, raw, STATE_DCS_IGNORE, ACTION_NONE);
-			return;
-		case 0x20 ... 0x2f:
-			do_trans(vte, raw, STATE_DCS_INT, ACTION_COLLECT);
-			return;
-		case 0x40 ... 0x7e:
-			do_trans(vte, raw, STATE_DCS_PASS, ACTION_NONE);
-			return;
-		}
-		do_trans(vte, raw, STATE_DCS_PASS, ACTION_NONE);
-		return;
-	case STATE_DCS_INT:
-		switch (raw) {
-		case 0x00 ... 0x17:
-		case 0x19:
-		case 0x1c ... 0x1f:
-		case 0x7f:
-			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
-			return;
-		case 0x20 ... 0x2f:
-			do_trans(vte, raw, STATE_NONE, ACTION_COLLECT);
-			return;
-		case 0x30 ... 0x3f:
-			do_trans(vte, raw, STATE_DCS_IGNORE, ACTION_NONE);
-			return;
-		case 0x40 ... 0x7e:
-			do_trans(vte, raw, STATE_DCS_PASS, ACTION_NONE);
-			return;
-		}
-		do_trans(vte, raw, STATE_DCS_PASS, ACTION_NONE);
-		return;
-	case STATE_DCS_PASS:
-		switch (raw) {
-		case 0x00 ... 0x17:
-		case 0x19:
-		case 0x1c ... 0x1f:
-		case 0x20 ... 0x7e:
-			do_trans(vte, raw, STATE_NONE, ACTION_DCS_COLLECT);
-			return;
-		case 0x7f:
-			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
-			return;
-		case 0x9c:
-			do_trans(vte, raw, STATE_GROUND, ACTION_NONE);
-			return;
-		}
-		do_trans(vte, raw, STATE_NONE, ACTION_DCS_COLLECT);
-		return;
-	case STATE_DCS_IGNORE:
-		switch (raw) {
-		case 0x00 ... 0x17:
-		case 0x19:
-		case 0x1c ... 0x1f:
-		case 0x20 ... 0x7f:
-			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
-			return;
-		case 0x9c:
-			do_trans(vte, raw, STATE_GROUND, ACTION_NONE);
-			return;
-		}
-		do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
+	/* Printable characters in the ground state are by far the most common
+	 * input so these skip the table. */
+	if (vte->state == STATE_GROUND &&
+	    ((raw >= 0x20 && raw <= 0x7f) || raw >= HIGH_CLASS)) {
+		write_console(vte, tsm_symbol_make(vte_map(vte, raw)));
 		return;
-	case STATE_OSC_STRING:
-		switch (raw) {
-		case 0x00 ... 0x06:
-		case 0x08 ... 0x17:
-		case 0x19:
-		case 0x1c ... 0x1f:
-			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
-			return;
-		case 0x20 ... 0x7f:
-			do_trans(vte, raw, STATE_NONE, ACTION_OSC_COLLECT);
-			return;
-		case 0x07:
-		case 0x9c:
-			do_trans(vte, raw, STATE_GROUND, ACTION_NONE);
-			return;
-		}
-		do_trans(vte, raw, STATE_NONE, ACTION_OSC_COLLECT);
-		return;
-	case STATE_ST_IGNORE:
-		switch (raw) {
-		case 0x00 ... 0x17:
-		case 0x19:
-		case 0x1c ... 0x1f:
-		case 0x20 ... 0x7f:
-			do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
-			return;
-		case 0x9c:
-			do_trans(vte, raw, STATE_GROUND, ACTION_NONE);
-			return;
+	}
+
+	trans = vte_trans[vte->state][raw < HIGH_CLASS ? raw : HIGH_CLASS];
+
+	do_trans(vte, raw, TRANS_STATE(trans), TRANS_ACTION(trans));
+}
+
+/* Decode up to VTE_DECODE_BLOCK bytes of UTF-8 in one go and parse the
+ * result. Returns the number of bytes used, which is less than that if the
+ * input switched the vte to 7bit or 8bit mode. */
+static size_t vte_input_utf8(struct tsm_vte *vte, const char *u8, size_t len)
+{
+	uint32_t ucs4[VTE_DECODE_BLOCK];
+	struct tsm_utf8_mach mach, end;
+	size_t i, n, num;
+	int state;
+
+	if (len > VTE_DECODE_BLOCK)
+		len = VTE_DECODE_BLOCK;
+
+	/* A reset while parsing has no effect on the bytes after it as the
+	 * machine is between characters at that point, so the state after
+	 * the block is stored back once all of it has been parsed. */
+	mach = vte->mach;
+	end = mach;
+	num = tsm_utf8_mach_decode(&end, u8, len, ucs4);
+
+	for (n = 0; n < num; ++n) {
+		parse_data(vte, ucs4[n]);
+
+		if (!(vte->flags & (TSM_VTE_FLAG_7BIT_MODE |
+				    TSM_VTE_FLAG_8BIT_MODE)))
+			continue;
+
+		/* The rest must not be read as UTF-8, so find out where the
+		 * character that switched modes ended. */
+		for (i = 0; i < len; ++i) {
+			state = tsm_utf8_mach_feed(&mach, u8[i]);
+			if ((state == TSM_UTF8_ACCEPT ||
+			     state == TSM_UTF8_REJECT) && n-- == 0)
+				break;
 		}
-		do_trans(vte, raw, STATE_NONE, ACTION_IGNORE);
-		return;
+		vte->mach = mach;
+		return i + 1;
 	}
 
-	llog_warning(vte, "unhandled input %u in state %d", raw, vte->state);
+	vte->mach = end;
+	return len;
 }
 
 SHL_EXPORT
 void tsm_vte_input(struct tsm_vte *vte, const char *u8, size_t len)
 {
-	int state;
-	uint32_t ucs4;
 	size_t i;
 
 	if (!vte || !vte->con)
 		return;
 
 	++vte->parse_cnt;
-	for (i = 0; i < len; ++i) {
+	for (i = 0; i < len; ) {
 		if (vte->flags & TSM_VTE_FLAG_7BIT_MODE) {
 			if (u8[i] & 0x80)
 				llog_debug(vte, "receiving 8bit character U+%d from pty while in 7bit mode",
 					   (int)u8[i]);
 			parse_data(vte, u8[i] & 0x7f);
+			++i;
 		} else if (vte->flags & TSM_VTE_FLAG_8BIT_MODE) {
 			parse_data(vte, u8[i]);
+			++i;
 		} else {
-			state = tsm_utf8_mach_feed(&vte->mach, u8[i]);
-			if (state == TSM_UTF8_ACCEPT ||
-			    state == TSM_UTF8_REJECT) {
-				ucs4 = tsm_utf8_mach_get(&vte->mach);
-				parse_data(vte, ucs4);
-			}
+			i += vte_input_utf8(vte, &u8[i], len - i);
 		}
 	}
 	--vte->parse_cnt;
@@ -2407,6 +2368,90 @@ void tsm_vte_set_backspace_sends_delete(struct tsm_vte *vte, bool enable)
 	vte->backspace_sends_delete = enable;
 }
 
+/* Append one pasted character to \out, encoded the same way as keyboard
+ * input. \cr tracks whether the previous character was a CR so that the LF
+ * of a CR LF pair is dropped. */
+static char *paste_char(struct tsm_vte *vte, char *out, uint32_t ucs4,
+			bool bracketed, bool *cr)
+{
+	bool was_cr = *cr;
+
+	*cr = (ucs4 == '\r');
+
+	if (ucs4 == '\r' || ucs4 == '\n') {
+		if (ucs4 == '\n' && was_cr)
+			return out;
+		*out++ = '\r';
+		if (vte->flags & TSM_VTE_FLAG_LINE_FEED_NEW_LINE_MODE)
+			*out++ = '\n';
+		return out;
+	}
+
+	if (bracketed && ucs4 == '\e')
+		return out;
+
+	if (vte->flags & TSM_VTE_FLAG_7BIT_MODE)
+		*out++ = (ucs4 & ~0x7f) ? '?' : ucs4;
+	else if (vte->flags & TSM_VTE_FLAG_8BIT_MODE)
+		*out++ = (ucs4 & ~0xff) ? '?' : ucs4;
+	else
+		out += tsm_ucs4_to_utf8(tsm_symbol_make(ucs4), out);
+
+	return out;
+}
+
+SHL_EXPORT
+bool tsm_vte_paste(struct tsm_vte *vte, const char *u8, size_t len)
+{
+	struct tsm_utf8_mach mach;
+	char *buf, *out;
+	size_t i;
+	int state = TSM_UTF8_START;
+	bool bracketed, cr = false;
+
+	if (!vte)
+		return false;
+
+	bracketed = !!(vte->flags & TSM_VTE_FLAG_BRACKETED_PASTE_MODE);
+
+	/* A byte turns into at most three: an invalid one is replaced by
+	 * U+FFFD and a line break may become CR LF. */
+	buf = malloc(len * 3 + 12);
+	if (!buf)
+		return false;
+
+	out = buf;
+	if (bracketed) {
+		memcpy(out, "\e[200~", 6);
+		out += 6;
+	}
+
+	tsm_utf8_mach_init(&mach);
+
+	for (i = 0; i < len; ++i) {
+		state = tsm_utf8_mach_feed(&mach, u8[i]);
+		if (state == TSM_UTF8_ACCEPT || state == TSM_UTF8_REJECT)
+			out = paste_char(vte, out, tsm_utf8_mach_get(&mach),
+					 bracketed, &cr);
+	}
+
+	/* incomplete sequence at the end */
+	if (state >= TSM_UTF8_EXPECT1)
+		out = paste_char(vte, out, tsm_utf8_mach_get(&mach),
+				 bracketed, &cr);
+
+	if (bracketed) {
+		memcpy(out, "\e[201~", 6);
+		out += 6;
+	}
+
+	if (out != buf)
+		vte_write_raw(vte, buf, out - buf);
+
+	free(buf);
+	return true;
+}
+
 #ifdef __amigaos4__
 #include "tsm-vte-keyboard-amiga.c"
 #else
@@ -46,6 +46,26 @@ int connect(int sock, const struct sockaddr *addr, socklen_t addrlen)
 	return ISocket->connect(sock, (struct sockaddr *)addr, addrlen);
 }
 
+int bind(int sock, const struct sockaddr *addr, socklen_t addrlen)
+{
+	return ISocket->bind(sock, (struct sockaddr *)addr, addrlen);
+}
+
+int listen(int sock, int backlog)
+{
+	return ISocket->listen(sock, backlog);
+}
+
+int accept(int sock, struct sockaddr *addr, socklen_t *addrlen)
+{
+	return ISocket->accept(sock, addr, addrlen);
+}
+
+int shutdown(int sock, int how)
+{
+	return ISocket->shutdown(sock, how);
+}
+
 ssize_t send(int sock, const void *buf, size_t len, int flags)
 {
 	return ISocket->send(sock, (void *)buf, len, flags);
@@ -83,6 +103,11 @@ in_addr_t inet_addr(const char *cp)
 	return ISocket->inet_addr((STRPTR)cp);
 }
 
+char *inet_ntoa(struct in_addr in)
+{
+	return ISocket->Inet_NtoA(in.s_addr);
+}
+
 struct hostent *gethostbyname(const char *name)
 {
 	return ISocket->gethostbyname((STRPTR)name);
@@ -0,0 +1,178 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "charmap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct CharMap
+{
+	uint8_t cm_Index[256];     /* page number for each high byte */
+	uint8_t cm_Pages[][256];   /* page 0 is always empty */
+};
+
+struct Fallback
+{
+	uint16_t fb_From;
+	uint16_t fb_To; /* ASCII or a code point listed further up */
+};
+
+/* Substitutes for characters missing from the charset. They are applied in
+ * order so an entry may refer to one that comes before it, e.g. heavy lines
+ * are drawn as light lines which in turn are drawn as ASCII if the charset
+ * has no box drawing characters at all.
+ */
+static const struct Fallback fallbacks[] =
+{
+	/* Light box drawing */
+	{ 0x2500, '-' }, { 0x2502, '|' },
+	{ 0x250C, '+' }, { 0x2510, '+' }, { 0x2514, '+' }, { 0x2518, '+' },
+	{ 0x251C, '+' }, { 0x2524, '+' }, { 0x252C, '+' }, { 0x2534, '+' },
+	{ 0x253C, '+' },
+
+	/* Heavy box drawing */
+	{ 0x2501, 0x2500 }, { 0x2503, 0x2502 },
+	{ 0x250F, 0x250C }, { 0x2513, 0x2510 }, { 0x2517, 0x2514 }, { 0x251B, 0x2518 },
+	{ 0x2523, 0x251C }, { 0x252B, 0x2524 }, { 0x2533, 0x252C }, { 0x253B, 0x2534 },
+	{ 0x254B, 0x253C },
+
+	/* Double box drawing */
+	{ 0x2550, 0x2500 }, { 0x2551, 0x2502 },
+	{ 0x2554, 0x250C }, { 0x2557, 0x2510 }, { 0x255A, 0x2514 }, { 0x255D, 0x2518 },
+	{ 0x2560, 0x251C }, { 0x2563, 0x2524 }, { 0x2566, 0x252C }, { 0x2569, 0x2534 },
+	{ 0x256C, 0x253C },
+
+	/* Rounded corners */
+	{ 0x256D, 0x250C }, { 0x256E, 0x2510 }, { 0x256F, 0x2518 }, { 0x2570, 0x2514 },
+
+	/* Dashed and half lines */
+	{ 0x2504, 0x2500 }, { 0x2508, 0x2500 }, { 0x254C, 0x2500 },
+	{ 0x2505, 0x2501 }, { 0x2509, 0x2501 }, { 0x254D, 0x2501 },
+	{ 0x2506, 0x2502 }, { 0x250A, 0x2502 }, { 0x254E, 0x2502 },
+	{ 0x2507, 0x2503 }, { 0x250B, 0x2503 }, { 0x254F, 0x2503 },
+	{ 0x2574, 0x2500 }, { 0x2576, 0x2500 }, { 0x2578, 0x2501 }, { 0x257A, 0x2501 },
+	{ 0x2575, 0x2502 }, { 0x2577, 0x2502 }, { 0x2579, 0x2503 }, { 0x257B, 0x2503 },
+
+	/* Block elements */
+	{ 0x2588, '#' }, { 0x2593, 0x2588 }, { 0x2592, 0x2593 }, { 0x2591, 0x2592 },
+	{ 0x2580, 0x2588 }, { 0x2584, 0x2588 }, { 0x258C, 0x2588 }, { 0x2590, 0x2588 },
+
+	/* Geometric shapes and arrows */
+	{ 0x25B2, '^' }, { 0x25BC, 'v' }, { 0x25B6, '>' }, { 0x25C0, '<' },
+	{ 0x2191, '^' }, { 0x2193, 'v' }, { 0x2192, '>' }, { 0x2190, '<' },
+	{ 0x25CF, '*' }, { 0x25CB, 'o' },
+
+	/* Punctuation */
+	{ 0x00A0, ' ' }, { 0x00B7, '.' }, { 0x2022, 0x00B7 }, { 0x2026, '.' },
+	{ 0x2010, '-' }, { 0x2011, '-' }, { 0x2012, '-' }, { 0x2013, '-' }, { 0x2014, '-' },
+	{ 0x2018, '\'' }, { 0x2019, '\'' }, { 0x201A, ',' },
+	{ 0x201C, '"' }, { 0x201D, '"' }, { 0x201E, '"' },
+	{ 0x2039, '<' }, { 0x203A, '>' }
+};
+
+#define NUM_FALLBACKS (sizeof(fallbacks) / sizeof(fallbacks[0]))
+
+static uint8_t *lookup_slot(struct CharMap *cm, uint32_t unicode)
+{
+	return &cm->cm_Pages[cm->cm_Index[unicode >> 8]][unicode & 0xff];
+}
+
+struct CharMap *charmap_new(const uint32_t *maptable)
+{
+	struct CharMap *cm;
+	uint8_t used[256];
+	uint32_t num_pages, i;
+
+	/* Find out which pages are needed */
+	memset(used, 0, sizeof(used));
+
+	for (i = 128; i < 256; i++)
+	{
+		if (maptable[i] >= 128 && maptable[i] <= 0xffff)
+			used[maptable[i] >> 8] = 1;
+	}
+
+	for (i = 0; i < NUM_FALLBACKS; i++)
+		used[fallbacks[i].fb_From >> 8] = 1;
+
+	num_pages = 1;
+	for (i = 0; i < 256; i++)
+	{
+		if (used[i])
+			num_pages++;
+	}
+
+	cm = calloc(1, sizeof(*cm) + num_pages * sizeof(cm->cm_Pages[0]));
+	if (cm == NULL)
+		return NULL;
+
+	num_pages = 1;
+	for (i = 0; i < 256; i++)
+	{
+		if (used[i])
+			cm->cm_Index[i] = num_pages++;
+	}
+
+	/* Where a code point appears more than once the lowest character wins,
+	 * same as with a linear search of the map table. */
+	for (i = 255; i >= 128; i--)
+	{
+		if (maptable[i] >= 128 && maptable[i] <= 0xffff)
+			*lookup_slot(cm, maptable[i]) = i;
+	}
+
+	for (i = 0; i < NUM_FALLBACKS; i++)
+	{
+		const struct Fallback *fb = &fallbacks[i];
+		uint8_t *slot = lookup_slot(cm, fb->fb_From);
+
+		if (*slot != 0)
+			continue;
+
+		if (fb->fb_To < 128)
+			*slot = fb->fb_To;
+		else
+			*slot = *lookup_slot(cm, fb->fb_To);
+	}
+
+	return cm;
+}
+
+void charmap_free(struct CharMap *cm)
+{
+	free(cm);
+}
+
+uint8_t charmap_lookup(const struct CharMap *cm, uint32_t unicode)
+{
+	uint8_t ch;
+
+	if (unicode < 128)
+		return unicode;
+
+	if (unicode > 0xffff)
+		return '?';
+
+	ch = cm->cm_Pages[cm->cm_Index[unicode >> 8]][unicode & 0xff];
+
+	return (ch != 0) ? ch : '?';
+}
@@ -0,0 +1,45 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef CHARMAP_H
+#define CHARMAP_H
+
+#include <stdint.h>
+
+/* Reverse lookup from Unicode code points to the characters of an 8-bit
+ * charset, built from a diskfont map table (which goes the other way).
+ *
+ * The BMP is split into 256 pages of 256 code points. Pages that hold no
+ * mapped characters all share one empty page so only a handful of them
+ * are actually stored.
+ *
+ * Code points that the charset lacks but for which there is a reasonable
+ * substitute (box drawing, block elements, typographic quotes etc.) are
+ * mapped to that instead of '?'.
+ */
+
+struct CharMap;
+
+struct CharMap *charmap_new(const uint32_t *maptable);
+void charmap_free(struct CharMap *cm);
+uint8_t charmap_lookup(const struct CharMap *cm, uint32_t unicode);
+
+#endif /* CHARMAP_H */
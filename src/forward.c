@@ -0,0 +1,774 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "sshterm.h"
+#include "forward.h"
+
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+struct ForwardList
+{
+	LIBSSH2_SESSION    *fl_Session;
+	int                 fl_Socket;  /* the session's socket */
+	struct MinList      fl_Forwards;
+	struct MinList      fl_Connections;
+	struct ForwardConn *fl_Opening; /* connection whose channel open is in progress */
+	struct ForwardConn *fl_Spare;   /* allocated ahead for accept_remote() */
+};
+
+struct Forward
+{
+	struct MinNode    fw_Node;
+	BOOL              fw_Remote;
+	char             *fw_Spec;
+	int               fw_Socket;   /* listening socket (LOCALFWD) */
+	LIBSSH2_LISTENER *fw_Listener; /* server side listener (REMOTEFWD) */
+	char             *fw_Host;     /* where connections are forwarded to */
+	int               fw_Port;
+	struct sockaddr_in fw_Addr;    /* fw_Host looked up (REMOTEFWD) */
+	ULONG             fw_NumConnections;
+	UQUAD             fw_RxBytes;  /* channel -> local socket */
+	UQUAD             fw_TxBytes;  /* local socket -> channel */
+};
+
+/* Connection states, none of them blocks the main loop */
+enum {
+	FC_OPENING,    /* LOCALFWD: waiting for the direct-tcpip channel */
+	FC_CONNECTING, /* REMOTEFWD: connect() to fw_Host in progress */
+	FC_RELAY,      /* moving data both ways */
+	FC_CLOSING     /* socket closed, channel being closed and freed */
+};
+
+struct ForwardConn
+{
+	struct MinNode    fc_Node;
+	struct Forward   *fc_Forward;
+	int               fc_State;
+	int               fc_Socket;
+	LIBSSH2_CHANNEL  *fc_Channel;
+	struct sockaddr_in fc_Peer;      /* where a LOCALFWD connection came from */
+	BOOL              fc_SocketEOF;  /* EOF read from the socket */
+	BOOL              fc_EOFSent;    /* and passed on to the channel */
+	BOOL              fc_ChannelEOF; /* EOF from the channel passed on to the socket */
+	BOOL              fc_WantWrite;  /* channel data waiting for the socket */
+	BOOL              fc_Throttled;  /* out of quantum with data left to send */
+	size_t            fc_Offset;
+	size_t            fc_Length;     /* socket data not yet written to the channel */
+	UQUAD             fc_RxBytes;
+	UQUAD             fc_TxBytes;
+	char              fc_Buffer[FORWARD_BUFFER_SIZE];
+};
+
+/* Split "[bind_address:]port:host:hostport", returns a copy of the spec that
+ * the returned strings point into. */
+static char *parse_spec(const char *spec, const char **bind_address, int *port,
+	const char **host, int *hostport)
+{
+	char *fields[4];
+	char *copy, *end;
+	int i, num_fields;
+
+	copy = strdup(spec);
+	if (copy == NULL)
+		return NULL;
+
+	num_fields = 0;
+	fields[num_fields++] = copy;
+	for (i = 0; copy[i] != '\0'; i++)
+	{
+		if (copy[i] == ':')
+		{
+			if (num_fields == 4)
+				goto fail;
+
+			copy[i] = '\0';
+			fields[num_fields++] = &copy[i + 1];
+		}
+	}
+
+	if (num_fields < 3)
+		goto fail;
+
+	i = 0;
+	*bind_address = (num_fields == 4) ? fields[i++] : NULL;
+
+	*port = strtol(fields[i++], &end, 10);
+	if (*end != '\0' || *port <= 0 || *port > 65535)
+		goto fail;
+
+	*host = fields[i++];
+
+	*hostport = strtol(fields[i++], &end, 10);
+	if (*end != '\0' || *hostport <= 0 || *hostport > 65535)
+		goto fail;
+
+	return copy;
+
+fail:
+	fprintf(stderr, "Invalid forwarding specification '%s'\n", spec);
+	free(copy);
+	return NULL;
+}
+
+static void set_nonblocking(int sock)
+{
+	fcntl(sock, F_SETFL, O_NONBLOCK);
+}
+
+struct ForwardList *forward_create(LIBSSH2_SESSION *session, int sock)
+{
+	struct ForwardList *fl;
+
+	fl = malloc(sizeof(*fl));
+	if (fl == NULL)
+		return NULL;
+
+	fl->fl_Session = session;
+	fl->fl_Socket  = sock;
+	fl->fl_Opening = NULL;
+	fl->fl_Spare   = NULL;
+	IExec->NewMinList(&fl->fl_Forwards);
+	IExec->NewMinList(&fl->fl_Connections);
+
+	/* Forwarded connections run as bulk channels so keystrokes for the
+	 * terminal are not queued behind them. */
+	libssh2_session_set_bulk_quantum(session, FORWARD_QUANTUM);
+
+	return fl;
+}
+
+static struct Forward *forward_new(const char *spec, const char *host, int port)
+{
+	struct Forward *fw;
+
+	fw = malloc(sizeof(*fw));
+	if (fw == NULL)
+		return NULL;
+
+	memset(fw, 0, sizeof(*fw));
+
+	fw->fw_Socket = -1;
+	fw->fw_Port   = port;
+	fw->fw_Spec   = strdup(spec);
+	fw->fw_Host   = strdup(host);
+	if (fw->fw_Spec == NULL || fw->fw_Host == NULL)
+	{
+		free(fw->fw_Spec);
+		free(fw->fw_Host);
+		free(fw);
+		return NULL;
+	}
+
+	return fw;
+}
+
+static void forward_free(struct ForwardList *fl, struct Forward *fw)
+{
+	if (fw->fw_Socket != -1)
+		close(fw->fw_Socket);
+
+	if (fw->fw_Listener != NULL)
+		libssh2_channel_forward_cancel(fw->fw_Listener);
+
+	free(fw->fw_Spec);
+	free(fw->fw_Host);
+	free(fw);
+}
+
+BOOL forward_add_local(struct ForwardList *fl, const char *spec)
+{
+	struct Forward *fw;
+	struct sockaddr_in sin;
+	const char *bind_address, *host;
+	int port, hostport;
+	int one = 1;
+	char *copy;
+
+	copy = parse_spec(spec, &bind_address, &port, &host, &hostport);
+	if (copy == NULL)
+		return FALSE;
+
+	fw = forward_new(spec, host, hostport);
+	if (fw == NULL)
+		goto fail;
+
+	memset(&sin, 0, sizeof(sin));
+
+	sin.sin_family = AF_INET;
+	sin.sin_port   = htons(port);
+
+	/* Like OpenSSH only listen on the loopback interface by default */
+	if (bind_address == NULL || strcmp(bind_address, "localhost") == 0)
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	else if (bind_address[0] == '\0' || strcmp(bind_address, "*") == 0)
+		sin.sin_addr.s_addr = htonl(INADDR_ANY);
+	else
+		sin.sin_addr.s_addr = inet_addr(bind_address);
+
+	fw->fw_Socket = socket(AF_INET, SOCK_STREAM, 0);
+	if (fw->fw_Socket == -1)
+		goto fail;
+
+	setsockopt(fw->fw_Socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	if (bind(fw->fw_Socket, (struct sockaddr *)&sin, sizeof(sin)) != 0 ||
+	    listen(fw->fw_Socket, 5) != 0)
+	{
+		fprintf(stderr, "Failed to listen on port %d - %d\n", port, errno);
+		goto fail;
+	}
+
+	set_nonblocking(fw->fw_Socket);
+
+	IExec->AddTail((struct List *)&fl->fl_Forwards, (struct Node *)&fw->fw_Node);
+
+	free(copy);
+	return TRUE;
+
+fail:
+	if (fw != NULL)
+		forward_free(fl, fw);
+
+	free(copy);
+	return FALSE;
+}
+
+BOOL forward_add_remote(struct ForwardList *fl, const char *spec)
+{
+	struct Forward *fw;
+	const struct hostent *hostent;
+	const char *bind_address, *host;
+	int port, hostport, bound_port;
+	char *copy;
+
+	copy = parse_spec(spec, &bind_address, &port, &host, &hostport);
+	if (copy == NULL)
+		return FALSE;
+
+	fw = forward_new(spec, host, hostport);
+	if (fw == NULL)
+		goto fail;
+
+	fw->fw_Remote = TRUE;
+
+	/* Look the host up once here, as there is no non-blocking way of doing
+	 * it for each connection later on. */
+	hostent = gethostbyname(host);
+	if (hostent == NULL)
+	{
+		fprintf(stderr, "Unknown host '%s'\n", host);
+		goto fail;
+	}
+
+	fw->fw_Addr.sin_family = AF_INET;
+	fw->fw_Addr.sin_port   = htons(hostport);
+	memcpy(&fw->fw_Addr.sin_addr, hostent->h_addr_list[0], sizeof(struct in_addr));
+
+	fw->fw_Listener = libssh2_channel_forward_listen_ex(fl->fl_Session,
+		bind_address, port, &bound_port, 16);
+	if (fw->fw_Listener == NULL)
+	{
+		fprintf(stderr, "Server refused to listen on port %d\n", port);
+		goto fail;
+	}
+
+	IExec->AddTail((struct List *)&fl->fl_Forwards, (struct Node *)&fw->fw_Node);
+
+	free(copy);
+	return TRUE;
+
+fail:
+	if (fw != NULL)
+		forward_free(fl, fw);
+
+	free(copy);
+	return FALSE;
+}
+
+static struct ForwardConn *forward_conn_alloc(void)
+{
+	struct ForwardConn *fc;
+
+	fc = malloc(sizeof(*fc));
+	if (fc != NULL)
+		memset(fc, 0, offsetof(struct ForwardConn, fc_Buffer));
+
+	return fc;
+}
+
+static void forward_conn_add(struct ForwardList *fl, struct Forward *fw,
+	struct ForwardConn *fc, int state, int sock, LIBSSH2_CHANNEL *channel)
+{
+	fc->fc_Forward = fw;
+	fc->fc_State   = state;
+	fc->fc_Socket  = sock;
+	fc->fc_Channel = channel;
+
+	if (channel != NULL)
+		libssh2_channel_set_priority(channel, LIBSSH2_CHANNEL_PRIORITY_BULK);
+
+	fw->fw_NumConnections++;
+
+	IExec->AddTail((struct List *)&fl->fl_Connections, (struct Node *)&fc->fc_Node);
+}
+
+/* Close the socket and the channel. Closing the channel waits for the
+ * server's reply, so in non-blocking mode this returns FALSE until a later
+ * call finds it done. */
+static BOOL forward_conn_close(struct ForwardConn *fc)
+{
+	fc->fc_State = FC_CLOSING;
+
+	if (fc->fc_Socket != -1)
+	{
+		close(fc->fc_Socket);
+		fc->fc_Socket = -1;
+	}
+
+	if (fc->fc_Channel != NULL)
+	{
+		if (libssh2_channel_free(fc->fc_Channel) == LIBSSH2_ERROR_EAGAIN)
+			return FALSE;
+
+		fc->fc_Channel = NULL;
+	}
+
+	return TRUE;
+}
+
+static void forward_conn_free(struct ForwardConn *fc)
+{
+	struct Forward *fw = fc->fc_Forward;
+
+	IExec->Remove((struct Node *)&fc->fc_Node);
+
+	fw->fw_RxBytes += fc->fc_RxBytes;
+	fw->fw_TxBytes += fc->fc_TxBytes;
+
+	free(fc);
+}
+
+static void accept_local(struct ForwardList *fl, struct Forward *fw)
+{
+	struct ForwardConn *fc;
+	socklen_t sinlen;
+	int sock;
+
+	fc = forward_conn_alloc();
+	if (fc == NULL)
+		return;
+
+	sinlen = sizeof(fc->fc_Peer);
+	sock = accept(fw->fw_Socket, (struct sockaddr *)&fc->fc_Peer, &sinlen);
+	if (sock == -1)
+	{
+		free(fc);
+		return;
+	}
+
+	set_nonblocking(sock);
+
+	/* The socket is not read before the channel has been opened */
+	forward_conn_add(fl, fw, fc, FC_OPENING, sock, NULL);
+}
+
+/* Only one channel open can be in progress on the session at a time, so the
+ * connections waiting for a channel take turns, also with anybody else
+ * opening channels on the session. */
+static BOOL forward_conn_open(struct ForwardList *fl, struct ForwardConn *fc)
+{
+	struct Forward *fw = fc->fc_Forward;
+	LIBSSH2_CHANNEL *channel;
+
+	if (fl->fl_Opening != fc)
+	{
+		if (fl->fl_Opening != NULL || libssh2_session_open_pending(fl->fl_Session))
+			return TRUE;
+
+		fl->fl_Opening = fc;
+	}
+
+	channel = libssh2_channel_direct_tcpip_ex(fl->fl_Session, fw->fw_Host, fw->fw_Port,
+		inet_ntoa(fc->fc_Peer.sin_addr), ntohs(fc->fc_Peer.sin_port));
+	if (channel == NULL)
+	{
+		if (libssh2_session_last_errno(fl->fl_Session) == LIBSSH2_ERROR_EAGAIN)
+			return TRUE;
+
+		fl->fl_Opening = NULL;
+		IExec->DebugPrintF("libssh2_channel_direct_tcpip_ex failed\n");
+		return FALSE;
+	}
+
+	fl->fl_Opening = NULL;
+
+	fc->fc_Channel = channel;
+	fc->fc_State   = FC_RELAY;
+
+	libssh2_channel_set_priority(channel, LIBSSH2_CHANNEL_PRIORITY_BULK);
+
+	return TRUE;
+}
+
+static void accept_remote(struct ForwardList *fl, struct Forward *fw)
+{
+	LIBSSH2_CHANNEL *channel;
+	struct ForwardConn *fc;
+	int sock, state;
+
+	/* Allocated before accepting, so that an accepted channel always has a
+	 * connection to be closed through. */
+	if (fl->fl_Spare == NULL)
+	{
+		fl->fl_Spare = forward_conn_alloc();
+		if (fl->fl_Spare == NULL)
+			return;
+	}
+
+	channel = libssh2_channel_forward_accept(fw->fw_Listener);
+	if (channel == NULL)
+		return;
+
+	fc = fl->fl_Spare;
+	fl->fl_Spare = NULL;
+
+	state = FC_CLOSING;
+
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock != -1)
+	{
+		set_nonblocking(sock);
+
+		if (connect(sock, (struct sockaddr *)&fw->fw_Addr, sizeof(fw->fw_Addr)) == 0)
+			state = FC_RELAY;
+		else if (errno == EINPROGRESS)
+			state = FC_CONNECTING;
+		else
+		{
+			close(sock);
+			sock = -1;
+		}
+	}
+
+	if (state == FC_CLOSING)
+		IExec->DebugPrintF("Failed to connect to %s:%d - %d\n", fw->fw_Host, fw->fw_Port, errno);
+
+	forward_conn_add(fl, fw, fc, state, sock, channel);
+}
+
+/* The socket becomes writable once connect() has finished either way */
+static BOOL forward_conn_connect(struct ForwardConn *fc, fd_set *wfds)
+{
+	struct Forward *fw = fc->fc_Forward;
+	socklen_t len;
+	int error;
+
+	if (!FD_ISSET(fc->fc_Socket, wfds))
+		return TRUE;
+
+	error = 0;
+	len = sizeof(error);
+	if (getsockopt(fc->fc_Socket, SOL_SOCKET, SO_ERROR, &error, &len) != 0 || error != 0)
+	{
+		IExec->DebugPrintF("Failed to connect to %s:%d - %d\n", fw->fw_Host, fw->fw_Port, error);
+		return FALSE;
+	}
+
+	fc->fc_State = FC_RELAY;
+
+	return TRUE;
+}
+
+/* Move at most one buffer of data in each direction. The channel data is
+ * sent straight from libssh2's packet buffers and only consumed as far as
+ * the socket accepted it, while socket data is only read after the previous
+ * buffer has fit in the channel window. Either way a slow receiver stops
+ * the sender instead of making us queue more. */
+static BOOL forward_conn_relay(struct ForwardConn *fc, fd_set *rfds)
+{
+	LIBSSH2_CHANNEL *channel = fc->fc_Channel;
+	const char *data;
+	size_t window;
+	ssize_t rs, ws;
+
+	if (!fc->fc_ChannelEOF)
+	{
+		fc->fc_WantWrite = FALSE;
+
+		rs = libssh2_channel_read_peek(channel, 0, &data);
+		if (rs > 0)
+		{
+			if (rs > FORWARD_BUFFER_SIZE)
+				rs = FORWARD_BUFFER_SIZE;
+
+			ws = send(fc->fc_Socket, data, rs, 0);
+			if (ws > 0)
+			{
+				libssh2_channel_read_consume(channel, 0, ws);
+				fc->fc_RxBytes += ws;
+			}
+			else if (ws < 0 && errno != EWOULDBLOCK)
+			{
+				return FALSE;
+			}
+
+			fc->fc_WantWrite = TRUE;
+		}
+		else if (rs == 0 && libssh2_channel_eof(channel))
+		{
+			shutdown(fc->fc_Socket, SHUT_WR);
+			fc->fc_ChannelEOF = TRUE;
+		}
+		else if (rs < 0 && rs != LIBSSH2_ERROR_EAGAIN)
+		{
+			IExec->DebugPrintF("libssh2_channel_read_peek: %d\n", rs);
+			return FALSE;
+		}
+	}
+
+	if (fc->fc_Length == 0 && !fc->fc_SocketEOF && FD_ISSET(fc->fc_Socket, rfds))
+	{
+		rs = recv(fc->fc_Socket, fc->fc_Buffer, sizeof(fc->fc_Buffer), 0);
+		if (rs > 0)
+		{
+			fc->fc_Offset = 0;
+			fc->fc_Length = rs;
+		}
+		else if (rs == 0)
+		{
+			fc->fc_SocketEOF = TRUE;
+		}
+		else if (errno != EWOULDBLOCK)
+		{
+			return FALSE;
+		}
+	}
+
+	fc->fc_Throttled = FALSE;
+
+	if (fc->fc_Length > 0)
+	{
+		window = libssh2_channel_window_write(channel);
+		if (window > fc->fc_Length)
+			window = fc->fc_Length;
+
+		/* Staying within the window, EAGAIN can only mean that the SSH
+		 * socket is full. The main loop then waits for it to become
+		 * writable, and the rest goes out on a later pass. */
+		while (window > 0)
+		{
+			ws = libssh2_channel_write(channel, &fc->fc_Buffer[fc->fc_Offset], window);
+			if (ws > 0)
+			{
+				fc->fc_TxBytes += ws;
+				fc->fc_Offset += ws;
+				fc->fc_Length -= ws;
+				window -= ws;
+			}
+			else if (ws == 0)
+			{
+				/* Quantum used up for this pass */
+				fc->fc_Throttled = TRUE;
+				break;
+			}
+			else if (ws == LIBSSH2_ERROR_EAGAIN)
+			{
+				break;
+			}
+			else
+			{
+				IExec->DebugPrintF("libssh2_channel_write: %d\n", ws);
+				return FALSE;
+			}
+		}
+	}
+
+	/* The EOF follows the last of the data */
+	if (fc->fc_SocketEOF && !fc->fc_EOFSent && fc->fc_Length == 0)
+	{
+		ws = libssh2_channel_send_eof(channel);
+		if (ws == 0)
+		{
+			fc->fc_EOFSent = TRUE;
+		}
+		else if (ws != LIBSSH2_ERROR_EAGAIN)
+		{
+			IExec->DebugPrintF("libssh2_channel_send_eof: %d\n", ws);
+			return FALSE;
+		}
+	}
+
+	return !(fc->fc_EOFSent && fc->fc_ChannelEOF);
+}
+
+int forward_fdset(struct ForwardList *fl, fd_set *rfds, fd_set *wfds, int nfds)
+{
+	struct Forward *fw;
+	struct ForwardConn *fc;
+	BOOL throttled = FALSE;
+
+	for (fw = (struct Forward *)IExec->GetHead((struct List *)&fl->fl_Forwards);
+	     fw != NULL;
+	     fw = (struct Forward *)IExec->GetSucc((struct Node *)&fw->fw_Node))
+	{
+		if (fw->fw_Socket != -1)
+		{
+			FD_SET(fw->fw_Socket, rfds);
+			if (fw->fw_Socket >= nfds)
+				nfds = fw->fw_Socket + 1;
+		}
+	}
+
+	for (fc = (struct ForwardConn *)IExec->GetHead((struct List *)&fl->fl_Connections);
+	     fc != NULL;
+	     fc = (struct ForwardConn *)IExec->GetSucc((struct Node *)&fc->fc_Node))
+	{
+		/* Opening and closing connections only wait for the SSH socket */
+		if (fc->fc_State == FC_CONNECTING)
+		{
+			FD_SET(fc->fc_Socket, wfds);
+		}
+		else if (fc->fc_State == FC_RELAY)
+		{
+			if (fc->fc_Length == 0 && !fc->fc_SocketEOF)
+				FD_SET(fc->fc_Socket, rfds);
+			if (fc->fc_WantWrite)
+				FD_SET(fc->fc_Socket, wfds);
+			if (fc->fc_Throttled)
+				throttled = TRUE;
+		}
+		else
+		{
+			continue;
+		}
+
+		if (fc->fc_Socket >= nfds)
+			nfds = fc->fc_Socket + 1;
+	}
+
+	/* A throttled connection has nothing to wait for on its own socket, it
+	 * continues once the next pass has started a new round of the quantum.
+	 * That pass comes when the SSH socket has room for more, rather than
+	 * right away, which would just spin while the link is busy. */
+	if (throttled)
+	{
+		FD_SET(fl->fl_Socket, wfds);
+		if (fl->fl_Socket >= nfds)
+			nfds = fl->fl_Socket + 1;
+	}
+
+	return nfds;
+}
+
+void forward_handle(struct ForwardList *fl, fd_set *rfds, fd_set *wfds)
+{
+	struct Forward *fw;
+	struct ForwardConn *fc, *next;
+	BOOL ok;
+
+	libssh2_session_bulk_round(fl->fl_Session);
+
+	for (fw = (struct Forward *)IExec->GetHead((struct List *)&fl->fl_Forwards);
+	     fw != NULL;
+	     fw = (struct Forward *)IExec->GetSucc((struct Node *)&fw->fw_Node))
+	{
+		if (fw->fw_Remote)
+			accept_remote(fl, fw);
+		else if (FD_ISSET(fw->fw_Socket, rfds))
+			accept_local(fl, fw);
+	}
+
+	/* Every connection gets its turn on each pass through the main loop, and
+	 * as none of them can move more than a buffer per pass and all of them
+	 * together no more than the quantum, the terminal is never held up for
+	 * long. */
+	for (fc = (struct ForwardConn *)IExec->GetHead((struct List *)&fl->fl_Connections);
+	     fc != NULL;
+	     fc = next)
+	{
+		next = (struct ForwardConn *)IExec->GetSucc((struct Node *)&fc->fc_Node);
+
+		switch (fc->fc_State)
+		{
+			case FC_OPENING:
+				ok = forward_conn_open(fl, fc);
+				break;
+
+			case FC_CONNECTING:
+				ok = forward_conn_connect(fc, wfds);
+				if (!ok || fc->fc_State != FC_RELAY)
+					break;
+				/* Pass on whatever the channel already holds */
+				/* fall through */
+
+			case FC_RELAY:
+				ok = forward_conn_relay(fc, rfds);
+				break;
+
+			default:
+				ok = FALSE;
+				break;
+		}
+
+		if (!ok && forward_conn_close(fc))
+			forward_conn_free(fc);
+	}
+
+	/* Rotate the list so that a different connection gets the first share of
+	 * the quantum on the next pass. */
+	fc = (struct ForwardConn *)IExec->RemHead((struct List *)&fl->fl_Connections);
+	if (fc != NULL)
+		IExec->AddTail((struct List *)&fl->fl_Connections, (struct Node *)&fc->fc_Node);
+}
+
+void forward_delete(struct ForwardList *fl)
+{
+	struct Forward *fw;
+	struct ForwardConn *fc;
+
+	if (fl == NULL)
+		return;
+
+	/* The session is back in blocking mode here, so this finishes closing
+	 * the channels. One that was still being opened is left to
+	 * libssh2_session_free(). */
+	while ((fc = (struct ForwardConn *)IExec->GetHead((struct List *)&fl->fl_Connections)) != NULL)
+	{
+		forward_conn_close(fc);
+		forward_conn_free(fc);
+	}
+
+	free(fl->fl_Spare);
+
+	while ((fw = (struct Forward *)IExec->RemHead((struct List *)&fl->fl_Forwards)) != NULL)
+	{
+		printf("%s %s: %lu connections, %llu bytes in, %llu bytes out\n",
+			fw->fw_Remote ? "REMOTEFWD" : "LOCALFWD", fw->fw_Spec,
+			fw->fw_NumConnections, fw->fw_RxBytes, fw->fw_TxBytes);
+
+		forward_free(fl, fw);
+	}
+
+	free(fl);
+}
@@ -0,0 +1,47 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef FORWARD_H
+#define FORWARD_H
+
+#include <libssh2.h>
+
+/* TCP port forwarding over the SSH session.
+ *
+ * LOCALFWD and REMOTEFWD take specifications in the same format as the -L
+ * and -R options of OpenSSH, "[bind_address:]port:host:hostport". They are
+ * added during setup, while the session is still in blocking mode. From then
+ * on all local sockets and the session are non-blocking and serviced from
+ * the main waitselect() loop, and forward_delete() expects the session to be
+ * back in blocking mode.
+ */
+
+#define FORWARD_BUFFER_SIZE 16384 /* most data moved per connection and loop */
+#define FORWARD_QUANTUM     32768 /* most data sent by all forwards per loop */
+
+struct ForwardList *forward_create(LIBSSH2_SESSION *session, int sock);
+void forward_delete(struct ForwardList *fl);
+BOOL forward_add_local(struct ForwardList *fl, const char *spec);
+BOOL forward_add_remote(struct ForwardList *fl, const char *spec);
+int forward_fdset(struct ForwardList *fl, fd_set *rfds, fd_set *wfds, int nfds);
+void forward_handle(struct ForwardList *fl, fd_set *rfds, fd_set *wfds);
+
+#endif /* FORWARD_H */
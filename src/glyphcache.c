@@ -0,0 +1,200 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "glyphcache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_SLOT 0xffff
+
+struct GlyphEntry
+{
+	uint32_t ge_Key;
+	uint16_t ge_HashNext;
+	uint16_t ge_Prev;     /* towards most recently used */
+	uint16_t ge_Next;     /* towards least recently used */
+};
+
+struct GlyphCache
+{
+	uint32_t           gc_NumSlots;
+	uint32_t           gc_HashMask;
+	uint16_t          *gc_Hash;
+	struct GlyphEntry *gc_Entries;
+	uint16_t           gc_MRU;
+	uint16_t           gc_LRU;
+	uint32_t           gc_NumUsed;
+	uint32_t           gc_Hits;
+	uint32_t           gc_Misses;
+};
+
+static uint32_t hash_key(const struct GlyphCache *gc, uint32_t key)
+{
+	return ((uint32_t)(key * 0x9e3779b1UL) >> 16) & gc->gc_HashMask;
+}
+
+struct GlyphCache *glyphcache_new(uint32_t num_slots)
+{
+	struct GlyphCache *gc;
+	uint32_t hash_size;
+
+	if (num_slots == 0 || num_slots >= NO_SLOT)
+		return NULL;
+
+	/* Power of two with a load factor of at most 0.5 */
+	hash_size = 1;
+	while (hash_size < 2 * num_slots)
+		hash_size <<= 1;
+
+	gc = malloc(sizeof(*gc));
+	if (gc == NULL)
+		return NULL;
+
+	gc->gc_NumSlots = num_slots;
+	gc->gc_HashMask = hash_size - 1;
+	gc->gc_Hash     = malloc(hash_size * sizeof(gc->gc_Hash[0]));
+	gc->gc_Entries  = malloc(num_slots * sizeof(gc->gc_Entries[0]));
+	if (gc->gc_Hash == NULL || gc->gc_Entries == NULL)
+	{
+		glyphcache_free(gc);
+		return NULL;
+	}
+
+	glyphcache_clear(gc);
+
+	return gc;
+}
+
+void glyphcache_free(struct GlyphCache *gc)
+{
+	if (gc == NULL)
+		return;
+
+	free(gc->gc_Hash);
+	free(gc->gc_Entries);
+	free(gc);
+}
+
+void glyphcache_clear(struct GlyphCache *gc)
+{
+	memset(gc->gc_Hash, 0xff, (gc->gc_HashMask + 1) * sizeof(gc->gc_Hash[0]));
+	memset(gc->gc_Entries, 0, gc->gc_NumSlots * sizeof(gc->gc_Entries[0]));
+
+	gc->gc_MRU     = NO_SLOT;
+	gc->gc_LRU     = NO_SLOT;
+	gc->gc_NumUsed = 0;
+	gc->gc_Hits    = 0;
+	gc->gc_Misses  = 0;
+}
+
+static void lru_unlink(struct GlyphCache *gc, uint16_t slot)
+{
+	struct GlyphEntry *ge = &gc->gc_Entries[slot];
+
+	if (ge->ge_Prev != NO_SLOT)
+		gc->gc_Entries[ge->ge_Prev].ge_Next = ge->ge_Next;
+	else
+		gc->gc_MRU = ge->ge_Next;
+
+	if (ge->ge_Next != NO_SLOT)
+		gc->gc_Entries[ge->ge_Next].ge_Prev = ge->ge_Prev;
+	else
+		gc->gc_LRU = ge->ge_Prev;
+}
+
+static void lru_push(struct GlyphCache *gc, uint16_t slot)
+{
+	struct GlyphEntry *ge = &gc->gc_Entries[slot];
+
+	ge->ge_Prev = NO_SLOT;
+	ge->ge_Next = gc->gc_MRU;
+
+	if (gc->gc_MRU != NO_SLOT)
+		gc->gc_Entries[gc->gc_MRU].ge_Prev = slot;
+	else
+		gc->gc_LRU = slot;
+
+	gc->gc_MRU = slot;
+}
+
+static void hash_remove(struct GlyphCache *gc, uint16_t slot)
+{
+	uint16_t *link = &gc->gc_Hash[hash_key(gc, gc->gc_Entries[slot].ge_Key)];
+
+	while (*link != slot)
+		link = &gc->gc_Entries[*link].ge_HashNext;
+
+	*link = gc->gc_Entries[slot].ge_HashNext;
+}
+
+/* Returns 1 if the glyph is already in *slot. Otherwise 0 is returned and
+ * *slot has been assigned to the key, to be filled in by the caller. */
+int glyphcache_lookup(struct GlyphCache *gc, uint32_t key, uint32_t *slot)
+{
+	struct GlyphEntry *ge;
+	uint32_t hash = hash_key(gc, key);
+	uint16_t i;
+
+	for (i = gc->gc_Hash[hash]; i != NO_SLOT; i = gc->gc_Entries[i].ge_HashNext)
+	{
+		if (gc->gc_Entries[i].ge_Key == key)
+		{
+			if (gc->gc_MRU != i)
+			{
+				lru_unlink(gc, i);
+				lru_push(gc, i);
+			}
+
+			gc->gc_Hits++;
+			*slot = i;
+			return 1;
+		}
+	}
+
+	if (gc->gc_NumUsed < gc->gc_NumSlots)
+	{
+		i = gc->gc_NumUsed++;
+	}
+	else
+	{
+		i = gc->gc_LRU;
+		lru_unlink(gc, i);
+		hash_remove(gc, i);
+	}
+
+	ge = &gc->gc_Entries[i];
+	ge->ge_Key      = key;
+	ge->ge_HashNext = gc->gc_Hash[hash];
+	gc->gc_Hash[hash] = i;
+
+	lru_push(gc, i);
+
+	gc->gc_Misses++;
+	*slot = i;
+	return 0;
+}
+
+void glyphcache_stats(const struct GlyphCache *gc, uint32_t *hits, uint32_t *misses)
+{
+	*hits   = gc->gc_Hits;
+	*misses = gc->gc_Misses;
+}
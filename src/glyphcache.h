@@ -0,0 +1,48 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef GLYPHCACHE_H
+#define GLYPHCACHE_H
+
+#include <stdint.h>
+
+/* Bookkeeping for a cache of rendered glyphs. It only hands out slot numbers
+ * for keys, what a slot holds and where it is stored is up to the caller.
+ * When all slots are in use the least recently used one is recycled.
+ *
+ * Kept free of any AmigaOS dependencies so that it can be built and tested
+ * on other systems as well.
+ */
+
+#define GLYPHCACHE_BOLD      (1UL << 30)
+#define GLYPHCACHE_UNDERLINE (1UL << 29)
+
+#define GLYPHCACHE_KEY(ch, flags) ((uint32_t)(ch) | (flags))
+
+struct GlyphCache;
+
+struct GlyphCache *glyphcache_new(uint32_t num_slots);
+void glyphcache_free(struct GlyphCache *gc);
+void glyphcache_clear(struct GlyphCache *gc);
+int glyphcache_lookup(struct GlyphCache *gc, uint32_t key, uint32_t *slot);
+void glyphcache_stats(const struct GlyphCache *gc, uint32_t *hits, uint32_t *misses);
+
+#endif /* GLYPHCACHE_H */
@@ -21,15 +21,21 @@
 
 #include "sshterm.h"
 #include "timer.h"
+#include "mux.h"
+#include "forward.h"
+#include "record.h"
+#include "stats.h"
 
 #include <proto/intuition.h>
 #include <classes/requester.h>
 
 #include <unistd.h>
+#include <sys/time.h>
 
 #include "SSHTerm_rev.h"
 
-#define BLINK_DELAY 1000 /* 1 second delay */
+#define STATUS_DELAY 1000 /* minimum time between status title updates */
+#define DEFAULT_FPS 50 /* maximum screen updates per second */
 
 static const char template[] =
 	"HOSTADDR/A,"
@@ -40,7 +46,18 @@ static const char template[] =
 	"KEYFILE/K,"
 	"MAXSB/N/K,"
 	"TITLE/K,"
-	"BSISDEL/S";
+	"BSISDEL/S,"
+	"KEEPALIVE/N/K,"
+	"SHARE/S,"
+	"LOCALFWD/K/M,"
+	"REMOTEFWD/K/M,"
+	"FPS/N/K,"
+	"RECORD/K,"
+	"CIPHERS/K,"
+	"MACS/K,"
+	"COMPRESS/S,"
+	"STATS/S,"
+	"PREDICT/S";
 
 enum {
 	ARG_HOSTADDR,
@@ -52,6 +69,17 @@ enum {
 	ARG_MAXSB,
 	ARG_TITLE,
 	ARG_BSISDEL,
+	ARG_KEEPALIVE,
+	ARG_SHARE,
+	ARG_LOCALFWD,
+	ARG_REMOTEFWD,
+	ARG_FPS,
+	ARG_RECORD,
+	ARG_CIPHERS,
+	ARG_MACS,
+	ARG_COMPRESS,
+	ARG_STATS,
+	ARG_PREDICT,
 	NUM_ARGS
 };
 
@@ -227,9 +255,101 @@ struct ssh_session {
 	char            *password;
     LIBSSH2_AGENT   *agent;
 	const char      *keyfile;
-	char             iobuf[32768];
+	UQUAD            rx_bytes;
+	UQUAD            tx_bytes;
+	UQUAD            status_rx;
+	UQUAD            status_tx;
+	struct timeval   status_time;
+	ULONG            handshake_ms;
 };
 
+static ULONG elapsed_ms(const struct timeval *start, const struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000 +
+	       ((LONG)end->tv_usec - (LONG)start->tv_usec) / 1000;
+}
+
+/* Append the keepalive round-trip time and the channel throughput measured
+ * since the last update to the window title. */
+static void update_status(struct ssh_session *ss, struct TermTask *termtask, const char *windowtitle)
+{
+	struct libssh2_keepalive_stats stats;
+	struct timeval now;
+	ULONG ms, rx_rate, tx_rate;
+	char title[256];
+
+	gettimeofday(&now, NULL);
+
+	ms = elapsed_ms(&ss->status_time, &now);
+	if (ms < STATUS_DELAY)
+		return;
+
+	rx_rate = (ULONG)((ss->rx_bytes - ss->status_rx) * 1000 / ms);
+	tx_rate = (ULONG)((ss->tx_bytes - ss->status_tx) * 1000 / ms);
+
+	ss->status_rx   = ss->rx_bytes;
+	ss->status_tx   = ss->tx_bytes;
+	ss->status_time = now;
+
+	if (libssh2_keepalive_rtt(ss->session, &stats) == 0)
+	{
+		snprintf(title, sizeof(title),
+			"%s [RTT %lu.%lu ms +/- %lu.%lu, in %lu.%lu KB/s, out %lu.%lu KB/s]",
+			windowtitle,
+			(ULONG)(stats.srtt_us / 1000), (ULONG)(stats.srtt_us % 1000) / 100,
+			(ULONG)(stats.rttvar_us / 1000), (ULONG)(stats.rttvar_us % 1000) / 100,
+			rx_rate / 1024, (rx_rate % 1024) * 10 / 1024,
+			tx_rate / 1024, (tx_rate % 1024) * 10 / 1024);
+	}
+	else
+	{
+		snprintf(title, sizeof(title),
+			"%s [RTT n/a, in %lu.%lu KB/s, out %lu.%lu KB/s]",
+			windowtitle,
+			rx_rate / 1024, (rx_rate % 1024) * 10 / 1024,
+			tx_rate / 1024, (tx_rate % 1024) * 10 / 1024);
+	}
+
+	termtask_set_title(termtask, title);
+}
+
+/* Print the transport counters kept by libssh2 together with the methods
+ * that were negotiated, as a baseline for comparing ciphers, MACs and
+ * compression on a real connection. */
+static void print_stats(struct ssh_session *ss)
+{
+	struct libssh2_transport_stats stats;
+	struct MallocStats ms;
+	const char *crypt, *mac, *comp;
+	UQUAD total;
+
+	if (libssh2_session_transport_stats(ss->session, &stats) != 0)
+		return;
+
+	crypt = libssh2_session_methods(ss->session, LIBSSH2_METHOD_CRYPT_SC);
+	mac   = libssh2_session_methods(ss->session, LIBSSH2_METHOD_MAC_SC);
+	comp  = libssh2_session_methods(ss->session, LIBSSH2_METHOD_COMP_SC);
+
+	printf("Handshake: %lu ms\n", ss->handshake_ms);
+	printf("Methods: %s, %s, %s\n",
+		crypt != NULL ? crypt : "?", mac != NULL ? mac : "?", comp != NULL ? comp : "?");
+	printf("Received: %llu bytes, %llu packets in %llu reads\n",
+		stats.bytes_in, stats.packets_in, stats.recv_calls);
+	printf("Sent: %llu bytes, %llu packets in %llu writes\n",
+		stats.bytes_out, stats.packets_out, stats.send_calls);
+	printf("Channel data: %llu bytes in, %llu bytes out\n",
+		ss->rx_bytes, ss->tx_bytes);
+
+	total = stats.bytes_in + stats.bytes_out;
+	printf("Allocations: %llu (%llu per MB)\n",
+		stats.allocs, total != 0 ? stats.allocs * 1048576 / total : 0ULL);
+
+	malloc_get_stats(&ms);
+
+	printf("Heap: %lu KB in use, %lu KB peak, %lu slabs\n",
+		(ULONG)(ms.ms_Live >> 10), (ULONG)(ms.ms_Peak >> 10), ms.ms_Slabs);
+}
+
 static void kbd_callback(const char *name, int name_len, const char *instruction,
 	int instruction_len, int num_prompts, const LIBSSH2_USERAUTH_KBDINT_PROMPT *prompts,
 	LIBSSH2_USERAUTH_KBDINT_RESPONSE *responses, void **abstract)
@@ -267,6 +387,51 @@ static int passphrase_callback(char *buf, int size, int rwflag, void *userdata)
 	return strlen(buf);
 }
 
+/* Main loop for a window that uses the connection of another SSHTerm
+ * process (see mux.h). */
+static int mux_client_loop(struct MuxClient *mc, struct TermTask *termtask)
+{
+	LIBSSH2_IOVEC iov[2];
+	UWORD columns, rows;
+	size_t len;
+	BOOL done;
+	ULONG signals;
+
+	done = FALSE;
+
+	while (!done)
+	{
+		signals = termtask_signal(termtask) | mux_client_signal(mc) | SIGBREAKF_CTRL_C;
+
+		signals = IExec->Wait(signals);
+
+		if (signals & SIGBREAKF_CTRL_C)
+			done = TRUE;
+
+		if (termtask_closed(termtask))
+			done = TRUE;
+
+		if (mux_client_handle(mc, termtask))
+			done = TRUE;
+
+		/* Anything that does not fit in the free buffers is sent when the
+		 * master replies to one of the earlier messages. */
+		if (termtask_poll_new_size(termtask) && mux_client_writable(mc))
+		{
+			termtask_get_size(termtask, &columns, &rows);
+			mux_client_resize(mc, columns, rows);
+		}
+
+		while (termtask_peek(termtask, iov) > 0 && mux_client_writable(mc))
+		{
+			len = mux_client_write(mc, iov[0].iov_base, iov[0].iov_len);
+			termtask_pull(termtask, len);
+		}
+	}
+
+	return RETURN_OK;
+}
+
 int sshterm(int argc, char **argv)
 {
 	LONG args[NUM_ARGS];
@@ -276,20 +441,34 @@ int sshterm(int argc, char **argv)
 	char *windowtitle = NULL;
 	LONG sb_size = 2000;
 	BOOL bs_is_del = FALSE;
+	BOOL predict = FALSE;
 	struct Screen *screen = NULL;
-	struct TermWindow *termwin = NULL;
+	struct TermTask *termtask = NULL;
 	struct ssh_session *ss = NULL;
 	const struct hostent *hostent;
 	struct in_addr hostaddr;
 	int port;
 	struct sockaddr_in sin;
+	struct timeval start_time, end_time;
 	int rc;
 	char homedir[1024];
 	const char *userauthlist;
 	unsigned int auth_pw;
 	UWORD columns, rows;
-	struct TimeRequest *blink_timer = NULL;
+	struct TimeRequest *keepalive_timer = NULL;
+	ULONG keepalive_ms = 0;
+	ULONG frame_ms = 1000 / DEFAULT_FPS;
+	char *mux_name = NULL;
+	struct MuxServer *mux_server = NULL;
+	struct MuxClient *mux_client = NULL;
+	struct ForwardList *forwards = NULL;
+	struct Recorder *recorder = NULL;
+	char *buffer;
+	int nfds;
+	long ms_to_next;
 	BOOL done;
+	BOOL shell_done = FALSE;
+	BOOL resize_pending = FALSE;
 	ULONG signals;
 	fd_set rfds, wfds;
 	int retval = RETURN_ERROR;
@@ -306,6 +485,13 @@ int sshterm(int argc, char **argv)
 	hostname = (const char *)args[ARG_HOSTADDR];
 	username = (const char *)args[ARG_USER];
 
+	port = 22;
+
+	if (args[ARG_PORT])
+	{
+		port = *(LONG *)args[ARG_PORT];
+	}
+
 	screen = IIntuition->LockPubScreen(NULL);
 	if (screen == NULL)
 	{
@@ -333,13 +519,71 @@ int sshterm(int argc, char **argv)
 		bs_is_del = TRUE;
 	}
 
-	termwin = termwin_open(screen, sb_size, windowtitle, bs_is_del);
-	if (termwin == NULL)
+	if (args[ARG_PREDICT])
+	{
+		predict = TRUE;
+	}
+
+	if (args[ARG_KEEPALIVE])
+	{
+		LONG interval = *(LONG *)args[ARG_KEEPALIVE];
+		if (interval < 0)
+			interval = 0;
+		else if (interval > 0 && interval < 100)
+			interval = 100;
+		keepalive_ms = interval;
+	}
+
+	if (args[ARG_FPS])
+	{
+		LONG fps = *(LONG *)args[ARG_FPS];
+		if (fps <= 0)
+			frame_ms = 0;
+		else if (fps > 1000)
+			frame_ms = 1;
+		else
+			frame_ms = 1000 / fps;
+	}
+
+	termtask = termtask_start(screen, sb_size, windowtitle, bs_is_del, predict, frame_ms);
+	if (termtask == NULL)
 	{
 		fprintf(stderr, "Failed to create terminal\n");
 		goto out;
 	}
 
+	if (args[ARG_RECORD])
+	{
+		recorder = record_open((const char *)args[ARG_RECORD]);
+		if (recorder == NULL)
+		{
+			fprintf(stderr, "Failed to create recording\n");
+			goto out;
+		}
+
+		termtask_record(termtask, recorder);
+	}
+
+	if (args[ARG_SHARE])
+	{
+		mux_name = mux_port_name(username, hostname, port);
+		if (mux_name == NULL)
+		{
+			goto out;
+		}
+
+		termtask_get_size(termtask, &columns, &rows);
+
+		/* Use the connection of an already running SSHTerm if there is one,
+		 * otherwise connect normally and offer ours to the next one. */
+		mux_client = mux_client_open(mux_name, columns, rows);
+		if (mux_client != NULL)
+		{
+			retval = mux_client_loop(mux_client, termtask);
+			goto out;
+		}
+	}
+
 	ss = malloc(sizeof(*ss));
 	if (ss == NULL)
 	{
@@ -370,13 +614,6 @@ int sshterm(int argc, char **argv)
 
 	memcpy(&hostaddr, hostent->h_addr_list[0], sizeof(struct in_addr));
 
-	port = 22;
-
-	if (args[ARG_PORT])
-	{
-		port = *(LONG *)args[ARG_PORT];
-	}
-
 	memset(&sin, 0, sizeof(sin));
 
 	sin.sin_family = AF_INET;
@@ -398,6 +635,41 @@ int sshterm(int argc, char **argv)
 		goto out;
 	}
 
+	#ifdef ENABLE_STATS
+	stats_hook_session(ss->session);
+	#endif
+
+	if (args[ARG_CIPHERS])
+	{
+		const char *ciphers = (const char *)args[ARG_CIPHERS];
+
+		if (libssh2_session_method_pref(ss->session, LIBSSH2_METHOD_CRYPT_CS, ciphers) < 0 ||
+		    libssh2_session_method_pref(ss->session, LIBSSH2_METHOD_CRYPT_SC, ciphers) < 0)
+		{
+			fprintf(stderr, "None of the ciphers are supported\n");
+			goto out;
+		}
+	}
+
+	if (args[ARG_MACS])
+	{
+		const char *macs = (const char *)args[ARG_MACS];
+
+		if (libssh2_session_method_pref(ss->session, LIBSSH2_METHOD_MAC_CS, macs) < 0 ||
+		    libssh2_session_method_pref(ss->session, LIBSSH2_METHOD_MAC_SC, macs) < 0)
+		{
+			fprintf(stderr, "None of the MACs are supported\n");
+			goto out;
+		}
+	}
+
+	if (args[ARG_COMPRESS])
+	{
+		libssh2_session_flag(ss->session, LIBSSH2_FLAG_COMPRESS, 1);
+	}
+
+	gettimeofday(&start_time, NULL);
+
 	rc = libssh2_session_handshake(ss->session, ss->socket);
 	if (rc < 0)
 	{
@@ -405,6 +677,9 @@ int sshterm(int argc, char **argv)
 		goto out;
 	}
 
+	gettimeofday(&end_time, NULL);
+	ss->handshake_ms = elapsed_ms(&start_time, &end_time);
+
 	if (IDOS->GetVar("HOME", homedir, sizeof(homedir), 0) <= 0)
 	{
 		strcpy(homedir, "HOME:");
@@ -572,7 +847,7 @@ int sshterm(int argc, char **argv)
 		goto out;
 	}
 
-	termwin_get_size(termwin, &columns, &rows);
+	termtask_get_size(termtask, &columns, &rows);
 
 	if (libssh2_channel_request_pty_ex(ss->channel, "xterm-256color", 14, NULL, 0, columns, rows, 0, 0))
 	{
@@ -586,16 +861,57 @@ int sshterm(int argc, char **argv)
 		goto out;
 	}
 
+	if (args[ARG_LOCALFWD] || args[ARG_REMOTEFWD])
+	{
+		STRPTR *spec;
+
+		forwards = forward_create(ss->session, ss->socket);
+		if (forwards == NULL)
+		{
+			goto out;
+		}
+
+		for (spec = (STRPTR *)args[ARG_LOCALFWD]; spec != NULL && *spec != NULL; spec++)
+		{
+			if (!forward_add_local(forwards, *spec))
+				fprintf(stderr, "Local forwarding %s failed\n", *spec);
+		}
+
+		for (spec = (STRPTR *)args[ARG_REMOTEFWD]; spec != NULL && *spec != NULL; spec++)
+		{
+			if (!forward_add_remote(forwards, *spec))
+				fprintf(stderr, "Remote forwarding %s failed\n", *spec);
+		}
+	}
+
 	libssh2_session_set_blocking(ss->session, 0);
 
-	blink_timer = timer_open(UNIT_MICROHZ);
-	if (blink_timer == NULL)
+	if (mux_name != NULL)
 	{
-		fprintf(stderr, "Failed to open timer.device\n");
-		goto out;
+		mux_server = mux_server_create(ss->session, mux_name);
+		if (mux_server == NULL)
+		{
+			fprintf(stderr, "Failed to share connection\n");
+		}
 	}
 
-	timer_start(blink_timer, BLINK_DELAY);
+	if (keepalive_ms != 0)
+	{
+		keepalive_timer = timer_open(UNIT_MICROHZ);
+		if (keepalive_timer == NULL)
+		{
+			fprintf(stderr, "Failed to open timer.device\n");
+			goto out;
+		}
+
+		/* Keepalives are sent with want_reply set so that the replies can be
+		 * used for measuring the round-trip time. */
+		libssh2_keepalive_config_ms(ss->session, 1, keepalive_ms);
+
+		gettimeofday(&ss->status_time, NULL);
+
+		timer_start(keepalive_timer, keepalive_ms);
+	}
 
 	done = FALSE;
 
@@ -604,16 +920,31 @@ int sshterm(int argc, char **argv)
 		FD_ZERO(&rfds);
 		FD_ZERO(&wfds);
 
+		/* The socket is always read, so shared channels, forwarded
+		 * connections and keepalive replies keep flowing while the
+		 * terminal is behind. Only the shell channel waits for it to make
+		 * room, and its window limits what libssh2 buffers meanwhile. */
 		FD_SET(ss->socket, &rfds);
 
-		if (termwin_poll_new_size(termwin) || termwin_poll(termwin))
+		/* Also wait for the socket to become writable while the tail of a
+		 * packet that only went out partially is still pending. */
+		if ((!shell_done && (resize_pending || termtask_poll_new_size(termtask) || termtask_poll(termtask))) ||
+			(libssh2_session_block_directions(ss->session) & LIBSSH2_SESSION_BLOCK_OUTBOUND))
 		{
 			FD_SET(ss->socket, &wfds);
 		}
 
-		signals = termwin_get_signals(termwin) | timer_signal(blink_timer);
+		nfds = ss->socket + 1;
+		if (forwards != NULL)
+			nfds = forward_fdset(forwards, &rfds, &wfds, nfds);
+
+		signals = termtask_signal(termtask);
+		if (keepalive_timer != NULL)
+			signals |= timer_signal(keepalive_timer);
+		if (mux_server != NULL)
+			signals |= mux_server_signal(mux_server);
 
-		rc = waitselect(ss->socket + 1, &rfds, &wfds, NULL, NULL, (sigmask_t *)&signals);
+		rc = waitselect(nfds, &rfds, &wfds, NULL, NULL, (sigmask_t *)&signals);
 		if (rc < 0)
 		{
 			if (errno != EINTR)
@@ -625,27 +956,69 @@ int sshterm(int argc, char **argv)
 			done = TRUE;
 		}
 
-		if (signals & timer_signal(blink_timer))
+		STATS_BEGIN(loop_start);
+
+		if (keepalive_timer != NULL && (signals & timer_signal(keepalive_timer)))
 		{
-			termwin_blink(termwin);
-			timer_end(blink_timer);
-			timer_start(blink_timer, BLINK_DELAY);
+			timer_end(keepalive_timer);
+
+			ms_to_next = 0;
+			rc = libssh2_keepalive_send_ms(ss->session, &ms_to_next);
+
+			timer_start(keepalive_timer, ms_to_next > 0 ? ms_to_next : keepalive_ms);
+
+			if (rc < 0)
+			{
+				IExec->DebugPrintF("libssh2_keepalive_send_ms: %d\n", rc);
+				goto out;
+			}
+
+			/* The title says what we are waiting for once our shell is gone */
+			if (ss->channel != NULL)
+				update_status(ss, termtask, windowtitle);
 		}
 
-		if (termwin_handle_input(termwin))
-			done = TRUE;
+		if (termtask_closed(termtask))
+			shell_done = TRUE;
+
+		if (mux_server != NULL && (signals & mux_server_signal(mux_server)))
+			mux_server_handle(mux_server);
 
-		if (FD_ISSET(ss->socket, &rfds))
+		/* libssh2 may already hold data that was read from the socket while
+		 * the terminal was behind, so also try when it has made room. */
+		if (!shell_done && (FD_ISSET(ss->socket, &rfds) || (signals & termtask_signal(termtask))))
 		{
 			ssize_t rs;
+			size_t len;
 
 			do
 			{
-				rs = libssh2_channel_read(ss->channel, ss->iobuf, sizeof(ss->iobuf));
+				/* Read straight into the terminal's input buffer */
+				len = termtask_reserve(termtask, &buffer);
+				if (len == 0)
+				{
+					/* Still take in what arrived, so the socket does not
+					 * stay readable, and leave the shell data queued */
+					if (FD_ISSET(ss->socket, &rfds))
+					{
+						const char *data;
+
+						rs = libssh2_channel_read_peek(ss->channel, 0, &data);
+						if (rs < 0 && rs != LIBSSH2_ERROR_EAGAIN)
+						{
+							IExec->DebugPrintF("libssh2_channel_read_peek: %d\n", rs);
+							goto out;
+						}
+					}
+					break;
+				}
+
+				rs = libssh2_channel_read(ss->channel, buffer, len);
 
 				if (rs > 0)
 				{
-					termwin_write(termwin, ss->iobuf, rs);
+					ss->rx_bytes += rs;
+					termtask_commit(termtask, rs);
 				}
 				else if (rs < 0 && rs != LIBSSH2_ERROR_EAGAIN)
 				{
@@ -654,71 +1027,151 @@ int sshterm(int argc, char **argv)
 				}
 			}
 			while (rs > 0 && libssh2_poll_channel_read(ss->channel, 0));
-
-			termwin_refresh(termwin);
 		}
 
 		if (FD_ISSET(ss->socket, &wfds))
 		{
-			if (termwin_poll_new_size(termwin))
+			rc = libssh2_session_flush(ss->session);
+			if (rc < 0 && rc != LIBSSH2_ERROR_EAGAIN)
+			{
+				IExec->DebugPrintF("libssh2_session_flush: %d\n", rc);
+				goto out;
+			}
+
+			/* A size request that got EAGAIN has to be repeated with the
+			 * same size before the next one can be sent. */
+			if (!shell_done && !resize_pending && termtask_poll_new_size(termtask))
 			{
-				termwin_get_size(termwin, &columns, &rows);
+				termtask_get_size(termtask, &columns, &rows);
+				resize_pending = TRUE;
+			}
 
+			if (!shell_done && resize_pending)
+			{
 				rc = libssh2_channel_request_pty_size(ss->channel, columns, rows);
-				if (rc < 0)
+				if (rc == 0)
+				{
+					resize_pending = FALSE;
+				}
+				else if (rc != LIBSSH2_ERROR_EAGAIN)
 				{
 					IExec->DebugPrintF("libssh2_channel_request_pty_size: %d\n", rc);
 					goto out;
 				}
 			}
 
-			if (termwin_poll(termwin))
+			if (!shell_done && termtask_poll(termtask))
 			{
-				char *buffer;
-				ssize_t input_size, remain, ws;
-
-				do
+				LIBSSH2_IOVEC iov[2];
+				int iovcnt;
+				ssize_t ws;
+
+				/* Write straight from the ring buffer and only remove what
+				 * the channel has accepted. Whatever is left is sent the
+				 * next time the socket is writable. */
+				while ((iovcnt = termtask_peek(termtask, iov)) > 0)
 				{
-					input_size = termwin_read(termwin, ss->iobuf, sizeof(ss->iobuf));
-
-					buffer = ss->iobuf;
-					remain = input_size;
-					while (remain > 0)
+					ws = libssh2_channel_writev(ss->channel, iov, iovcnt);
+					if (ws > 0)
 					{
-						ws = libssh2_channel_write(ss->channel, buffer, remain);
-						if (ws > 0)
-						{
-							buffer += ws;
-							remain -= ws;
-						}
-						else if (ws < 0 && ws != LIBSSH2_ERROR_EAGAIN)
-						{
-							IExec->DebugPrintF("libssh2_channel_write: %d\n", ws);
-							goto out;
-						}
+						ss->tx_bytes += ws;
+						termtask_pull(termtask, ws);
+					}
+					else if (ws < 0 && ws != LIBSSH2_ERROR_EAGAIN)
+					{
+						IExec->DebugPrintF("libssh2_channel_writev: %d\n", ws);
+						goto out;
+					}
+					else
+					{
+						break;
 					}
 				}
-				while (input_size > 0);
 			}
 		}
 
-		if (libssh2_channel_eof(ss->channel))
+		if (mux_server != NULL)
 		{
-			done = TRUE;
+			/* Reading our own channel may also have queued data for the
+			 * shared ones, so check these every time. */
+			mux_server_poll(mux_server);
 		}
-	}
 
-	if (AboutWindowPID != 0)
-		aboutwin_close();
+		if (forwards != NULL)
+			forward_handle(forwards, &rfds, &wfds);
+
+		if (!shell_done && libssh2_channel_eof(ss->channel))
+			shell_done = TRUE;
+
+		/* The session outlives our own shell for as long as other windows
+		 * share it. Our channel is closed meanwhile and the window is only
+		 * kept for the status line. */
+		if (shell_done)
+		{
+			if (mux_server == NULL || mux_server_close(mux_server))
+			{
+				done = TRUE;
+			}
+			else if (ss->channel != NULL)
+			{
+				if (libssh2_channel_free(ss->channel) != LIBSSH2_ERROR_EAGAIN)
+				{
+					static const char msg[] = "\r\n[Waiting for the shared windows to close]\r\n";
+					char title[256];
+
+					ss->channel = NULL;
+
+					/* The window stays open after its close gadget has been
+					 * used, so tell the user why in the title as well. */
+					termtask_write(termtask, msg, sizeof(msg) - 1);
+
+					snprintf(title, sizeof(title), "%s [Waiting for the shared windows to close]",
+						windowtitle);
+					termtask_set_title(termtask, title);
+				}
+			}
+		}
+
+		STATS_END(STAT_NET_LOOP, loop_start, 0);
+	}
 
 	retval = RETURN_OK;
 
 out:
-	if (blink_timer != NULL)
+	/* Like the setup, the shutdown is done in blocking mode */
+	if (ss != NULL && ss->session != NULL)
+		libssh2_session_set_blocking(ss->session, 1);
+
+	if (mux_client != NULL)
+	{
+		mux_client_close(mux_client);
+		mux_client = NULL;
+	}
+
+	if (mux_server != NULL)
+	{
+		/* Waits for the windows using our connection to close */
+		mux_server_delete(mux_server);
+		mux_server = NULL;
+	}
+
+	if (mux_name != NULL)
 	{
-		timer_abort(blink_timer);
-		timer_close(blink_timer);
-		blink_timer = NULL;
+		IExec->FreeVec(mux_name);
+		mux_name = NULL;
+	}
+
+	if (forwards != NULL)
+	{
+		forward_delete(forwards);
+		forwards = NULL;
+	}
+
+	if (keepalive_timer != NULL)
+	{
+		timer_abort(keepalive_timer);
+		timer_close(keepalive_timer);
+		keepalive_timer = NULL;
 	}
 
 	if (ss != NULL)
@@ -740,6 +1193,9 @@ out:
 
 		if (ss->session != NULL)
 		{
+			if (args[ARG_STATS])
+				print_stats(ss);
+
 			libssh2_session_disconnect(ss->session, "Normal Shutdown, Thank you for playing");
 			libssh2_session_free(ss->session);
 			ss->session = NULL;
@@ -762,24 +1218,21 @@ out:
 		ss = NULL;
 	}
 
-	if (termwin != NULL)
+	if (termtask != NULL)
 	{
-		termwin_close(termwin);
-		termwin = NULL;
+		termtask_stop(termtask);
+		termtask = NULL;
 	}
 
-	if (windowtitle != NULL)
+	if (recorder != NULL)
 	{
-		IExec->FreeVec(windowtitle);
+		record_close(recorder);
+		recorder = NULL;
 	}
 
-	if (AboutWindowPID != 0)
+	if (windowtitle != NULL)
 	{
-		while (find_pid(AboutWindowPID))
-		{
-			IExec->Wait(SIGF_CHILD);
-		}
-		AboutWindowPID = 0;
+		IExec->FreeVec(windowtitle);
 	}
 
 	if (screen != NULL)
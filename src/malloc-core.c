@@ -0,0 +1,498 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include "sshterm.h"
+#include "malloc-core.h"
+
+#include <string.h>
+#include <stdint.h>
+
+/* Size-class slab allocator.
+ *
+ * Requests up to MAX_SMALL bytes are rounded up to one of the size classes
+ * below and carved out of SLAB_SIZE slabs that hold objects of one class
+ * only. The slabs are aligned to their size so the slab an object belongs
+ * to is found by masking its address, and a hash table of slab addresses
+ * tells small objects apart from large ones. Small objects therefore have no
+ * header at all. Freed objects go on a free list in their slab, a slab that
+ * becomes empty is given back unless it is the last one with free space in
+ * its class.
+ *
+ * Larger requests get a header holding the usable size, which is rounded up
+ * so that a block can grow in place a little before realloc() has to move
+ * it. realloc() also moves a block that shrinks to less than half its size,
+ * if a smaller one can hold it.
+ *
+ * All processes share the allocator and take the lock around every call.
+ */
+
+#define SLAB_SHIFT   16
+#define SLAB_SIZE    (1UL << SLAB_SHIFT)
+#define MAX_SMALL    2048
+#define SMALL_SHIFT  4
+
+struct slab {
+	struct slab *next;   /* slabs with free space in the same class */
+	struct slab *prev;
+	void        *free;   /* freed objects */
+	UBYTE       *carve;  /* objects from here to end have never been used */
+	UBYTE       *end;
+	ULONG        sclass;
+	ULONG        used;
+	BOOL         listed;
+};
+
+#define SLAB_HEADER ((sizeof(struct slab) + 15) & ~15)
+
+struct sizeclass {
+	struct slab *partial;
+	ULONG        size;
+};
+
+struct memchunk {
+	ULONG size;
+	APTR ptr;
+};
+
+static const UWORD class_sizes[MALLOC_CLASSES] = {
+	16, 32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512,
+	640, 768, 1024, 1280, 1536, 2048
+};
+
+static UBYTE class_index[(MAX_SMALL >> SMALL_SHIFT) + 1];
+static struct sizeclass classes[MALLOC_CLASSES];
+
+/* Open addressed hash table of slab addresses */
+static uintptr_t *slab_table;
+static ULONG slab_table_size;
+static ULONG slab_count;
+
+static struct MallocStats mstats;
+
+void malloc_core_init(void)
+{
+	ULONG c, i;
+
+	for (c = 0, i = 0; i <= (MAX_SMALL >> SMALL_SHIFT); i++)
+	{
+		if ((i << SMALL_SHIFT) > class_sizes[c])
+			c++;
+		class_index[i] = c;
+	}
+
+	for (c = 0; c < MALLOC_CLASSES; c++)
+		classes[c].size = class_sizes[c];
+}
+
+/* Gives back the slabs, the large blocks are left to the platform */
+void malloc_core_cleanup(void)
+{
+	ULONG i;
+
+	if (slab_table != NULL)
+	{
+		for (i = 0; i < slab_table_size; i++)
+		{
+			if (slab_table[i] != 0)
+				malloc_os_free_slab((APTR)slab_table[i]);
+		}
+
+		malloc_os_free_table(slab_table);
+		slab_table = NULL;
+		slab_table_size = 0;
+		slab_count = 0;
+	}
+
+	memset(classes, 0, sizeof(classes));
+	memset(&mstats, 0, sizeof(mstats));
+	malloc_core_init();
+}
+
+static inline ULONG slab_hash(uintptr_t base)
+{
+	return (ULONG)(base >> SLAB_SHIFT) * 2654435761UL;
+}
+
+static BOOL slab_table_insert(uintptr_t base)
+{
+	ULONG mask, i;
+
+	/* Keep the table at most half full */
+	if ((slab_count + 1) * 2 > slab_table_size)
+	{
+		uintptr_t *old_table = slab_table;
+		ULONG old_size = slab_table_size;
+		ULONG new_size = old_size != 0 ? old_size * 2 : 64;
+		uintptr_t *new_table;
+
+		new_table = malloc_os_alloc_table(new_size * sizeof(uintptr_t));
+		if (new_table == NULL)
+			return FALSE;
+
+		slab_table      = new_table;
+		slab_table_size = new_size;
+
+		mask = new_size - 1;
+		for (i = 0; i < old_size; i++)
+		{
+			ULONG j;
+
+			if (old_table[i] == 0)
+				continue;
+
+			j = slab_hash(old_table[i]) & mask;
+			while (new_table[j] != 0)
+				j = (j + 1) & mask;
+
+			new_table[j] = old_table[i];
+		}
+
+		if (old_table != NULL)
+			malloc_os_free_table(old_table);
+	}
+
+	mask = slab_table_size - 1;
+	i = slab_hash(base) & mask;
+	while (slab_table[i] != 0)
+		i = (i + 1) & mask;
+
+	slab_table[i] = base;
+	slab_count++;
+
+	return TRUE;
+}
+
+static void slab_table_remove(uintptr_t base)
+{
+	ULONG mask = slab_table_size - 1;
+	ULONG i, j, k;
+
+	i = slab_hash(base) & mask;
+	while (slab_table[i] != base)
+		i = (i + 1) & mask;
+
+	/* Move later entries of the same probe sequence into the hole so that
+	 * lookups never stop early. */
+	j = i;
+	for (;;)
+	{
+		j = (j + 1) & mask;
+		if (slab_table[j] == 0)
+			break;
+
+		k = slab_hash(slab_table[j]) & mask;
+		if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j)))
+		{
+			slab_table[i] = slab_table[j];
+			i = j;
+		}
+	}
+
+	slab_table[i] = 0;
+	slab_count--;
+}
+
+static struct slab *slab_lookup(const void *ptr)
+{
+	uintptr_t base = (uintptr_t)ptr & ~(SLAB_SIZE - 1);
+	ULONG mask, i;
+
+	if (slab_count == 0)
+		return NULL;
+
+	mask = slab_table_size - 1;
+	i = slab_hash(base) & mask;
+	while (slab_table[i] != 0)
+	{
+		if (slab_table[i] == base)
+			return (struct slab *)base;
+
+		i = (i + 1) & mask;
+	}
+
+	return NULL;
+}
+
+static void slab_link(struct sizeclass *sc, struct slab *s)
+{
+	s->prev = NULL;
+	s->next = sc->partial;
+	if (s->next != NULL)
+		s->next->prev = s;
+	sc->partial = s;
+	s->listed = TRUE;
+}
+
+static void slab_unlink(struct sizeclass *sc, struct slab *s)
+{
+	if (s->prev != NULL)
+		s->prev->next = s->next;
+	else
+		sc->partial = s->next;
+	if (s->next != NULL)
+		s->next->prev = s->prev;
+	s->listed = FALSE;
+}
+
+static struct slab *slab_new(ULONG c)
+{
+	struct slab *s;
+
+	s = malloc_os_alloc_slab(SLAB_SIZE);
+	if (s == NULL)
+		return NULL;
+
+	if (!slab_table_insert((uintptr_t)s))
+	{
+		malloc_os_free_slab(s);
+		return NULL;
+	}
+
+	s->free   = NULL;
+	s->carve  = (UBYTE *)s + SLAB_HEADER;
+	s->end    = (UBYTE *)s + SLAB_SIZE;
+	s->sclass = c;
+	s->used   = 0;
+
+	slab_link(&classes[c], s);
+
+	mstats.ms_Slabs++;
+
+	return s;
+}
+
+static void *slab_alloc(ULONG c)
+{
+	struct sizeclass *sc = &classes[c];
+	struct slab *s;
+	void *obj;
+
+	s = sc->partial;
+	if (s == NULL)
+	{
+		s = slab_new(c);
+		if (s == NULL)
+			return NULL;
+	}
+
+	if (s->free != NULL)
+	{
+		obj = s->free;
+		s->free = *(void **)obj;
+	}
+	else
+	{
+		obj = s->carve;
+		s->carve += sc->size;
+	}
+
+	s->used++;
+
+	if (s->free == NULL && s->carve + sc->size > s->end)
+		slab_unlink(sc, s);
+
+	mstats.ms_ClassLive[c]++;
+	mstats.ms_ClassAllocs[c]++;
+	mstats.ms_Live += sc->size;
+	if (mstats.ms_Live > mstats.ms_Peak)
+		mstats.ms_Peak = mstats.ms_Live;
+
+	return obj;
+}
+
+static void slab_free(struct slab *s, void *obj)
+{
+	struct sizeclass *sc = &classes[s->sclass];
+
+	*(void **)obj = s->free;
+	s->free = obj;
+	s->used--;
+
+	mstats.ms_ClassLive[s->sclass]--;
+	mstats.ms_Live -= sc->size;
+
+	if (!s->listed)
+		slab_link(sc, s);
+
+	/* Give the slab back unless it is the only one left to allocate from */
+	if (s->used == 0 && (sc->partial != s || s->next != NULL))
+	{
+		slab_unlink(sc, s);
+		slab_table_remove((uintptr_t)s);
+		malloc_os_free_slab(s);
+
+		mstats.ms_Slabs--;
+	}
+}
+
+/* Round up to a multiple of 1/8 of the highest power of two in the size,
+ * so 2049 becomes 2304 and at most 1/8 is wasted */
+static size_t large_size(size_t size)
+{
+	size_t step = 1;
+
+	while ((step << 1) <= (size >> 3))
+		step <<= 1;
+
+	return (size + step - 1) & ~(step - 1);
+}
+
+static void *large_alloc(size_t size)
+{
+	struct memchunk *mc;
+
+	size = large_size(size);
+
+	mc = malloc_os_alloc_large(sizeof(*mc) + size);
+	if (mc == NULL)
+		return NULL;
+
+	mc->size = size;
+	mc->ptr  = mc + 1;
+
+	mstats.ms_Live  += size;
+	mstats.ms_Large += size;
+	if (mstats.ms_Live > mstats.ms_Peak)
+		mstats.ms_Peak = mstats.ms_Live;
+
+	return mc->ptr;
+}
+
+static struct memchunk *large_chunk(void *ptr)
+{
+	struct memchunk *mc;
+
+	mc = (struct memchunk *)ptr - 1;
+
+	if (mc->ptr != ptr)
+		malloc_os_corrupt();
+
+	return mc;
+}
+
+static void large_free(void *ptr)
+{
+	struct memchunk *mc = large_chunk(ptr);
+
+	mstats.ms_Live  -= mc->size;
+	mstats.ms_Large -= mc->size;
+
+	malloc_os_free_large(mc, sizeof(*mc) + mc->size);
+}
+
+/* The size a request is rounded up to */
+static size_t alloc_size(size_t size)
+{
+	if (size <= MAX_SMALL)
+		return classes[class_index[(size + (1 << SMALL_SHIFT) - 1) >> SMALL_SHIFT]].size;
+	else
+		return large_size(size);
+}
+
+static void *malloc_locked(size_t size)
+{
+	if (size <= MAX_SMALL)
+		return slab_alloc(class_index[(size + (1 << SMALL_SHIFT) - 1) >> SMALL_SHIFT]);
+	else
+		return large_alloc(size);
+}
+
+static void free_locked(void *ptr)
+{
+	struct slab *s;
+
+	s = slab_lookup(ptr);
+	if (s != NULL)
+		slab_free(s, ptr);
+	else
+		large_free(ptr);
+}
+
+void *malloc_core_alloc(size_t size)
+{
+	void *ptr;
+
+	malloc_os_lock();
+	ptr = malloc_locked(size);
+	malloc_os_unlock();
+
+	return ptr;
+}
+
+void *malloc_core_realloc(void *ptr, size_t size)
+{
+	struct slab *s;
+	size_t old_size;
+	void *new;
+
+	if (ptr == NULL)
+		return malloc_core_alloc(size);
+
+	malloc_os_lock();
+
+	s = slab_lookup(ptr);
+	if (s != NULL)
+		old_size = classes[s->sclass].size;
+	else
+		old_size = large_chunk(ptr)->size;
+
+	/* Stay in place while the block is big enough, unless less than half
+	 * of it would be used and a smaller one will do */
+	if (size <= old_size && (size >= old_size / 2 || alloc_size(size) == old_size))
+	{
+		malloc_os_unlock();
+		return ptr;
+	}
+
+	new = malloc_locked(size);
+	if (new != NULL)
+	{
+		memcpy(new, ptr, size < old_size ? size : old_size);
+		free_locked(ptr);
+	}
+	else if (size <= old_size)
+	{
+		/* Shrinking must not fail, the old block still fits */
+		new = ptr;
+	}
+
+	malloc_os_unlock();
+
+	return new;
+}
+
+void malloc_core_free(void *ptr)
+{
+	if (ptr != NULL)
+	{
+		malloc_os_lock();
+		free_locked(ptr);
+		malloc_os_unlock();
+	}
+}
+
+void malloc_core_get_stats(struct MallocStats *ms)
+{
+	malloc_os_lock();
+	memcpy(ms, &mstats, sizeof(*ms));
+	malloc_os_unlock();
+}
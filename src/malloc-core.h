@@ -0,0 +1,63 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef MALLOC_CORE_H
+#define MALLOC_CORE_H
+
+#include <stddef.h>
+
+/* The size-class slab allocator behind malloc() and friends (malloc-core.c).
+ *
+ * The core does not call the operating system itself but goes through the
+ * small set of malloc_os_*() functions below, which src/malloc.c implements
+ * with exec.library. That way the core can be built and tested on other
+ * systems as well.
+ */
+
+struct MallocStats;
+
+void malloc_core_init(void);
+void malloc_core_cleanup(void);
+void *malloc_core_alloc(size_t size);
+void *malloc_core_realloc(void *ptr, size_t size);
+void malloc_core_free(void *ptr);
+void malloc_core_get_stats(struct MallocStats *ms);
+
+/* Taken around every call into the core, which may come from any process */
+void malloc_os_lock(void);
+void malloc_os_unlock(void);
+
+/* Memory aligned to its size for a slab */
+void *malloc_os_alloc_slab(size_t size);
+void malloc_os_free_slab(void *ptr);
+
+/* Cleared memory for the slab address table */
+void *malloc_os_alloc_table(size_t size);
+void malloc_os_free_table(void *ptr);
+
+/* Memory for a large block, freed with the size it was allocated with */
+void *malloc_os_alloc_large(size_t size);
+void malloc_os_free_large(void *ptr, size_t size);
+
+/* Called when a pointer that was not allocated here is freed */
+void malloc_os_corrupt(void);
+
+#endif /* MALLOC_CORE_H */
@@ -19,27 +19,39 @@
  * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
-#include <proto/exec.h>
+
+#include "sshterm.h"
+#include "malloc-core.h"
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
-static APTR mempool;
+/* malloc() and friends for all processes of SSHTerm, on top of the slab
+ * allocator in malloc-core.c. This file provides the exec.library side of
+ * it: a mutex, slabs from AllocVecTags() and large blocks from a memory
+ * pool.
+ */
 
-struct memchunk {
-	ULONG size;
-	APTR ptr;
-};
+static APTR mempool;
+static APTR mutex;
 
 static void __attribute__((constructor)) malloc_init(void)
 {
+	malloc_core_init();
+
+	mutex = IExec->AllocSysObjectTags(ASOT_MUTEX,
+		ASOMUTEX_Recursive, FALSE,
+		TAG_END);
+	if (mutex == NULL)
+		exit(EXIT_FAILURE);
+
 	mempool = IExec->AllocSysObjectTags(ASOT_MEMPOOL,
 		ASOPOOL_Name,      "SSHTerm memory pool",
 		ASO_MemoryOvr,     MEMF_SHARED,
 		ASOPOOL_MFlags,    MEMF_SHARED,
-		ASOPOOL_Puddle,    4096,
-		ASOPOOL_Threshold, 2048,
-		ASOPOOL_Protected, TRUE,
+		ASOPOOL_Puddle,    32768,
+		ASOPOOL_Threshold, 8192,
 		TAG_END);
 	if (mempool == NULL)
 		exit(EXIT_FAILURE);
@@ -47,35 +59,79 @@ static void __attribute__((constructor)) malloc_init(void)
 
 static void __attribute__((destructor)) malloc_cleanup(void)
 {
+	malloc_core_cleanup();
+
 	if (mempool != NULL)
 		IExec->FreeSysObject(ASOT_MEMPOOL, mempool);
+
+	if (mutex != NULL)
+		IExec->FreeSysObject(ASOT_MUTEX, mutex);
 }
 
-void *malloc(size_t size)
+void malloc_os_lock(void)
 {
-	struct memchunk *mc;
-	void *ptr = NULL;
+	IExec->MutexObtain(mutex);
+}
 
-	size = (size + 7) & ~7;
+void malloc_os_unlock(void)
+{
+	IExec->MutexRelease(mutex);
+}
 
-	mc = IExec->AllocPooled(mempool, sizeof(*mc) + size);
-	if (mc != NULL)
-	{
-		ptr = mc + 1;
+void *malloc_os_alloc_slab(size_t size)
+{
+	return IExec->AllocVecTags(size,
+		AVT_Type,      MEMF_SHARED,
+		AVT_Alignment, size,
+		TAG_END);
+}
 
-		mc->size = size;
-		mc->ptr = ptr;
-	}
+void malloc_os_free_slab(void *ptr)
+{
+	IExec->FreeVec(ptr);
+}
 
-	return ptr;
+void *malloc_os_alloc_table(size_t size)
+{
+	return IExec->AllocVecTags(size,
+		AVT_Type,           MEMF_SHARED,
+		AVT_ClearWithValue, 0,
+		TAG_END);
+}
+
+void malloc_os_free_table(void *ptr)
+{
+	IExec->FreeVec(ptr);
+}
+
+void *malloc_os_alloc_large(size_t size)
+{
+	return IExec->AllocPooled(mempool, size);
+}
+
+void malloc_os_free_large(void *ptr, size_t size)
+{
+	IExec->FreePooled(mempool, ptr, size);
+}
+
+void malloc_os_corrupt(void)
+{
+	IExec->Alert(AN_MemCorrupt);
+}
+
+void *malloc(size_t size)
+{
+	return malloc_core_alloc(size);
 }
 
 void *calloc(size_t num, size_t size)
 {
 	void *ptr;
 
+	if (size != 0 && num > SIZE_MAX / size)
+		return NULL;
+
 	size *= num;
-	size = (size + 7) & ~7;
 
 	ptr = malloc(size);
 	if (ptr != NULL)
@@ -88,48 +144,17 @@ void *calloc(size_t num, size_t size)
 
 void *realloc(void *ptr, size_t size)
 {
-	void *new;
-
-	if (ptr != NULL)
-	{
-		struct memchunk *mc;
-
-		mc = (struct memchunk *)ptr - 1;
-
-		if (mc->ptr != ptr)
-			IExec->Alert(AN_MemCorrupt);
-
-		if (mc->size >= size)
-			return ptr;
-
-		new = malloc(size);
-		if (new != NULL)
-		{
-			memcpy(new, ptr, mc->size);
-			free(ptr);
-		}
-	}
-	else
-	{
-		new = malloc(size);
-	}
-
-	return new;
+	return malloc_core_realloc(ptr, size);
 }
 
 void free(void *ptr)
 {
-	if (ptr != NULL)
-	{
-		struct memchunk *mc;
-
-		mc = (struct memchunk *)ptr - 1;
-
-		if (mc->ptr != ptr)
-			IExec->Alert(AN_MemCorrupt);
+	malloc_core_free(ptr);
+}
 
-		IExec->FreePooled(mempool, mc, sizeof(*mc) + mc->size);
-	}
+void malloc_get_stats(struct MallocStats *ms)
+{
+	malloc_core_get_stats(ms);
 }
 
 char *strdup(const char *src)
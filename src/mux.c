@@ -0,0 +1,808 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "sshterm.h"
+#include "mux.h"
+
+/* Master side channel states, none of them blocks the main loop */
+enum {
+	MC_OPENING, /* opening the session channel */
+	MC_PTY,     /* requesting the pty */
+	MC_SHELL,   /* starting the shell */
+	MC_OPEN,    /* passing data, mc_OpenMsg has been answered */
+	MC_CLOSING  /* freeing the channel, then waiting for our buffers */
+};
+
+struct MuxChannel
+{
+	struct MinNode     mc_Node;
+	int                mc_State;
+	LIBSSH2_CHANNEL   *mc_Channel;
+	struct MsgPort    *mc_Port;
+	struct MuxMessage *mc_Free[MUX_NUM_BUFFERS];
+	ULONG              mc_NumFree;
+	struct MinList     mc_Requests; /* DATA and RESIZE from the client, in order */
+	ULONG              mc_Offset;   /* data of the first request already written */
+	struct MuxMessage *mc_OpenMsg;  /* answered once the shell has started */
+	struct MuxMessage *mc_CloseMsg;
+	BOOL               mc_EOF;
+};
+
+struct MuxServer
+{
+	LIBSSH2_SESSION   *ms_Session;
+	struct MsgPort    *ms_Port;
+	struct MinList     ms_Channels;
+	struct MuxChannel *ms_Opening; /* channel whose open is in progress */
+	BOOL               ms_Public;
+};
+
+struct MuxClient
+{
+	struct MsgPort    *mc_Port;
+	struct MsgPort    *mc_Master;
+	APTR               mc_Handle;
+	struct MuxMessage *mc_Free[MUX_NUM_BUFFERS];
+	ULONG              mc_NumFree;
+	struct MuxMessage *mc_Pending; /* data that did not fit in the terminal */
+	ULONG              mc_Offset;
+	BOOL               mc_EOF;
+};
+
+char *mux_port_name(const char *username, const char *hostname, int port)
+{
+	return IUtility->ASPrintf("SSHTerm.%s@%s:%ld", username, hostname, (LONG)port);
+}
+
+static struct MuxMessage *alloc_message(struct MsgPort *replyport)
+{
+	return IExec->AllocSysObjectTags(ASOT_MESSAGE,
+		ASOMSG_Size,      sizeof(struct MuxMessage),
+		ASOMSG_ReplyPort, replyport,
+		TAG_END);
+}
+
+static void free_message(struct MuxMessage *msg)
+{
+	IExec->FreeSysObject(ASOT_MESSAGE, msg);
+}
+
+/* The channel is set up by mux_server_poll(), MUX_CMD_OPEN is answered
+ * when that is done. */
+static struct MuxChannel *mux_channel_new(struct MuxServer *ms, struct MuxMessage *msg)
+{
+	struct MuxChannel *mc;
+	ULONG i;
+
+	mc = malloc(sizeof(*mc));
+	if (mc == NULL)
+		return NULL;
+
+	memset(mc, 0, sizeof(*mc));
+
+	mc->mc_State   = MC_OPENING;
+	mc->mc_Port    = msg->mm_Port;
+	mc->mc_OpenMsg = msg;
+	IExec->NewMinList(&mc->mc_Requests);
+
+	for (i = 0; i < MUX_NUM_BUFFERS; i++)
+	{
+		mc->mc_Free[i] = alloc_message(ms->ms_Port);
+		if (mc->mc_Free[i] == NULL)
+			goto fail;
+
+		mc->mc_Free[i]->mm_Handle = mc;
+		mc->mc_NumFree++;
+	}
+
+	IExec->AddTail((struct List *)&ms->ms_Channels, (struct Node *)&mc->mc_Node);
+
+	return mc;
+
+fail:
+	for (i = 0; i < mc->mc_NumFree; i++)
+		free_message(mc->mc_Free[i]);
+
+	free(mc);
+
+	return NULL;
+}
+
+static void mux_channel_reply(struct MuxMessage *msg, LONG result)
+{
+	msg->mm_Result = result;
+
+	IExec->ReplyMsg(&msg->mm_Message);
+}
+
+/* Only called once every buffer of the channel has come back */
+static void mux_channel_free(struct MuxChannel *mc)
+{
+	ULONG i;
+
+	IExec->Remove((struct Node *)&mc->mc_Node);
+
+	for (i = 0; i < mc->mc_NumFree; i++)
+		free_message(mc->mc_Free[i]);
+
+	if (mc->mc_CloseMsg != NULL)
+		IExec->ReplyMsg(&mc->mc_CloseMsg->mm_Message);
+
+	free(mc);
+}
+
+/* Answer whatever the client has queued, giving it its buffers back */
+static void mux_channel_drop_requests(struct MuxChannel *mc)
+{
+	struct MuxMessage *msg;
+
+	while ((msg = (struct MuxMessage *)IExec->RemHead((struct List *)&mc->mc_Requests)) != NULL)
+		mux_channel_reply(msg, -1);
+
+	mc->mc_Offset = 0;
+}
+
+/* Free the libssh2 channel, which takes a few passes in non-blocking mode
+ * as it waits for the server's reply, and then the MuxChannel once the
+ * client has returned all of its buffers. */
+static void mux_channel_close(struct MuxChannel *mc)
+{
+	mc->mc_State = MC_CLOSING;
+
+	mux_channel_drop_requests(mc);
+
+	if (mc->mc_OpenMsg != NULL)
+	{
+		mux_channel_reply(mc->mc_OpenMsg, -1);
+		mc->mc_OpenMsg = NULL;
+	}
+
+	if (mc->mc_Channel != NULL)
+	{
+		if (libssh2_channel_free(mc->mc_Channel) == LIBSSH2_ERROR_EAGAIN)
+			return;
+
+		mc->mc_Channel = NULL;
+	}
+
+	if (mc->mc_NumFree == MUX_NUM_BUFFERS)
+		mux_channel_free(mc);
+}
+
+static void mux_channel_send(struct MuxChannel *mc, struct MuxMessage *msg)
+{
+	IExec->PutMsg(mc->mc_Port, &msg->mm_Message);
+}
+
+static void mux_channel_send_eof(struct MuxChannel *mc)
+{
+	struct MuxMessage *msg;
+
+	if (mc->mc_State != MC_OPEN || mc->mc_EOF)
+		return;
+
+	mux_channel_drop_requests(mc);
+
+	if (mc->mc_NumFree == 0)
+		return;
+
+	msg = mc->mc_Free[--mc->mc_NumFree];
+	msg->mm_Command = MUX_CMD_EOF;
+	msg->mm_Length  = 0;
+
+	mc->mc_EOF = TRUE;
+
+	mux_channel_send(mc, msg);
+}
+
+/* Open the channel, request the pty and start the shell, each step taking
+ * as many passes as it needs. Only one channel open can be in progress on
+ * the session at a time, so channels waiting for theirs take turns, also
+ * with anybody else opening channels on the session. */
+static void mux_channel_setup(struct MuxServer *ms, struct MuxChannel *mc)
+{
+	struct MuxMessage *msg = mc->mc_OpenMsg;
+	int rc;
+
+	switch (mc->mc_State)
+	{
+		case MC_OPENING:
+			if (ms->ms_Opening != mc)
+			{
+				if (ms->ms_Opening != NULL || libssh2_session_open_pending(ms->ms_Session))
+					return;
+
+				ms->ms_Opening = mc;
+			}
+
+			mc->mc_Channel = libssh2_channel_open_session(ms->ms_Session);
+			if (mc->mc_Channel == NULL)
+			{
+				if (libssh2_session_last_errno(ms->ms_Session) == LIBSSH2_ERROR_EAGAIN)
+					return;
+
+				ms->ms_Opening = NULL;
+				IExec->DebugPrintF("libssh2_channel_open_session failed\n");
+				mux_channel_close(mc);
+				return;
+			}
+
+			ms->ms_Opening = NULL;
+			mc->mc_State = MC_PTY;
+			/* fall through */
+
+		case MC_PTY:
+			rc = libssh2_channel_request_pty_ex(mc->mc_Channel, "xterm-256color", 14, NULL, 0,
+				msg->mm_Columns, msg->mm_Rows, 0, 0);
+			if (rc == LIBSSH2_ERROR_EAGAIN)
+				return;
+			if (rc != 0)
+			{
+				IExec->DebugPrintF("libssh2_channel_request_pty_ex: %d\n", rc);
+				mux_channel_close(mc);
+				return;
+			}
+
+			mc->mc_State = MC_SHELL;
+			/* fall through */
+
+		case MC_SHELL:
+			rc = libssh2_channel_shell(mc->mc_Channel);
+			if (rc == LIBSSH2_ERROR_EAGAIN)
+				return;
+			if (rc != 0)
+			{
+				IExec->DebugPrintF("libssh2_channel_shell: %d\n", rc);
+				mux_channel_close(mc);
+				return;
+			}
+
+			mc->mc_State   = MC_OPEN;
+			mc->mc_OpenMsg = NULL;
+
+			msg->mm_Handle = mc;
+			mux_channel_reply(msg, 0);
+			break;
+	}
+}
+
+/* Write the client's data and pass on its size changes in the order they
+ * came in. A request is only answered once it has been sent completely, so
+ * a client that keeps sending runs out of buffers while the channel is
+ * behind. Whatever does not go out now is retried on the next pass, which
+ * comes when the SSH socket has room again. */
+static void mux_channel_requests(struct MuxChannel *mc)
+{
+	struct MuxMessage *msg;
+	ssize_t ws;
+	LONG result;
+	int rc;
+
+	while ((msg = (struct MuxMessage *)IExec->GetHead((struct List *)&mc->mc_Requests)) != NULL)
+	{
+		if (msg->mm_Command == MUX_CMD_DATA)
+		{
+			ws = libssh2_channel_write(mc->mc_Channel, (const char *)msg->mm_Data + mc->mc_Offset,
+				msg->mm_Length - mc->mc_Offset);
+			if (ws > 0)
+			{
+				mc->mc_Offset += ws;
+				if (mc->mc_Offset < msg->mm_Length)
+					continue;
+
+				result = 0;
+			}
+			else if (ws == 0 || ws == LIBSSH2_ERROR_EAGAIN)
+			{
+				return;
+			}
+			else
+			{
+				IExec->DebugPrintF("libssh2_channel_write: %d\n", ws);
+				result = -1;
+			}
+		}
+		else
+		{
+			rc = libssh2_channel_request_pty_size(mc->mc_Channel, msg->mm_Columns, msg->mm_Rows);
+			if (rc == LIBSSH2_ERROR_EAGAIN)
+				return;
+
+			result = (rc == 0) ? 0 : -1;
+		}
+
+		IExec->Remove(&msg->mm_Message.mn_Node);
+		mc->mc_Offset = 0;
+
+		mux_channel_reply(msg, result);
+
+		if (result != 0)
+		{
+			mux_channel_send_eof(mc);
+			break;
+		}
+	}
+}
+
+struct MuxServer *mux_server_create(LIBSSH2_SESSION *session, const char *name)
+{
+	struct MuxServer *ms;
+
+	ms = malloc(sizeof(*ms));
+	if (ms == NULL)
+		return NULL;
+
+	memset(ms, 0, sizeof(*ms));
+
+	ms->ms_Session = session;
+	ms->ms_Opening = NULL;
+	IExec->NewMinList(&ms->ms_Channels);
+
+	ms->ms_Port = IExec->AllocSysObjectTags(ASOT_PORT,
+		ASOPORT_Name, name,
+		TAG_END);
+	if (ms->ms_Port == NULL)
+	{
+		free(ms);
+		return NULL;
+	}
+
+	IExec->Forbid();
+	if (IExec->FindPort(name) == NULL)
+	{
+		IExec->AddPort(ms->ms_Port);
+		ms->ms_Public = TRUE;
+	}
+	IExec->Permit();
+
+	if (!ms->ms_Public)
+	{
+		/* Somebody else is already sharing this connection */
+		IExec->FreeSysObject(ASOT_PORT, ms->ms_Port);
+		free(ms);
+		return NULL;
+	}
+
+	return ms;
+}
+
+ULONG mux_server_signal(const struct MuxServer *ms)
+{
+	return (1UL << ms->ms_Port->mp_SigBit);
+}
+
+static void mux_server_handle_msg(struct MuxServer *ms, struct MuxMessage *msg, BOOL closing)
+{
+	struct MuxChannel *mc = msg->mm_Handle;
+
+	switch (msg->mm_Command)
+	{
+		case MUX_CMD_OPEN:
+			/* Answered once the shell has started */
+			if (ms->ms_Public && mux_channel_new(ms, msg) != NULL)
+				return;
+			break;
+
+		case MUX_CMD_DATA:
+		case MUX_CMD_RESIZE:
+			if (!closing && !mc->mc_EOF && mc->mc_State == MC_OPEN)
+			{
+				IExec->AddTail((struct List *)&mc->mc_Requests, &msg->mm_Message.mn_Node);
+				return;
+			}
+			break;
+
+		case MUX_CMD_CLOSE:
+			/* Replied when the channel is freed */
+			mc->mc_CloseMsg = msg;
+			mux_channel_close(mc);
+			return;
+	}
+
+	mux_channel_reply(msg, -1);
+}
+
+static void mux_server_get_msgs(struct MuxServer *ms, BOOL closing)
+{
+	struct MuxMessage *msg;
+	struct MuxChannel *mc;
+
+	while ((msg = (struct MuxMessage *)IExec->GetMsg(ms->ms_Port)) != NULL)
+	{
+		if (msg->mm_Message.mn_Node.ln_Type == NT_REPLYMSG)
+		{
+			/* One of our buffers came back from a client */
+			mc = msg->mm_Handle;
+			mc->mc_Free[mc->mc_NumFree++] = msg;
+
+			if (mc->mc_State == MC_CLOSING && mc->mc_Channel == NULL &&
+			    mc->mc_NumFree == MUX_NUM_BUFFERS)
+			{
+				mux_channel_free(mc);
+			}
+		}
+		else
+		{
+			mux_server_handle_msg(ms, msg, closing);
+		}
+	}
+}
+
+void mux_server_handle(struct MuxServer *ms)
+{
+	mux_server_get_msgs(ms, FALSE);
+}
+
+/* Move whatever the server has sent on the shared channel to the client,
+ * for as long as it has buffers free. */
+static void mux_channel_read(struct MuxChannel *mc)
+{
+	struct MuxMessage *msg;
+	ssize_t rs;
+
+	if (mc->mc_EOF)
+		return;
+
+	while (mc->mc_NumFree > 0)
+	{
+		msg = mc->mc_Free[mc->mc_NumFree - 1];
+
+		rs = libssh2_channel_read(mc->mc_Channel, (char *)msg->mm_Data, MUX_BUFFER_SIZE);
+		if (rs > 0)
+		{
+			mc->mc_NumFree--;
+
+			msg->mm_Command = MUX_CMD_DATA;
+			msg->mm_Length  = rs;
+
+			mux_channel_send(mc, msg);
+		}
+		else
+		{
+			if (rs < 0 && rs != LIBSSH2_ERROR_EAGAIN)
+			{
+				IExec->DebugPrintF("libssh2_channel_read: %d\n", rs);
+				mux_channel_send_eof(mc);
+			}
+			break;
+		}
+	}
+
+	if (libssh2_channel_eof(mc->mc_Channel))
+		mux_channel_send_eof(mc);
+}
+
+/* Drives every shared channel, called on each pass through the main loop
+ * as reading our own channel may also have queued data for them. */
+void mux_server_poll(struct MuxServer *ms)
+{
+	struct MuxChannel *mc, *next;
+
+	for (mc = (struct MuxChannel *)IExec->GetHead((struct List *)&ms->ms_Channels);
+	     mc != NULL;
+	     mc = next)
+	{
+		next = (struct MuxChannel *)IExec->GetSucc((struct Node *)&mc->mc_Node);
+
+		switch (mc->mc_State)
+		{
+			case MC_OPENING:
+			case MC_PTY:
+			case MC_SHELL:
+				mux_channel_setup(ms, mc);
+				break;
+
+			case MC_OPEN:
+				mux_channel_requests(mc);
+				mux_channel_read(mc);
+				break;
+
+			case MC_CLOSING:
+				mux_channel_close(mc);
+				break;
+		}
+	}
+}
+
+static void mux_server_unpublish(struct MuxServer *ms)
+{
+	if (ms->ms_Public)
+	{
+		IExec->Forbid();
+		IExec->RemPort(ms->ms_Port);
+		IExec->Permit();
+		ms->ms_Public = FALSE;
+	}
+}
+
+BOOL mux_server_close(struct MuxServer *ms)
+{
+	mux_server_unpublish(ms);
+
+	return IsMinListEmpty(&ms->ms_Channels);
+}
+
+void mux_server_delete(struct MuxServer *ms)
+{
+	struct MuxChannel *mc, *next;
+
+	if (ms == NULL)
+		return;
+
+	/* No new clients from here on, but the port stays valid until every
+	 * attached one has sent MUX_CMD_CLOSE. */
+	mux_server_unpublish(ms);
+
+	/* An open that is still in progress is dropped with the session */
+	ms->ms_Opening = NULL;
+
+	/* The session is back in blocking mode here, so closing a channel
+	 * finishes right away. */
+	while (!IsMinListEmpty(&ms->ms_Channels))
+	{
+		for (mc = (struct MuxChannel *)IExec->GetHead((struct List *)&ms->ms_Channels);
+		     mc != NULL;
+		     mc = next)
+		{
+			next = (struct MuxChannel *)IExec->GetSucc((struct Node *)&mc->mc_Node);
+
+			if (mc->mc_State == MC_OPEN)
+				mux_channel_send_eof(mc);
+			else
+				mux_channel_close(mc);
+		}
+
+		if (IsMinListEmpty(&ms->ms_Channels))
+			break;
+
+		IExec->WaitPort(ms->ms_Port);
+		mux_server_get_msgs(ms, TRUE);
+	}
+
+	/* Turn away anything that was queued before the port went private */
+	mux_server_get_msgs(ms, TRUE);
+
+	IExec->FreeSysObject(ASOT_PORT, ms->ms_Port);
+	free(ms);
+}
+
+struct MuxClient *mux_client_open(const char *name, UWORD columns, UWORD rows)
+{
+	struct MuxClient *mc;
+	struct MuxMessage *msg;
+	ULONG i;
+
+	mc = malloc(sizeof(*mc));
+	if (mc == NULL)
+		return NULL;
+
+	memset(mc, 0, sizeof(*mc));
+
+	mc->mc_Port = IExec->AllocSysObject(ASOT_PORT, NULL);
+	if (mc->mc_Port == NULL)
+		goto fail;
+
+	for (i = 0; i < MUX_NUM_BUFFERS; i++)
+	{
+		mc->mc_Free[i] = alloc_message(mc->mc_Port);
+		if (mc->mc_Free[i] == NULL)
+			goto fail;
+
+		mc->mc_NumFree++;
+	}
+
+	msg = mc->mc_Free[--mc->mc_NumFree];
+	msg->mm_Command = MUX_CMD_OPEN;
+	msg->mm_Handle  = NULL;
+	msg->mm_Port    = mc->mc_Port;
+	msg->mm_Columns = columns;
+	msg->mm_Rows    = rows;
+	msg->mm_Result  = -1;
+
+	IExec->Forbid();
+	mc->mc_Master = IExec->FindPort(name);
+	if (mc->mc_Master != NULL)
+		IExec->PutMsg(mc->mc_Master, &msg->mm_Message);
+	IExec->Permit();
+
+	if (mc->mc_Master == NULL)
+	{
+		mc->mc_Free[mc->mc_NumFree++] = msg;
+		goto fail;
+	}
+
+	/* Nothing else is sent to us before the open has been answered */
+	IExec->WaitPort(mc->mc_Port);
+	IExec->GetMsg(mc->mc_Port);
+
+	mc->mc_Free[mc->mc_NumFree++] = msg;
+
+	if (msg->mm_Result != 0)
+		goto fail;
+
+	mc->mc_Handle = msg->mm_Handle;
+
+	return mc;
+
+fail:
+	for (i = 0; i < mc->mc_NumFree; i++)
+		free_message(mc->mc_Free[i]);
+
+	if (mc->mc_Port != NULL)
+		IExec->FreeSysObject(ASOT_PORT, mc->mc_Port);
+
+	free(mc);
+
+	return NULL;
+}
+
+static void mux_client_send(struct MuxClient *mc, struct MuxMessage *msg)
+{
+	msg->mm_Handle = mc->mc_Handle;
+
+	IExec->PutMsg(mc->mc_Master, &msg->mm_Message);
+}
+
+/* Handle messages from the master, data is passed on to the terminal if one
+ * is given and dropped otherwise. A data message that does not fit is kept
+ * until the terminal has made room, and no further messages are taken
+ * before it has been passed on. */
+static void mux_client_get_msgs(struct MuxClient *mc, struct TermTask *tt)
+{
+	struct MuxMessage *msg;
+
+	msg = mc->mc_Pending;
+	if (msg != NULL)
+	{
+		if (tt != NULL)
+		{
+			mc->mc_Offset += termtask_write(tt, (const char *)msg->mm_Data + mc->mc_Offset,
+				msg->mm_Length - mc->mc_Offset);
+			if (mc->mc_Offset < msg->mm_Length)
+				return;
+		}
+
+		mc->mc_Pending = NULL;
+		IExec->ReplyMsg(&msg->mm_Message);
+	}
+
+	while ((msg = (struct MuxMessage *)IExec->GetMsg(mc->mc_Port)) != NULL)
+	{
+		if (msg->mm_Message.mn_Node.ln_Type == NT_REPLYMSG)
+		{
+			mc->mc_Free[mc->mc_NumFree++] = msg;
+			continue;
+		}
+
+		switch (msg->mm_Command)
+		{
+			case MUX_CMD_DATA:
+				if (tt != NULL)
+				{
+					mc->mc_Offset = termtask_write(tt, (const char *)msg->mm_Data, msg->mm_Length);
+					if (mc->mc_Offset < msg->mm_Length)
+					{
+						mc->mc_Pending = msg;
+						return;
+					}
+				}
+				break;
+
+			case MUX_CMD_EOF:
+				mc->mc_EOF = TRUE;
+				break;
+		}
+
+		IExec->ReplyMsg(&msg->mm_Message);
+	}
+}
+
+ULONG mux_client_signal(const struct MuxClient *mc)
+{
+	return (1UL << mc->mc_Port->mp_SigBit);
+}
+
+BOOL mux_client_handle(struct MuxClient *mc, struct TermTask *tt)
+{
+	mux_client_get_msgs(mc, tt);
+
+	return mc->mc_EOF;
+}
+
+BOOL mux_client_writable(const struct MuxClient *mc)
+{
+	return (!mc->mc_EOF && mc->mc_NumFree > 0);
+}
+
+size_t mux_client_write(struct MuxClient *mc, const char *buffer, size_t len)
+{
+	struct MuxMessage *msg;
+
+	if (!mux_client_writable(mc))
+		return 0;
+
+	if (len > MUX_BUFFER_SIZE)
+		len = MUX_BUFFER_SIZE;
+
+	msg = mc->mc_Free[--mc->mc_NumFree];
+	msg->mm_Command = MUX_CMD_DATA;
+	msg->mm_Length  = len;
+	memcpy(msg->mm_Data, buffer, len);
+
+	mux_client_send(mc, msg);
+
+	return len;
+}
+
+BOOL mux_client_resize(struct MuxClient *mc, UWORD columns, UWORD rows)
+{
+	struct MuxMessage *msg;
+
+	if (!mux_client_writable(mc))
+		return FALSE;
+
+	msg = mc->mc_Free[--mc->mc_NumFree];
+	msg->mm_Command = MUX_CMD_RESIZE;
+	msg->mm_Columns = columns;
+	msg->mm_Rows    = rows;
+
+	mux_client_send(mc, msg);
+
+	return TRUE;
+}
+
+void mux_client_close(struct MuxClient *mc)
+{
+	struct MuxMessage *msg;
+	ULONG i;
+
+	if (mc == NULL)
+		return;
+
+	/* Drop anything the terminal has not taken yet */
+	mux_client_get_msgs(mc, NULL);
+
+	while (mc->mc_NumFree == 0)
+	{
+		IExec->WaitPort(mc->mc_Port);
+		mux_client_get_msgs(mc, NULL);
+	}
+
+	msg = mc->mc_Free[--mc->mc_NumFree];
+	msg->mm_Command = MUX_CMD_CLOSE;
+
+	mux_client_send(mc, msg);
+
+	/* The master answers the close only after all of its own buffers have
+	 * been returned, so keep replying until everything is back. */
+	while (mc->mc_NumFree != MUX_NUM_BUFFERS)
+	{
+		IExec->WaitPort(mc->mc_Port);
+		mux_client_get_msgs(mc, NULL);
+	}
+
+	for (i = 0; i < mc->mc_NumFree; i++)
+		free_message(mc->mc_Free[i]);
+
+	IExec->FreeSysObject(ASOT_PORT, mc->mc_Port);
+
+	free(mc);
+}
@@ -0,0 +1,89 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef MUX_H
+#define MUX_H
+
+#include <exec/ports.h>
+#include <libssh2.h>
+
+/* Connection sharing between SSHTerm processes.
+ *
+ * The first process started with SHARE for a given user@host:port becomes
+ * the master. It keeps the SSH session and adds a public message port under
+ * a name derived from the connection. Later processes find the port, ask
+ * the master to open a new shell channel on their behalf and exchange the
+ * plain channel data with it as MuxMessages.
+ *
+ * Every side owns MUX_NUM_BUFFERS messages which are returned to it by
+ * ReplyMsg(), so a side that stops replying also stops the other one from
+ * sending more. A client always ends with MUX_CMD_CLOSE and the master does
+ * not free its port before every client has done so.
+ *
+ * The master serves the clients from its main loop with the session in
+ * non-blocking mode and answers MUX_CMD_OPEN, MUX_CMD_DATA and
+ * MUX_CMD_RESIZE once they have been carried out. When its own shell ends
+ * it calls mux_server_close(), which turns away new clients, and keeps
+ * going until that reports the last one gone.
+ */
+
+#define MUX_BUFFER_SIZE 8192
+#define MUX_NUM_BUFFERS 4
+
+enum {
+	MUX_CMD_OPEN = 1, /* client -> master: open a shell channel */
+	MUX_CMD_DATA,     /* both ways: channel data */
+	MUX_CMD_RESIZE,   /* client -> master: new pty size */
+	MUX_CMD_EOF,      /* master -> client: channel has been closed */
+	MUX_CMD_CLOSE     /* client -> master: detach and close the channel */
+};
+
+struct MuxMessage
+{
+	struct Message  mm_Message;
+	ULONG           mm_Command;
+	APTR            mm_Handle;  /* master side channel */
+	struct MsgPort *mm_Port;    /* client port (MUX_CMD_OPEN) */
+	UWORD           mm_Columns; /* MUX_CMD_OPEN, MUX_CMD_RESIZE */
+	UWORD           mm_Rows;
+	LONG            mm_Result;
+	ULONG           mm_Length;  /* MUX_CMD_DATA */
+	UBYTE           mm_Data[MUX_BUFFER_SIZE];
+};
+
+char *mux_port_name(const char *username, const char *hostname, int port);
+
+struct MuxServer *mux_server_create(LIBSSH2_SESSION *session, const char *name);
+void mux_server_delete(struct MuxServer *ms);
+ULONG mux_server_signal(const struct MuxServer *ms);
+void mux_server_handle(struct MuxServer *ms);
+void mux_server_poll(struct MuxServer *ms);
+BOOL mux_server_close(struct MuxServer *ms);
+
+struct MuxClient *mux_client_open(const char *name, UWORD columns, UWORD rows);
+void mux_client_close(struct MuxClient *mc);
+ULONG mux_client_signal(const struct MuxClient *mc);
+BOOL mux_client_handle(struct MuxClient *mc, struct TermTask *tt);
+BOOL mux_client_writable(const struct MuxClient *mc);
+size_t mux_client_write(struct MuxClient *mc, const char *buffer, size_t len);
+BOOL mux_client_resize(struct MuxClient *mc, UWORD columns, UWORD rows);
+
+#endif /* MUX_H */
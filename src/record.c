@@ -0,0 +1,96 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "sshterm.h"
+#include "record.h"
+
+#include <sys/time.h>
+
+struct Recorder
+{
+	BPTR   rec_File;
+	BOOL   rec_Error;
+};
+
+static void put_le32(UBYTE *p, ULONG v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+struct Recorder *record_open(const char *filename)
+{
+	struct Recorder *rec;
+
+	rec = malloc(sizeof(*rec));
+	if (rec == NULL)
+		return NULL;
+
+	memset(rec, 0, sizeof(*rec));
+
+	rec->rec_File = IDOS->FOpen(filename, MODE_NEWFILE, RECORD_BUFFER_SIZE);
+	if (rec->rec_File == ZERO)
+	{
+		free(rec);
+		return NULL;
+	}
+
+	return rec;
+}
+
+void record_close(struct Recorder *rec)
+{
+	if (rec != NULL)
+	{
+		IDOS->FClose(rec->rec_File);
+
+		free(rec);
+	}
+}
+
+/* Writes are buffered by dos.library so that the network side is not held
+ * up by the disk. Recording stops at the first error. */
+BOOL record_write(struct Recorder *rec, const void *data, size_t len)
+{
+	struct timeval now;
+	UBYTE header[12];
+
+	if (rec->rec_Error || len == 0)
+		return !rec->rec_Error;
+
+	gettimeofday(&now, NULL);
+
+	put_le32(&header[0], now.tv_sec);
+	put_le32(&header[4], now.tv_usec);
+	put_le32(&header[8], len);
+
+	if (IDOS->FWrite(rec->rec_File, header, sizeof(header), 1) != 1 ||
+	    IDOS->FWrite(rec->rec_File, data, len, 1) != 1)
+	{
+		fprintf(stderr, "Failed to write recording, recording stopped\n");
+		rec->rec_Error = TRUE;
+		return FALSE;
+	}
+
+	return TRUE;
+}
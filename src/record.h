@@ -0,0 +1,46 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <exec/types.h>
+#include <stddef.h>
+
+/* Recording of the terminal output.
+ *
+ * RECORD saves everything that is passed to the terminal emulation, as it
+ * arrives, in the ttyrec format: each block of data is preceded by a header
+ * of three little-endian 32-bit words holding the time of arrival (seconds
+ * and microseconds) and the length of the data. Recordings can be played
+ * back with ttyplay and other ttyrec tools, or fed to libtsm on another
+ * machine for benchmarking and reproducing emulation bugs.
+ */
+
+#define RECORD_BUFFER_SIZE 65536
+
+struct Recorder *record_open(const char *filename);
+void record_close(struct Recorder *rec);
+BOOL record_write(struct Recorder *rec, const void *data, size_t len);
+
+void termtask_record(struct TermTask *tt, struct Recorder *rec);
+
+#endif /* RECORD_H */
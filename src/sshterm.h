@@ -64,7 +64,7 @@ void close_interface(struct Interface *interface);
 
 int sshterm(int argc, char **argv);
 
-struct TermWindow *termwin_open(struct Screen *screen, ULONG max_sb, const char *win_title, BOOL bs_is_del);
+struct TermWindow *termwin_open(struct Screen *screen, ULONG max_sb, const char *win_title, BOOL bs_is_del, BOOL predict);
 void termwin_close(struct TermWindow *tw);
 void termwin_set_title( struct TermWindow *tw, const char *wintitle);
 void termwin_set_max_sb(struct TermWindow *tw, ULONG max_sb);
@@ -73,14 +73,43 @@ void termwin_refresh(struct TermWindow *tw);
 ULONG termwin_get_signals(struct TermWindow *tw);
 BOOL termwin_handle_input(struct TermWindow *tw);
 size_t termwin_poll(struct TermWindow *tw);
-ssize_t termwin_read(struct TermWindow *tw, char *buffer, size_t len);
+int termwin_peek(struct TermWindow *tw, LIBSSH2_IOVEC iov[2]);
+void termwin_pull(struct TermWindow *tw, size_t len);
 BOOL termwin_poll_new_size(struct TermWindow *tw);
 void termwin_get_size(struct TermWindow *tw, UWORD *columns, UWORD *rows);
+BOOL termwin_blinking(struct TermWindow *tw);
 void termwin_blink(struct TermWindow *tw);
 
+struct TermTask *termtask_start(struct Screen *screen, ULONG max_sb, const char *win_title, BOOL bs_is_del, BOOL predict, ULONG frame_ms);
+void termtask_stop(struct TermTask *tt);
+ULONG termtask_signal(const struct TermTask *tt);
+BOOL termtask_closed(struct TermTask *tt);
+size_t termtask_reserve(struct TermTask *tt, char **buffer);
+void termtask_commit(struct TermTask *tt, size_t len);
+size_t termtask_write(struct TermTask *tt, const char *buffer, size_t len);
+size_t termtask_poll(struct TermTask *tt);
+int termtask_peek(struct TermTask *tt, LIBSSH2_IOVEC iov[2]);
+void termtask_pull(struct TermTask *tt, size_t len);
+BOOL termtask_poll_new_size(struct TermTask *tt);
+void termtask_get_size(struct TermTask *tt, UWORD *columns, UWORD *rows);
+void termtask_set_title(struct TermTask *tt, const char *wintitle);
+
 BOOL aboutwin_open(struct Screen *screen);
 void aboutwin_close(void);
 
+#define MALLOC_CLASSES 19
+
+struct MallocStats {
+	size_t ms_Live;                          /* bytes in use, rounded up */
+	size_t ms_Peak;
+	size_t ms_Large;                         /* bytes in large blocks */
+	ULONG  ms_Slabs;
+	ULONG  ms_ClassLive[MALLOC_CLASSES];     /* objects in use per size class */
+	ULONG  ms_ClassAllocs[MALLOC_CLASSES];   /* objects allocated so far */
+};
+
+void malloc_get_stats(struct MallocStats *ms);
+
 BOOL signal_pid(ULONG pid, ULONG sigmask);
 BOOL find_pid(ULONG pid);
 
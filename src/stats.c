@@ -0,0 +1,168 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include "sshterm.h"
+#include "stats.h"
+
+#include <exec/exectags.h>
+
+static struct Stat Stats[NUM_STATS];
+
+static const char *const StatNames[NUM_STATS] = {
+	"Transport read",
+	"Transport send",
+	"Decrypt",
+	"Inflate",
+	"Deflate",
+	"Network loop",
+	"VTE input",
+	"Screen draw",
+	"Render",
+	"Terminal loop"
+};
+
+/* Stages reported by libssh2, indexed by LIBSSH2_STAGE_* */
+static const UBYTE SessionStages[] = {
+	STAT_TRANSPORT_READ,
+	STAT_TRANSPORT_SEND,
+	STAT_DECRYPT,
+	STAT_INFLATE,
+	STAT_DEFLATE
+};
+
+static UQUAD SessionStart[sizeof(SessionStages)];
+
+static UQUAD TimeBaseSpeed;
+
+static UQUAD GlyphHits;
+static UQUAD GlyphMisses;
+
+static ULONG stats_bucket(UQUAD ticks)
+{
+	ULONG e, i;
+
+	if (ticks < 4)
+		return ticks;
+
+	e = 63 - __builtin_clzll(ticks);
+	i = 4 * (e - 1) + ((ticks >> (e - 2)) & 3);
+
+	return i < STATS_BUCKETS ? i : STATS_BUCKETS - 1;
+}
+
+static UQUAD stats_bucket_ticks(ULONG i)
+{
+	if (i < 4)
+		return i;
+
+	return (UQUAD)(4 + (i & 3)) << (i / 4 - 1);
+}
+
+void stats_add(ULONG stage, UQUAD start, ULONG bytes)
+{
+	struct Stat *st = &Stats[stage];
+	UQUAD ticks = stats_ticks() - start;
+
+	st->st_Calls++;
+	st->st_Bytes += bytes;
+	st->st_Ticks += ticks;
+	st->st_Hist[stats_bucket(ticks)]++;
+}
+
+void stats_get(ULONG stage, struct Stat *st)
+{
+	memcpy(st, &Stats[stage], sizeof(*st));
+}
+
+const char *stats_name(ULONG stage)
+{
+	return StatNames[stage];
+}
+
+/* Returns the lower bound of the bucket holding the given percentile */
+UQUAD stats_percentile(const struct Stat *st, ULONG percent)
+{
+	UQUAD total = 0, limit, count = 0;
+	ULONG i;
+
+	for (i = 0; i < STATS_BUCKETS; i++)
+		total += st->st_Hist[i];
+
+	if (total == 0)
+		return 0;
+
+	limit = (total * percent + 99) / 100;
+
+	for (i = 0; i < STATS_BUCKETS; i++)
+	{
+		count += st->st_Hist[i];
+		if (count >= limit)
+			break;
+	}
+
+	return stats_bucket_ticks(i < STATS_BUCKETS ? i : STATS_BUCKETS - 1);
+}
+
+UQUAD stats_ticks_to_us(UQUAD ticks)
+{
+	if (TimeBaseSpeed == 0)
+	{
+		IExec->GetCPUInfoTags(
+			GCIT_TimeBaseSpeed, &TimeBaseSpeed,
+			TAG_END);
+	}
+
+	if (TimeBaseSpeed < 1000000)
+		return 0;
+
+	return ticks / (TimeBaseSpeed / 1000000);
+}
+
+static LIBSSH2_STAGE_FUNC(stats_stage_cb)
+{
+	if (stage < 0 || stage >= (int)sizeof(SessionStages))
+		return;
+
+	if (end)
+		stats_add(SessionStages[stage], SessionStart[stage], bytes);
+	else
+		SessionStart[stage] = stats_ticks();
+}
+
+void stats_hook_session(LIBSSH2_SESSION *session)
+{
+	/* Only called if libssh2 was not built with STATS=0 */
+	libssh2_session_callback_set(session, LIBSSH2_CALLBACK_STAGE, stats_stage_cb);
+}
+
+/* Glyph cache lookups, added up over all the caches the terminal has used */
+void stats_add_glyphs(ULONG hits, ULONG misses)
+{
+	GlyphHits   += hits;
+	GlyphMisses += misses;
+}
+
+void stats_get_glyphs(UQUAD *hits, UQUAD *misses)
+{
+	*hits   = GlyphHits;
+	*misses = GlyphMisses;
+}
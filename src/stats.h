@@ -0,0 +1,111 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <exec/types.h>
+#include <intuition/screens.h>
+#include <libssh2.h>
+
+/* Per-stage instrumentation.
+ *
+ * Unless built with STATS=0 (ENABLE_STATS defined) each stage counts its calls,
+ * the bytes it processed and the time spent in it, measured in ticks of the
+ * PowerPC time base, and sorts every call into a histogram from which the
+ * median and 99th percentile are taken. A stage is only ever updated by one
+ * process (the SSH stages and the network loop by the main process, the
+ * terminal stages by the terminal process) so no locking is needed. Readers
+ * may catch a stage in the middle of an update, which is good enough for
+ * display. Without ENABLE_STATS the macros below expand to nothing.
+ */
+
+enum {
+	STAT_TRANSPORT_READ,
+	STAT_TRANSPORT_SEND,
+	STAT_DECRYPT,
+	STAT_INFLATE,
+	STAT_DEFLATE,
+	STAT_NET_LOOP,
+	STAT_VTE_INPUT,
+	STAT_SCREEN_DRAW,
+	STAT_RENDER,
+	STAT_TERM_LOOP,
+	NUM_STATS
+};
+
+/* Histogram buckets are powers of two split into four steps each, so a
+ * percentile is at most 25% below the real value. */
+#define STATS_BUCKETS 128
+
+struct Stat {
+	UQUAD st_Calls;
+	UQUAD st_Bytes;
+	UQUAD st_Ticks;
+	ULONG st_Hist[STATS_BUCKETS];
+};
+
+#ifdef ENABLE_STATS
+
+static inline UQUAD stats_ticks(void)
+{
+	ULONG hi, lo, tmp;
+
+	/* Read the upper half again in case the lower half wrapped around */
+	__asm__ volatile (
+		"1:	mftbu %0\n"
+		"	mftb  %1\n"
+		"	mftbu %2\n"
+		"	cmpw  %0,%2\n"
+		"	bne-  1b\n"
+		: "=r" (hi), "=r" (lo), "=r" (tmp)
+		:
+		: "cr0");
+
+	return ((UQUAD)hi << 32) | lo;
+}
+
+void stats_add(ULONG stage, UQUAD start, ULONG bytes);
+void stats_get(ULONG stage, struct Stat *st);
+const char *stats_name(ULONG stage);
+UQUAD stats_percentile(const struct Stat *st, ULONG percent);
+UQUAD stats_ticks_to_us(UQUAD ticks);
+void stats_hook_session(LIBSSH2_SESSION *session);
+void stats_add_glyphs(ULONG hits, ULONG misses);
+void stats_get_glyphs(UQUAD *hits, UQUAD *misses);
+
+extern ULONG StatsWindowPID;
+
+BOOL statswin_open(struct Screen *screen);
+void statswin_close(void);
+
+#define STATS_BEGIN(start) UQUAD start = stats_ticks()
+#define STATS_END(stage, start, bytes) stats_add((stage), (start), (bytes))
+
+#else
+
+#define STATS_BEGIN(start)
+#define STATS_END(stage, start, bytes)
+
+#endif
+
+#endif /* STATS_H */
@@ -0,0 +1,383 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include "sshterm.h"
+#include "stats.h"
+#include "timer.h"
+
+#include <classes/window.h>
+#include <gadgets/layout.h>
+#include <gadgets/button.h>
+
+#define STATS_REFRESH_MS 1000
+#define STATS_ROW_LEN    80
+
+enum {
+	GID_DUMMY,
+	GID_OK
+};
+
+ULONG StatsWindowPID = 0;
+
+static void format_header(STRPTR buffer)
+{
+	snprintf(buffer, STATS_ROW_LEN, "%-14s %10s %10s %8s %8s %8s",
+		"Stage", "Calls", "KB", "Avg us", "p50 us", "p99 us");
+}
+
+static void format_stage(STRPTR buffer, ULONG stage)
+{
+	struct Stat st;
+	UQUAD avg = 0;
+
+	stats_get(stage, &st);
+
+	if (st.st_Calls != 0)
+		avg = st.st_Ticks / st.st_Calls;
+
+	snprintf(buffer, STATS_ROW_LEN, "%-14s %10llu %10llu %8llu %8llu %8llu",
+		stats_name(stage),
+		st.st_Calls,
+		st.st_Bytes >> 10,
+		stats_ticks_to_us(avg),
+		stats_ticks_to_us(stats_percentile(&st, 50)),
+		stats_ticks_to_us(stats_percentile(&st, 99)));
+}
+
+static void format_heap(STRPTR buffer)
+{
+	struct MallocStats ms;
+
+	malloc_get_stats(&ms);
+
+	snprintf(buffer, STATS_ROW_LEN, "%-14s %10lu KB in use, %lu KB peak, %lu slabs",
+		"Heap",
+		(ULONG)(ms.ms_Live >> 10),
+		(ULONG)(ms.ms_Peak >> 10),
+		ms.ms_Slabs);
+}
+
+static void format_glyphs(STRPTR buffer)
+{
+	UQUAD hits, misses, total;
+
+	stats_get_glyphs(&hits, &misses);
+
+	total = hits + misses;
+
+	snprintf(buffer, STATS_ROW_LEN, "%-14s %10llu hits, %llu misses, %lu%% hit rate",
+		"Glyph cache",
+		hits,
+		misses,
+		total != 0 ? (ULONG)(hits * 100 / total) : 0UL);
+}
+
+static LONG statswin_procentry(void)
+{
+	/* Button class keeps a pointer to the text so alternate between two
+	 * sets of buffers instead of changing the active one in place. */
+	TEXT                rows[2][NUM_STATS][STATS_ROW_LEN];
+	TEXT                heap[2][STATS_ROW_LEN];
+	TEXT                glyphs[2][STATS_ROW_LEN];
+	TEXT                header[STATS_ROW_LEN];
+	ULONG               index = 0;
+	struct TextFont    *font;
+	struct TTextAttr   *tta;
+	struct Screen      *screen;
+	struct TimeRequest *timer;
+	Object             *text[NUM_STATS];
+	Object             *heaptext;
+	Object             *glyphtext;
+	Object             *textlayout;
+	Object             *button;
+	Object             *buttonlayout;
+	Object             *layout;
+	Object             *winobj;
+	struct Window      *window;
+	ULONG               sigmask, signals;
+	ULONG               i;
+	BOOL                done;
+
+	screen = (IExec->FindTask(NULL))->tc_UserData;
+
+	/* The default font is fixed width which keeps the columns lined up */
+	font = ((struct GfxBase *)IGraphics->Data.LibBase)->DefaultFont;
+
+	tta = IDiskfont->ObtainTTextAttr(font);
+	if (tta == NULL)
+	{
+		return RETURN_ERROR;
+	}
+
+	timer = timer_open(UNIT_VBLANK);
+	if (timer == NULL)
+	{
+		IDiskfont->FreeTTextAttr(tta);
+		return RETURN_ERROR;
+	}
+
+	format_header(header);
+
+	textlayout = IIntuition->NewObject(LayoutClass, NULL,
+		LAYOUT_Orientation,    LAYOUT_ORIENT_VERT,
+		LAYOUT_SpaceOuter,     TRUE,
+		LAYOUT_BevelStyle,     BVS_FIELD,
+		LAYOUT_AddChild,       IIntuition->NewObject(ButtonClass, NULL,
+			GA_ReadOnly,           TRUE,
+			GA_Text,               header,
+			GA_TextAttr,           tta,
+			BUTTON_BevelStyle,     BVS_NONE,
+			BUTTON_Transparent,    TRUE,
+			BUTTON_Justification,  BCJ_LEFT,
+			TAG_END),
+		TAG_END);
+
+	for (i = 0; i < NUM_STATS; i++)
+	{
+		format_stage(rows[index][i], i);
+
+		text[i] = IIntuition->NewObject(ButtonClass, NULL,
+			GA_ReadOnly,           TRUE,
+			GA_Text,               rows[index][i],
+			GA_TextAttr,           tta,
+			BUTTON_BevelStyle,     BVS_NONE,
+			BUTTON_Transparent,    TRUE,
+			BUTTON_Justification,  BCJ_LEFT,
+			TAG_END);
+
+		IIntuition->SetAttrs(textlayout,
+			LAYOUT_AddChild, text[i],
+			TAG_END);
+	}
+
+	format_heap(heap[index]);
+
+	heaptext = IIntuition->NewObject(ButtonClass, NULL,
+		GA_ReadOnly,           TRUE,
+		GA_Text,               heap[index],
+		GA_TextAttr,           tta,
+		BUTTON_BevelStyle,     BVS_NONE,
+		BUTTON_Transparent,    TRUE,
+		BUTTON_Justification,  BCJ_LEFT,
+		TAG_END);
+
+	format_glyphs(glyphs[index]);
+
+	glyphtext = IIntuition->NewObject(ButtonClass, NULL,
+		GA_ReadOnly,           TRUE,
+		GA_Text,               glyphs[index],
+		GA_TextAttr,           tta,
+		BUTTON_BevelStyle,     BVS_NONE,
+		BUTTON_Transparent,    TRUE,
+		BUTTON_Justification,  BCJ_LEFT,
+		TAG_END);
+
+	IIntuition->SetAttrs(textlayout,
+		LAYOUT_AddChild, heaptext,
+		LAYOUT_AddChild, glyphtext,
+		TAG_END);
+
+	button = IIntuition->NewObject(ButtonClass, NULL,
+		GA_ID,                 GID_OK,
+		GA_RelVerify,          TRUE,
+		GA_Text,               "OK",
+		BUTTON_Justification,  BCJ_CENTER,
+		TAG_END);
+
+	buttonlayout = IIntuition->NewObject(LayoutClass, NULL,
+		LAYOUT_HorizAlignment, LALIGN_CENTER,
+		LAYOUT_AddChild,       button,
+		CHILD_WeightedWidth,   0,
+		TAG_END);
+
+	layout = IIntuition->NewObject(LayoutClass, NULL,
+		LAYOUT_Orientation,    LAYOUT_ORIENT_VERT,
+		LAYOUT_AddChild,       textlayout,
+		LAYOUT_AddChild,       buttonlayout,
+		CHILD_WeightedHeight,  0,
+		TAG_END);
+
+	winobj = IIntuition->NewObject(WindowClass, NULL,
+		WA_Title,         "Statistics - SSHTerm",
+		WA_PubScreen,     screen,
+		WA_Activate,      TRUE,
+		WA_CloseGadget,   TRUE,
+		WA_DragBar,       TRUE,
+		WA_DepthGadget,   TRUE,
+		WA_NoCareRefresh, TRUE,
+		WA_IDCMP,         IDCMP_CLOSEWINDOW | IDCMP_GADGETUP,
+		WINDOW_Position,  WPOS_CENTERSCREEN,
+		WINDOW_Layout,    layout,
+		TAG_END);
+	if (winobj == NULL)
+	{
+		timer_close(timer);
+		IDiskfont->FreeTTextAttr(tta);
+		return RETURN_ERROR;
+	}
+
+	window = (struct Window *)IIntuition->IDoMethod(winobj, WM_OPEN, NULL);
+	if (window == NULL)
+	{
+		IIntuition->DisposeObject(winobj);
+		timer_close(timer);
+		IDiskfont->FreeTTextAttr(tta);
+		return RETURN_ERROR;
+	}
+
+	timer_start(timer, STATS_REFRESH_MS);
+
+	done = FALSE;
+
+	while (!done)
+	{
+		IIntuition->GetAttr(WINDOW_SigMask, winobj, &sigmask);
+		signals = IExec->Wait(sigmask | timer_signal(timer) | SIGBREAKF_CTRL_C | SIGBREAKF_CTRL_F);
+
+		if (signals & SIGBREAKF_CTRL_C)
+			done = TRUE;
+
+		if (signals & SIGBREAKF_CTRL_F)
+		{
+			window = (struct Window *)IIntuition->IDoMethod(winobj, WM_OPEN, NULL);
+			if (window != NULL)
+				IIntuition->ScreenToFront(window->WScreen);
+		}
+
+		if (signals & timer_signal(timer))
+		{
+			timer_end(timer);
+
+			index ^= 1;
+
+			for (i = 0; i < NUM_STATS; i++)
+			{
+				format_stage(rows[index][i], i);
+
+				IIntuition->RefreshSetGadgetAttrs((struct Gadget *)text[i], window, NULL,
+					GA_Text, rows[index][i],
+					TAG_END);
+			}
+
+			format_heap(heap[index]);
+
+			IIntuition->RefreshSetGadgetAttrs((struct Gadget *)heaptext, window, NULL,
+				GA_Text, heap[index],
+				TAG_END);
+
+			format_glyphs(glyphs[index]);
+
+			IIntuition->RefreshSetGadgetAttrs((struct Gadget *)glyphtext, window, NULL,
+				GA_Text, glyphs[index],
+				TAG_END);
+
+			timer_start(timer, STATS_REFRESH_MS);
+		}
+
+		if (signals & sigmask)
+		{
+			ULONG result;
+			UWORD code;
+
+			while ((result = IIntuition->IDoMethod(winobj, WM_HANDLEINPUT, &code)) != WMHI_LASTMSG)
+			{
+				switch (result & WMHI_CLASSMASK)
+				{
+					case WMHI_GADGETUP:
+						if ((result & WMHI_GADGETMASK) == GID_OK)
+							done = TRUE;
+						break;
+
+					case WMHI_CLOSEWINDOW:
+						done = TRUE;
+						break;
+				}
+			}
+		}
+	}
+
+	timer_abort(timer);
+	timer_close(timer);
+
+	IIntuition->DisposeObject(winobj);
+	IDiskfont->FreeTTextAttr(tta);
+
+	return RETURN_OK;
+}
+
+BOOL statswin_open(struct Screen *screen)
+{
+	ULONG pid;
+	struct Process *proc;
+
+	pid = StatsWindowPID;
+	if (pid != 0)
+	{
+		/* Try to signal statistics window process */
+		if (signal_pid(pid, SIGBREAKF_CTRL_F))
+			return TRUE;
+
+		/* Statistics window process must have quit */
+		StatsWindowPID = 0;
+	}
+
+	if (screen == NULL)
+		return FALSE;
+
+	proc = IDOS->CreateNewProcTags(
+		NP_Name,                   "SSHTerm:Statistics",
+		NP_Entry,                  statswin_procentry,
+		NP_Priority,               0,
+		NP_Child,                  TRUE,
+		NP_UserData,               screen,
+		NP_CurrentDir,             ZERO,
+		NP_Path,                   ZERO,
+		NP_CopyVars,               FALSE,
+		NP_Input,                  ZERO,
+		NP_Output,                 ZERO,
+		NP_Error,                  ZERO,
+		NP_CloseInput,             FALSE,
+		NP_CloseOutput,            FALSE,
+		NP_CloseError,             FALSE,
+		NP_NotifyOnDeathSigTask,   NULL,
+		NP_NotifyOnDeathSignalBit, SIGB_CHILD,
+		TAG_END);
+	if (proc == NULL)
+		return FALSE;
+
+	/* IoErr() returns PID on CreateNewProc() success */
+	StatsWindowPID = IDOS->IoErr();
+
+	return TRUE;
+}
+
+void statswin_close(void)
+{
+	ULONG pid;
+
+	pid = StatsWindowPID;
+	if (pid != 0)
+	{
+		if (!signal_pid(pid, SIGBREAKF_CTRL_C))
+			StatsWindowPID = 0;
+	}
+}
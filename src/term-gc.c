@@ -21,6 +21,9 @@
 
 #include "sshterm.h"
 #include "term-gc.h"
+#include "glyphcache.h"
+#include "charmap.h"
+#include "stats.h"
 
 #include <intuition/gadgetclass.h>
 #include <intuition/icclass.h>
@@ -33,6 +36,7 @@
 #include <libtsm.h>
 #include <libtsm-int.h>
 #include <stdlib.h>
+#include <sys/time.h>
 #include <wchar.h>
 #include <stdarg.h>
 
@@ -55,12 +59,17 @@
 
 #define CHARSET_UTF8 106
 
+/* Glyph atlas layout, in cells */
+#define GLYPH_ATLAS_COLUMNS 32
+#define GLYPH_ATLAS_ROWS    16
+
 struct TermData
 {
 	Object            *td_Object;
 
 	struct tsm_screen *td_Con;
 	struct tsm_vte    *td_VTE;
+	struct tsm_predict *td_Predict; /* NULL unless TERM_Predict is set */
 
 	UWORD              td_Columns;
 	UWORD              td_Rows;
@@ -72,6 +81,7 @@ struct TermData
 
 	ULONG              td_CharSet;
 	const ULONG       *td_MapTable;
+	struct CharMap    *td_CharMap;
 
 	struct IBox        td_IBox;
 	UWORD              td_Width;
@@ -101,14 +111,32 @@ struct TermData
 	UWORD              td_MaxY;
 
 	#ifdef OFFSCREEN_BUFFER
-	struct Layer_Info *td_TmpLayerInfo;
-	struct Layer      *td_TmpLayer;
-	struct RastPort    td_TmpRP;
-	struct Screen     *td_TmpScreen;
-	ULONG              td_TmpSize;
+	struct Layer_Info *td_BufLayerInfo;
+	struct Layer      *td_BufLayer;
+	struct RastPort    td_BufRP;
+	struct Screen     *td_BufScreen;
+	UWORD              td_BufWidth;
+	UWORD              td_BufHeight;
+	UWORD              td_BufRows;
+	UWORD             *td_DirtyMin; /* first and last changed column per row */
+	UWORD             *td_DirtyMax;
 	#endif
 
+	struct GlyphCache *td_GlyphCache;
+	struct BitMap     *td_GlyphAtlas;
+	struct BitMap     *td_GlyphScratch;
+	struct RastPort    td_GlyphRP;
+	struct TextFont   *td_GlyphFont;
+
+	BOOL               td_SyncDeferred;
+
 	struct Screen     *td_Screen;
+
+	#ifdef ENABLE_STATS
+	ULONG              td_DrawnCells;
+	uint32_t           td_GlyphHits;   /* already passed on to stats */
+	uint32_t           td_GlyphMisses;
+	#endif
 };
 
 enum {
@@ -189,7 +217,13 @@ static ULONG TERM_dispatch(Class *cl, Object *obj, Msg msg)
 			break;
 
 		case GM_RENDER:
-			result = TERM_render(cl, obj, (struct gpRender *)msg);
+			{
+				STATS_BEGIN(start);
+
+				result = TERM_render(cl, obj, (struct gpRender *)msg);
+
+				STATS_END(STAT_RENDER, start, 0);
+			}
 			break;
 
 		case GM_HITTEST:
@@ -292,30 +326,7 @@ static void tsm_bell_cb(struct tsm_vte *vte, void *data)
 	call_hook(td, &thm);
 }
 
-static TEXT map_unicode(const ULONG *maptable, ULONG unicode)
-{
-	TEXT ch = '?';
-
-	if (unicode >= 128)
-	{
-		ULONG i;
-
-		for (i = 128; i < 256; i++)
-		{
-			if (maptable[i] == unicode)
-			{
-				ch = (TEXT)i;
-				break;
-			}
-		}
-	}
-	else
-		ch = (TEXT)unicode;
-
-	return ch;
-}
-
-static ULONG convert_from_utf8(STRPTR dst, CONST_STRPTR src, ULONG srclen, const ULONG *maptable)
+static ULONG convert_from_utf8(STRPTR dst, CONST_STRPTR src, ULONG srclen, const struct CharMap *charmap)
 {
 	struct tsm_utf8_mach mach;
 	ULONG i, j;
@@ -330,14 +341,14 @@ static ULONG convert_from_utf8(STRPTR dst, CONST_STRPTR src, ULONG srclen, const
 		if (state == TSM_UTF8_ACCEPT || state == TSM_UTF8_REJECT)
 		{
 			ucs4 = tsm_utf8_mach_get(&mach);
-			dst[j++] = map_unicode(maptable, ucs4);
+			dst[j++] = charmap_lookup(charmap, ucs4);
 		}
 	}
 
 	if (state >= TSM_UTF8_EXPECT1)
 	{
 		ucs4 = tsm_utf8_mach_get(&mach);
-		dst[j++] = map_unicode(maptable, ucs4);
+		dst[j++] = charmap_lookup(charmap, ucs4);
 	}
 
 	return j;
@@ -351,7 +362,7 @@ static void tsm_osc_cb(struct tsm_vte *vte, const char *u8, size_t len, void *da
 
 	if (u8[0] == '2' && u8[1] == ';')
 	{
-		convert_from_utf8(buffer, u8 + 2, len - 2, td->td_MapTable);
+		convert_from_utf8(buffer, u8 + 2, len - 2, td->td_CharMap);
 
 		thm.MethodID = THM_WINDOWTITLE;
 		thm.twthm_Title = buffer;
@@ -360,6 +371,223 @@ static void tsm_osc_cb(struct tsm_vte *vte, const char *u8, size_t len, void *da
 	}
 }
 
+#ifdef ENABLE_STATS
+/* Passes the lookups made since the last call on to the Statistics window */
+static void report_glyph_stats(struct TermData *td)
+{
+	uint32_t hits, misses;
+
+	if (td->td_GlyphCache == NULL)
+		return;
+
+	glyphcache_stats(td->td_GlyphCache, &hits, &misses);
+	stats_add_glyphs(hits - td->td_GlyphHits, misses - td->td_GlyphMisses);
+
+	td->td_GlyphHits   = hits;
+	td->td_GlyphMisses = misses;
+}
+#endif
+
+static void free_glyph_atlas(struct TermData *td)
+{
+	if (td->td_GlyphCache != NULL)
+	{
+		#ifdef ENABLE_STATS
+		report_glyph_stats(td);
+		td->td_GlyphHits   = 0;
+		td->td_GlyphMisses = 0;
+		#endif
+
+		glyphcache_free(td->td_GlyphCache);
+		td->td_GlyphCache = NULL;
+	}
+
+	if (td->td_GlyphAtlas != NULL)
+	{
+		IGraphics->FreeBitMap(td->td_GlyphAtlas);
+		td->td_GlyphAtlas = NULL;
+	}
+
+	if (td->td_GlyphScratch != NULL)
+	{
+		IGraphics->FreeBitMap(td->td_GlyphScratch);
+		td->td_GlyphScratch = NULL;
+	}
+
+	td->td_GlyphFont = NULL;
+}
+
+static BOOL font_is_antialiased(struct TextFont *font)
+{
+	struct TextFontExtension *tfe;
+
+	if (!IGraphics->ExtendFont(font, NULL))
+		return FALSE;
+
+	tfe = (struct TextFontExtension *)font->tf_Extension;
+
+	return (tfe->tfe_Flags1 & TE1F_ANTIALIAS) != 0;
+}
+
+/* The atlas holds single plane masks of the glyphs drawn so far, one per
+ * cell sized slot, which are then drawn in the wanted colour with
+ * BltTemplate(). It is thrown away whenever the font changes. A mask would
+ * lose the edges of anti-aliased glyphs, so these are always drawn with
+ * Text(). */
+static BOOL alloc_glyph_atlas(struct TermData *td)
+{
+	UWORD cellw = td->td_CellW;
+	UWORD cellh = td->td_CellH;
+
+	if (td->td_GlyphCache != NULL && td->td_GlyphFont == td->td_Font)
+		return TRUE;
+
+	free_glyph_atlas(td);
+
+	if (font_is_antialiased(td->td_Font))
+		return FALSE;
+
+	td->td_GlyphCache = glyphcache_new(GLYPH_ATLAS_COLUMNS * GLYPH_ATLAS_ROWS);
+
+	td->td_GlyphAtlas = IGraphics->AllocBitMap(GLYPH_ATLAS_COLUMNS * cellw,
+		GLYPH_ATLAS_ROWS * cellh, 1, BMF_CLEAR, NULL);
+
+	/* Glyphs are drawn here first so that anything sticking out of the cell
+	 * (bold smear, italic overhang) is not copied into the neighbouring
+	 * slots. */
+	td->td_GlyphScratch = IGraphics->AllocBitMap(2 * cellw, cellh, 1, BMF_CLEAR, NULL);
+
+	if (td->td_GlyphCache == NULL || td->td_GlyphAtlas == NULL || td->td_GlyphScratch == NULL)
+	{
+		free_glyph_atlas(td);
+		return FALSE;
+	}
+
+	IGraphics->InitRastPort(&td->td_GlyphRP);
+	td->td_GlyphRP.BitMap = td->td_GlyphScratch;
+
+	IGraphics->SetFont(&td->td_GlyphRP, td->td_Font);
+	IGraphics->SetDrMd(&td->td_GlyphRP, JAM1);
+
+	td->td_GlyphFont = td->td_Font;
+
+	return TRUE;
+}
+
+#ifdef OFFSCREEN_BUFFER
+static void free_back_buffer(struct TermData *td)
+{
+	if (td->td_BufRP.BitMap != NULL)
+	{
+		ILayers->DeleteLayer(0, td->td_BufLayer);
+		ILayers->DisposeLayerInfo(td->td_BufLayerInfo);
+		IGraphics->FreeBitMap(td->td_BufRP.BitMap);
+
+		td->td_BufLayer = NULL;
+		td->td_BufLayerInfo = NULL;
+		td->td_BufRP.BitMap = NULL;
+	}
+
+	if (td->td_DirtyMin != NULL)
+	{
+		free(td->td_DirtyMin);
+		td->td_DirtyMin = NULL;
+		td->td_DirtyMax = NULL;
+	}
+}
+
+/* The back buffer holds the whole terminal area. Cells are drawn into it
+ * and only the parts that changed are copied to the window, so the window
+ * can be refreshed from it without redrawing any cells. */
+static BOOL alloc_back_buffer(struct TermData *td, struct Screen *screen)
+{
+	UWORD width  = td->td_Columns * td->td_CellW;
+	UWORD height = td->td_Rows * td->td_CellH;
+	UWORD rows   = td->td_Rows;
+	struct BitMap *bitmap;
+	struct Layer_Info *li;
+	struct Layer *layer;
+	UWORD *dirty;
+	UWORD i;
+
+	if (td->td_BufRP.BitMap != NULL &&
+		td->td_BufScreen == screen &&
+		td->td_BufWidth == width &&
+		td->td_BufHeight == height &&
+		td->td_BufRows == rows)
+	{
+		return TRUE;
+	}
+
+	free_back_buffer(td);
+
+	const struct TagItem bmtags[] =
+	{
+		{ BMATags_Friend,      (ULONG)screen->RastPort.BitMap },
+		{ BMATags_UserPrivate, TRUE                           },
+		{ TAG_END,             0                              }
+	};
+
+	if (LIB_IS_AT_LEAST(IGraphics->Data.LibBase, 53, 7))
+		bitmap = IGraphics->AllocBitMapTagList(width, height, 24, bmtags);
+	else
+		bitmap = IGraphics->AllocBitMap(width, height, 24, BMF_CHECKVALUE, (struct BitMap *)bmtags);
+
+	if (bitmap == NULL)
+		return FALSE;
+
+	li = ILayers->NewLayerInfo();
+	if (li == NULL)
+	{
+		IGraphics->FreeBitMap(bitmap);
+		return FALSE;
+	}
+
+	layer = ILayers->CreateUpfrontHookLayer(li, bitmap, 0, 0, width - 1, height - 1,
+	                                        0, LAYERS_NOBACKFILL, NULL);
+	if (layer == NULL)
+	{
+		ILayers->DisposeLayerInfo(li);
+		IGraphics->FreeBitMap(bitmap);
+		return FALSE;
+	}
+
+	dirty = malloc(2 * rows * sizeof(UWORD));
+	if (dirty == NULL)
+	{
+		ILayers->DeleteLayer(0, layer);
+		ILayers->DisposeLayerInfo(li);
+		IGraphics->FreeBitMap(bitmap);
+		return FALSE;
+	}
+
+	td->td_BufLayerInfo = li;
+	td->td_BufLayer = layer;
+
+	IGraphics->InitRastPort(&td->td_BufRP);
+	td->td_BufRP.BitMap = bitmap;
+
+	td->td_BufScreen = screen;
+	td->td_BufWidth  = width;
+	td->td_BufHeight = height;
+	td->td_BufRows   = rows;
+
+	td->td_DirtyMin = dirty;
+	td->td_DirtyMax = dirty + rows;
+
+	for (i = 0; i < rows; i++)
+	{
+		td->td_DirtyMin[i] = 0xffff;
+		td->td_DirtyMax[i] = 0;
+	}
+
+	/* Nothing has been drawn into it yet */
+	td->td_Age = 0;
+
+	return TRUE;
+}
+#endif
+
 static ULONG TERM_new(Class *cl, Object *obj, struct opSet *ops)
 {
 	obj = (Object *)IIntuition->IDoSuperMethodA(cl, obj, (Msg)ops);
@@ -406,6 +634,13 @@ static ULONG TERM_new(Class *cl, Object *obj, struct opSet *ops)
 			return (ULONG)NULL;
 		}
 
+		td->td_CharMap = charmap_new((const uint32_t *)td->td_MapTable);
+		if (td->td_CharMap == NULL)
+		{
+			IIntuition->ICoerceMethod(cl, obj, OM_DISPOSE);
+			return (ULONG)NULL;
+		}
+
 		td->td_MaxSB     = 0;
 		td->td_SBTop     = 0;
 		td->td_SBVisible = td->td_Rows;
@@ -413,6 +648,16 @@ static ULONG TERM_new(Class *cl, Object *obj, struct opSet *ops)
 
 		TERM_set(cl, obj, ops);
 
+		if (IUtility->GetTagData(TERM_Predict, FALSE, ops->ops_AttrList))
+		{
+			rc = tsm_predict_new(&td->td_Predict, td->td_Con, &tsm_log_cb, td);
+			if (rc < 0)
+			{
+				IIntuition->ICoerceMethod(cl, obj, OM_DISPOSE);
+				return (ULONG)NULL;
+			}
+		}
+
 		tsm_vte_set_bell_cb(td->td_VTE, tsm_bell_cb, td);
 		tsm_vte_set_osc_cb(td->td_VTE, tsm_osc_cb, td);
 	}
@@ -426,17 +671,22 @@ static ULONG TERM_dispose(Class *cl, Object *obj, Msg msg)
 	ULONG result;
 
 	#ifdef OFFSCREEN_BUFFER
-	if (td->td_TmpRP.BitMap != NULL)
+	free_back_buffer(td);
+	#endif
+
+	free_glyph_atlas(td);
+
+	if (td->td_CharMap != NULL)
 	{
-		ILayers->DeleteLayer(0, td->td_TmpLayer);
-		ILayers->DisposeLayerInfo(td->td_TmpLayerInfo);
-		IGraphics->FreeBitMap(td->td_TmpRP.BitMap);
+		charmap_free(td->td_CharMap);
+		td->td_CharMap = NULL;
+	}
 
-		td->td_TmpLayer = NULL;
-		td->td_TmpLayerInfo = NULL;
-		td->td_TmpRP.BitMap = NULL;
+	if (td->td_Predict != NULL)
+	{
+		tsm_predict_unref(td->td_Predict);
+		td->td_Predict = NULL;
 	}
-	#endif
 
 	if (td->td_VTE != NULL)
 	{
@@ -498,6 +748,11 @@ static ULONG TERM_get(Class *cl, Object *obj, struct opGet *opg)
 			*opg->opg_Storage = td->td_SBTotal;
 			break;
 
+		case TERM_Blinking:
+			*opg->opg_Storage = td->td_SyncDeferred || tsm_screen_has_blink(td->td_Con) ||
+			                    tsm_predict_pending(td->td_Predict);
+			break;
+
 		default:
 			result = IIntuition->IDoSuperMethodA(cl, obj, (Msg)opg);
 			break;
@@ -758,6 +1013,95 @@ static ULONG TERM_layout(Class *cl, Object *obj, struct gpLayout *gpl)
 	return 1;
 }
 
+static void draw_glyph(struct TermData *td, struct RastPort *rp, UWORD x, UWORD y,
+	uint32_t ch, ULONG style)
+{
+	struct RastPort *grp = &td->td_GlyphRP;
+	struct BitMap *atlas = td->td_GlyphAtlas;
+	UWORD cellw = td->td_CellW;
+	UWORD cellh = td->td_CellH;
+	uint32_t key, slot;
+	UWORD sx, sy;
+	BOOL hit;
+	TEXT tmp[1];
+
+	key = GLYPHCACHE_KEY(ch,
+		((style & FSF_BOLD) ? GLYPHCACHE_BOLD : 0) |
+		((style & FSF_UNDERLINED) ? GLYPHCACHE_UNDERLINE : 0));
+
+	hit = glyphcache_lookup(td->td_GlyphCache, key, &slot);
+
+	sx = (slot % GLYPH_ATLAS_COLUMNS) * cellw;
+	sy = (slot / GLYPH_ATLAS_COLUMNS) * cellh;
+
+	if (!hit)
+	{
+		IGraphics->SetAPen(grp, 0);
+		IGraphics->RectFill(grp, 0, 0, 2 * cellw - 1, cellh - 1);
+
+		IGraphics->SetAPen(grp, 1);
+		IGraphics->SetSoftStyle(grp, style & IGraphics->AskSoftStyle(grp), FSF_BOLD);
+
+		IGraphics->Move(grp, 0, td->td_Baseline);
+
+		tmp[0] = charmap_lookup(td->td_CharMap, ch);
+
+		IGraphics->Text(grp, tmp, 1);
+
+		if ((style & FSF_UNDERLINED) && (cellh > (td->td_Baseline + 1)))
+		{
+			IGraphics->Move(grp, 0, td->td_Baseline + 1);
+			IGraphics->Draw(grp, cellw - 1, td->td_Baseline + 1);
+		}
+
+		IGraphics->BltBitMap(td->td_GlyphScratch, 0, 0, atlas, sx, sy,
+			cellw, cellh, 0xc0, 0x01, NULL);
+	}
+
+	IGraphics->BltTemplate(atlas->Planes[0] + sy * atlas->BytesPerRow, sx,
+		atlas->BytesPerRow, rp, x, y, cellw, cellh);
+}
+
+/* Used when there is no glyph atlas */
+static void draw_text(struct TermData *td, struct RastPort *rp, UWORD x, UWORD y,
+	uint32_t ch, ULONG style)
+{
+	TEXT tmp[1];
+
+	style &= IGraphics->AskSoftStyle(rp);
+
+	/* Algorithmic underline is handled manually in code below */
+	IGraphics->SetSoftStyle(rp, style, FSF_BOLD);
+
+	IGraphics->Move(rp, x, y + td->td_Baseline);
+
+	tmp[0] = charmap_lookup(td->td_CharMap, ch);
+
+	#ifdef OFFSCREEN_BUFFER
+	if (rp == &td->td_BufRP)
+	{
+		/* Enable clipping */
+		rp->Layer = td->td_BufLayer;
+	}
+	#endif
+
+	IGraphics->Text(rp, tmp, 1);
+
+	#ifdef OFFSCREEN_BUFFER
+	if (rp == &td->td_BufRP)
+	{
+		/* Disable clipping */
+		rp->Layer = NULL;
+	}
+	#endif
+
+	if ((style & FSF_UNDERLINED) && (td->td_CellH > (td->td_Baseline + 1)))
+	{
+		IGraphics->Move(rp, x, y + td->td_Baseline + 1);
+		IGraphics->Draw(rp, x + td->td_CellW - 1, y + td->td_Baseline + 1);
+	}
+}
+
 static int tsm_draw_cb(struct tsm_screen *con, const uint32_t *ch,
                        size_t len, unsigned int width,
                        unsigned int posx, unsigned int posy,
@@ -770,7 +1114,6 @@ static int tsm_draw_cb(struct tsm_screen *con, const uint32_t *ch,
 	UWORD cellw, cellh;
 	UWORD x, y;
 	ULONG style;
-	TEXT tmp[1];
 
 	if (age != 0 && age <= td->td_Age)
 		return 0;
@@ -778,6 +1121,10 @@ static int tsm_draw_cb(struct tsm_screen *con, const uint32_t *ch,
 	if (posy < td->td_MinY || posy > td->td_MaxY)
 		return 0;
 
+	#ifdef ENABLE_STATS
+	td->td_DrawnCells++;
+	#endif
+
 	cellw = td->td_CellW;
 	cellh = td->td_CellH;
 
@@ -785,10 +1132,16 @@ static int tsm_draw_cb(struct tsm_screen *con, const uint32_t *ch,
 		len = 0;
 
 	#ifdef OFFSCREEN_BUFFER
-	if (len && td->td_TmpRP.BitMap != NULL)
+	if (td->td_BufRP.BitMap != NULL)
 	{
-		rp = &td->td_TmpRP;
-		x = y = 0;
+		rp = &td->td_BufRP;
+		x = posx * cellw;
+		y = posy * cellh;
+
+		if (posx < td->td_DirtyMin[posy])
+			td->td_DirtyMin[posy] = posx;
+		if (posx > td->td_DirtyMax[posy])
+			td->td_DirtyMax[posy] = posx;
 	}
 	else
 	#endif
@@ -829,59 +1182,15 @@ static int tsm_draw_cb(struct tsm_screen *con, const uint32_t *ch,
 			style |= FSF_UNDERLINED;
 		}
 
-		style &= IGraphics->AskSoftStyle(rp);
-
-		/* Algorithmic underline is handled manually in code below */
-		IGraphics->SetSoftStyle(rp, style, FSF_BOLD);
-
 		IGraphics->SetRPAttrs(rp,
 			RPTAG_APenColor, f_argb,
 			TAG_END);
 
-		IGraphics->Move(rp, x, y + td->td_Baseline);
-
-		tmp[0] = map_unicode(td->td_MapTable, ch[0]);
-
-		#ifdef OFFSCREEN_BUFFER
-		if (rp == &td->td_TmpRP)
-		{
-			/* Enable clipping */
-			rp->Layer = td->td_TmpLayer;
-		}
-		#endif
-
-		IGraphics->Text(rp, tmp, 1);
-
-		#ifdef OFFSCREEN_BUFFER
-		if (rp == &td->td_TmpRP)
-		{
-			/* Disable clipping */
-			rp->Layer = NULL;
-		}
-		#endif
-
-		if ((style & FSF_UNDERLINED) && (cellh > (td->td_Baseline + 1)))
-		{
-			IGraphics->Move(rp, x, y + td->td_Baseline + 1);
-			IGraphics->Draw(rp, x + cellw - 1, y + td->td_Baseline + 1);
-		}
-	}
-
-	#ifdef OFFSCREEN_BUFFER
-	if (rp == &td->td_TmpRP)
-	{
-		IGraphics->BltBitMapTags(
-			BLITA_SrcType,  BLITT_BITMAP,
-			BLITA_Source,   td->td_TmpRP.BitMap,
-			BLITA_DestType, BLITT_RASTPORT,
-			BLITA_Dest,     td->td_RPort,
-			BLITA_DestX,    td->td_IBox.Left + posx * cellw,
-			BLITA_DestY,    td->td_IBox.Top + posy * cellh,
-			BLITA_Width,    cellw,
-			BLITA_Height,   cellh,
-			TAG_END);
+		if (td->td_GlyphCache != NULL)
+			draw_glyph(td, rp, x, y, ch[0], style);
+		else
+			draw_text(td, rp, x, y, ch[0], style);
 	}
-	#endif
 
 	return 0;
 }
@@ -890,11 +1199,15 @@ static void render_cells(struct TermData *td, struct RastPort *rp, UWORD miny, U
 {
 	td->td_RPort = rp;
 
+	/* Falls back to drawing every glyph with Text() if this fails or the font
+	 * is anti-aliased */
+	alloc_glyph_atlas(td);
+
 	#ifdef OFFSCREEN_BUFFER
-	if (td->td_TmpRP.BitMap != NULL)
+	if (td->td_BufRP.BitMap != NULL)
 	{
-		IGraphics->SetDrMd(&td->td_TmpRP, JAM1);
-		IGraphics->SetFont(&td->td_TmpRP, td->td_Font);
+		IGraphics->SetDrMd(&td->td_BufRP, JAM1);
+		IGraphics->SetFont(&td->td_BufRP, td->td_Font);
 	}
 	else
 	#endif
@@ -906,8 +1219,24 @@ static void render_cells(struct TermData *td, struct RastPort *rp, UWORD miny, U
 	td->td_MinY = miny;
 	td->td_MaxY = maxy;
 
+	#ifdef ENABLE_STATS
+	td->td_DrawnCells = 0;
+	#endif
+
+	STATS_BEGIN(start);
+
 	td->td_Age = tsm_screen_draw(td->td_Con, &tsm_draw_cb, td);
 
+	STATS_END(STAT_SCREEN_DRAW, start, td->td_DrawnCells);
+
+	#ifdef ENABLE_STATS
+	report_glyph_stats(td);
+	#endif
+
+	/* Drawn with age 0 on top of the screen contents, the cells are
+	 * invalidated when a prediction goes away. */
+	tsm_predict_draw(td->td_Predict, &tsm_draw_cb, td);
+
 	td->td_RPort = NULL;
 }
 
@@ -944,75 +1273,163 @@ static void fill_margins(struct TermData *td, struct RastPort *rp)
 	}
 }
 
-static ULONG TERM_render(Class *cl, Object *obj, struct gpRender *gpr)
+#ifdef OFFSCREEN_BUFFER
+static void mark_all_dirty(struct TermData *td)
 {
-	struct TermData *td = INST_DATA(cl, obj);
-	struct RastPort *rp = gpr->gpr_RPort;
+	UWORD i;
 
-	#ifdef OFFSCREEN_BUFFER
-	struct Screen *screen = gpr->gpr_GInfo->gi_Screen;
-	ULONG cellw = td->td_CellW;
-	ULONG cellh = td->td_CellH;
-	if (td->td_TmpRP.BitMap == NULL ||
-		td->td_TmpScreen != screen ||
-		td->td_TmpSize != ((cellw << 16) | cellh))
-	{
-		struct BitMap *bitmap;
-		struct Layer_Info *li;
-		struct Layer *layer;
-
-		if (td->td_TmpRP.BitMap != NULL)
-		{
-			ILayers->DeleteLayer(0, td->td_TmpLayer);
-			ILayers->DisposeLayerInfo(td->td_TmpLayerInfo);
-			IGraphics->FreeBitMap(td->td_TmpRP.BitMap);
+	for (i = 0; i < td->td_BufRows; i++)
+	{
+		td->td_DirtyMin[i] = 0;
+		td->td_DirtyMax[i] = td->td_Columns - 1;
+	}
+}
 
-			td->td_TmpLayer = NULL;
-			td->td_TmpLayerInfo = NULL;
-			td->td_TmpRP.BitMap = NULL;
-		}
+/* Copy the changed parts of the back buffer to the window. Consecutive
+ * changed rows are copied together as one rectangle. */
+static void copy_dirty(struct TermData *td, struct RastPort *rp)
+{
+	UWORD cellw = td->td_CellW;
+	UWORD cellh = td->td_CellH;
+	UWORD row, first, minx, maxx;
+	UWORD x, y, w, h;
 
-		const struct TagItem bmtags[] =
+	row = 0;
+	while (row < td->td_BufRows)
+	{
+		if (td->td_DirtyMin[row] > td->td_DirtyMax[row])
 		{
-			{ BMATags_Friend,      (ULONG)screen->RastPort.BitMap },
-			{ BMATags_UserPrivate, TRUE                           },
-			{ TAG_END,             0                              }
-		};
+			row++;
+			continue;
+		}
 
-		if (LIB_IS_AT_LEAST(IGraphics->Data.LibBase, 53, 7))
-			bitmap = IGraphics->AllocBitMapTagList(cellw, cellh, 24, bmtags);
-		else
-			bitmap = IGraphics->AllocBitMap(cellw, cellh, 24, BMF_CHECKVALUE, (struct BitMap *)bmtags);
+		first = row;
+		minx  = 0xffff;
+		maxx  = 0;
 
-		if (bitmap != NULL)
+		while (row < td->td_BufRows && td->td_DirtyMin[row] <= td->td_DirtyMax[row])
 		{
-			li = ILayers->NewLayerInfo();
-			if (li != NULL)
-			{
-				layer = ILayers->CreateUpfrontHookLayer(li, bitmap, 0, 0, cellw - 1, cellh - 1,
-				                                        0, LAYERS_NOBACKFILL, NULL);
-				if (layer != NULL)
-				{
-					td->td_TmpLayerInfo = li;
-					td->td_TmpLayer = layer;
+			if (td->td_DirtyMin[row] < minx)
+				minx = td->td_DirtyMin[row];
+			if (td->td_DirtyMax[row] > maxx)
+				maxx = td->td_DirtyMax[row];
 
-					IGraphics->InitRastPort(&td->td_TmpRP);
-					td->td_TmpRP.BitMap = bitmap;
+			td->td_DirtyMin[row] = 0xffff;
+			td->td_DirtyMax[row] = 0;
 
-					td->td_TmpScreen = screen;
-					td->td_TmpSize = (cellw << 16) | cellh;
-				}
-				else
-				{
-					ILayers->DisposeLayerInfo(li);
-					IGraphics->FreeBitMap(bitmap);
-				}
-			}
+			row++;
+		}
+
+		x = minx * cellw;
+		y = first * cellh;
+		w = (maxx - minx + 1) * cellw;
+		h = (row - first) * cellh;
+
+		/* The gadget may be smaller than the terminal */
+		if (x >= td->td_Width || y >= td->td_Height)
+			continue;
+		if (x + w > td->td_Width)
+			w = td->td_Width - x;
+		if (y + h > td->td_Height)
+			h = td->td_Height - y;
+
+		IGraphics->BltBitMapTags(
+			BLITA_SrcType,  BLITT_BITMAP,
+			BLITA_Source,   td->td_BufRP.BitMap,
+			BLITA_SrcX,     x,
+			BLITA_SrcY,     y,
+			BLITA_DestType, BLITT_RASTPORT,
+			BLITA_Dest,     rp,
+			BLITA_DestX,    td->td_IBox.Left + x,
+			BLITA_DestY,    td->td_IBox.Top + y,
+			BLITA_Width,    w,
+			BLITA_Height,   h,
+			TAG_END);
+	}
+}
+
+static void render_buffered(struct TermData *td, struct RastPort *rp, ULONG redraw)
+{
+	UWORD rows = td->td_Rows;
+
+	if (redraw == GREDRAW_SCROLL)
+	{
+		LONG scroll = td->td_ScrollDelta;
+		UWORD cellh = td->td_CellH;
+
+		td->td_ScrollDelta = 0;
+
+		if (ABS(scroll) >= rows)
+		{
+			td->td_Age = 0;
+			render_cells(td, rp, 0, rows - 1);
+		}
+		else
+		{
+			/* Move the rows that are still visible within the buffer and
+			 * draw the ones that scrolled into view. */
+			IGraphics->BltBitMapTags(
+				BLITA_SrcType,  BLITT_BITMAP,
+				BLITA_Source,   td->td_BufRP.BitMap,
+				BLITA_SrcX,     0,
+				BLITA_SrcY,     scroll > 0 ? scroll * cellh : 0,
+				BLITA_DestType, BLITT_BITMAP,
+				BLITA_Dest,     td->td_BufRP.BitMap,
+				BLITA_DestX,    0,
+				BLITA_DestY,    scroll < 0 ? -scroll * cellh : 0,
+				BLITA_Width,    td->td_BufWidth,
+				BLITA_Height,   (rows - ABS(scroll)) * cellh,
+				TAG_END);
+
+			if (scroll < 0)
+				render_cells(td, rp, 0, 1 - scroll);
 			else
-			{
-				IGraphics->FreeBitMap(bitmap);
-			}
+				render_cells(td, rp, rows - scroll, rows - 1);
 		}
+
+		mark_all_dirty(td);
+	}
+	else
+	{
+		render_cells(td, rp, 0, rows - 1);
+
+		/* The window contents have been lost but the buffer is still good */
+		if (redraw == GREDRAW_REDRAW)
+			mark_all_dirty(td);
+	}
+
+	copy_dirty(td, rp);
+
+	if (redraw != GREDRAW_SCROLL)
+		fill_margins(td, rp);
+}
+#endif
+
+static ULONG TERM_render(Class *cl, Object *obj, struct gpRender *gpr)
+{
+	struct TermData *td = INST_DATA(cl, obj);
+	struct RastPort *rp = gpr->gpr_RPort;
+
+	/* Leave the screen as it is until the application has finished drawing
+	 * its next frame. Damaged areas still have to be redrawn though. */
+	if (gpr->gpr_Redraw == GREDRAW_UPDATE && tsm_vte_synchronized_update(td->td_VTE))
+	{
+		td->td_SyncDeferred = TRUE;
+		return 1;
+	}
+
+	td->td_SyncDeferred = FALSE;
+
+	#ifdef OFFSCREEN_BUFFER
+	if (gpr->gpr_Redraw == GREDRAW_REDRAW && !td->td_Layouted)
+	{
+		IIntuition->ICoerceMethod(cl, obj, GM_LAYOUT, gpr->gpr_GInfo, 1);
+	}
+
+	if (alloc_back_buffer(td, gpr->gpr_GInfo->gi_Screen))
+	{
+		render_buffered(td, rp, gpr->gpr_Redraw);
+		return 1;
 	}
 	#endif
 
@@ -1120,13 +1537,51 @@ static ULONG TERM_handlescroll(Class *cl, Object *obj, struct gpInput *gpi)
 	return result;
 }
 
+/* Milliseconds for the prediction engine, only differences are used */
+static uint64_t predict_time(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/* Classify a key that the VTE has sent for the prediction engine */
+static unsigned int predict_key(const struct InputEvent *ie, ULONG ucs4)
+{
+	if (ie->ie_Qualifier & (IEQUALIFIER_CONTROL | IEQUALIFIER_LALT))
+		return TSM_PREDICT_OTHER;
+
+	switch (ie->ie_Code)
+	{
+		case RAWKEY_BACKSPACE:
+			return TSM_PREDICT_BACKSPACE;
+		case RAWKEY_CRSRLEFT:
+			return TSM_PREDICT_LEFT;
+		case RAWKEY_CRSRRIGHT:
+			return TSM_PREDICT_RIGHT;
+	}
+
+	if (ucs4 != TSM_VTE_INVALID && ucs4 >= 0x20)
+		return TSM_PREDICT_CHAR;
+
+	return TSM_PREDICT_OTHER;
+}
+
 static ULONG TERM_input(Class *cl, Object *obj, struct tpInput *tpi)
 {
 	struct TermData *td = INST_DATA(cl, obj);
 	ULONG top, visible, total;
 
+	STATS_BEGIN(start);
+
 	tsm_vte_input(td->td_VTE, tpi->tpi_Data, tpi->tpi_Length);
 
+	STATS_END(STAT_VTE_INPUT, start, tpi->tpi_Length);
+
+	tsm_predict_update(td->td_Predict, predict_time());
+
 	if (tpi->tpi_GInfo != NULL)
 	{
 		top     = tsm_screen_get_sb_top(td->td_Con);
@@ -1182,6 +1637,15 @@ static ULONG TERM_handlekeyboard(Class *cl, Object *obj, struct tpKeyboard *tpk)
 	if (tsm_vte_handle_keyboard_amiga(td->td_VTE, ie->ie_Code, ie->ie_Qualifier, ucs4))
 	{
 		tsm_screen_sb_reset(td->td_Con);
+
+		if (td->td_Predict != NULL)
+		{
+			tsm_predict_key(td->td_Predict, predict_key(ie, ucs4), ucs4, predict_time());
+
+			if (tpk->tpk_GInfo != NULL)
+				IIntuition->DoRender(obj, tpk->tpk_GInfo, GREDRAW_UPDATE);
+		}
+
 		return 1;
 	}
 
@@ -1304,12 +1768,13 @@ static ULONG TERM_handlemouse(Class *cl, Object *obj, struct tpMouse *tpm)
 	return 0;
 }
 
-static BOOL write_clip(ULONG unit, CONST_STRPTR utf8, ULONG utf8_len)
+static BOOL write_clip(struct TermData *td, ULONG unit, CONST_STRPTR utf8, ULONG utf8_len)
 {
 	struct IFFParseIFace *IIFFParse;
 	struct IFFHandle *iff = NULL;
 	LONG error;
 	ULONG charset;
+	struct CharMap *charmap = NULL;
 	STRPTR text = NULL;
 	ULONG len = 0;
 	BOOL result = FALSE;
@@ -1327,17 +1792,27 @@ static BOOL write_clip(ULONG unit, CONST_STRPTR utf8, ULONG utf8_len)
 
 	if (charset != CHARSET_UTF8)
 	{
-		const ULONG *maptable;
+		const struct CharMap *cm = td->td_CharMap;
 
-		maptable = (const ULONG *)IDiskfont->ObtainCharsetInfo(DFCS_NUMBER, charset, DFCS_MAPTABLE);
-		if (maptable == NULL)
-			goto cleanup;
+		/* Only if the system charset has been changed since we were created */
+		if (charset != td->td_CharSet)
+		{
+			const ULONG *maptable;
+
+			maptable = (const ULONG *)IDiskfont->ObtainCharsetInfo(DFCS_NUMBER, charset, DFCS_MAPTABLE);
+			if (maptable == NULL)
+				goto cleanup;
+
+			cm = charmap = charmap_new((const uint32_t *)maptable);
+			if (charmap == NULL)
+				goto cleanup;
+		}
 
 		text = malloc(utf8_len + 1);
 		if (text == NULL)
 			goto cleanup;
 
-		len = convert_from_utf8(text, utf8, utf8_len, maptable);
+		len = convert_from_utf8(text, utf8, utf8_len, cm);
 	}
 
 	iff = IIFFParse->AllocIFF();
@@ -1417,6 +1892,9 @@ cleanup:
 	if (text != NULL)
 		free(text);
 
+	if (charmap != NULL)
+		charmap_free(charmap);
+
 	if (IIFFParse != NULL)
 		close_interface((struct Interface *)IIFFParse);
 
@@ -1440,7 +1918,7 @@ static ULONG TERM_copy(Class *cl, Object *obj, struct tpGeneric *tpg)
 
 	if (utf8_len >= 0)
 	{
-		result = write_clip(PRIMARY_CLIP, utf8, utf8_len);
+		result = write_clip(td, PRIMARY_CLIP, utf8, utf8_len);
 
 		free(utf8);
 	}
@@ -1650,33 +2128,7 @@ static ULONG TERM_paste(Class *cl, Object *obj, struct tpGeneric *tpg)
 	result = read_clip(PRIMARY_CLIP, &utf8, &utf8_len);
 	if (result)
 	{
-		struct tsm_utf8_mach mach;
-		ULONG i;
-		int state = TSM_UTF8_START;
-		wchar_t ucs4;
-		UWORD code;
-
-		tsm_utf8_mach_init(&mach);
-
-		for (i = 0; i < utf8_len; i++)
-		{
-			state = tsm_utf8_mach_feed(&mach, utf8[i]);
-			if (state == TSM_UTF8_ACCEPT || state == TSM_UTF8_REJECT)
-			{
-				ucs4 = tsm_utf8_mach_get(&mach);
-				code = (ucs4 == '\n') ? RAWKEY_RETURN : 0;
-
-				tsm_vte_handle_keyboard_amiga(td->td_VTE, code, 0, ucs4);
-			}
-		}
-
-		if (state >= TSM_UTF8_EXPECT1)
-		{
-			ucs4 = tsm_utf8_mach_get(&mach);
-			code = (ucs4 == '\n') ? RAWKEY_RETURN : 0;
-
-			tsm_vte_handle_keyboard_amiga(td->td_VTE, code, 0, ucs4);
-		}
+		tsm_vte_paste(td->td_VTE, utf8, utf8_len);
 
 		free(utf8);
 
@@ -1725,6 +2177,18 @@ static ULONG TERM_blink(Class *cl, Object *obj, struct tpGeneric *tpg)
 
 	r = tsm_screen_blink(td->td_Con);
 
+	/* Start from the visible phase when blinking text appears again */
+	if (!r)
+		td->td_BlinkState = 0;
+
+	/* Catches synchronized updates that timed out with no further input */
+	if (td->td_SyncDeferred)
+		r = true;
+
+	/* Expire predictions that the server never confirmed */
+	if (tsm_predict_update(td->td_Predict, predict_time()))
+		r = true;
+
 	if (r && tpg->tpg_GInfo != NULL)
 	{
 		IIntuition->DoRender(obj, tpg->tpg_GInfo, GREDRAW_UPDATE);
@@ -37,6 +37,8 @@
 #define TERM_SBTotal           (TERM_Dummy + 9)
 #define TERM_BuiltInPalette    (TERM_Dummy + 10)
 #define TERM_BackspaceIsDelete (TERM_Dummy + 11)
+#define TERM_Blinking          (TERM_Dummy + 12)
+#define TERM_Predict           (TERM_Dummy + 13)
 
 #define TM_DUMMY           (0x840000)
 #define TM_INPUT           (TM_DUMMY + 1)
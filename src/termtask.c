@@ -0,0 +1,612 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "sshterm.h"
+#include "timer.h"
+#include "record.h"
+#include "stats.h"
+
+#include <shl-spsc.h>
+
+/* The terminal window runs in a process of its own so that parsing and
+ * drawing does not hold up the connection and the other way around.
+ *
+ * The process that calls termtask_start() keeps the socket and the SSH
+ * session, as these may only be used by the process that opened
+ * bsdsocket.library and amissl.library. Channel data is passed to the
+ * terminal process and keyboard data back through two lock-free rings
+ * with one producer and one consumer each. Either side signals the other
+ * after it has added data to a ring or made room in it. The few other
+ * things that are shared (size, title and close request) are protected
+ * by Forbid().
+ */
+
+#define TERMTASK_RING_SIZE 65536
+#define TERMTASK_CHUNK_SIZE 8192 /* hand back room in the input ring in steps of this */
+#define BLINK_DELAY 1000 /* 1 second delay */
+#define RESIZE_DELAY 150 /* wait for the window to stop changing size */
+
+enum {
+	TTS_STARTING,
+	TTS_RUNNING,
+	TTS_FAILED
+};
+
+struct TermTask {
+	struct Task     *NetTask;
+	BYTE             NetSigBit;
+	ULONG            NetSignal;
+	struct Task     *WinTask;
+	ULONG            WinSignal;
+	ULONG            PID;
+	LONG             State;
+	struct Screen   *Screen;
+	ULONG            MaxSB;
+	const char      *WinTitle;
+	BOOL             BSIsDel;
+	BOOL             Predict;
+	ULONG            FrameMS;
+	struct shl_spsc  Input;      /* channel data for the terminal */
+	struct shl_spsc  Output;     /* keyboard data for the channel */
+	char            *Reserved;   /* last termtask_reserve() result */
+	struct Recorder *Recorder;
+	UWORD            Columns;
+	UWORD            Rows;
+	BOOL             NewSize;
+	BOOL             Closed;
+	BOOL             NewTitle;
+	char             Title[256];
+};
+
+static void termtask_signal_net(struct TermTask *tt)
+{
+	IExec->Signal(tt->NetTask, tt->NetSignal);
+}
+
+static void termtask_signal_win(struct TermTask *tt)
+{
+	IExec->Signal(tt->WinTask, tt->WinSignal);
+}
+
+/* Passes channel data to the terminal. Room is handed back to the network
+ * side in chunks so that it can keep reading while the rest is parsed. */
+static BOOL termtask_drain(struct TermTask *tt, struct TermWindow *termwin)
+{
+	struct iovec vec[2];
+	size_t len;
+	BOOL result = FALSE;
+
+	while (shl_spsc_peek(&tt->Input, vec) != 0)
+	{
+		len = vec[0].iov_len;
+		if (len > TERMTASK_CHUNK_SIZE)
+			len = TERMTASK_CHUNK_SIZE;
+
+		termwin_write(termwin, vec[0].iov_base, len);
+		shl_spsc_pull(&tt->Input, len);
+
+		termtask_signal_net(tt);
+
+		result = TRUE;
+	}
+
+	return result;
+}
+
+/* Moves keyboard data to the output ring. Anything that does not fit stays
+ * in the terminal's own buffer until the network side has made room. */
+static void termtask_flush(struct TermTask *tt, struct TermWindow *termwin)
+{
+	LIBSSH2_IOVEC iov[2];
+	size_t len;
+	BOOL pushed = FALSE;
+
+	while (termwin_peek(termwin, iov) > 0)
+	{
+		len = shl_spsc_push(&tt->Output, iov[0].iov_base, iov[0].iov_len);
+		if (len == 0)
+			break;
+
+		termwin_pull(termwin, len);
+		pushed = TRUE;
+	}
+
+	if (pushed)
+		termtask_signal_net(tt);
+}
+
+static LONG termtask_procentry(void)
+{
+	struct TermTask *tt;
+	struct TermWindow *termwin = NULL;
+	struct TimeRequest *blink_timer = NULL;
+	BOOL blink_busy = FALSE;
+	struct TimeRequest *frame_timer = NULL;
+	BOOL frame_busy = FALSE;
+	struct TimeRequest *resize_timer = NULL;
+	BOOL resize_busy = FALSE;
+	BOOL refresh_pending = FALSE;
+	BYTE sigbit;
+	UWORD columns, rows;
+	char title[2][256];
+	int title_index = 0;
+	BOOL done;
+	ULONG signals;
+
+	tt = (IExec->FindTask(NULL))->tc_UserData;
+
+	sigbit = IExec->AllocSignal(-1);
+	if (sigbit == -1)
+		goto fail;
+
+	termwin = termwin_open(tt->Screen, tt->MaxSB, tt->WinTitle, tt->BSIsDel, tt->Predict);
+	if (termwin == NULL)
+		goto fail;
+
+	blink_timer = timer_open(UNIT_MICROHZ);
+	if (blink_timer == NULL)
+		goto fail;
+
+	resize_timer = timer_open(UNIT_MICROHZ);
+	if (resize_timer == NULL)
+		goto fail;
+
+	if (tt->FrameMS != 0)
+	{
+		frame_timer = timer_open(UNIT_MICROHZ);
+		if (frame_timer == NULL)
+			goto fail;
+	}
+
+	termwin_get_size(termwin, &columns, &rows);
+
+	IExec->Forbid();
+	tt->WinTask    = IExec->FindTask(NULL);
+	tt->WinSignal  = 1UL << sigbit;
+	tt->Columns    = columns;
+	tt->Rows       = rows;
+	tt->State      = TTS_RUNNING;
+	termtask_signal_net(tt);
+	IExec->Permit();
+
+	done = FALSE;
+
+	while (!done)
+	{
+		/* The blink timer is only kept running while there is blinking
+		 * text on the screen. */
+		if (!blink_busy && termwin_blinking(termwin))
+		{
+			timer_start(blink_timer, BLINK_DELAY);
+			blink_busy = TRUE;
+		}
+
+		signals = termwin_get_signals(termwin) | tt->WinSignal |
+		          timer_signal(blink_timer) | timer_signal(resize_timer) |
+		          SIGBREAKF_CTRL_C;
+		if (frame_timer != NULL)
+			signals |= timer_signal(frame_timer);
+
+		signals = IExec->Wait(signals);
+
+		STATS_BEGIN(loop_start);
+
+		if (signals & SIGBREAKF_CTRL_C)
+			done = TRUE;
+
+		if (blink_busy && (signals & timer_signal(blink_timer)))
+		{
+			timer_end(blink_timer);
+			blink_busy = FALSE;
+
+			termwin_blink(termwin);
+		}
+
+		if (frame_busy && (signals & timer_signal(frame_timer)))
+		{
+			timer_end(frame_timer);
+			frame_busy = FALSE;
+
+			/* Draw what has been received since the last update and hold
+			 * off further updates for another frame. */
+			if (refresh_pending)
+			{
+				termwin_refresh(termwin);
+				refresh_pending = FALSE;
+
+				timer_start(frame_timer, tt->FrameMS);
+				frame_busy = TRUE;
+			}
+		}
+
+		if (termwin_handle_input(termwin))
+		{
+			/* The network side decides when to stop, we only tell it that
+			 * the window has been closed and wait for CTRL-C. */
+			IExec->Forbid();
+			tt->Closed = TRUE;
+			IExec->Permit();
+
+			termtask_signal_net(tt);
+		}
+
+		if (signals & tt->WinSignal)
+		{
+			BOOL new_title = FALSE;
+
+			IExec->Forbid();
+			if (tt->NewTitle)
+			{
+				/* Window class keeps a pointer to the title so alternate
+				 * between two buffers instead of changing the active one
+				 * in place. */
+				title_index ^= 1;
+				strlcpy(title[title_index], tt->Title, sizeof(title[0]));
+				tt->NewTitle = FALSE;
+				new_title = TRUE;
+			}
+			IExec->Permit();
+
+			if (new_title)
+				termwin_set_title(termwin, title[title_index]);
+
+			if (termtask_drain(tt, termwin))
+			{
+				/* The first data after an idle period (such as the echo of
+				 * a keypress) is drawn at once. After that the screen is
+				 * updated at most once per frame while data keeps coming
+				 * in. */
+				if (frame_busy)
+				{
+					refresh_pending = TRUE;
+				}
+				else
+				{
+					termwin_refresh(termwin);
+
+					if (frame_timer != NULL)
+					{
+						timer_start(frame_timer, tt->FrameMS);
+						frame_busy = TRUE;
+					}
+				}
+			}
+		}
+
+		/* The window is laid out again for every step while its size is
+		 * being changed, so only pass the size on to the server once it
+		 * has stayed the same for a while. Each new pty size makes the
+		 * remote programs redraw their output. */
+		if (resize_busy && (signals & timer_signal(resize_timer)))
+		{
+			timer_end(resize_timer);
+			resize_busy = FALSE;
+
+			IExec->Forbid();
+			tt->Columns = columns;
+			tt->Rows    = rows;
+			tt->NewSize = TRUE;
+			IExec->Permit();
+
+			termtask_signal_net(tt);
+		}
+
+		if (termwin_poll_new_size(termwin))
+		{
+			termwin_get_size(termwin, &columns, &rows);
+
+			if (resize_busy)
+			{
+				timer_abort(resize_timer);
+				IExec->SetSignal(0, timer_signal(resize_timer));
+			}
+
+			timer_start(resize_timer, RESIZE_DELAY);
+			resize_busy = TRUE;
+		}
+
+		if (termwin_poll(termwin))
+			termtask_flush(tt, termwin);
+
+		STATS_END(STAT_TERM_LOOP, loop_start, 0);
+	}
+
+	if (AboutWindowPID != 0)
+	{
+		/* The about window is a child of this process */
+		aboutwin_close();
+
+		while (find_pid(AboutWindowPID))
+		{
+			IExec->Wait(SIGF_CHILD);
+		}
+		AboutWindowPID = 0;
+	}
+
+	#ifdef ENABLE_STATS
+	if (StatsWindowPID != 0)
+	{
+		statswin_close();
+
+		while (find_pid(StatsWindowPID))
+		{
+			IExec->Wait(SIGF_CHILD);
+		}
+		StatsWindowPID = 0;
+	}
+	#endif
+
+	if (frame_busy)
+		timer_abort(frame_timer);
+	timer_close(frame_timer);
+
+	if (resize_busy)
+		timer_abort(resize_timer);
+	timer_close(resize_timer);
+
+	if (blink_busy)
+		timer_abort(blink_timer);
+	timer_close(blink_timer);
+
+	termwin_close(termwin);
+
+	IExec->FreeSignal(sigbit);
+
+	return RETURN_OK;
+
+fail:
+	timer_close(frame_timer);
+	timer_close(resize_timer);
+	timer_close(blink_timer);
+	termwin_close(termwin);
+
+	if (sigbit != -1)
+		IExec->FreeSignal(sigbit);
+
+	IExec->Forbid();
+	tt->State = TTS_FAILED;
+	termtask_signal_net(tt);
+	IExec->Permit();
+
+	return RETURN_ERROR;
+}
+
+struct TermTask *termtask_start(struct Screen *screen, ULONG max_sb, const char *win_title, BOOL bs_is_del, BOOL predict, ULONG frame_ms)
+{
+	struct TermTask *tt;
+	struct Process *proc;
+	BYTE sigbit;
+
+	if (screen == NULL)
+		return NULL;
+
+	tt = malloc(sizeof(*tt));
+	if (tt == NULL)
+		return NULL;
+
+	memset(tt, 0, sizeof(*tt));
+
+	sigbit = IExec->AllocSignal(-1);
+	if (sigbit == -1)
+	{
+		free(tt);
+		return NULL;
+	}
+
+	tt->NetTask   = IExec->FindTask(NULL);
+	tt->NetSigBit = sigbit;
+	tt->NetSignal = 1UL << sigbit;
+	tt->State     = TTS_STARTING;
+	tt->Screen    = screen;
+	tt->MaxSB     = max_sb;
+	tt->WinTitle  = win_title;
+	tt->BSIsDel   = bs_is_del;
+	tt->Predict   = predict;
+	tt->FrameMS   = frame_ms;
+
+	if (shl_spsc_init(&tt->Input, TERMTASK_RING_SIZE) < 0 ||
+	    shl_spsc_init(&tt->Output, TERMTASK_RING_SIZE) < 0)
+	{
+		termtask_stop(tt);
+		return NULL;
+	}
+
+	proc = IDOS->CreateNewProcTags(
+		NP_Name,                   "SSHTerm:Terminal",
+		NP_Entry,                  termtask_procentry,
+		NP_Priority,               0,
+		NP_StackSize,              65536,
+		NP_Child,                  TRUE,
+		NP_UserData,               tt,
+		NP_CurrentDir,             ZERO,
+		NP_Path,                   ZERO,
+		NP_CopyVars,               FALSE,
+		NP_Input,                  ZERO,
+		NP_Output,                 ZERO,
+		NP_Error,                  ZERO,
+		NP_CloseInput,             FALSE,
+		NP_CloseOutput,            FALSE,
+		NP_CloseError,             FALSE,
+		NP_NotifyOnDeathSigTask,   NULL,
+		NP_NotifyOnDeathSignalBit, SIGB_CHILD,
+		TAG_END);
+	if (proc == NULL)
+	{
+		termtask_stop(tt);
+		return NULL;
+	}
+
+	/* IoErr() returns PID on CreateNewProc() success */
+	tt->PID = IDOS->IoErr();
+
+	/* Wait until the window is open so that the caller can ask for its
+	 * size straight away. */
+	while (tt->State == TTS_STARTING)
+	{
+		IExec->Wait(tt->NetSignal);
+	}
+
+	if (tt->State != TTS_RUNNING)
+	{
+		termtask_stop(tt);
+		return NULL;
+	}
+
+	return tt;
+}
+
+void termtask_stop(struct TermTask *tt)
+{
+	if (tt != NULL)
+	{
+		if (tt->PID != 0)
+		{
+			if (tt->State == TTS_RUNNING)
+				IExec->Signal(tt->WinTask, SIGBREAKF_CTRL_C);
+
+			while (find_pid(tt->PID))
+			{
+				IExec->Wait(SIGF_CHILD);
+			}
+			tt->PID = 0;
+		}
+
+		shl_spsc_clear(&tt->Output);
+		shl_spsc_clear(&tt->Input);
+
+		IExec->FreeSignal(tt->NetSigBit);
+
+		free(tt);
+	}
+}
+
+ULONG termtask_signal(const struct TermTask *tt)
+{
+	return tt->NetSignal;
+}
+
+BOOL termtask_closed(struct TermTask *tt)
+{
+	return tt->Closed;
+}
+
+/* Returns the free space at the end of the input ring, the caller may read
+ * up to that many bytes of channel data into it and pass them on with
+ * termtask_commit(). Zero means that the terminal is behind and that
+ * reading the shell channel should wait for the next signal. */
+size_t termtask_reserve(struct TermTask *tt, char **buffer)
+{
+	struct iovec vec[2];
+
+	if (shl_spsc_reserve(&tt->Input, vec) == 0)
+		return 0;
+
+	*buffer = tt->Reserved = vec[0].iov_base;
+
+	return vec[0].iov_len;
+}
+
+void termtask_commit(struct TermTask *tt, size_t len)
+{
+	if (tt->Recorder != NULL)
+		record_write(tt->Recorder, tt->Reserved, len);
+
+	shl_spsc_commit(&tt->Input, len);
+
+	termtask_signal_win(tt);
+}
+
+/* Copies as much of the data as fits into the input ring and returns how
+ * much that was. */
+size_t termtask_write(struct TermTask *tt, const char *buffer, size_t len)
+{
+	len = shl_spsc_push(&tt->Input, buffer, len);
+	if (len > 0)
+	{
+		if (tt->Recorder != NULL)
+			record_write(tt->Recorder, buffer, len);
+
+		termtask_signal_win(tt);
+	}
+
+	return len;
+}
+
+/* Everything passed to the terminal from now on is also saved with the
+ * given recorder, which must stay open until termtask_stop(). */
+void termtask_record(struct TermTask *tt, struct Recorder *rec)
+{
+	tt->Recorder = rec;
+}
+
+size_t termtask_poll(struct TermTask *tt)
+{
+	return shl_spsc_get_size(&tt->Output);
+}
+
+/* Same as termwin_peek() but for the keyboard data that has been handed
+ * over to the network side. */
+int termtask_peek(struct TermTask *tt, LIBSSH2_IOVEC iov[2])
+{
+	struct iovec vec[2];
+	int i, n;
+
+	n = shl_spsc_peek(&tt->Output, vec);
+	for (i = 0; i < n; i++)
+	{
+		iov[i].iov_base = vec[i].iov_base;
+		iov[i].iov_len  = vec[i].iov_len;
+	}
+
+	return n;
+}
+
+void termtask_pull(struct TermTask *tt, size_t len)
+{
+	shl_spsc_pull(&tt->Output, len);
+
+	/* There may be more waiting in the terminal's own buffer */
+	termtask_signal_win(tt);
+}
+
+BOOL termtask_poll_new_size(struct TermTask *tt)
+{
+	return tt->NewSize;
+}
+
+void termtask_get_size(struct TermTask *tt, UWORD *columns, UWORD *rows)
+{
+	IExec->Forbid();
+	tt->NewSize = FALSE;
+	*columns = tt->Columns;
+	*rows    = tt->Rows;
+	IExec->Permit();
+}
+
+void termtask_set_title(struct TermTask *tt, const char *wintitle)
+{
+	IExec->Forbid();
+	strlcpy(tt->Title, wintitle, sizeof(tt->Title));
+	tt->NewTitle = TRUE;
+	IExec->Permit();
+
+	termtask_signal_win(tt);
+}
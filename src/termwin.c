@@ -22,6 +22,7 @@
 #include "sshterm.h"
 #include "menus.h"
 #include "term-gc.h"
+#include "stats.h"
 
 #include <intuition/menuclass.h>
 #include <diskfont/diskfonttag.h>
@@ -54,6 +55,7 @@ enum {
 	MID_PROJECT_MENU,
 	MID_PROJECT_ICONIFY,
 	MID_PROJECT_ABOUT,
+	MID_PROJECT_STATS,
 	MID_PROJECT_CLEARSB,
 	MID_PROJECT_CLOSE,
 	MID_EDIT_MENU,
@@ -98,6 +100,9 @@ static const struct NewMenu newmenus[] =
 	{ NM_TITLE, "Project",          NULL, 0,               0,   (APTR)MID_PROJECT_MENU                     },
 	{ NM_ITEM,  "Iconify",          "I",  0,               0,   (APTR)MID_PROJECT_ICONIFY                  },
 	{ NM_ITEM,  "About...",         "?",  0,               0,   (APTR)MID_PROJECT_ABOUT                    },
+	#ifdef ENABLE_STATS
+	{ NM_ITEM,  "Statistics...",    NULL, 0,               0,   (APTR)MID_PROJECT_STATS                    },
+	#endif
 	{ NM_ITEM,  NM_BARLABEL,        NULL, 0,               0,   NULL                                       },
 	{ NM_ITEM,  "Clear Scrollback", NULL, 0,               0,   (APTR)MID_PROJECT_CLEARSB                  },
 	{ NM_ITEM,  NM_BARLABEL,        NULL, 0,               0,   NULL                                       },
@@ -119,7 +124,7 @@ static const struct NewMenu newmenus[] =
 	{ NM_END,   NULL,               NULL, 0,               0,   NULL                                       }
 };
 
-struct TermWindow *termwin_open(struct Screen *screen, ULONG max_sb, const char *win_title, BOOL bs_is_del)
+struct TermWindow *termwin_open(struct Screen *screen, ULONG max_sb, const char *win_title, BOOL bs_is_del, BOOL predict)
 {
 	struct TermWindow *tw;
 	Object *scroller;
@@ -144,6 +149,9 @@ struct TermWindow *termwin_open(struct Screen *screen, ULONG max_sb, const char
 		NM_Menu, "Project",          MA_ID, MID_PROJECT_MENU,
 		NM_Item, "Iconify",          MA_ID, MID_PROJECT_ICONIFY, MA_Key, "I",
 		NM_Item, "About...",         MA_ID, MID_PROJECT_ABOUT,   MA_Key, "?",
+		#ifdef ENABLE_STATS
+		NM_Item, "Statistics...",    MA_ID, MID_PROJECT_STATS,
+		#endif
 		NM_Item, ML_SEPARATOR,
 		NM_Item, "Clear Scrollback", MA_ID, MID_PROJECT_CLEARSB,
 		NM_Item, ML_SEPARATOR,
@@ -184,6 +192,7 @@ struct TermWindow *termwin_open(struct Screen *screen, ULONG max_sb, const char
 
 	tw->Term = IIntuition->NewObject(TermClass, NULL,
 		TERM_UserHook, &tw->TermHook,
+		TERM_Predict,  predict,
 		TAG_END);
 
 	tw->Layout = IIntuition->NewObject(LayoutClass, NULL,
@@ -400,7 +409,9 @@ static ULONG term_idcmp_cb(struct Hook *hook, Object *winobj, struct IntuiMessag
 
 void termwin_set_title(struct TermWindow *tw, const char *wintitle)
 {
-	IIntuition->SetAttrs(tw->Window, WA_Title, wintitle);
+	IIntuition->SetAttrs(tw->Window,
+		WA_Title, wintitle,
+		TAG_END);
 }
 
 static BOOL termwin_iconify(struct TermWindow *tw)
@@ -523,6 +534,12 @@ BOOL termwin_handle_input(struct TermWindow *tw)
 							aboutwin_open(tw->Screen);
 							break;
 
+						#ifdef ENABLE_STATS
+						case MID_PROJECT_STATS:
+							statswin_open(tw->Screen);
+							break;
+						#endif
+
 						case MID_PROJECT_CLEARSB:
 							tpg.MethodID  = TM_CLEARSB;
 							tpg.tpg_GInfo = NULL;
@@ -610,19 +627,28 @@ size_t termwin_poll(struct TermWindow *tw)
 	return tw->RingBuffer.used;
 }
 
-ssize_t termwin_read(struct TermWindow *tw, char *buffer, size_t len)
+/* Returns the buffered input as up to two buffers without copying it. The
+ * data stays in the ring buffer until termwin_pull() is called. */
+int termwin_peek(struct TermWindow *tw, LIBSSH2_IOVEC iov[2])
 {
-	size_t n;
+	struct iovec vec[2];
+	int i, n;
 
-	n = shl_ring_copy(&tw->RingBuffer, buffer, len);
-	if (n > 0)
+	n = shl_ring_peek(&tw->RingBuffer, vec);
+	for (i = 0; i < n; i++)
 	{
-		shl_ring_pull(&tw->RingBuffer, n);
+		iov[i].iov_base = vec[i].iov_base;
+		iov[i].iov_len  = vec[i].iov_len;
 	}
 
 	return n;
 }
 
+void termwin_pull(struct TermWindow *tw, size_t len)
+{
+	shl_ring_pull(&tw->RingBuffer, len);
+}
+
 BOOL termwin_poll_new_size(struct TermWindow *tw)
 {
 	return tw->NewSize;
@@ -637,6 +663,11 @@ void termwin_get_size(struct TermWindow *tw, UWORD *columns, UWORD *rows)
 	IExec->Permit();
 }
 
+BOOL termwin_blinking(struct TermWindow *tw)
+{
+	return GET(tw->Term, TERM_Blinking);
+}
+
 void termwin_blink(struct TermWindow *tw)
 {
 	struct tpGeneric tpg;
@@ -75,7 +75,7 @@ void timer_start(struct TimeRequest *tr, ULONG msec)
 {
 	tr->Request.io_Command = TR_ADDREQUEST;
 	tr->Time.Seconds       = msec / 1000;
-	tr->Time.Microseconds  = msec % 1000;
+	tr->Time.Microseconds  = (msec % 1000) * 1000;
 
 	IExec->SendIO(&tr->Request);
 }
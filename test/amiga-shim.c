@@ -0,0 +1,88 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "amiga-shim.h"
+
+#include <stdarg.h>
+
+static void shim_NewMinList(struct MinList *list)
+{
+	list->mlh_Head     = (struct MinNode *)&list->mlh_Tail;
+	list->mlh_Tail     = NULL;
+	list->mlh_TailPred = (struct MinNode *)&list->mlh_Head;
+}
+
+static void shim_AddTail(struct List *list, struct Node *node)
+{
+	struct Node *tail = (struct Node *)&list->lh_Tail;
+
+	node->ln_Succ = tail;
+	node->ln_Pred = list->lh_TailPred;
+	list->lh_TailPred->ln_Succ = node;
+	list->lh_TailPred = node;
+}
+
+static void shim_Remove(struct Node *node)
+{
+	node->ln_Pred->ln_Succ = node->ln_Succ;
+	node->ln_Succ->ln_Pred = node->ln_Pred;
+}
+
+static struct Node *shim_GetHead(struct List *list)
+{
+	return list->lh_Head->ln_Succ != NULL ? list->lh_Head : NULL;
+}
+
+static struct Node *shim_GetSucc(struct Node *node)
+{
+	return node->ln_Succ->ln_Succ != NULL ? node->ln_Succ : NULL;
+}
+
+static struct Node *shim_RemHead(struct List *list)
+{
+	struct Node *node = shim_GetHead(list);
+
+	if (node != NULL)
+		shim_Remove(node);
+
+	return node;
+}
+
+static void shim_DebugPrintF(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+static struct ExecIFace exec_iface = {
+	shim_NewMinList,
+	shim_AddTail,
+	shim_Remove,
+	shim_RemHead,
+	shim_GetHead,
+	shim_GetSucc,
+	shim_DebugPrintF
+};
+
+struct ExecIFace *IExec = &exec_iface;
@@ -0,0 +1,112 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef AMIGA_SHIM_H
+#define AMIGA_SHIM_H
+
+/* Host replacement for the parts of src/sshterm.h and the AmigaOS headers
+ * that the modules built by the host tests use. It is passed with -include
+ * and defines SSHTERM_H, so that the real sshterm.h is skipped. */
+#define SSHTERM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include <libssh2.h>
+
+typedef long               LONG;
+typedef unsigned long      ULONG;
+typedef short              WORD;
+typedef unsigned short     UWORD;
+typedef unsigned char      UBYTE;
+typedef unsigned long long UQUAD;
+typedef short              BOOL;
+typedef void              *APTR;
+typedef char              *STRPTR;
+
+#ifndef TRUE
+#define TRUE  1
+#define FALSE 0
+#endif
+
+struct Node
+{
+	struct Node *ln_Succ;
+	struct Node *ln_Pred;
+};
+
+struct MinNode
+{
+	struct MinNode *mln_Succ;
+	struct MinNode *mln_Pred;
+};
+
+struct List
+{
+	struct Node *lh_Head;
+	struct Node *lh_Tail;
+	struct Node *lh_TailPred;
+};
+
+struct MinList
+{
+	struct MinNode *mlh_Head;
+	struct MinNode *mlh_Tail;
+	struct MinNode *mlh_TailPred;
+};
+
+#define IsMinListEmpty(l) ((l)->mlh_TailPred == (struct MinNode *)(l))
+
+/* As in sshterm.h, for malloc-core.c */
+#define MALLOC_CLASSES 19
+
+struct MallocStats {
+	size_t ms_Live;                          /* bytes in use, rounded up */
+	size_t ms_Peak;
+	size_t ms_Large;                         /* bytes in large blocks */
+	ULONG  ms_Slabs;
+	ULONG  ms_ClassLive[MALLOC_CLASSES];     /* objects in use per size class */
+	ULONG  ms_ClassAllocs[MALLOC_CLASSES];   /* objects allocated so far */
+};
+
+/* Only the exec.library calls that the tested modules make */
+struct ExecIFace
+{
+	void (*NewMinList)(struct MinList *list);
+	void (*AddTail)(struct List *list, struct Node *node);
+	void (*Remove)(struct Node *node);
+	struct Node *(*RemHead)(struct List *list);
+	struct Node *(*GetHead)(struct List *list);
+	struct Node *(*GetSucc)(struct Node *node);
+	void (*DebugPrintF)(const char *fmt, ...);
+};
+
+extern struct ExecIFace *IExec;
+
+#endif /* AMIGA_SHIM_H */
@@ -0,0 +1,497 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Port forwarding benchmark
+ *
+ * Runs src/forward.c over a session with the in-process server stub of the
+ * libssh2 tests, driving it from a loop like the one in main.c. LOCALFWD
+ * is measured uploading into a sink and downloading from a source, and
+ * REMOTEFWD downloading from channels the stub opens, which forward.c then
+ * connects to a local listener. The other end of every connection runs in
+ * a thread of its own and checks the data.
+ *
+ * Besides the throughput this reports the main loop passes per MB and the
+ * number of times the loop was woken by its timeout rather than a socket,
+ * which would point at a connection that waits without anything in the
+ * select() sets to wake it.
+ *
+ * Usage: bench-forward [-m MB] [-c connections]
+ */
+
+#include "forward.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "sshd-stub.h"
+
+#define CHUNK 16384
+
+struct peer
+{
+	pthread_t pr_Thread;
+	int       pr_Socket;
+	BOOL      pr_Upload;
+	size_t    pr_Length;  /* bytes to send or to expect */
+	size_t    pr_Done;
+	BOOL      pr_Failed;
+};
+
+struct bench
+{
+	const char      *b_Name;
+	int              b_NumPeers;
+	size_t           b_Length;   /* per connection */
+	struct peer      b_Peers[16];
+	int              b_Listener; /* REMOTEFWD target */
+	pthread_t        b_Acceptor;
+	int              b_Finished;
+};
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Find a free port on the loopback interface */
+static int free_port(int *listener)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	int sock, one = 1;
+
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock == -1)
+		return -1;
+
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family      = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(sock, (struct sockaddr *)&sin, sizeof(sin)) != 0 ||
+	    getsockname(sock, (struct sockaddr *)&sin, &len) != 0 ||
+	    (listener != NULL && listen(sock, 16) != 0))
+	{
+		close(sock);
+		return -1;
+	}
+
+	if (listener != NULL)
+		*listener = sock;
+	else
+		close(sock);
+
+	return ntohs(sin.sin_port);
+}
+
+static int connect_port(int port)
+{
+	struct sockaddr_in sin;
+	int sock;
+
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock == -1)
+		return -1;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family      = AF_INET;
+	sin.sin_port        = htons(port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (connect(sock, (struct sockaddr *)&sin, sizeof(sin)) != 0)
+	{
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+/* The local end of one forwarded connection */
+static void *peer_thread(void *arg)
+{
+	static __thread unsigned char buf[CHUNK], expect[CHUNK];
+	struct peer *pr = arg;
+	ssize_t n;
+
+	if (pr->pr_Upload)
+	{
+		while (pr->pr_Done < pr->pr_Length)
+		{
+			n = pr->pr_Length - pr->pr_Done;
+			if (n > CHUNK)
+				n = CHUNK;
+
+			stub_fill(buf, n, pr->pr_Done);
+			n = send(pr->pr_Socket, buf, n, MSG_NOSIGNAL);
+			if (n <= 0)
+			{
+				pr->pr_Failed = TRUE;
+				break;
+			}
+
+			pr->pr_Done += n;
+		}
+
+		shutdown(pr->pr_Socket, SHUT_WR);
+	}
+
+	/* Downloads check the data, uploads wait for the EOF from the sink */
+	while ((n = recv(pr->pr_Socket, buf, sizeof(buf), 0)) > 0)
+	{
+		if (pr->pr_Upload)
+		{
+			pr->pr_Failed = TRUE;
+			continue;
+		}
+
+		stub_fill(expect, n, pr->pr_Done);
+		if (memcmp(buf, expect, n) != 0)
+			pr->pr_Failed = TRUE;
+
+		pr->pr_Done += n;
+	}
+
+	if (n < 0 || pr->pr_Done != pr->pr_Length)
+		pr->pr_Failed = TRUE;
+
+	close(pr->pr_Socket);
+
+	return NULL;
+}
+
+static void *acceptor_thread(void *arg)
+{
+	struct bench *b = arg;
+	int i, sock;
+
+	for (i = 0; i < b->b_NumPeers; i++)
+	{
+		sock = accept(b->b_Listener, NULL, NULL);
+		if (sock == -1)
+			break;
+
+		b->b_Peers[i].pr_Socket = sock;
+		pthread_create(&b->b_Peers[i].pr_Thread, NULL, peer_thread, &b->b_Peers[i]);
+	}
+
+	for (; i > 0; i--)
+	{
+		pthread_join(b->b_Peers[i - 1].pr_Thread, NULL);
+		__atomic_add_fetch(&b->b_Finished, 1, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+static void *joiner_thread(void *arg)
+{
+	struct bench *b = arg;
+	int i;
+
+	for (i = 0; i < b->b_NumPeers; i++)
+	{
+		pthread_join(b->b_Peers[i].pr_Thread, NULL);
+		__atomic_add_fetch(&b->b_Finished, 1, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+static LIBSSH2_SESSION *session_open(int fd)
+{
+	LIBSSH2_SESSION *session;
+
+	session = libssh2_session_init();
+	if (session == NULL)
+		return NULL;
+
+	libssh2_session_method_pref(session, LIBSSH2_METHOD_KEX, "curve25519-sha256");
+	libssh2_session_method_pref(session, LIBSSH2_METHOD_HOSTKEY, "ssh-ed25519");
+
+	if (libssh2_session_handshake(session, fd) != 0)
+	{
+		libssh2_session_free(session);
+		return NULL;
+	}
+
+	/* The stub accepts the "none" method that this tries first */
+	libssh2_userauth_list(session, "bench", 5);
+	if (!libssh2_userauth_authenticated(session))
+	{
+		libssh2_session_free(session);
+		return NULL;
+	}
+
+	return session;
+}
+
+/* The relevant part of the main loop in main.c */
+static int forward_loop(LIBSSH2_SESSION *session, int fd, struct ForwardList *fl,
+	struct bench *b, unsigned long *passes, unsigned long *stalls)
+{
+	fd_set rfds, wfds;
+	struct timeval tv;
+	int nfds, rc;
+
+	libssh2_session_set_blocking(session, 0);
+
+	while (__atomic_load_n(&b->b_Finished, __ATOMIC_ACQUIRE) < b->b_NumPeers)
+	{
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+
+		FD_SET(fd, &rfds);
+		if (libssh2_session_block_directions(session) & LIBSSH2_SESSION_BLOCK_OUTBOUND)
+			FD_SET(fd, &wfds);
+
+		nfds = forward_fdset(fl, &rfds, &wfds, fd + 1);
+
+		/* Also wakes up to notice the peers finishing */
+		tv.tv_sec  = 0;
+		tv.tv_usec = 20000;
+
+		rc = select(nfds, &rfds, &wfds, NULL, &tv);
+		if (rc < 0)
+		{
+			perror("select");
+			return -1;
+		}
+		if (rc == 0 && __atomic_load_n(&b->b_Finished, __ATOMIC_ACQUIRE) < b->b_NumPeers)
+			(*stalls)++;
+
+		if (FD_ISSET(fd, &wfds))
+		{
+			rc = libssh2_session_flush(session);
+			if (rc < 0 && rc != LIBSSH2_ERROR_EAGAIN)
+			{
+				fprintf(stderr, "libssh2_session_flush: %d\n", rc);
+				return -1;
+			}
+		}
+
+		forward_handle(fl, &rfds, &wfds);
+
+		(*passes)++;
+	}
+
+	libssh2_session_set_blocking(session, 1);
+
+	return 0;
+}
+
+enum {
+	LOCAL_UP,
+	LOCAL_DOWN,
+	REMOTE_DOWN
+};
+
+static int run(const char *name, int mode, int num_peers, size_t length)
+{
+	struct sshd_stub_config config;
+	struct sshd_stub_result result;
+	struct sshd_stub *stub;
+	LIBSSH2_SESSION *session;
+	struct ForwardList *fl;
+	struct bench b;
+	pthread_t joiner;
+	unsigned long passes = 0, stalls = 0;
+	char spec[128], source[32];
+	double t, mb;
+	int sv[2], port, i;
+	BOOL ok;
+
+	memset(&b, 0, sizeof(b));
+	b.b_Name     = name;
+	b.b_NumPeers = num_peers;
+	b.b_Length   = length;
+	b.b_Listener = -1;
+
+	memset(&config, 0, sizeof(config));
+	if (mode == REMOTE_DOWN)
+	{
+		snprintf(source, sizeof(source), "source %lu", (unsigned long)length);
+		config.forward          = source;
+		config.forward_channels = num_peers;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+	{
+		perror("socketpair");
+		return -1;
+	}
+
+	stub = sshd_stub_start(sv[1], &config);
+	session = session_open(sv[0]);
+	fl = session != NULL ? forward_create(session, sv[0]) : NULL;
+	if (stub == NULL || fl == NULL)
+	{
+		fprintf(stderr, "%s: setup failed\n", name);
+		return -1;
+	}
+
+	for (i = 0; i < num_peers; i++)
+	{
+		b.b_Peers[i].pr_Upload = (mode == LOCAL_UP);
+		b.b_Peers[i].pr_Length = length;
+	}
+
+	if (mode == REMOTE_DOWN)
+	{
+		port = free_port(&b.b_Listener);
+		snprintf(spec, sizeof(spec), "2222:127.0.0.1:%d", port);
+		ok = port > 0 && forward_add_remote(fl, spec);
+	}
+	else
+	{
+		port = free_port(NULL);
+		snprintf(spec, sizeof(spec), "%d:%s %lu:1", port,
+			mode == LOCAL_UP ? "sink" : "source", (unsigned long)length);
+		ok = port > 0 && forward_add_local(fl, spec);
+	}
+	if (!ok)
+	{
+		fprintf(stderr, "%s: forwarding %s failed\n", name, spec);
+		return -1;
+	}
+
+	t = now();
+
+	if (mode == REMOTE_DOWN)
+	{
+		pthread_create(&b.b_Acceptor, NULL, acceptor_thread, &b);
+	}
+	else
+	{
+		for (i = 0; i < num_peers; i++)
+		{
+			b.b_Peers[i].pr_Socket = connect_port(port);
+			if (b.b_Peers[i].pr_Socket == -1)
+			{
+				fprintf(stderr, "%s: connect failed\n", name);
+				return -1;
+			}
+			pthread_create(&b.b_Peers[i].pr_Thread, NULL, peer_thread, &b.b_Peers[i]);
+		}
+		pthread_create(&joiner, NULL, joiner_thread, &b);
+	}
+
+	if (forward_loop(session, sv[0], fl, &b, &passes, &stalls) != 0)
+		return -1;
+
+	t = now() - t;
+
+	if (mode == REMOTE_DOWN)
+	{
+		pthread_join(b.b_Acceptor, NULL);
+		close(b.b_Listener);
+	}
+	else
+	{
+		pthread_join(joiner, NULL);
+	}
+
+	forward_delete(fl);
+	libssh2_session_disconnect(session, "done");
+	libssh2_session_free(session);
+	close(sv[0]);
+
+	if (sshd_stub_join(stub, &result) != 0)
+	{
+		fprintf(stderr, "%s: stub error\n", name);
+		return -1;
+	}
+
+	for (i = 0; i < num_peers; i++)
+	{
+		if (b.b_Peers[i].pr_Failed)
+		{
+			fprintf(stderr, "%s: connection %d got %lu of %lu bytes or wrong data\n",
+				name, i, (unsigned long)b.b_Peers[i].pr_Done, (unsigned long)length);
+			return -1;
+		}
+	}
+
+	if ((mode == LOCAL_UP && result.bytes_in != (uint64_t)num_peers * length) ||
+	    (mode != LOCAL_UP && result.bytes_out != (uint64_t)num_peers * length) ||
+	    result.channels != num_peers)
+	{
+		fprintf(stderr, "%s: the stub saw %d channels, %llu bytes in, %llu out\n", name,
+			result.channels, (unsigned long long)result.bytes_in,
+			(unsigned long long)result.bytes_out);
+		return -1;
+	}
+
+	mb = (double)num_peers * length / 1048576;
+
+	printf("%-16s %5d %8.1f %8.1f %9.1f %7lu\n", name, num_peers, mb, mb / t,
+		passes / mb, stalls);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	size_t total = 32 * 1048576;
+	int conns = 4;
+	int i, rc = 0;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+			total = (size_t)atoi(argv[++i]) * 1048576;
+		else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			conns = atoi(argv[++i]);
+		else
+			conns = 0;
+	}
+
+	if (conns < 1 || conns > 16 || total == 0)
+	{
+		fprintf(stderr, "Usage: %s [-m MB] [-c connections (1-16)]\n", argv[0]);
+		return 1;
+	}
+
+	if (libssh2_init(0) != 0)
+	{
+		fprintf(stderr, "libssh2_init failed\n");
+		return 1;
+	}
+
+	printf("%-16s %5s %8s %8s %9s %7s\n", "", "conns", "MB", "MB/s", "loops/MB", "stalls");
+
+	if (run("LOCALFWD up", LOCAL_UP, conns, total / conns) != 0 ||
+	    run("LOCALFWD down", LOCAL_DOWN, conns, total / conns) != 0 ||
+	    run("REMOTEFWD down", REMOTE_DOWN, conns, total / conns) != 0)
+		rc = 1;
+
+	libssh2_exit();
+
+	return rc;
+}
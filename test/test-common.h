@@ -0,0 +1,63 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef TEST_COMMON_H
+#define TEST_COMMON_H
+
+/* Helpers shared by the host tests: the random numbers that make every run
+ * the same and failure reports. */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* LCG on a seed of the caller's, for threads that need their own sequence */
+static inline uint32_t rnd_r(uint32_t *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+
+	return *seed >> 8;
+}
+
+static inline uint32_t rnd(void)
+{
+	static uint32_t seed = 1;
+
+	return rnd_r(&seed);
+}
+
+/* Prints "FAIL: " and the message and returns 1, for "return fail(...)" */
+static inline int fail(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static inline int fail(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "FAIL: ");
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+
+	return 1;
+}
+
+#endif /* TEST_COMMON_H */
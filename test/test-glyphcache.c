@@ -0,0 +1,206 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Glyph cache test
+ *
+ * Runs src/glyphcache.c against a plain array model of an LRU cache with
+ * random lookups, using key sets both smaller and larger than the cache and
+ * the style flags the terminal adds to the keys. Every lookup must agree
+ * with the model on hit or miss, a hit must return the slot the key was
+ * given on its miss, a miss must recycle the slot of the least recently
+ * used key once the cache is full, and the counters must add up.
+ *
+ * Usage: test-glyphcache
+ */
+
+#include "glyphcache.h"
+#include "test-common.h"
+
+#define MAX_SLOTS 512
+#define LOOKUPS   100000
+
+struct model
+{
+	uint32_t m_NumSlots;
+	uint32_t m_NumUsed;
+	uint32_t m_Keys[MAX_SLOTS];  /* key held by each slot */
+	uint32_t m_Used[MAX_SLOTS];  /* time of the last lookup */
+	uint32_t m_Time;
+	uint32_t m_Hits;
+	uint32_t m_Misses;
+};
+
+static void model_clear(struct model *m, uint32_t num_slots)
+{
+	memset(m, 0, sizeof(*m));
+
+	m->m_NumSlots = num_slots;
+}
+
+/* Returns the slot holding 'key' or -1 if it is not cached */
+static int model_find(const struct model *m, uint32_t key)
+{
+	uint32_t i;
+
+	for (i = 0; i < m->m_NumUsed; i++)
+	{
+		if (m->m_Keys[i] == key)
+			return i;
+	}
+
+	return -1;
+}
+
+static uint32_t model_lru(const struct model *m)
+{
+	uint32_t i, lru = 0;
+
+	for (i = 1; i < m->m_NumUsed; i++)
+	{
+		if (m->m_Used[i] < m->m_Used[lru])
+			lru = i;
+	}
+
+	return lru;
+}
+
+static uint32_t random_key(uint32_t num_keys)
+{
+	static const uint32_t flags[4] = {
+		0, GLYPHCACHE_BOLD, GLYPHCACHE_UNDERLINE, GLYPHCACHE_BOLD | GLYPHCACHE_UNDERLINE
+	};
+	uint32_t n = rnd() % num_keys;
+
+	/* Mostly Latin-1 with some CJK, so that keys differ in the high bits
+	 * as well as the low ones */
+	if (n & 1)
+		n = 0x4e00 + (n >> 1);
+	else
+		n >>= 1;
+
+	return GLYPHCACHE_KEY(n >> 2, flags[n & 3]);
+}
+
+/* Lookups from a key set of 'num_keys' keys, which also favours a few of
+ * them the way text does */
+static int run(uint32_t num_slots, uint32_t num_keys)
+{
+	struct GlyphCache *gc;
+	struct model m;
+	uint32_t i, key, slot, hits, misses;
+	int expect, hit;
+
+	gc = glyphcache_new(num_slots);
+	if (gc == NULL)
+		return fail("%lu slots: glyphcache_new", (ULONG)num_slots);
+
+	model_clear(&m, num_slots);
+
+	for (i = 0; i < LOOKUPS; i++)
+	{
+		if (i == LOOKUPS / 2)
+		{
+			/* Starts over as after a font change */
+			glyphcache_clear(gc);
+			model_clear(&m, num_slots);
+		}
+
+		key = random_key(rnd() % 4 ? 16 : num_keys);
+
+		expect = model_find(&m, key);
+		hit = glyphcache_lookup(gc, key, &slot);
+
+		if (slot >= num_slots)
+			return fail("%lu slots: slot out of range (lookup %lu)",
+				(ULONG)num_slots, (ULONG)i);
+
+		if (expect >= 0)
+		{
+			if (!hit)
+				return fail("%lu slots: miss for a cached key (lookup %lu)",
+					(ULONG)num_slots, (ULONG)i);
+			if (slot != (uint32_t)expect)
+				return fail("%lu slots: hit in the wrong slot (lookup %lu)",
+					(ULONG)num_slots, (ULONG)i);
+
+			m.m_Hits++;
+		}
+		else
+		{
+			if (hit)
+				return fail("%lu slots: hit for a key that is not cached (lookup %lu)",
+					(ULONG)num_slots, (ULONG)i);
+
+			if (m.m_NumUsed < num_slots)
+			{
+				if (slot != m.m_NumUsed)
+					return fail("%lu slots: free slot not used (lookup %lu)",
+						(ULONG)num_slots, (ULONG)i);
+				m.m_NumUsed++;
+			}
+			else if (slot != model_lru(&m))
+			{
+				return fail("%lu slots: recycled a slot that was not the LRU one (lookup %lu)",
+					(ULONG)num_slots, (ULONG)i);
+			}
+
+			m.m_Keys[slot] = key;
+			m.m_Misses++;
+		}
+
+		m.m_Used[slot] = ++m.m_Time;
+	}
+
+	glyphcache_stats(gc, &hits, &misses);
+	if (hits != m.m_Hits || misses != m.m_Misses)
+		return fail("%lu slots: wrong hit and miss counts (lookup %lu)",
+			(ULONG)num_slots, (ULONG)LOOKUPS);
+
+	glyphcache_free(gc);
+
+	printf("%3lu slots, %4lu keys: %lu hits, %lu misses OK\n", (ULONG)num_slots,
+		(ULONG)num_keys, (ULONG)hits, (ULONG)misses);
+
+	return 0;
+}
+
+int main(void)
+{
+	static const uint32_t slots[] = { 1, 2, 7, 64, 256, MAX_SLOTS };
+	uint32_t i;
+
+	if (glyphcache_new(0) != NULL || glyphcache_new(0xffff) != NULL)
+		return fail("accepted an invalid size");
+
+	for (i = 0; i < sizeof(slots) / sizeof(slots[0]); i++)
+	{
+		if (run(slots[i], slots[i] / 2 + 1) ||
+		    run(slots[i], slots[i]) ||
+		    run(slots[i], 4 * slots[i] + 3))
+		{
+			return 1;
+		}
+	}
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,541 @@
+/*
+ * SSHTerm - SSH2 shell client
+ *
+ * Copyright (C) 2019-2022 Fredrik Wikstrom <fredrik@a500.org>
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the SSHTerm
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Allocator test
+ *
+ * Runs the slab allocator in src/malloc-core.c on top of a pthread version
+ * of its OS functions. First from a single thread it checks the size every
+ * request is rounded up to, from the size classes to the 1/8 steps of the
+ * large blocks, that realloc() stays in place exactly while the rounded size
+ * is enough, that it moves a block shrunk to less than half its size and
+ * that empty slabs are given back. Then several threads allocate, grow,
+ * shrink and free blocks of random sizes and pass some of them to
+ * each other to be freed there, the way SSHTerm's processes share the
+ * allocator. Every block is filled with a pattern that is checked before it
+ * is freed, so overlapping blocks are found, and in the end the statistics
+ * must add up to nothing in use.
+ *
+ * The makefile also builds it with ThreadSanitizer.
+ *
+ * Usage: test-malloc [OPS]
+ */
+
+#include "malloc-core.h"
+#include "test-common.h"
+
+#include <pthread.h>
+
+#define THREADS    4
+#define SLOTS      256
+#define MAILBOXES  64
+#ifndef OPS
+#define OPS        200000
+#endif
+
+#define SLAB_SIZE  65536
+#define MAX_SMALL  2048
+
+struct block
+{
+	UBYTE  *b_Ptr;
+	size_t  b_Size;
+	UBYTE   b_Tag;    /* start of the fill pattern */
+};
+
+struct worker
+{
+	pthread_t w_Thread;
+	uint32_t  w_Seed;
+	ULONG     w_Ops;
+	ULONG     w_SmallAllocs;   /* new small blocks, counting moves */
+	const char *w_Error;
+};
+
+static const UWORD class_sizes[MALLOC_CLASSES] = {
+	16, 32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512,
+	640, 768, 1024, 1280, 1536, 2048
+};
+
+/* Blocks on their way from one thread to another */
+static struct block mailbox[MAILBOXES];
+static pthread_mutex_t mailbox_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The OS functions for the core */
+
+static pthread_mutex_t core_lock = PTHREAD_MUTEX_INITIALIZER;
+static long os_slabs;
+
+void malloc_os_lock(void)
+{
+	pthread_mutex_lock(&core_lock);
+}
+
+void malloc_os_unlock(void)
+{
+	pthread_mutex_unlock(&core_lock);
+}
+
+void *malloc_os_alloc_slab(size_t size)
+{
+	void *ptr;
+
+	if (posix_memalign(&ptr, size, size) != 0)
+		return NULL;
+
+	os_slabs++;
+
+	return ptr;
+}
+
+void malloc_os_free_slab(void *ptr)
+{
+	os_slabs--;
+	free(ptr);
+}
+
+void *malloc_os_alloc_table(size_t size)
+{
+	return calloc(1, size);
+}
+
+void malloc_os_free_table(void *ptr)
+{
+	free(ptr);
+}
+
+void *malloc_os_alloc_large(size_t size)
+{
+	return malloc(size);
+}
+
+void malloc_os_free_large(void *ptr, size_t size)
+{
+	free(ptr);
+}
+
+void malloc_os_corrupt(void)
+{
+	fprintf(stderr, "FAIL: freed a block that was not allocated\n");
+	abort();
+}
+
+/* What a request should be rounded up to */
+static size_t rounded_size(size_t size)
+{
+	size_t top = 1, step;
+	ULONG c;
+
+	if (size <= MAX_SMALL)
+	{
+		for (c = 0; class_sizes[c] < size; c++)
+			;
+		return class_sizes[c];
+	}
+
+	while (top * 2 <= size)
+		top *= 2;
+	step = top / 8;
+
+	return (size + step - 1) / step * step;
+}
+
+static UBYTE pattern(const struct block *b, size_t i)
+{
+	return b->b_Tag + i * 7;
+}
+
+static void fill(const struct block *b, size_t from)
+{
+	size_t i;
+
+	for (i = from; i < b->b_Size; i++)
+		b->b_Ptr[i] = pattern(b, i);
+}
+
+static BOOL check(const struct block *b, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		if (b->b_Ptr[i] != pattern(b, i))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static int test_sizes(void)
+{
+	static void *objs[3 * SLAB_SIZE / 16];
+	struct MallocStats ms;
+	size_t size, want, half, live;
+	void *ptr, *moved;
+	ULONG i;
+
+	malloc_core_init();
+
+	for (size = 1; size <= 70000; size += size < 4200 ? 1 : 97)
+	{
+		want = rounded_size(size);
+
+		malloc_core_get_stats(&ms);
+		live = ms.ms_Live;
+
+		ptr = malloc_core_alloc(size);
+		if (ptr == NULL)
+			return fail("allocation failed (size %lu)", (ULONG)size);
+		if (size <= MAX_SMALL && ((uintptr_t)ptr & 15) != 0)
+			return fail("small block not 16 byte aligned (size %lu)", (ULONG)size);
+
+		malloc_core_get_stats(&ms);
+		if (ms.ms_Live - live != want)
+			return fail("not rounded up to the expected size (size %lu)",
+				(ULONG)size);
+		if (want - size > want / 8 && size > MAX_SMALL)
+			return fail("more than 1/8 of a large block wasted (size %lu)",
+				(ULONG)size);
+
+		if (malloc_core_realloc(ptr, want) != ptr)
+			return fail("moved while the rounded size is enough (size %lu)",
+				(ULONG)size);
+
+		moved = malloc_core_realloc(ptr, want + 1);
+		if (moved == NULL || moved == ptr)
+			return fail("not moved when growing past the rounded size (size %lu)",
+				(ULONG)size);
+
+		malloc_core_free(moved);
+	}
+
+	/* realloc() keeps a block that is still half used and moves one that
+	 * shrinks below that to the size class or large block size it needs */
+	for (size = 32; size <= 70000; size += size < 4200 ? 1 : 97)
+	{
+		want = rounded_size(size);
+		half = want / 2;
+
+		ptr = malloc_core_alloc(size);
+		if (ptr == NULL)
+			return fail("allocation failed (size %lu)", (ULONG)size);
+		for (i = 0; i < half; i++)
+			((UBYTE *)ptr)[i] = i * 7;
+
+		if (malloc_core_realloc(ptr, half) != ptr)
+			return fail("moved when shrinking to half (size %lu)", (ULONG)size);
+
+		malloc_core_get_stats(&ms);
+		live = ms.ms_Live;
+
+		moved = malloc_core_realloc(ptr, half - 1);
+		if (moved == NULL || moved == ptr)
+			return fail("not moved when shrinking below half (size %lu)",
+				(ULONG)size);
+
+		malloc_core_get_stats(&ms);
+		if (live - ms.ms_Live != want - rounded_size(half - 1))
+			return fail("not moved to the smallest size that fits (size %lu)",
+				(ULONG)size);
+
+		for (i = 0; i < half - 1; i++)
+		{
+			if (((UBYTE *)moved)[i] != (UBYTE)(i * 7))
+				return fail("contents not kept when shrinking (size %lu)",
+					(ULONG)size);
+		}
+
+		malloc_core_free(moved);
+	}
+
+	/* the first size of a new 1/8 step, where the old loop stepped too far */
+	ptr = malloc_core_alloc(2049);
+	malloc_core_get_stats(&ms);
+	if (ms.ms_Large != 2304)
+		return fail("2049 bytes not rounded up to 2304");
+	malloc_core_free(ptr);
+
+	/* a few slabs of one class, all but the last are given back when
+	 * they become empty */
+	for (i = 0; i < sizeof(objs) / sizeof(objs[0]); i++)
+	{
+		objs[i] = malloc_core_alloc(16);
+		if (objs[i] == NULL)
+			return fail("allocation failed (size 16)");
+	}
+	malloc_core_get_stats(&ms);
+	if (ms.ms_Slabs < 3)
+		return fail("objects of one class not in several slabs (size 16)");
+	for (i = 0; i < sizeof(objs) / sizeof(objs[0]); i++)
+		malloc_core_free(objs[i]);
+
+	malloc_core_get_stats(&ms);
+	if (ms.ms_Live != 0 || ms.ms_Large != 0)
+		return fail("bytes still in use after freeing everything");
+	if (ms.ms_Slabs != os_slabs)
+		return fail("slab count differs from the slabs allocated");
+	if (ms.ms_Slabs > MALLOC_CLASSES)
+		return fail("empty slabs not given back (size 16)");
+	for (i = 0; i < MALLOC_CLASSES; i++)
+	{
+		if (ms.ms_ClassLive[i] != 0)
+			return fail("objects still in use (size %lu)", (ULONG)class_sizes[i]);
+	}
+
+	malloc_core_cleanup();
+	if (os_slabs != 0)
+		return fail("slabs left after cleanup");
+
+	printf("sizes OK\n");
+
+	return 0;
+}
+
+static size_t random_size(uint32_t *seed)
+{
+	switch (rnd_r(seed) % 8)
+	{
+		case 0:
+			return 1 + rnd_r(seed) % 65536;
+		case 1:
+		case 2:
+			return 1 + rnd_r(seed) % 4096;
+		default:
+			return 1 + rnd_r(seed) % 256;
+	}
+}
+
+static BOOL new_block(struct worker *w, struct block *b, size_t size)
+{
+	b->b_Ptr = malloc_core_alloc(size);
+	if (b->b_Ptr == NULL)
+	{
+		w->w_Error = "allocation failed";
+		return FALSE;
+	}
+
+	b->b_Size = size;
+	b->b_Tag  = rnd_r(&w->w_Seed);
+	fill(b, 0);
+
+	if (size <= MAX_SMALL)
+		w->w_SmallAllocs++;
+
+	return TRUE;
+}
+
+static BOOL free_block(struct worker *w, struct block *b)
+{
+	if (!check(b, b->b_Size))
+	{
+		w->w_Error = "block overwritten";
+		return FALSE;
+	}
+
+	malloc_core_free(b->b_Ptr);
+	b->b_Ptr = NULL;
+
+	return TRUE;
+}
+
+static BOOL resize_block(struct worker *w, struct block *b, size_t size)
+{
+	size_t old_size;
+	UBYTE *ptr;
+
+	if (!check(b, b->b_Size))
+	{
+		w->w_Error = "block overwritten";
+		return FALSE;
+	}
+
+	ptr = malloc_core_realloc(b->b_Ptr, size);
+	if (ptr == NULL)
+	{
+		w->w_Error = "realloc failed";
+		return FALSE;
+	}
+
+	if (ptr != b->b_Ptr && size <= MAX_SMALL)
+		w->w_SmallAllocs++;
+	b->b_Ptr = ptr;
+
+	if (!check(b, size < b->b_Size ? size : b->b_Size))
+	{
+		w->w_Error = "contents not kept by realloc";
+		return FALSE;
+	}
+
+	old_size = b->b_Size;
+	b->b_Size = size;
+	if (size > old_size)
+		fill(b, old_size);
+
+	return TRUE;
+}
+
+/* Swaps a block with a random mailbox, so blocks are freed by other
+ * threads than the one that allocated them */
+static void swap_mailbox(struct worker *w, struct block *b)
+{
+	struct block tmp;
+	ULONG i = rnd_r(&w->w_Seed) % MAILBOXES;
+
+	pthread_mutex_lock(&mailbox_lock);
+	tmp = mailbox[i];
+	mailbox[i] = *b;
+	*b = tmp;
+	pthread_mutex_unlock(&mailbox_lock);
+}
+
+static void *worker_run(void *data)
+{
+	struct worker *w = data;
+	struct block slots[SLOTS];
+	struct block *b;
+	ULONG op, i;
+
+	memset(slots, 0, sizeof(slots));
+
+	for (op = 0; op < w->w_Ops && w->w_Error == NULL; op++)
+	{
+		b = &slots[rnd_r(&w->w_Seed) % SLOTS];
+
+		switch (rnd_r(&w->w_Seed) % 8)
+		{
+			case 0:
+			case 1:
+			case 2:
+				if (b->b_Ptr != NULL)
+					free_block(w, b);
+				else
+					new_block(w, b, random_size(&w->w_Seed));
+				break;
+			case 3:
+				if (b->b_Ptr == NULL)
+					new_block(w, b, random_size(&w->w_Seed));
+				else if (b->b_Size > 65536)
+					free_block(w, b);
+				else
+					resize_block(w, b, b->b_Size + random_size(&w->w_Seed) / 4);
+				break;
+			case 4:
+				if (b->b_Ptr == NULL)
+					new_block(w, b, random_size(&w->w_Seed));
+				else
+					resize_block(w, b, 1 + rnd_r(&w->w_Seed) % b->b_Size);
+				break;
+			case 5:
+				if (b->b_Ptr != NULL)
+					swap_mailbox(w, b);
+				break;
+			default:
+				if (b->b_Ptr != NULL && free_block(w, b))
+					new_block(w, b, random_size(&w->w_Seed));
+				break;
+		}
+	}
+
+	for (i = 0; i < SLOTS && w->w_Error == NULL; i++)
+	{
+		if (slots[i].b_Ptr != NULL)
+			free_block(w, &slots[i]);
+	}
+
+	return NULL;
+}
+
+static int test_threads(ULONG ops)
+{
+	struct worker workers[THREADS];
+	struct MallocStats ms;
+	ULONG i, small = 0, allocs = 0;
+
+	malloc_core_init();
+
+	memset(workers, 0, sizeof(workers));
+	for (i = 0; i < THREADS; i++)
+	{
+		workers[i].w_Seed = i + 1;
+		workers[i].w_Ops  = ops;
+		if (pthread_create(&workers[i].w_Thread, NULL, worker_run, &workers[i]))
+			return fail("pthread_create");
+	}
+
+	for (i = 0; i < THREADS; i++)
+	{
+		pthread_join(workers[i].w_Thread, NULL);
+		if (workers[i].w_Error != NULL)
+			return fail("%s", workers[i].w_Error);
+		small += workers[i].w_SmallAllocs;
+	}
+
+	/* what is left in the mailboxes */
+	for (i = 0; i < MAILBOXES; i++)
+	{
+		if (mailbox[i].b_Ptr != NULL)
+		{
+			if (!check(&mailbox[i], mailbox[i].b_Size))
+				return fail("block overwritten (size %lu)",
+					(ULONG)mailbox[i].b_Size);
+			malloc_core_free(mailbox[i].b_Ptr);
+			mailbox[i].b_Ptr = NULL;
+		}
+	}
+
+	malloc_core_get_stats(&ms);
+	if (ms.ms_Live != 0 || ms.ms_Large != 0)
+		return fail("%lu bytes still in use after freeing everything",
+			(ULONG)ms.ms_Live);
+	if (ms.ms_Slabs != os_slabs || ms.ms_Slabs > MALLOC_CLASSES)
+		return fail("empty slabs not given back (%lu slabs)", ms.ms_Slabs);
+	for (i = 0; i < MALLOC_CLASSES; i++)
+	{
+		if (ms.ms_ClassLive[i] != 0)
+			return fail("objects still in use (size %lu)", (ULONG)class_sizes[i]);
+		allocs += ms.ms_ClassAllocs[i];
+	}
+	if (allocs != small)
+		return fail("allocation counts do not add up (%lu)", allocs);
+
+	printf("%d threads, %lu operations each, peak %lu KB OK\n", THREADS,
+		ops, (ULONG)(ms.ms_Peak >> 10));
+
+	malloc_core_cleanup();
+	if (os_slabs != 0)
+		return fail("slabs left after cleanup");
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	ULONG ops = OPS;
+
+	if (argc > 1)
+		ops = strtoul(argv[1], NULL, 0);
+
+	if (test_sizes() || test_threads(ops))
+		return 1;
+
+	printf("OK\n");
+
+	return 0;
+}